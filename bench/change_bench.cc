@@ -0,0 +1,201 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures change detection on Kinect1 sized frames of a static scene
+// with sensor noise and a moving object, and verifies the dirty tiles
+// against a plain reference implementation.
+//
+// Usage: kkonnect-change-bench [--iterations=N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_buffer_allocator.h"
+#include "src/kk_change_detector.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH    640
+#define FRAME_HEIGHT   480
+#define TILE_SIZE      16
+// Side of the square that moves across the scene, in pixels.
+#define OBJECT_SIZE    48
+
+// Fills |frame| with a static scene, noise, and an object whose position
+// depends on |index|.
+static void FillFrame(uint8_t* frame, ImageFormat format, int index,
+                      unsigned int* seed) {
+  int object_x = (index * 7) % (FRAME_WIDTH - OBJECT_SIZE);
+  int object_y = (index * 3) % (FRAME_HEIGHT - OBJECT_SIZE);
+  for (int y = 0; y < FRAME_HEIGHT; ++y) {
+    for (int x = 0; x < FRAME_WIDTH; ++x) {
+      bool is_object = (x >= object_x && x < object_x + OBJECT_SIZE &&
+                        y >= object_y && y < object_y + OBJECT_SIZE);
+      if (format == kImageFormatDepthMm) {
+        int value = is_object ? 900 : 2000 + x + y;
+        value += rand_r(seed) % 9;
+        // Holes flicker along some edges of the scene.
+        if (x % 97 == 0 && rand_r(seed) % 2) value = 0;
+        reinterpret_cast<uint16_t*>(frame)[y * FRAME_WIDTH + x] = value;
+      } else {
+        for (int c = 0; c < 3; ++c) {
+          int value = is_object ? 40 * c : (x + y * c) & 0xFF;
+          value += rand_r(seed) % 5;
+          frame[(y * FRAME_WIDTH + x) * 3 + c] = value > 255 ? 255 : value;
+        }
+      }
+    }
+  }
+}
+
+// Computes dirty tiles like ChangeDetector, one pixel at a time.
+static void DetectPlain(const uint8_t* frame, uint8_t* reference,
+                        ImageFormat format,
+                        const ChangeDetectionOptions& options,
+                        uint64_t* dirty_tiles) {
+  bool is_depth = (format == kImageFormatDepthMm);
+  int bpp = GetBytesPerPixel(format);
+  int columns = (FRAME_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+  int rows = (FRAME_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+  for (int ty = 0; ty < rows; ++ty) {
+    dirty_tiles[ty] = 0;
+    for (int tx = 0; tx < columns; ++tx) {
+      uint64_t sum = 0;
+      int pixels = 0;
+      for (int y = ty * TILE_SIZE;
+           y < (ty + 1) * TILE_SIZE && y < FRAME_HEIGHT; ++y) {
+        for (int x = tx * TILE_SIZE;
+             x < (tx + 1) * TILE_SIZE && x < FRAME_WIDTH; ++x) {
+          int offset = (y * FRAME_WIDTH + x) * bpp;
+          ++pixels;
+          if (is_depth) {
+            int a = frame[offset] | (frame[offset + 1] << 8);
+            int b = reference[offset] | (reference[offset + 1] << 8);
+            if (abs(a - b) > options.depth_threshold_mm || (!a) != (!b)) {
+              ++sum;
+            }
+          } else {
+            for (int c = 0; c < bpp; ++c) {
+              sum += abs(frame[offset + c] - reference[offset + c]);
+            }
+          }
+        }
+      }
+      uint64_t limit = is_depth ? (uint64_t) options.depth_min_pixels :
+          (uint64_t) options.video_threshold * pixels * bpp;
+      if (sum > limit) dirty_tiles[ty] |= 1ULL << tx;
+    }
+  }
+  for (int ty = 0; ty < rows; ++ty) {
+    for (int tx = 0; tx < columns; ++tx) {
+      if (!((dirty_tiles[ty] >> tx) & 1)) continue;
+      for (int y = ty * TILE_SIZE;
+           y < (ty + 1) * TILE_SIZE && y < FRAME_HEIGHT; ++y) {
+        for (int x = tx * TILE_SIZE;
+             x < (tx + 1) * TILE_SIZE && x < FRAME_WIDTH; ++x) {
+          int offset = (y * FRAME_WIDTH + x) * bpp;
+          memcpy(reference + offset, frame + offset, bpp);
+        }
+      }
+    }
+  }
+}
+
+static bool RunFormat(ImageFormat format, const char* name, int iterations) {
+  const int frame_count = 8;
+  const int frame_size = FRAME_WIDTH * FRAME_HEIGHT * GetBytesPerPixel(format);
+  uint8_t* frames[frame_count];
+  unsigned int seed = 1;
+  for (int i = 0; i < frame_count; ++i) {
+    frames[i] = new uint8_t[frame_size];
+    FillFrame(frames[i], format, i, &seed);
+  }
+
+  ChangeDetectionOptions options;
+  options.tile_size = TILE_SIZE;
+  BufferAllocator allocator;
+  ChangeDetector detector;
+  detector.SetOptions(options);
+  detector.SetAllocator(&allocator);
+  CHECK(detector.Init(FRAME_WIDTH, FRAME_HEIGHT, format));
+
+  // The first frame seeds both references.
+  uint8_t* reference = new uint8_t[frame_size];
+  memcpy(reference, frames[0], frame_size);
+  FrameMetadata metadata;
+  detector.Detect(frames[0], FRAME_WIDTH * GetBytesPerPixel(format),
+                  &metadata);
+
+  uint64_t expected[kMaxChangeTiles];
+  uint64_t elapsed = 0;
+  uint64_t dirty_count = 0;
+  for (int i = 1; i <= iterations; ++i) {
+    const uint8_t* frame = frames[i % frame_count];
+    uint64_t start_time = GetCurrentMicros();
+    detector.Detect(frame, FRAME_WIDTH * GetBytesPerPixel(format),
+                    &metadata);
+    elapsed += GetCurrentMicros() - start_time;
+    for (int y = 0; y < metadata.change_tile_rows; ++y) {
+      dirty_count += __builtin_popcountll(metadata.dirty_tiles[y]);
+    }
+    if (i > 2 * frame_count) continue;
+    DetectPlain(frame, reference, format, options, expected);
+    for (int y = 0; y < metadata.change_tile_rows; ++y) {
+      if (metadata.dirty_tiles[y] != expected[y]) {
+        fprintf(stderr, "%s: mismatch against plain reference in frame %d\n",
+                name, i);
+        return false;
+      }
+    }
+  }
+
+  int tile_count = metadata.change_tile_columns * metadata.change_tile_rows;
+  printf("%s: %.1f us/frame, %.1f%% of tiles dirty\n", name,
+         (double) elapsed / iterations,
+         100.0 * dirty_count / ((uint64_t) tile_count * iterations));
+  delete[] reference;
+  for (int i = 0; i < frame_count; ++i) delete[] frames[i];
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int iterations = 500;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("path: %s\n", HasCpuFeature(kCpuFeatureSse2) ? "sse2" : "scalar");
+  if (!RunFormat(kImageFormatVideoRgb, "video", iterations)) return 1;
+  if (!RunFormat(kImageFormatDepthMm, "depth", iterations)) return 1;
+  return 0;
+}
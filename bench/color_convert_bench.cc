@@ -0,0 +1,176 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures YUV 4:2:2 to RGB and BGRA conversion on every code path the
+// CPU supports, and verifies the SIMD paths against the scalar reference.
+// Also reports how far the output is from libfreenect's conversion.
+//
+// Usage: kkonnect-color-convert-bench [--iterations=N]
+
+#include <kk_color_convert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH    640
+#define FRAME_HEIGHT   480
+// Rounding differences accepted against libfreenect, per channel.
+#define MAX_LIBFREENECT_DIFF   3
+
+enum Path {
+  kPathScalar,
+  kPathSse2,
+  kPathAvx2,
+  kPathCount,
+};
+
+static const char* kPathNames[kPathCount] = {"scalar", "sse2", "avx2"};
+
+// Makes the conversion take |path|. Returns false if the CPU does not
+// support it.
+static bool SelectPath(Path path) {
+  SetCpuFeatureDisabled(kCpuFeatureSse2, false);
+  SetCpuFeatureDisabled(kCpuFeatureAvx2, false);
+  if (path == kPathSse2 && !HasCpuFeature(kCpuFeatureSse2)) return false;
+  if (path == kPathAvx2 && !HasCpuFeature(kCpuFeatureAvx2)) return false;
+  SetCpuFeatureDisabled(kCpuFeatureSse2, path < kPathSse2);
+  SetCpuFeatureDisabled(kCpuFeatureAvx2, path < kPathAvx2);
+  return true;
+}
+
+static ErrorCode Convert(bool bgra, const uint8_t* src, int src_row_size,
+                         int width, int height, uint8_t* dst) {
+  return bgra ?
+      ConvertYuv422ToBgra(src, src_row_size, width, height, dst, 0) :
+      ConvertYuv422ToRgb(src, src_row_size, width, height, dst, 0);
+}
+
+static uint8_t Clamp(int value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// Returns the largest channel difference from the conversion of
+// libfreenect's RGB modes.
+static int GetLibfreenectDiff(const uint8_t* src, const uint8_t* rgb,
+                              int pixel_count) {
+  int max_diff = 0;
+  for (int i = 0; i < pixel_count; ++i) {
+    const uint8_t* uyvy = src + (i & ~1) * 2;
+    int y = src[i * 2 + 1] - 16;
+    int u = uyvy[0] - 128;
+    int v = uyvy[2] - 128;
+    uint8_t expected[3] = {
+        Clamp(y * 1164 / 1000 + v * 1596 / 1000),
+        Clamp(y * 1164 / 1000 - v * 813 / 1000 - u * 391 / 1000),
+        Clamp(y * 1164 / 1000 + u * 2018 / 1000)};
+    for (int c = 0; c < 3; ++c) {
+      int diff = abs(expected[c] - rgb[i * 3 + c]);
+      if (diff > max_diff) max_diff = diff;
+    }
+  }
+  return max_diff;
+}
+
+int main(int argc, char** argv) {
+  int iterations = 200;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Source rows carry padding, which must not be converted.
+  const int src_row_size = FRAME_WIDTH * 2 + 32;
+  const int dst_size = FRAME_WIDTH * FRAME_HEIGHT * 4;
+  uint8_t* src = new uint8_t[src_row_size * FRAME_HEIGHT];
+  uint8_t* expected = new uint8_t[dst_size];
+  uint8_t* actual = new uint8_t[dst_size];
+  unsigned int seed = 1;
+  for (int i = 0; i < src_row_size * FRAME_HEIGHT; ++i) {
+    src[i] = (uint8_t) rand_r(&seed);
+  }
+
+  SelectPath(kPathScalar);
+  CHECK(Convert(false, src, FRAME_WIDTH * 2, FRAME_WIDTH, 1, expected) ==
+        kErrorSuccess);
+  int libfreenect_diff = GetLibfreenectDiff(src, expected, FRAME_WIDTH);
+  printf("max difference from libfreenect: %d\n", libfreenect_diff);
+  if (libfreenect_diff > MAX_LIBFREENECT_DIFF) {
+    fprintf(stderr, "Expected at most %d\n", MAX_LIBFREENECT_DIFF);
+    return 1;
+  }
+
+  for (int path = kPathSse2; path < kPathCount; ++path) {
+    if (!SelectPath((Path) path)) continue;
+    for (int bgra = 0; bgra < 2; ++bgra) {
+      // Check every even width up to a few vector widths, to cover
+      // the tails, and then a full frame.
+      for (int width = 2; width <= FRAME_WIDTH; width += 2) {
+        if (width > 66) width = FRAME_WIDTH;
+        int size = width * (bgra ? 4 : 3) * FRAME_HEIGHT;
+        SelectPath(kPathScalar);
+        Convert(bgra, src, src_row_size, width, FRAME_HEIGHT, expected);
+        SelectPath((Path) path);
+        memset(actual, 0, size);
+        Convert(bgra, src, src_row_size, width, FRAME_HEIGHT, actual);
+        if (memcmp(expected, actual, size)) {
+          fprintf(stderr, "%s %s: mismatch against scalar reference at "
+                  "width %d\n", kPathNames[path], bgra ? "bgra" : "rgb",
+                  width);
+          return 1;
+        }
+      }
+    }
+  }
+
+  for (int bgra = 0; bgra < 2; ++bgra) {
+    uint64_t scalar_micros = 0;
+    for (int path = kPathScalar; path < kPathCount; ++path) {
+      if (!SelectPath((Path) path)) continue;
+      uint64_t start_time = GetCurrentMicros();
+      for (int i = 0; i < iterations; ++i) {
+        Convert(bgra, src, src_row_size, FRAME_WIDTH, FRAME_HEIGHT, actual);
+      }
+      uint64_t micros = GetCurrentMicros() - start_time;
+      if (path == kPathScalar) scalar_micros = micros;
+      printf("%s %s: %.1f us/frame, %.1fx\n", kPathNames[path],
+             bgra ? "bgra" : "rgb", (double) micros / iterations,
+             (double) scalar_micros / (micros ? micros : 1));
+    }
+  }
+
+  delete[] actual;
+  delete[] expected;
+  delete[] src;
+  return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Compares CopyImageData against a plain per-row memcpy, for frame sizes
+// of both device versions and a strided destination.
+//
+// Usage: kkonnect-copy-bench [--threads=N] [--iterations=N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_thread_pool.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+// Destination rows are padded, as for texture staging buffers.
+#define DST_ROW_PADDING   256
+
+struct CopyCase {
+  const char* name;
+  int row_size;
+  int height;
+};
+
+static void CopyRowsWithMemcpy(uint8_t* dst, const uint8_t* src,
+                               int dst_row_size, int src_row_size,
+                               int height) {
+  for (int i = 0; i < height; ++i) {
+    memcpy(dst, src, src_row_size);
+    dst += dst_row_size;
+    src += src_row_size;
+  }
+}
+
+int main(int argc, char** argv) {
+  int thread_count = 3;
+  int iterations = 200;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--threads=", 10)) {
+      thread_count = atoi(argv[i] + 10);
+    } else if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--threads=N] [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const CopyCase cases[] = {
+    {"640x480 depth", 640 * 2, 480},
+    {"640x480 rgb", 640 * 3, 480},
+    {"1920x1080 rgb", 1920 * 3, 1080},
+    {"3840x2160 bgra", 3840 * 4, 2160},
+  };
+  ThreadPool pool(thread_count);
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+    const CopyCase& copy_case = cases[c];
+    int src_row_size = copy_case.row_size;
+    int dst_row_size = src_row_size + DST_ROW_PADDING;
+    int height = copy_case.height;
+    uint8_t* src = new uint8_t[(size_t) src_row_size * height];
+    uint8_t* expected = new uint8_t[(size_t) dst_row_size * height];
+    uint8_t* dst = new uint8_t[(size_t) dst_row_size * height];
+    for (size_t i = 0; i < (size_t) src_row_size * height; ++i) {
+      src[i] = (uint8_t) (i * 7);
+    }
+    memset(expected, 0, (size_t) dst_row_size * height);
+    memset(dst, 0, (size_t) dst_row_size * height);
+
+    uint64_t times[3];
+    for (int mode = 0; mode < 3; ++mode) {
+      uint64_t start_time = GetCurrentMicros();
+      for (int i = 0; i < iterations; ++i) {
+        if (mode == 0) {
+          CopyRowsWithMemcpy(expected, src, dst_row_size, src_row_size,
+                             height);
+        } else {
+          CopyImageData(dst, src, dst_row_size, src_row_size, height,
+                        mode == 2 ? &pool : NULL);
+        }
+      }
+      times[mode] = GetCurrentMicros() - start_time;
+      if (mode && memcmp(expected, dst, (size_t) dst_row_size * height)) {
+        fprintf(stderr, "%s: copies differ\n", copy_case.name);
+        return 1;
+      }
+    }
+
+    double megabytes = (double) src_row_size * height * iterations /
+        (1024 * 1024);
+    printf("%s: memcpy %.0f MB/sec, CopyImageData %.0f MB/sec, "
+           "with %d threads %.0f MB/sec\n",
+           copy_case.name, megabytes / (times[0] / 1e6),
+           megabytes / (times[1] / 1e6), thread_count + 1,
+           megabytes / (times[2] / 1e6));
+    delete[] dst;
+    delete[] expected;
+    delete[] src;
+  }
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures compression ratio and speed of DepthCodec.
+//
+// Frames are read from a file of concatenated raw 16-bit little-endian
+// depth frames, or captured from a locally attached device.
+//
+// Usage: kkonnect-depth-codec-bench [--input=FILE] [--width=W] [--height=H]
+//                                   [--device=INDEX] [--frames=N]
+//                                   [--iterations=N]
+
+#include <kk_connection.h>
+#include <kk_depth_codec.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+static int ReadFrames(const char* path, int frame_size, int max_frames,
+                      uint8_t* frames) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    REPORT_ERRNO("fopen");
+    return 0;
+  }
+  int count = 0;
+  while (count < max_frames &&
+         fread(frames + (size_t) count * frame_size, frame_size, 1, file)) {
+    ++count;
+  }
+  fclose(file);
+  return count;
+}
+
+static int CaptureFrames(int device_index, int max_frames, int* width,
+                         int* height, uint8_t** frames) {
+  Connection* connection = Connection::OpenLocal();
+  if (!connection) return 0;
+  DeviceOpenRequest request(device_index);
+  request.depth_format = kImageFormatDepthMm;
+  Device* device = NULL;
+  ErrorCode err = connection->OpenDevice(request, &device);
+  if (err != kErrorSuccess) {
+    fprintf(stderr, "Unable to open device %d: %d\n", device_index, err);
+    connection->Close();
+    return 0;
+  }
+
+  int count = 0;
+  uint64_t end_time = GetCurrentMillis() + 30000;
+  while (count < max_frames && GetCurrentMillis() < end_time) {
+    if (!(device->WaitForFrame(kStreamMaskDepth, 1000) & kStreamMaskDepth)) {
+      continue;
+    }
+    FrameLease lease;
+    if (!device->AcquireDepthFrame(&lease)) continue;
+    if (!*frames) {
+      *width = lease.width;
+      *height = lease.height;
+      *frames = new uint8_t[(size_t) max_frames * lease.width *
+                            lease.height * 2];
+    }
+    CopyImageData(*frames + (size_t) count * lease.width * lease.height * 2,
+                  lease.data, lease.width * 2, lease.row_size, lease.height);
+    device->ReleaseFrame(&lease);
+    ++count;
+  }
+  connection->CloseDevice(device);
+  connection->Close();
+  return count;
+}
+
+int main(int argc, char** argv) {
+  const char* input = NULL;
+  int width = 640;
+  int height = 480;
+  int device_index = 0;
+  int max_frames = 100;
+  int iterations = 5;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--input=", 8)) {
+      input = argv[i] + 8;
+    } else if (!strncmp(argv[i], "--width=", 8)) {
+      width = atoi(argv[i] + 8);
+    } else if (!strncmp(argv[i], "--height=", 9)) {
+      height = atoi(argv[i] + 9);
+    } else if (!strncmp(argv[i], "--device=", 9)) {
+      device_index = atoi(argv[i] + 9);
+    } else if (!strncmp(argv[i], "--frames=", 9)) {
+      max_frames = atoi(argv[i] + 9);
+    } else if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--input=FILE] [--width=W] [--height=H] "
+              "[--device=INDEX] [--frames=N] [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (width <= 0 || height <= 0 || max_frames <= 0 || iterations <= 0) {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+
+  uint8_t* frames = NULL;
+  int frame_count;
+  if (input) {
+    frames = new uint8_t[(size_t) max_frames * width * height * 2];
+    frame_count = ReadFrames(input, width * height * 2, max_frames, frames);
+  } else {
+    frame_count = CaptureFrames(device_index, max_frames, &width, &height,
+                                &frames);
+  }
+  if (!frame_count) {
+    fprintf(stderr, "No depth frames to measure\n");
+    delete[] frames;
+    return 1;
+  }
+
+  int frame_size = width * height * 2;
+  int max_encoded_size = DepthCodec::GetMaxEncodedSize(width, height);
+  uint8_t* encoded = new uint8_t[(size_t) frame_count * max_encoded_size];
+  int* encoded_sizes = new int[frame_count];
+  uint16_t* decoded = new uint16_t[width * height];
+  DepthCodec codec;
+
+  uint64_t encode_micros = 0;
+  uint64_t decode_micros = 0;
+  for (int iteration = 0; iteration < iterations; ++iteration) {
+    uint64_t start_time = GetCurrentMicros();
+    for (int i = 0; i < frame_count; ++i) {
+      codec.Encode(reinterpret_cast<const uint16_t*>(
+                       frames + (size_t) i * frame_size),
+                   width, height, 0, encoded + (size_t) i * max_encoded_size,
+                   max_encoded_size, &encoded_sizes[i]);
+    }
+    uint64_t mid_time = GetCurrentMicros();
+    for (int i = 0; i < frame_count; ++i) {
+      ErrorCode err = codec.Decode(
+          encoded + (size_t) i * max_encoded_size, encoded_sizes[i],
+          decoded, width, height, 0);
+      if (err != kErrorSuccess ||
+          memcmp(decoded, frames + (size_t) i * frame_size, frame_size)) {
+        fprintf(stderr, "Frame %d did not survive round trip\n", i);
+        return 1;
+      }
+    }
+    encode_micros += mid_time - start_time;
+    decode_micros += GetCurrentMicros() - mid_time;
+  }
+
+  uint64_t total_encoded = 0;
+  for (int i = 0; i < frame_count; ++i) total_encoded += encoded_sizes[i];
+  double raw_mb = (double) frame_size * frame_count * iterations /
+      (1024 * 1024);
+  int total_frames = frame_count * iterations;
+  printf("%d frames of %dx%d, %s kernels\n", frame_count, width, height,
+         codec.GetKernelName());
+  printf("ratio: %.2f, %llu bytes/frame\n",
+         (double) frame_size * frame_count / total_encoded,
+         (unsigned long long) (total_encoded / frame_count));
+  printf("encode: %.1f MB/sec, %.1f frames/sec\n",
+         raw_mb / (encode_micros / 1e6), total_frames / (encode_micros / 1e6));
+  printf("decode: %.1f MB/sec, %.1f frames/sec\n",
+         raw_mb / (decode_micros / 1e6), total_frames / (decode_micros / 1e6));
+
+  delete[] decoded;
+  delete[] encoded_sizes;
+  delete[] encoded;
+  delete[] frames;
+  return 0;
+}
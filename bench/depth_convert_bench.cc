@@ -0,0 +1,139 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures the float to 16-bit depth conversion used for Kinect2 frames
+// on every code path the CPU supports, and verifies the SIMD paths
+// against the scalar reference.
+//
+// Usage: kkonnect-depth-convert-bench [--iterations=N]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_depth_convert.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH    512
+#define FRAME_HEIGHT   424
+
+enum Path {
+  kPathScalar,
+  kPathSse41,
+  kPathAvx2,
+  kPathCount,
+};
+
+static const char* kPathNames[kPathCount] = {"scalar", "sse4.1", "avx2"};
+
+// Makes ConvertDepthFloatToMm() take |path|. Returns false if the CPU
+// does not support it.
+static bool SelectPath(Path path) {
+  SetCpuFeatureDisabled(kCpuFeatureSse41, false);
+  SetCpuFeatureDisabled(kCpuFeatureAvx2, false);
+  if (path == kPathSse41 && !HasCpuFeature(kCpuFeatureSse41)) return false;
+  if (path == kPathAvx2 && !HasCpuFeature(kCpuFeatureAvx2)) return false;
+  SetCpuFeatureDisabled(kCpuFeatureSse41, path < kPathSse41);
+  SetCpuFeatureDisabled(kCpuFeatureAvx2, path < kPathAvx2);
+  return true;
+}
+
+// Fills |values| with typical depth and with the edge cases the
+// conversion must handle.
+static void FillDepth(float* values, int count) {
+  unsigned int seed = 1;
+  for (int i = 0; i < count; ++i) {
+    switch (rand_r(&seed) % 16) {
+      case 0: values[i] = NAN; break;
+      case 1: values[i] = INFINITY; break;
+      case 2: values[i] = -INFINITY; break;
+      case 3: values[i] = -(float) (rand_r(&seed) % 1000); break;
+      case 4: values[i] = 65535.0f + rand_r(&seed) % 100000; break;
+      case 5: values[i] = (rand_r(&seed) % 4) * 0.5f + 65533.0f; break;
+      case 6: values[i] = 0.0f; break;
+      default:
+        values[i] = 500.0f + (float) rand_r(&seed) / RAND_MAX * 8000.0f;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int iterations = 1000;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const int count = FRAME_WIDTH * FRAME_HEIGHT;
+  float* src = new float[count];
+  uint16_t* expected = new uint16_t[count];
+  uint16_t* actual = new uint16_t[count];
+  FillDepth(src, count);
+
+  uint64_t scalar_micros = 0;
+  for (int path = kPathScalar; path < kPathCount; ++path) {
+    if (!SelectPath((Path) path)) {
+      printf("%s: not supported\n", kPathNames[path]);
+      continue;
+    }
+
+    // Check every length up to a few vector widths, to cover the tails,
+    // and then a full frame.
+    for (int length = 0; length <= count; ++length) {
+      if (length > 64) length = count;
+      ConvertDepthFloatToMmScalar(src, expected, length);
+      memset(actual, 0, length * sizeof(uint16_t));
+      ConvertDepthFloatToMm(src, actual, length);
+      if (memcmp(expected, actual, length * sizeof(uint16_t))) {
+        fprintf(stderr, "%s: mismatch against scalar reference at "
+                "length %d\n", kPathNames[path], length);
+        return 1;
+      }
+    }
+
+    uint64_t start_time = GetCurrentMicros();
+    for (int i = 0; i < iterations; ++i) {
+      ConvertDepthFloatToMm(src, actual, count);
+    }
+    uint64_t micros = GetCurrentMicros() - start_time;
+    if (path == kPathScalar) scalar_micros = micros;
+    printf("%s: %.1f us/frame, %.1fx\n", kPathNames[path],
+           (double) micros / iterations,
+           (double) scalar_micros / (micros ? micros : 1));
+  }
+
+  delete[] actual;
+  delete[] expected;
+  delete[] src;
+  return 0;
+}
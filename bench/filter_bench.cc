@@ -0,0 +1,145 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures the built-in depth filters on Kinect1 sized frames, and
+// verifies the selected SIMD paths against the scalar reference.
+//
+// Usage: kkonnect-filter-bench [--iterations=N]
+
+#include <kk_frame_filter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_builtin_filters.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH    640
+#define FRAME_HEIGHT   480
+// Frames with different noise, cycled through so that temporal filters
+// see changing input.
+#define FRAME_COUNT    4
+
+// Fills |frame| with a smooth depth ramp, sensor noise, holes, speckles
+// and out-of-range values.
+static void FillDepth(uint16_t* frame, unsigned int* seed) {
+  for (int y = 0; y < FRAME_HEIGHT; ++y) {
+    for (int x = 0; x < FRAME_WIDTH; ++x) {
+      int value = 800 + x * 4 + y + rand_r(seed) % 16;
+      switch (rand_r(seed) % 32) {
+        case 0: case 1: value = 0; break;
+        case 2: value = rand_r(seed) % 65536; break;
+        case 3: value = 9000 + rand_r(seed) % 1000; break;
+      }
+      frame[y * FRAME_WIDTH + x] = value;
+    }
+  }
+}
+
+// Runs |filter| on every source frame in turn, |iterations| times in total.
+// Returns the time spent in microseconds. When |output| is not NULL,
+// it receives all filtered frames of the first pass.
+static uint64_t RunFilter(FrameFilter* filter, uint16_t* const* frames,
+                          uint16_t* work, int iterations, uint16_t* output) {
+  const int count = FRAME_WIDTH * FRAME_HEIGHT;
+  uint64_t elapsed = 0;
+  for (int i = 0; i < iterations; ++i) {
+    memcpy(work, frames[i % FRAME_COUNT], count * sizeof(uint16_t));
+    uint64_t start_time = GetCurrentMicros();
+    filter->Apply(work, FRAME_WIDTH * sizeof(uint16_t), FRAME_WIDTH,
+                  FRAME_HEIGHT, kImageFormatDepthMm);
+    elapsed += GetCurrentMicros() - start_time;
+    if (output && i < FRAME_COUNT) {
+      memcpy(output + i * count, work, count * sizeof(uint16_t));
+    }
+  }
+  return elapsed;
+}
+
+int main(int argc, char** argv) {
+  int iterations = 500;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const int count = FRAME_WIDTH * FRAME_HEIGHT;
+  uint16_t* frames[FRAME_COUNT];
+  unsigned int seed = 1;
+  for (int i = 0; i < FRAME_COUNT; ++i) {
+    frames[i] = new uint16_t[count];
+    FillDepth(frames[i], &seed);
+  }
+  uint16_t* work = new uint16_t[count];
+  uint16_t* expected = new uint16_t[count * FRAME_COUNT];
+  uint16_t* actual = new uint16_t[count * FRAME_COUNT];
+
+  FrameFilterParams all_params[] = {
+    FrameFilterParams(kFrameFilterRange),
+    FrameFilterParams(kFrameFilterHoleFill),
+    FrameFilterParams(kFrameFilterSpeckle),
+    FrameFilterParams(kFrameFilterTemporalEma),
+    FrameFilterParams(kFrameFilterTemporalMedian),
+  };
+  all_params[0].min_depth = 500;
+  all_params[0].max_depth = 8000;
+
+  const char* path = HasCpuFeature(kCpuFeatureSse2) ? "sse2" : "scalar";
+  for (size_t i = 0; i < sizeof(all_params) / sizeof(all_params[0]); ++i) {
+    FrameFilter* scalar = CreateScalarFrameFilter(all_params[i]);
+    FrameFilter* simd = CreateFrameFilter(all_params[i]);
+    CHECK(scalar && simd);
+
+    RunFilter(scalar, frames, work, FRAME_COUNT, expected);
+    RunFilter(simd, frames, work, FRAME_COUNT, actual);
+    if (memcmp(expected, actual, count * FRAME_COUNT * sizeof(uint16_t))) {
+      fprintf(stderr, "%s: mismatch against scalar reference\n",
+              simd->GetName());
+      return 1;
+    }
+
+    uint64_t scalar_micros = RunFilter(scalar, frames, work, iterations, NULL);
+    uint64_t simd_micros = RunFilter(simd, frames, work, iterations, NULL);
+    printf("%s: scalar %.1f us/frame, %s %.1f us/frame, %.1fx\n",
+           simd->GetName(), (double) scalar_micros / iterations, path,
+           (double) simd_micros / iterations,
+           (double) scalar_micros / (simd_micros ? simd_micros : 1));
+    delete simd;
+    delete scalar;
+  }
+
+  delete[] actual;
+  delete[] expected;
+  delete[] work;
+  for (int i = 0; i < FRAME_COUNT; ++i) delete[] frames[i];
+  return 0;
+}
@@ -0,0 +1,330 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Exercises FramePool with one producer and several consumer threads,
+// and verifies that leased frames are never overwritten, that no frame
+// is delivered twice, and that public and internal leases stay within
+// their limits.
+//
+// Usage: kkonnect-frame-pool-bench [--frames=N] [--consumers=N]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_buffer_allocator.h"
+#include "src/kk_frame_pool.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH     64
+#define FRAME_HEIGHT    48
+#define MAX_CONSUMERS   16
+// Leases that every public consumer tries to hold. Together, consumers
+// try to hold more leases than the pool allows.
+#define HELD_LEASES     3
+// Leases allowed in addition to kMaxFrameLeases, see FramePool.
+#define INTERNAL_LEASES 2
+// Threads sleep instead of yielding, which interleaves them better
+// on a single CPU.
+#define SLEEP_TIME      0.00001
+// Stream index that FramePool stores in leases for the device.
+#define STREAM_INDEX    0
+
+struct BenchState {
+  FramePool pool;
+  int frame_count;
+  bool is_done;  // Atomic.
+  unsigned int next_seed;  // Atomic.
+  // Sequence numbers that were delivered, to find duplicates.
+  uint8_t* delivered;
+  // Leases held at the moment, and the largest such counts.
+  int public_leases;  // Atomic.
+  int internal_leases;  // Atomic.
+  int max_public_leases;  // Atomic.
+  int max_internal_leases;  // Atomic.
+  uint64_t acquired_frames;  // Atomic.
+  uint64_t failed_count;  // Atomic.
+};
+
+// Every 32-bit word of a frame holds its sequence number.
+static void FillFrame(void* data, uint32_t sequence) {
+  uint32_t* words = reinterpret_cast<uint32_t*>(data);
+  int count = FRAME_WIDTH * FRAME_HEIGHT * 2 / sizeof(uint32_t);
+  for (int i = 0; i < count; ++i) words[i] = sequence;
+}
+
+static bool IsFrameIntact(const FrameLease& lease) {
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(lease.data);
+  int count = lease.row_size * lease.height / sizeof(uint32_t);
+  for (int i = 0; i < count; ++i) {
+    if (words[i] != lease.metadata.sequence) return false;
+  }
+  return true;
+}
+
+static void Fail(BenchState* state, const char* message, uint64_t sequence) {
+  fprintf(stderr, "%s, frame %llu\n", message, (unsigned long long) sequence);
+  __atomic_add_fetch(&state->failed_count, 1, __ATOMIC_RELAXED);
+}
+
+static void UpdateMax(int* max_value, int value) {
+  int current = __atomic_load_n(max_value, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(max_value, &current, value, false,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+// Checks a fresh lease, and counts it as held.
+static void OnAcquired(BenchState* state, const FrameLease& lease,
+                       int* lease_count, int* max_lease_count) {
+  UpdateMax(max_lease_count,
+            __atomic_add_fetch(lease_count, 1, __ATOMIC_SEQ_CST));
+  __atomic_add_fetch(&state->acquired_frames, 1, __ATOMIC_RELAXED);
+  uint64_t sequence = lease.metadata.sequence;
+  if (sequence < 1 || sequence > (uint64_t) state->frame_count) {
+    Fail(state, "Unexpected sequence number", sequence);
+    return;
+  }
+  if (__atomic_exchange_n(&state->delivered[sequence], 1, __ATOMIC_SEQ_CST)) {
+    Fail(state, "Frame delivered twice", sequence);
+  }
+  if (!IsFrameIntact(lease)) Fail(state, "Frame modified", sequence);
+}
+
+static void ReleaseLease(BenchState* state, FrameLease* lease, bool internal,
+                         int* lease_count) {
+  // The producer may publish any number of frames while the lease is held.
+  if (!IsFrameIntact(*lease)) {
+    Fail(state, "Leased frame overwritten", lease->metadata.sequence);
+  }
+  __atomic_sub_fetch(lease_count, 1, __ATOMIC_SEQ_CST);
+  state->pool.Release(lease, internal);
+}
+
+static void* RunProducer(void* arg) {
+  BenchState* state = reinterpret_cast<BenchState*>(arg);
+  unsigned int seed = 0;
+  void* buffer = state->pool.GetFillBuffer();
+  for (int i = 1; i <= state->frame_count; ++i) {
+    FillFrame(buffer, i);
+    buffer = state->pool.Publish(i);
+    // Let consumers run between frames, also on a single CPU.
+    if (rand_r(&seed) % 2) Sleep(SLEEP_TIME);
+  }
+  __atomic_store_n(&state->is_done, true, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+// Holds several leases in a rotation, like a consumer queueing frames,
+// and returns them at random.
+static void* RunPublicConsumer(void* arg) {
+  BenchState* state = reinterpret_cast<BenchState*>(arg);
+  unsigned int seed = __atomic_add_fetch(&state->next_seed, 1,
+                                         __ATOMIC_RELAXED);
+  FrameLease leases[HELD_LEASES];
+  int held_count = 0;
+  int next = 0;
+  while (!__atomic_load_n(&state->is_done, __ATOMIC_SEQ_CST)) {
+    if (held_count && (held_count == HELD_LEASES || !(rand_r(&seed) % 4))) {
+      ReleaseLease(state, &leases[next], false, &state->public_leases);
+      next = (next + 1) % HELD_LEASES;
+      --held_count;
+    }
+    // Skipping frames at random lets other consumers get them.
+    FrameLease* lease = &leases[(next + held_count) % HELD_LEASES];
+    if (rand_r(&seed) % 2 &&
+        state->pool.Acquire(STREAM_INDEX, false, lease)) {
+      OnAcquired(state, *lease, &state->public_leases,
+                 &state->max_public_leases);
+      ++held_count;
+    } else {
+      Sleep(SLEEP_TIME);
+    }
+  }
+  for (int i = 0; i < held_count; ++i) {
+    ReleaseLease(state, &leases[(next + i) % HELD_LEASES], false,
+                 &state->public_leases);
+  }
+  return NULL;
+}
+
+// Copies frames through internal leases, like GetAndClear*Data().
+static void* RunInternalConsumer(void* arg) {
+  BenchState* state = reinterpret_cast<BenchState*>(arg);
+  unsigned int seed = __atomic_add_fetch(&state->next_seed, 1,
+                                         __ATOMIC_RELAXED);
+  uint8_t copy[FRAME_WIDTH * FRAME_HEIGHT * 2];
+  while (!__atomic_load_n(&state->is_done, __ATOMIC_SEQ_CST)) {
+    FrameLease lease;
+    if (!state->pool.Acquire(STREAM_INDEX, true, &lease)) {
+      Sleep(SLEEP_TIME);
+      continue;
+    }
+    OnAcquired(state, lease, &state->internal_leases,
+               &state->max_internal_leases);
+    memcpy(copy, lease.data, sizeof(copy));
+    // Some copies are slow, so that internal leases overlap.
+    if (!(rand_r(&seed) % 4)) Sleep(SLEEP_TIME);
+    ReleaseLease(state, &lease, true, &state->internal_leases);
+  }
+  return NULL;
+}
+
+// Checks the lease limits deterministically on a single thread.
+static bool CheckLimits(BufferAllocator* allocator) {
+  FramePool pool;
+  pool.SetAllocator(allocator);
+  CHECK(pool.Init(FRAME_WIDTH, FRAME_HEIGHT, 2, kImageFormatDepthMm));
+  FrameLease public_leases[kMaxFrameLeases + 1];
+  FrameLease internal_leases[INTERNAL_LEASES + 1];
+  bool is_ok = true;
+
+  for (int i = 0; i <= kMaxFrameLeases; ++i) {
+    pool.Publish(0);
+    bool expected = (i < kMaxFrameLeases);
+    if (pool.Acquire(STREAM_INDEX, false, &public_leases[i]) != expected) {
+      fprintf(stderr, "Public lease %d: expected %s\n", i,
+              expected ? "success" : "failure");
+      is_ok = false;
+    }
+  }
+  // The internal reserve remains available to GetAndClear*Data().
+  for (int i = 0; i <= INTERNAL_LEASES; ++i) {
+    pool.Publish(0);
+    bool expected = (i < INTERNAL_LEASES);
+    if (pool.Acquire(STREAM_INDEX, true, &internal_leases[i]) != expected) {
+      fprintf(stderr, "Internal lease %d: expected %s\n", i,
+              expected ? "success" : "failure");
+      is_ok = false;
+    }
+  }
+  // All leases are held, and the producer still finds free slots.
+  for (int i = 0; i < 4; ++i) pool.Publish(0);
+  if (pool.Acquire(STREAM_INDEX, false, &public_leases[kMaxFrameLeases])) {
+    fprintf(stderr, "Public lease after the limit: expected failure\n");
+    is_ok = false;
+  }
+
+  pool.Release(&public_leases[0], false);
+  if (!pool.Acquire(STREAM_INDEX, false, &public_leases[0])) {
+    fprintf(stderr, "Public lease after release: expected success\n");
+    is_ok = false;
+  }
+  for (int i = 0; i < kMaxFrameLeases; ++i) {
+    pool.Release(&public_leases[i], false);
+  }
+  for (int i = 0; i < INTERNAL_LEASES; ++i) {
+    pool.Release(&internal_leases[i], true);
+  }
+  return is_ok;
+}
+
+int main(int argc, char** argv) {
+  int frame_count = 50000;
+  int consumer_count = 3;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--frames=", 9)) {
+      frame_count = atoi(argv[i] + 9);
+    } else if (!strncmp(argv[i], "--consumers=", 12)) {
+      consumer_count = atoi(argv[i] + 12);
+    } else {
+      fprintf(stderr, "Usage: %s [--frames=N] [--consumers=N]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (frame_count < 1 || consumer_count < 1 ||
+      consumer_count > MAX_CONSUMERS) {
+    fprintf(stderr, "Expected 1+ frames and 1-%d consumers\n", MAX_CONSUMERS);
+    return 1;
+  }
+
+  BufferAllocator allocator;
+  if (!CheckLimits(&allocator)) return 1;
+  printf("limits: ok\n");
+
+  BenchState* state = new BenchState();
+  state->pool.SetAllocator(&allocator);
+  CHECK(state->pool.Init(FRAME_WIDTH, FRAME_HEIGHT, 2, kImageFormatDepthMm));
+  state->frame_count = frame_count;
+  state->is_done = false;
+  state->next_seed = 0;
+  state->delivered = new uint8_t[frame_count + 1];
+  memset(state->delivered, 0, frame_count + 1);
+  state->public_leases = 0;
+  state->internal_leases = 0;
+  state->max_public_leases = 0;
+  state->max_internal_leases = 0;
+  state->acquired_frames = 0;
+  state->failed_count = 0;
+
+  // Each public consumer is paired with an internal one.
+  pthread_t consumers[2 * MAX_CONSUMERS];
+  for (int i = 0; i < consumer_count; ++i) {
+    CHECK(!pthread_create(&consumers[2 * i], NULL, RunPublicConsumer, state));
+    CHECK(!pthread_create(&consumers[2 * i + 1], NULL, RunInternalConsumer,
+                          state));
+  }
+  uint64_t start_time = GetCurrentMicros();
+  pthread_t producer;
+  CHECK(!pthread_create(&producer, NULL, RunProducer, state));
+  pthread_join(producer, NULL);
+  uint64_t elapsed = GetCurrentMicros() - start_time;
+  for (int i = 0; i < 2 * consumer_count; ++i) {
+    pthread_join(consumers[i], NULL);
+  }
+
+  StreamStats stats;
+  state->pool.GetStats(&stats);
+  bool is_ok = !state->failed_count;
+  if (state->max_public_leases > kMaxFrameLeases ||
+      state->max_internal_leases > INTERNAL_LEASES) {
+    fprintf(stderr, "Held %d public and %d internal leases\n",
+            state->max_public_leases, state->max_internal_leases);
+    is_ok = false;
+  }
+  if (stats.received_frames != (uint64_t) frame_count ||
+      stats.delivered_frames != state->acquired_frames) {
+    fprintf(stderr, "Stats do not match: %llu received, %llu delivered\n",
+            (unsigned long long) stats.received_frames,
+            (unsigned long long) stats.delivered_frames);
+    is_ok = false;
+  }
+
+  printf("%d frames in %.1f ms, %.2f us/frame, %llu delivered, "
+         "%llu dropped, up to %d+%d leases\n",
+         frame_count, elapsed / 1000.0, (double) elapsed / frame_count,
+         (unsigned long long) stats.delivered_frames,
+         (unsigned long long) stats.dropped_frames,
+         state->max_public_leases, state->max_internal_leases);
+  delete[] state->delivered;
+  delete state;
+  printf("%s\n", is_ok ? "ok" : "FAILED");
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,624 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures the whole frame path on synthetic or replayed devices, and
+// writes the results as JSON, so that they can be compared across
+// releases. Progress goes to stderr.
+//
+// Sections:
+//   latency        - time from frame publication to a consumer's lease.
+//   get_and_clear  - GetAndClearDepthData() throughput with competing
+//                    consumer threads.
+//   copy           - CopyImageData() bandwidth across row strides.
+//   connect        - time to connect and to reconnect after a close.
+//   scaling        - delivered frames and latency from 1 to N devices.
+// The connect and scaling sections need synthetic devices, and are
+// skipped when replaying.
+//
+// Usage: kkonnect-bench [--devices=N] [--seconds=N] [--replay=FILE]
+//                       [--output=FILE]
+
+#include <kk_connection.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH          640
+#define FRAME_HEIGHT         480
+#define NOMINAL_FPS          30
+// Highest rate of synthetic devices, for throughput measurements.
+#define MAX_FPS              1000
+#define CONNECT_TIMEOUT_MS   10000
+#define CONNECT_ITERATIONS   10
+#define COPY_ITERATIONS      200
+#define MAX_CONSUMERS        4
+
+struct BenchOptions {
+  int max_devices;
+  double seconds;
+  const char* replay_path;
+
+  BenchOptions() : max_devices(8), seconds(2), replay_path(NULL) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON OUTPUT
+////////////////////////////////////////////////////////////////////////////////
+
+// Writes indented JSON. Keys are ignored inside arrays.
+class JsonWriter {
+ public:
+  explicit JsonWriter(FILE* file) : file_(file), depth_(0) {
+    has_items_[0] = false;
+  }
+
+  void BeginObject(const char* key) { Begin(key, '{'); }
+  void EndObject() { End('}'); }
+  void BeginArray(const char* key) { Begin(key, '['); }
+  void EndArray() { End(']'); }
+
+  void Int(const char* key, int64_t value) {
+    Key(key);
+    fprintf(file_, "%lld", (long long) value);
+  }
+
+  void Double(const char* key, double value) {
+    Key(key);
+    fprintf(file_, "%.3f", value);
+  }
+
+  void String(const char* key, const char* value) {
+    Key(key);
+    fputc('"', file_);
+    for (const char* c = value; *c; ++c) {
+      if (*c == '"' || *c == '\\') fputc('\\', file_);
+      fputc(*c, file_);
+    }
+    fputc('"', file_);
+  }
+
+  void Finish() { fputc('\n', file_); }
+
+ private:
+  void Key(const char* key) {
+    if (depth_ && has_items_[depth_]) fputc(',', file_);
+    if (depth_) fprintf(file_, "\n%*s", depth_ * 2, "");
+    has_items_[depth_] = true;
+    if (key && is_object_[depth_]) fprintf(file_, "\"%s\": ", key);
+  }
+
+  void Begin(const char* key, char bracket) {
+    Key(key);
+    fputc(bracket, file_);
+    ++depth_;
+    CHECK(depth_ < kMaxDepth);
+    has_items_[depth_] = false;
+    is_object_[depth_] = bracket == '{';
+  }
+
+  void End(char bracket) {
+    bool has_items = has_items_[depth_];
+    --depth_;
+    if (has_items) fprintf(file_, "\n%*s", depth_ * 2, "");
+    fputc(bracket, file_);
+  }
+
+  static const int kMaxDepth = 8;
+
+  FILE* file_;
+  int depth_;
+  bool has_items_[kMaxDepth];
+  bool is_object_[kMaxDepth];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// HELPERS
+////////////////////////////////////////////////////////////////////////////////
+
+// Collects latency samples in microseconds.
+class LatencySamples {
+ public:
+  LatencySamples() : samples_(NULL), count_(0), capacity_(0) {}
+  ~LatencySamples() { delete[] samples_; }
+
+  void Add(uint64_t latency_us) {
+    if (count_ == capacity_) {
+      int capacity = capacity_ ? capacity_ * 2 : 1024;
+      uint32_t* samples = new uint32_t[capacity];
+      if (count_) memcpy(samples, samples_, count_ * sizeof(uint32_t));
+      delete[] samples_;
+      samples_ = samples;
+      capacity_ = capacity;
+    }
+    samples_[count_++] =
+        latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t) latency_us;
+  }
+
+  void Append(const LatencySamples& other) {
+    for (int i = 0; i < other.count_; ++i) Add(other.samples_[i]);
+  }
+
+  int count() const { return count_; }
+
+  // Sorts the samples. Must be called before Percentile().
+  void Sort() {
+    qsort(samples_, count_, sizeof(uint32_t), CompareSamples);
+  }
+
+  uint32_t Percentile(double percentile) const {
+    if (!count_) return 0;
+    int index = (int) (percentile / 100 * (count_ - 1) + 0.5);
+    return samples_[index];
+  }
+
+  void Write(JsonWriter* json) const {
+    json->Int("samples", count_);
+    json->Int("p50_us", Percentile(50));
+    json->Int("p90_us", Percentile(90));
+    json->Int("p99_us", Percentile(99));
+    json->Int("p999_us", Percentile(99.9));
+    json->Int("max_us", Percentile(100));
+  }
+
+ private:
+  static int CompareSamples(const void* a, const void* b) {
+    uint32_t value_a = *reinterpret_cast<const uint32_t*>(a);
+    uint32_t value_b = *reinterpret_cast<const uint32_t*>(b);
+    return value_a < value_b ? -1 : value_a > value_b;
+  }
+
+  uint32_t* samples_;
+  int count_;
+  int capacity_;
+
+  LatencySamples(const LatencySamples& src);
+  LatencySamples& operator=(const LatencySamples& src);
+};
+
+static uint64_t GetCpuMicros() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+      1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static Connection* OpenSource(const BenchOptions& options,
+                              int device_count, int fps) {
+  if (options.replay_path) {
+    ReplayOptions replay_options;
+    replay_options.speed = fps == MAX_FPS ? 0 : 1;
+    replay_options.loop = true;
+    return Connection::OpenReplay(options.replay_path, replay_options);
+  }
+  SyntheticOptions synthetic_options;
+  synthetic_options.device_count = device_count;
+  synthetic_options.width = FRAME_WIDTH;
+  synthetic_options.height = FRAME_HEIGHT;
+  synthetic_options.fps = fps;
+  return Connection::OpenSynthetic(synthetic_options);
+}
+
+// Opens |device_index| with both streams. Replayed devices only serve
+// their recorded formats, so the formats are probed.
+static Device* OpenDevice(Connection* connection, int device_index) {
+  static const ImageFormat kVideoFormats[] = {
+    kImageFormatVideoRgb, kImageFormatVideoYuv422, kImageFormatNone};
+  static const ImageFormat kDepthFormats[] = {
+    kImageFormatDepthMm, kImageFormatDepthRegistered, kImageFormatNone};
+  for (int v = 0; v < 3; ++v) {
+    for (int d = 0; d < 3; ++d) {
+      DeviceOpenRequest request(device_index);
+      request.video_format = kVideoFormats[v];
+      request.depth_format = kDepthFormats[d];
+      Device* device = NULL;
+      ErrorCode err = connection->OpenDevice(request, &device);
+      if (err == kErrorSuccess) return device;
+      if (err != kErrorInvalidArgument) {
+        fprintf(stderr, "Unable to open device %d: %d\n", device_index, err);
+        return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Returns the time it took the device to connect in microseconds, or -1
+// on failure.
+static int64_t WaitConnected(Device* device, uint64_t start_us) {
+  if (device->WaitForConnect(CONNECT_TIMEOUT_MS) != kErrorSuccess) return -1;
+  return GetCurrentMicros() - start_us;
+}
+
+// Reads both streams of a device on its own thread, as an application
+// would.
+struct Consumer {
+  Device* device;
+  uint8_t* video_buffer;
+  uint16_t* depth_buffer;
+  // Whether to copy frames with GetAndClear*Data() instead of leasing.
+  bool copy_frames;
+  // Only read depth frames.
+  bool depth_only;
+  volatile bool stop;
+  pthread_t thread;
+
+  uint64_t frame_count;
+  uint64_t byte_count;
+  uint64_t dropped_frames;
+  uint64_t missed_reads;
+  LatencySamples latency;
+
+  Consumer()
+      : device(NULL), video_buffer(NULL), depth_buffer(NULL),
+        copy_frames(false), depth_only(false), stop(false),
+        frame_count(0), byte_count(0), dropped_frames(0), missed_reads(0) {}
+  ~Consumer() {
+    delete[] video_buffer;
+    delete[] depth_buffer;
+  }
+};
+
+static void CountFrame(Consumer* consumer, const FrameMetadata& metadata,
+                       int size) {
+  ++consumer->frame_count;
+  consumer->byte_count += size;
+  consumer->dropped_frames += metadata.dropped_frames;
+  consumer->latency.Add(GetCurrentMicros() - metadata.host_time_us);
+}
+
+static void* RunConsumer(void* arg) {
+  Consumer* consumer = reinterpret_cast<Consumer*>(arg);
+  Device* device = consumer->device;
+  ImageInfo video_info = device->GetVideoImageInfo();
+  ImageInfo depth_info = device->GetDepthImageInfo();
+  int video_size = video_info.enabled ? video_info.width *
+      video_info.height * GetBytesPerPixel(video_info.format) : 0;
+  int depth_size = depth_info.enabled ?
+      depth_info.width * depth_info.height * 2 : 0;
+  if (consumer->copy_frames) {
+    consumer->video_buffer = new uint8_t[video_size];
+    consumer->depth_buffer = new uint16_t[depth_size / 2];
+  }
+  int streams_mask = kStreamMaskDepth;
+  if (!consumer->depth_only) streams_mask |= kStreamMaskVideo;
+
+  while (!consumer->stop) {
+    int streams = device->WaitForFrame(streams_mask, 100);
+    FrameMetadata metadata;
+    if (streams & kStreamMaskDepth) {
+      if (consumer->copy_frames) {
+        if (device->GetAndClearDepthData(consumer->depth_buffer, 0,
+                                         &metadata)) {
+          CountFrame(consumer, metadata, depth_size);
+        } else {
+          ++consumer->missed_reads;
+        }
+      } else {
+        FrameLease lease;
+        if (device->AcquireDepthFrame(&lease)) {
+          CountFrame(consumer, lease.metadata, 0);
+          device->ReleaseFrame(&lease);
+        }
+      }
+    }
+    if (streams & kStreamMaskVideo) {
+      if (consumer->copy_frames) {
+        if (device->GetAndClearVideoData(consumer->video_buffer, 0,
+                                         &metadata)) {
+          CountFrame(consumer, metadata, video_size);
+        } else {
+          ++consumer->missed_reads;
+        }
+      } else {
+        FrameLease lease;
+        if (device->AcquireVideoFrame(&lease)) {
+          CountFrame(consumer, lease.metadata, 0);
+          device->ReleaseFrame(&lease);
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+static void RunConsumers(Consumer* consumers, int count, double seconds) {
+  for (int i = 0; i < count; ++i) {
+    CHECK(!pthread_create(&consumers[i].thread, NULL, RunConsumer,
+                          &consumers[i]));
+  }
+  Sleep(seconds);
+  for (int i = 0; i < count; ++i) consumers[i].stop = true;
+  for (int i = 0; i < count; ++i) pthread_join(consumers[i].thread, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SECTIONS
+////////////////////////////////////////////////////////////////////////////////
+
+static bool BenchLatency(const BenchOptions& options, JsonWriter* json) {
+  fprintf(stderr, "Measuring latency\n");
+  Connection* connection = OpenSource(options, 1, NOMINAL_FPS);
+  if (!connection) return false;
+  Device* device = OpenDevice(connection, 0);
+  if (!device || WaitConnected(device, GetCurrentMicros()) < 0) {
+    connection->Close();
+    return false;
+  }
+
+  Consumer consumer;
+  consumer.device = device;
+  RunConsumers(&consumer, 1, options.seconds);
+  connection->Close();
+
+  consumer.latency.Sort();
+  json->BeginObject("latency");
+  consumer.latency.Write(json);
+  json->EndObject();
+  return true;
+}
+
+static bool BenchGetAndClear(const BenchOptions& options, JsonWriter* json) {
+  json->BeginArray("get_and_clear");
+  for (int consumer_count = 1; consumer_count <= MAX_CONSUMERS;
+       consumer_count *= 2) {
+    fprintf(stderr, "Measuring GetAndClearDepthData with %d consumers\n",
+            consumer_count);
+    Connection* connection = OpenSource(options, 1, MAX_FPS);
+    if (!connection) return false;
+    Device* device = OpenDevice(connection, 0);
+    if (!device || WaitConnected(device, GetCurrentMicros()) < 0) {
+      connection->Close();
+      return false;
+    }
+
+    Consumer consumers[MAX_CONSUMERS];
+    for (int i = 0; i < consumer_count; ++i) {
+      consumers[i].device = device;
+      consumers[i].copy_frames = true;
+      consumers[i].depth_only = true;
+    }
+    RunConsumers(consumers, consumer_count, options.seconds);
+    connection->Close();
+
+    uint64_t frame_count = 0, byte_count = 0, missed_reads = 0;
+    LatencySamples latency;
+    for (int i = 0; i < consumer_count; ++i) {
+      frame_count += consumers[i].frame_count;
+      byte_count += consumers[i].byte_count;
+      missed_reads += consumers[i].missed_reads;
+      latency.Append(consumers[i].latency);
+    }
+    latency.Sort();
+    json->BeginObject(NULL);
+    json->Int("consumers", consumer_count);
+    json->Double("reads_per_sec", frame_count / options.seconds);
+    json->Double("mb_per_sec",
+                 byte_count / options.seconds / (1024 * 1024));
+    json->Int("missed_reads", missed_reads);
+    json->Int("p99_latency_us", latency.Percentile(99));
+    json->EndObject();
+  }
+  json->EndArray();
+  return true;
+}
+
+static void BenchCopy(JsonWriter* json) {
+  struct CopyCase {
+    const char* name;
+    int row_size;
+    int height;
+  };
+  const CopyCase cases[] = {
+    {"640x480 depth", 640 * 2, 480},
+    {"640x480 rgb", 640 * 3, 480},
+    {"1920x1080 rgb", 1920 * 3, 1080},
+  };
+  // Packed, odd, cache line and page padding of destination rows.
+  const int paddings[] = {0, 3, 64, 4096};
+
+  json->BeginArray("copy");
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+    const CopyCase& copy_case = cases[c];
+    fprintf(stderr, "Measuring CopyImageData for %s\n", copy_case.name);
+    int src_row_size = copy_case.row_size;
+    size_t src_size = (size_t) src_row_size * copy_case.height;
+    uint8_t* src = new uint8_t[src_size];
+    memset(src, 1, src_size);
+    for (size_t p = 0; p < sizeof(paddings) / sizeof(paddings[0]); ++p) {
+      int dst_row_size = src_row_size + paddings[p];
+      uint8_t* dst = new uint8_t[(size_t) dst_row_size * copy_case.height];
+      memset(dst, 0, (size_t) dst_row_size * copy_case.height);
+      uint64_t start_time = GetCurrentMicros();
+      for (int i = 0; i < COPY_ITERATIONS; ++i) {
+        CopyImageData(dst, src, dst_row_size, src_row_size,
+                      copy_case.height);
+      }
+      uint64_t micros = GetCurrentMicros() - start_time;
+      delete[] dst;
+
+      json->BeginObject(NULL);
+      json->String("image", copy_case.name);
+      json->Int("dst_row_padding", paddings[p]);
+      json->Double("mb_per_sec", (double) src_size * COPY_ITERATIONS /
+                   (1024 * 1024) / (micros ? micros / 1e6 : 1e-6));
+      json->EndObject();
+    }
+    delete[] src;
+  }
+  json->EndArray();
+}
+
+static bool BenchConnect(const BenchOptions& options, JsonWriter* json) {
+  fprintf(stderr, "Measuring connect time\n");
+  Connection* connection = OpenSource(options, 1, NOMINAL_FPS);
+  if (!connection) return false;
+  // The first connect is measured separately, since later ones reuse the
+  // frame pools.
+  int64_t first_us = -1;
+  int64_t total_us = 0;
+  int64_t max_us = 0;
+  for (int i = 0; i <= CONNECT_ITERATIONS; ++i) {
+    uint64_t start_us = GetCurrentMicros();
+    Device* device = OpenDevice(connection, 0);
+    int64_t micros = device ? WaitConnected(device, start_us) : -1;
+    if (device) connection->CloseDevice(device);
+    if (micros < 0) {
+      connection->Close();
+      return false;
+    }
+    if (!i) {
+      first_us = micros;
+    } else {
+      total_us += micros;
+      if (micros > max_us) max_us = micros;
+    }
+  }
+  connection->Close();
+
+  json->BeginObject("connect");
+  json->Int("first_us", first_us);
+  json->Double("reconnect_mean_us", (double) total_us / CONNECT_ITERATIONS);
+  json->Int("reconnect_max_us", max_us);
+  json->EndObject();
+  return true;
+}
+
+static bool BenchScaling(const BenchOptions& options, JsonWriter* json) {
+  json->BeginArray("scaling");
+  for (int device_count = 1; device_count <= options.max_devices;
+       device_count = device_count * 2 > options.max_devices &&
+           device_count < options.max_devices ?
+           options.max_devices : device_count * 2) {
+    fprintf(stderr, "Measuring %d devices\n", device_count);
+    Connection* connection = OpenSource(options, device_count, NOMINAL_FPS);
+    if (!connection) return false;
+    Consumer* consumers = new Consumer[device_count];
+    bool connected = true;
+    for (int i = 0; i < device_count && connected; ++i) {
+      consumers[i].device = OpenDevice(connection, i);
+      consumers[i].copy_frames = true;
+      connected = consumers[i].device != NULL;
+    }
+    for (int i = 0; i < device_count && connected; ++i) {
+      connected = WaitConnected(consumers[i].device, GetCurrentMicros()) >= 0;
+    }
+    if (!connected) {
+      connection->Close();
+      delete[] consumers;
+      return false;
+    }
+
+    uint64_t start_cpu = GetCpuMicros();
+    RunConsumers(consumers, device_count, options.seconds);
+    double cpu_seconds = (GetCpuMicros() - start_cpu) / 1e6;
+    ConnectionStats stats = connection->GetStats();
+    connection->Close();
+
+    uint64_t frame_count = 0, dropped_frames = 0;
+    LatencySamples latency;
+    for (int i = 0; i < device_count; ++i) {
+      frame_count += consumers[i].frame_count;
+      dropped_frames += consumers[i].dropped_frames;
+      latency.Append(consumers[i].latency);
+    }
+    delete[] consumers;
+    latency.Sort();
+
+    json->BeginObject(NULL);
+    json->Int("devices", device_count);
+    json->Double("frames_per_sec", frame_count / options.seconds);
+    json->Double("expected_frames_per_sec",
+                 2.0 * NOMINAL_FPS * device_count);
+    json->Int("dropped_frames", dropped_frames);
+    json->Int("p50_latency_us", latency.Percentile(50));
+    json->Int("p99_latency_us", latency.Percentile(99));
+    json->Double("cpu_percent", cpu_seconds / options.seconds * 100);
+    json->Double("measured_fps", stats.video.fps + stats.depth.fps);
+    json->Int("lock_wait_us", stats.lock_wait_us);
+    json->EndObject();
+  }
+  json->EndArray();
+  return true;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  const char* output_path = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--devices=", 10)) {
+      options.max_devices = atoi(argv[i] + 10);
+    } else if (!strncmp(argv[i], "--seconds=", 10)) {
+      options.seconds = atof(argv[i] + 10);
+    } else if (!strncmp(argv[i], "--replay=", 9)) {
+      options.replay_path = argv[i] + 9;
+    } else if (!strncmp(argv[i], "--output=", 9)) {
+      output_path = argv[i] + 9;
+    } else {
+      fprintf(stderr, "Usage: %s [--devices=N] [--seconds=N] "
+              "[--replay=FILE] [--output=FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (options.max_devices < 1 || options.seconds <= 0) {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+
+  FILE* output = stdout;
+  if (output_path) {
+    output = fopen(output_path, "w");
+    if (!output) {
+      REPORT_ERRNO("fopen");
+      return 1;
+    }
+  }
+
+  JsonWriter json(output);
+  json.BeginObject(NULL);
+  json.String("source", options.replay_path ? "replay" : "synthetic");
+  json.Double("seconds_per_run", options.seconds);
+  bool success = BenchLatency(options, &json) &&
+      BenchGetAndClear(options, &json);
+  if (success) BenchCopy(&json);
+  if (success && !options.replay_path) {
+    success = BenchConnect(options, &json) && BenchScaling(options, &json);
+  }
+  json.EndObject();
+  json.Finish();
+  if (output != stdout) fclose(output);
+
+  if (!success) {
+    fprintf(stderr, "Benchmark failed\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures frame throughput from a kkonnect-host. Reports the size of
+// frames as sent over the network, and as decoded into frame buffers.
+//
+// Usage: kkonnect-net-bench [--host=HOST] [--port=PORT] [--device=INDEX]
+//                           [--seconds=N]
+
+#include <kk_connection.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_remote_protocol.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+int main(int argc, char** argv) {
+  const char* host = "localhost";
+  int port = REMOTE_DEFAULT_PORT;
+  int device_index = 0;
+  int seconds = 10;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--host=", 7)) {
+      host = argv[i] + 7;
+    } else if (!strncmp(argv[i], "--port=", 7)) {
+      port = atoi(argv[i] + 7);
+    } else if (!strncmp(argv[i], "--device=", 9)) {
+      device_index = atoi(argv[i] + 9);
+    } else if (!strncmp(argv[i], "--seconds=", 10)) {
+      seconds = atoi(argv[i] + 10);
+    } else {
+      fprintf(stderr, "Usage: %s [--host=HOST] [--port=PORT] "
+              "[--device=INDEX] [--seconds=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Connection* connection = Connection::OpenRemote(host, port);
+  if (!connection) return 1;
+
+  DeviceOpenRequest request(device_index);
+  request.video_format = kImageFormatVideoRgb;
+  request.depth_format = kImageFormatDepthMm;
+  Device* device = NULL;
+  ErrorCode err = connection->OpenDevice(request, &device);
+  if (err != kErrorSuccess) {
+    fprintf(stderr, "Unable to open device %d: %d\n", device_index, err);
+    connection->Close();
+    return 1;
+  }
+
+  uint64_t start_time = GetCurrentMillis();
+  uint64_t end_time = start_time + seconds * 1000;
+  uint64_t frame_counts[2] = {0, 0};
+  uint64_t decoded_byte_counts[2] = {0, 0};
+  uint64_t dropped_counts[2] = {0, 0};
+  uint64_t now;
+  while ((now = GetCurrentMillis()) < end_time) {
+    int streams = device->WaitForFrame(
+        kStreamMaskVideo | kStreamMaskDepth, (int) (end_time - now));
+    for (int stream = 0; stream < 2; ++stream) {
+      if (!(streams & (1 << stream))) continue;
+      FrameLease lease;
+      bool acquired = stream == 0 ? device->AcquireVideoFrame(&lease) :
+          device->AcquireDepthFrame(&lease);
+      if (!acquired) continue;
+      ++frame_counts[stream];
+      decoded_byte_counts[stream] += lease.row_size * lease.height;
+      dropped_counts[stream] += lease.metadata.dropped_frames;
+      device->ReleaseFrame(&lease);
+    }
+  }
+
+  double elapsed = (GetCurrentMillis() - start_time) / 1000.0;
+  DeviceStats stats = device->GetStats();
+  const char* names[2] = {"video", "depth"};
+  const StreamStats* stream_stats[2] = {&stats.video, &stats.depth};
+  for (int stream = 0; stream < 2; ++stream) {
+    uint64_t frames = frame_counts[stream];
+    // Network sizes are averaged over all frames since the device was
+    // opened, including dropped ones.
+    uint64_t received_frames = stream_stats[stream]->received_frames;
+    uint64_t network_bytes = stream_stats[stream]->network_bytes;
+    printf("%s: %.1f frames/sec, %llu network bytes/frame, "
+           "%llu decoded bytes/frame, %.1f network MB/sec, %llu dropped\n",
+           names[stream], frames / elapsed,
+           (unsigned long long) (received_frames ?
+                                 network_bytes / received_frames : 0),
+           (unsigned long long) (frames ?
+                                 decoded_byte_counts[stream] / frames : 0),
+           network_bytes / elapsed / (1024 * 1024),
+           (unsigned long long) dropped_counts[stream]);
+  }
+
+  connection->CloseDevice(device);
+  connection->Close();
+  return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Serves synthetic devices with RemoteHost on 127.0.0.1 and reads them
+// back through Connection::OpenRemote(). Verifies the count, geometry,
+// sequence numbers and contents of received frames, and that closing
+// the client closes the devices on the host.
+//
+// Usage: kkonnect-net-loopback-test [--seconds=N] [--fps=N]
+
+#include <kk_connection.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_remote_host.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH          640
+#define FRAME_HEIGHT         480
+// Lowest accepted share of the nominal frame count.
+#define MIN_FRAME_SHARE      0.5
+#define CLOSE_TIMEOUT_MS     2000
+
+static void* RunHost(void* arg) {
+  reinterpret_cast<RemoteHost*>(arg)->Run();
+  return NULL;
+}
+
+// Checks the pattern of SyntheticDevice, which is derived from the frame
+// number. Depth is compressed on the way, so this verifies the codec too.
+static bool CheckContents(int stream, const FrameLease& lease, int fps) {
+  int frame = (int) (lease.metadata.device_timestamp / (1000000 / fps));
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(lease.data);
+  for (int y = 0; y < lease.height; ++y) {
+    const uint8_t* row = data + y * lease.row_size;
+    for (int x = 0; x < lease.width; ++x) {
+      bool is_ok;
+      if (stream == 0) {
+        uint8_t expected = (y + frame) & 0xFF;
+        is_ok = row[x * 3] == expected && row[x * 3 + 1] == expected &&
+            row[x * 3 + 2] == expected;
+      } else {
+        uint16_t expected = 500 + ((y + frame) & 511) * 8 + (x & 63);
+        is_ok = reinterpret_cast<const uint16_t*>(row)[x] == expected;
+      }
+      if (!is_ok) {
+        fprintf(stderr, "Unexpected pixel (%d, %d) of frame %d\n",
+                x, y, frame);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool WaitForHostClose(Connection* connection) {
+  uint64_t end_time = GetCurrentMillis() + CLOSE_TIMEOUT_MS;
+  while (connection->GetStats().open_device_count) {
+    if (GetCurrentMillis() >= end_time) return false;
+    Sleep(0.01);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int seconds = 3;
+  int fps = 30;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--seconds=", 10)) {
+      seconds = atoi(argv[i] + 10);
+    } else if (!strncmp(argv[i], "--fps=", 6)) {
+      fps = atoi(argv[i] + 6);
+    } else {
+      fprintf(stderr, "Usage: %s [--seconds=N] [--fps=N]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (seconds < 1 || fps < 1) {
+    fprintf(stderr, "Expected 1+ seconds and 1+ fps\n");
+    return 1;
+  }
+
+  SyntheticOptions options;
+  options.width = FRAME_WIDTH;
+  options.height = FRAME_HEIGHT;
+  options.fps = fps;
+  Connection* synthetic = Connection::OpenSynthetic(options);
+  if (!synthetic) return 1;
+  RemoteHost* host = new RemoteHost(synthetic);
+  if (!host->Listen(0)) {
+    delete host;
+    synthetic->Close();
+    return 1;
+  }
+  pthread_t host_thread;
+  CHECK(!pthread_create(&host_thread, NULL, RunHost, host));
+
+  bool is_ok = true;
+  Connection* connection = Connection::OpenRemote("127.0.0.1",
+                                                  host->GetPort());
+  Device* device = NULL;
+  if (!connection) {
+    is_ok = false;
+  } else {
+    DeviceOpenRequest request(0);
+    request.video_format = kImageFormatVideoRgb;
+    request.depth_format = kImageFormatDepthMm;
+    ErrorCode err = connection->OpenDevice(request, &device);
+    if (err == kErrorSuccess) err = device->WaitForConnect(1000);
+    if (err != kErrorSuccess) {
+      fprintf(stderr, "Unable to open remote device: %d\n", err);
+      is_ok = false;
+    }
+  }
+
+  const char* names[2] = {"video", "depth"};
+  const ImageFormat formats[2] = {kImageFormatVideoRgb, kImageFormatDepthMm};
+  const int pixel_sizes[2] = {3, 2};
+  uint64_t frame_counts[2] = {0, 0};
+  uint64_t dropped_counts[2] = {0, 0};
+  uint64_t last_sequences[2] = {0, 0};
+  uint32_t last_timestamps[2] = {0, 0};
+  uint64_t end_time = GetCurrentMillis() + seconds * 1000;
+  uint64_t now;
+  while (is_ok && (now = GetCurrentMillis()) < end_time) {
+    int streams = device->WaitForFrame(
+        kStreamMaskVideo | kStreamMaskDepth, (int) (end_time - now));
+    for (int stream = 0; stream < 2 && is_ok; ++stream) {
+      if (!(streams & (1 << stream))) continue;
+      FrameLease lease;
+      bool acquired = stream == 0 ? device->AcquireVideoFrame(&lease) :
+          device->AcquireDepthFrame(&lease);
+      if (!acquired) continue;
+      if (lease.width != FRAME_WIDTH || lease.height != FRAME_HEIGHT ||
+          lease.format != formats[stream] ||
+          lease.row_size != FRAME_WIDTH * pixel_sizes[stream]) {
+        fprintf(stderr, "Unexpected %s geometry: %dx%d, format %d, "
+                "row size %d\n", names[stream], lease.width, lease.height,
+                lease.format, lease.row_size);
+        is_ok = false;
+      } else if (lease.metadata.sequence != last_sequences[stream] + 1 +
+                 lease.metadata.dropped_frames) {
+        fprintf(stderr, "Unexpected %s sequence %llu after %llu, "
+                "%u dropped\n", names[stream],
+                (unsigned long long) lease.metadata.sequence,
+                (unsigned long long) last_sequences[stream],
+                lease.metadata.dropped_frames);
+        is_ok = false;
+      } else if (frame_counts[stream] &&
+                 lease.metadata.device_timestamp <= last_timestamps[stream]) {
+        fprintf(stderr, "Unexpected %s timestamp %u after %u\n",
+                names[stream], lease.metadata.device_timestamp,
+                last_timestamps[stream]);
+        is_ok = false;
+      } else if (!CheckContents(stream, lease, fps)) {
+        is_ok = false;
+      }
+      ++frame_counts[stream];
+      dropped_counts[stream] += lease.metadata.dropped_frames;
+      last_sequences[stream] = lease.metadata.sequence;
+      last_timestamps[stream] = lease.metadata.device_timestamp;
+      device->ReleaseFrame(&lease);
+    }
+  }
+
+  uint64_t min_frames = (uint64_t) (seconds * fps * MIN_FRAME_SHARE);
+  for (int stream = 0; stream < 2; ++stream) {
+    printf("%s: %llu frames, %llu dropped\n", names[stream],
+           (unsigned long long) frame_counts[stream],
+           (unsigned long long) dropped_counts[stream]);
+    if (is_ok && frame_counts[stream] < min_frames) {
+      fprintf(stderr, "Expected at least %llu %s frames\n",
+              (unsigned long long) min_frames, names[stream]);
+      is_ok = false;
+    }
+  }
+
+  if (connection) {
+    if (device) connection->CloseDevice(device);
+    connection->Close();
+  }
+  // The host closes devices of a client once it disconnects.
+  if (!WaitForHostClose(synthetic)) {
+    fprintf(stderr, "Host did not close the devices of the client\n");
+    is_ok = false;
+  }
+  host->Shutdown();
+  pthread_join(host_thread, NULL);
+  delete host;
+  synthetic->Close();
+
+  printf("%s\n", is_ok ? "ok" : "FAILED");
+  return is_ok ? 0 : 1;
+}
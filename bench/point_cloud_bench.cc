@@ -0,0 +1,153 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures the conversion of depth frames to point clouds, and checks
+// the output against the depth it was computed from.
+//
+// Usage: kkonnect-point-cloud-bench [--iterations=N]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kk_point_cloud.h>
+
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH    640
+#define FRAME_HEIGHT   480
+
+// Returns false if |count| points of |options| don't match |depth|.
+static bool CheckPoints(const uint16_t* depth, const PointCloudOptions& options,
+                        const void* points, const int32_t* pixel_indexes,
+                        int count) {
+  int expected_count = 0;
+  for (int y = 0; y < FRAME_HEIGHT; y += options.decimation) {
+    for (int x = 0; x < FRAME_WIDTH; x += options.decimation) {
+      if (depth[y * FRAME_WIDTH + x] || !options.skip_invalid) {
+        ++expected_count;
+      }
+    }
+  }
+  if (count != expected_count) return false;
+  for (int i = 0; i < count; ++i) {
+    int index = pixel_indexes[i];
+    if (index < 0 || index >= FRAME_WIDTH * FRAME_HEIGHT) return false;
+    int value = depth[index];
+    if (options.format == kPointFormatFloatXyz) {
+      const float* point = reinterpret_cast<const float*>(points) + i * 3;
+      if (fabsf(point[2] - value * 0.001f) > 1e-6f) return false;
+    } else {
+      const int16_t* point = reinterpret_cast<const int16_t*>(points) + i * 3;
+      if (point[2] != (value > 32767 ? 32767 : value)) return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int iterations = 1000;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Nominal Kinect1 intrinsics.
+  DepthIntrinsics intrinsics;
+  intrinsics.width = FRAME_WIDTH;
+  intrinsics.height = FRAME_HEIGHT;
+  intrinsics.fx = intrinsics.fy = 575.8f;
+  intrinsics.cx = FRAME_WIDTH / 2;
+  intrinsics.cy = FRAME_HEIGHT / 2;
+  intrinsics.k1 = 0.02f;
+
+  const int pixel_count = FRAME_WIDTH * FRAME_HEIGHT;
+  uint16_t* depth = new uint16_t[pixel_count];
+  unsigned int seed = 1;
+  // Invalid pixels come in spans, like shadows and out of range areas.
+  for (int i = 0; i < pixel_count;) {
+    int span = 1 + rand_r(&seed) % 64;
+    bool valid = rand_r(&seed) % 5;
+    for (; span && i < pixel_count; --span, ++i) {
+      depth[i] = valid ? 500 + rand_r(&seed) % 4000 : 0;
+    }
+  }
+  depth[pixel_count - 1] = 65535;
+
+  PointCloudConverter converter(intrinsics);
+  float* points = new float[pixel_count * 3];
+  int32_t* pixel_indexes = new int32_t[pixel_count];
+
+  static const PointFormat kFormats[] = {
+      kPointFormatFloatXyz, kPointFormatInt16Xyz};
+  static const int kDecimations[] = {1, 2, 3};
+  for (int f = 0; f < 2; ++f) {
+    for (int d = 0; d < 3; ++d) {
+      for (int skip = 0; skip < 2; ++skip) {
+        PointCloudOptions options;
+        options.format = kFormats[f];
+        options.decimation = kDecimations[d];
+        options.skip_invalid = skip;
+        int count = converter.Convert(depth, 0, options, points,
+                                      pixel_indexes);
+        if (!CheckPoints(depth, options, points, pixel_indexes, count)) {
+          fprintf(stderr, "Bad output: format %d, decimation %d, skip %d\n",
+                  options.format, options.decimation, skip);
+          return 1;
+        }
+      }
+    }
+  }
+
+  for (int f = 0; f < 2; ++f) {
+    for (int skip = 0; skip < 2; ++skip) {
+      PointCloudOptions options;
+      options.format = kFormats[f];
+      options.skip_invalid = skip;
+      uint64_t start_time = GetCurrentMicros();
+      int count = 0;
+      for (int i = 0; i < iterations; ++i) {
+        count = converter.Convert(depth, 0, options, points, NULL);
+      }
+      uint64_t micros = GetCurrentMicros() - start_time;
+      printf("%s%s: %.1f us/frame, %d points\n",
+             f ? "int16" : "float", skip ? " compact" : "",
+             (double) micros / iterations, count);
+    }
+  }
+
+  delete[] pixel_indexes;
+  delete[] points;
+  delete[] depth;
+  return 0;
+}
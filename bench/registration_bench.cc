@@ -0,0 +1,142 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Measures Kinect1 depth registration with synthetic calibration tables,
+// and verifies it against the remapping done by libfreenect.
+//
+// Usage: kkonnect-registration-bench [--iterations=N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_depth_registration.h"
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH    640
+#define FRAME_HEIGHT   480
+#define MAX_DEPTH      10000
+
+// Follows freenect_apply_registration(), after depth is converted to mm.
+static void RegisterReference(const int32_t (*registration_table)[2],
+                              const int32_t* depth_to_rgb_shift,
+                              const uint16_t* src, uint16_t* dst) {
+  memset(dst, 0, FRAME_WIDTH * FRAME_HEIGHT * sizeof(uint16_t));
+  for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i) {
+    uint16_t depth = src[i];
+    if (depth == 0 || depth >= MAX_DEPTH) continue;
+    uint32_t x = (registration_table[i][0] + depth_to_rgb_shift[depth]) / 256;
+    uint32_t y = registration_table[i][1];
+    if (x >= FRAME_WIDTH) continue;
+    uint32_t target = y * FRAME_WIDTH + x;
+    uint16_t current = dst[target];
+    if (current == 0 || current > depth) dst[target] = depth;
+  }
+}
+
+int main(int argc, char** argv) {
+  int iterations = 1000;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--iterations=", 13)) {
+      iterations = atoi(argv[i] + 13);
+    } else {
+      fprintf(stderr, "Usage: %s [--iterations=N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Tables shaped like the libfreenect ones: a mild rectification of
+  // each pixel, and an X shift that falls off with distance.
+  const int pixel_count = FRAME_WIDTH * FRAME_HEIGHT;
+  int32_t (*registration_table)[2] = new int32_t[pixel_count][2];
+  for (int y = 0; y < FRAME_HEIGHT; ++y) {
+    for (int x = 0; x < FRAME_WIDTH; ++x) {
+      int32_t* entry = registration_table[y * FRAME_WIDTH + x];
+      entry[0] = x * 256 * 95 / 100 + (y - FRAME_HEIGHT / 2) * 3;
+      entry[1] = y * 95 / 100 + 10;
+    }
+  }
+  int32_t* depth_to_rgb_shift = new int32_t[MAX_DEPTH];
+  for (int z = 0; z < MAX_DEPTH; ++z) {
+    depth_to_rgb_shift[z] = z ? 256 * 25000 / z - 256 * 20 : 0;
+  }
+  DepthRegistration registration;
+  registration.Init(FRAME_WIDTH, FRAME_HEIGHT, registration_table,
+                    depth_to_rgb_shift, MAX_DEPTH, 0);
+
+  // A sloped scene with noise, holes and out of range areas.
+  uint16_t* depth = new uint16_t[pixel_count];
+  unsigned int seed = 1;
+  for (int y = 0; y < FRAME_HEIGHT; ++y) {
+    for (int x = 0; x < FRAME_WIDTH; ++x) {
+      int value = 800 + x * 4 + y * 2 + rand_r(&seed) % 16;
+      if ((x / 40 + y / 30) % 7 == 0) value = 0;
+      if (x > 600 && y < 40) value = MAX_DEPTH + 10;
+      depth[y * FRAME_WIDTH + x] = value;
+    }
+  }
+
+  uint16_t* expected = new uint16_t[pixel_count];
+  uint16_t* actual = new uint16_t[pixel_count];
+  RegisterReference(registration_table, depth_to_rgb_shift, depth,
+                    expected);
+  registration.Apply(depth, actual);
+  if (memcmp(expected, actual, pixel_count * sizeof(uint16_t))) {
+    fprintf(stderr, "Mismatch against libfreenect remapping\n");
+    return 1;
+  }
+  int mapped_count = 0;
+  for (int i = 0; i < pixel_count; ++i) {
+    if (expected[i]) ++mapped_count;
+  }
+
+  uint64_t start_time = GetCurrentMicros();
+  for (int i = 0; i < iterations; ++i) {
+    RegisterReference(registration_table, depth_to_rgb_shift, depth,
+                      expected);
+  }
+  uint64_t reference_micros = GetCurrentMicros() - start_time;
+  start_time = GetCurrentMicros();
+  for (int i = 0; i < iterations; ++i) {
+    registration.Apply(depth, actual);
+  }
+  uint64_t micros = GetCurrentMicros() - start_time;
+
+  printf("%d of %d pixels mapped\n", mapped_count, pixel_count);
+  printf("libfreenect: %.1f us/frame\n",
+         (double) reference_micros / iterations);
+  printf("kkonnect: %.1f us/frame, %.1fx\n", (double) micros / iterations,
+         (double) reference_micros / (micros ? micros : 1));
+
+  delete[] actual;
+  delete[] expected;
+  delete[] depth;
+  delete[] depth_to_rgb_shift;
+  delete[] registration_table;
+  return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Records synthetic frames with Recorder, plays them back with
+// Connection::OpenReplay(), and verifies the leased frames. Measures
+// the rate at which replayed frames can be leased, and the timing of
+// paced playback.
+//
+// Usage: kkonnect-replay-bench [--frames=N] [--path=FILE]
+
+#include <kk_connection.h>
+#include <kk_recorder.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+using namespace kkonnect;
+
+#define FRAME_WIDTH    640
+#define FRAME_HEIGHT   480
+#define FRAME_FPS      30
+#define FRAME_INTERVAL_US  (1000000 / FRAME_FPS)
+
+static void FillVideo(int frame, uint8_t* dst) {
+  for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT * 3; ++i) {
+    dst[i] = (uint8_t) (frame + i * 3);
+  }
+}
+
+static void FillDepth(int frame, uint16_t* dst) {
+  for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i) {
+    dst[i] = (uint16_t) (frame * 7 + i);
+  }
+}
+
+static bool Record(const char* path, int frame_count) {
+  ImageInfo video_info(FRAME_WIDTH, FRAME_HEIGHT, kImageFormatVideoRgb,
+                       FRAME_FPS);
+  ImageInfo depth_info(FRAME_WIDTH, FRAME_HEIGHT, kImageFormatDepthMm,
+                       FRAME_FPS);
+  Recorder* recorder = Recorder::Create(
+      path, kDeviceVersion1, video_info, depth_info, DepthIntrinsics());
+  if (!recorder) return false;
+
+  uint8_t* video = new uint8_t[FRAME_WIDTH * FRAME_HEIGHT * 3];
+  uint16_t* depth = new uint16_t[FRAME_WIDTH * FRAME_HEIGHT];
+  bool ok = true;
+  for (int i = 0; i < frame_count && ok; ++i) {
+    FrameMetadata metadata;
+    metadata.device_timestamp = i;
+    // Depth arrives a few milliseconds after video.
+    metadata.host_time_us = 1000000 + (uint64_t) i * FRAME_INTERVAL_US;
+    FillVideo(i, video);
+    ok = recorder->AddVideoFrame(video, 0, metadata);
+    metadata.host_time_us += 5000;
+    FillDepth(i, depth);
+    ok = ok && recorder->AddDepthFrame(depth, 0, metadata);
+  }
+  ok = recorder->Finish() && ok;
+  delete recorder;
+  delete[] depth;
+  delete[] video;
+  return ok;
+}
+
+// Plays the recording back. Returns the number of leased frames, or -1
+// if a leased frame does not match the recording.
+static int Replay(const char* path, const ReplayOptions& options,
+                  int frame_count, double max_seconds, bool verify) {
+  Connection* connection = Connection::OpenReplay(path, options);
+  if (!connection) return -1;
+  DeviceOpenRequest request(0);
+  request.video_format = kImageFormatVideoRgb;
+  request.depth_format = kImageFormatDepthMm;
+  Device* device = NULL;
+  if (connection->OpenDevice(request, &device) != kErrorSuccess) {
+    connection->Close();
+    return -1;
+  }
+
+  uint8_t* video = new uint8_t[FRAME_WIDTH * FRAME_HEIGHT * 3];
+  uint16_t* depth = new uint16_t[FRAME_WIDTH * FRAME_HEIGHT];
+  int leased_count = 0;
+  bool valid = true;
+  bool done = false;
+  uint64_t end_time = GetCurrentMicros() + (uint64_t) (max_seconds * 1e6);
+  while (valid && !done && GetCurrentMicros() < end_time) {
+    int streams = device->WaitForFrame(
+        kStreamMaskVideo | kStreamMaskDepth, 100);
+    FrameLease lease;
+    if ((streams & kStreamMaskVideo) && device->AcquireVideoFrame(&lease)) {
+      int frame = lease.metadata.device_timestamp;
+      if (verify) FillVideo(frame, video);
+      valid = frame < frame_count &&
+          lease.row_size == FRAME_WIDTH * 3 &&
+          (!verify || !memcmp(lease.data, video, FRAME_WIDTH * 3 *
+                              FRAME_HEIGHT));
+      device->ReleaseFrame(&lease);
+      ++leased_count;
+    }
+    if ((streams & kStreamMaskDepth) && device->AcquireDepthFrame(&lease)) {
+      int frame = lease.metadata.device_timestamp;
+      if (verify) FillDepth(frame, depth);
+      valid = valid && frame < frame_count &&
+          lease.row_size == FRAME_WIDTH * 2 &&
+          (!verify || !memcmp(lease.data, depth, FRAME_WIDTH * 2 *
+                              FRAME_HEIGHT));
+      device->ReleaseFrame(&lease);
+      ++leased_count;
+      done = !options.loop && frame == frame_count - 1;
+    }
+  }
+
+  connection->Close();
+  delete[] depth;
+  delete[] video;
+  return valid ? leased_count : -1;
+}
+
+static int Run(const char* path, int frame_count) {
+  uint64_t start_time = GetCurrentMicros();
+  if (!Record(path, frame_count)) {
+    fprintf(stderr, "Failed to record %s\n", path);
+    return 1;
+  }
+  printf("Recorded %d frame pairs in %.1f ms\n", frame_count,
+         (GetCurrentMicros() - start_time) / 1000.0);
+
+  // Paced at four times the recorded rate, verifying every frame.
+  ReplayOptions options;
+  options.speed = 4;
+  double expected_seconds =
+      (double) (frame_count - 1) * FRAME_INTERVAL_US / 1e6 / options.speed;
+  start_time = GetCurrentMicros();
+  int leased_count = Replay(path, options, frame_count,
+                            expected_seconds + 5, true);
+  double seconds = (GetCurrentMicros() - start_time) / 1e6;
+  if (leased_count < 0) {
+    fprintf(stderr, "Mismatch against recorded frames\n");
+    return 1;
+  }
+  printf("Paced: %d frames leased in %.3f s, expected %.3f s\n",
+         leased_count, seconds, expected_seconds);
+
+  // Unpaced and looping, leasing as fast as the consumer can.
+  options.speed = 0;
+  options.loop = true;
+  start_time = GetCurrentMicros();
+  leased_count = Replay(path, options, frame_count, 1, false);
+  seconds = (GetCurrentMicros() - start_time) / 1e6;
+  if (leased_count < 0) {
+    fprintf(stderr, "Invalid frames in unpaced replay\n");
+    return 1;
+  }
+  printf("Unpaced: %.0f frames/s leased\n", leased_count / seconds);
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  int frame_count = 90;
+  const char* path = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--frames=", 9)) {
+      frame_count = atoi(argv[i] + 9);
+    } else if (!strncmp(argv[i], "--path=", 7)) {
+      path = argv[i] + 7;
+    } else {
+      fprintf(stderr, "Usage: %s [--frames=N] [--path=FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+  char temp_path[] = "/tmp/kkonnect-replay-XXXXXX";
+  if (!path) {
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+      REPORT_ERRNO("mkstemp");
+      return 1;
+    }
+    close(fd);
+    path = temp_path;
+  }
+
+  int result = Run(path, frame_count);
+  if (path == temp_path) unlink(path);
+  return result;
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+// Serves locally attached Kinect devices to remote KKonnect clients.
+//
+// Usage: kkonnect-host [--port=PORT]
+
+#include <kk_connection.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/kk_remote_host.h"
+#include "src/kk_remote_protocol.h"
+
+using kkonnect::Connection;
+using kkonnect::LocalOptions;
+using kkonnect::RemoteHost;
+
+int main(int argc, char** argv) {
+  int port = REMOTE_DEFAULT_PORT;
+  LocalOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--port=", 7)) {
+      port = atoi(argv[i] + 7);
+    } else if (!strncmp(argv[i], "--event-threads=", 16)) {
+      options.event_thread_count = atoi(argv[i] + 16);
+    } else {
+      fprintf(stderr, "Usage: %s [--port=PORT] [--event-threads=N]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  Connection* connection = Connection::OpenLocal(options);
+  if (!connection) return 1;
+  RemoteHost host(connection);
+  if (!host.Listen(port)) {
+    fprintf(stderr, "Unable to listen on port %d\n", port);
+    connection->Close();
+    return 1;
+  }
+
+  fprintf(stderr, "kkonnect-host is listening on port %d\n", port);
+  host.Run();
+  connection->Close();
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_COLOR_CONVERT_H_
+#define KKONNECT_KK_COLOR_CONVERT_H_
+
+#include <stdint.h>
+
+#include "kk_errors.h"
+
+namespace kkonnect {
+
+// Convert kImageFormatVideoYuv422 images, laid out as U0 Y0 V0 Y1 for
+// every pair of pixels, into 24-bit RGB or 32-bit BGRA with opaque alpha.
+// The conversion uses BT.601 studio-swing coefficients like the RGB
+// modes of libfreenect, but may differ from their output by rounding.
+// |width| must be even. When non-zero, row sizes define the distance
+// between rows in bytes.
+ErrorCode ConvertYuv422ToRgb(const uint8_t* src, int src_row_size,
+                             int width, int height, uint8_t* dst,
+                             int dst_row_size);
+ErrorCode ConvertYuv422ToBgra(const uint8_t* src, int src_row_size,
+                              int width, int height, uint8_t* dst,
+                              int dst_row_size);
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_COLOR_CONVERT_H_
@@ -31,15 +31,200 @@
 
 #include "kk_device.h"
 #include "kk_errors.h"
+#include "kk_frame_listener.h"
+#include "kk_frame_set.h"
 
 namespace kkonnect {
 
+// Limits of LocalOptions.
+const int kMaxLocalEventThreads = 16;
+const int kMaxLocalDevices = 32;
+
+// Controls how Connection::OpenLocal() processes USB events of Kinect1
+// devices.
+struct LocalOptions {
+  // Number of libfreenect contexts, each pumped by its own event thread.
+  // Devices are spread across them, so that callbacks of one device do
+  // not delay devices on other threads.
+  int event_thread_count;
+  // Event thread of each device index. Devices with a negative entry are
+  // assigned round-robin by device index.
+  int device_threads[kMaxLocalDevices];
+  // CPU that each event thread is pinned to, or -1 for no affinity.
+  int thread_cpus[kMaxLocalEventThreads];
+
+  LocalOptions() : event_thread_count(1) {
+    for (int i = 0; i < kMaxLocalDevices; ++i) device_threads[i] = -1;
+    for (int i = 0; i < kMaxLocalEventThreads; ++i) thread_cpus[i] = -1;
+  }
+};
+
+// Controls playback of a recording by Connection::OpenReplay().
+struct ReplayOptions {
+  // Playback rate relative to the recorded frame timing. Zero or less
+  // publishes frames as fast as possible.
+  double speed;
+  // Whether to restart from the first frame after the last one.
+  bool loop;
+
+  ReplayOptions() : speed(1.0), loop(false) {}
+};
+
+// Configures devices faked by Connection::OpenSynthetic(). Frames are
+// generated from cheap patterns, so that many devices can run at high
+// rates on one host.
+struct SyntheticOptions {
+  int device_count;
+  DeviceVersion version;
+  // Resolution and rate of both streams.
+  int width;
+  int height;
+  int fps;
+  // Maximum random deviation of a frame from its nominal time.
+  double jitter_ms;
+  // Probability that a frame is dropped by the fake device.
+  double drop_rate;
+  // Number of open attempts that fail on every connect, to exercise
+  // the retry path. Connecting fails after the retry limit.
+  int failed_open_attempts;
+  // Frames produced after every connect, after which the device stalls
+  // until the health check reconnects it. Zero never stalls.
+  int stall_after_frames;
+
+  SyntheticOptions()
+      : device_count(1), version(kDeviceVersion1), width(640), height(480),
+        fps(30), jitter_ms(0), drop_rate(0), failed_open_attempts(0),
+        stall_after_frames(0) {}
+};
+
+// Sums statistics of all devices open on a connection.
+struct ConnectionStats {
+  int open_device_count;
+  // Devices whose status is kErrorSuccess.
+  int connected_device_count;
+  // Devices whose status is an error.
+  int failed_device_count;
+  // Sums of the device counters. Frame rates are summed as well.
+  StreamStats video;
+  StreamStats depth;
+  uint64_t lock_wait_us;
+  int reconnect_count;
+
+  ConnectionStats()
+      : open_device_count(0), connected_device_count(0),
+        failed_device_count(0), lock_wait_us(0), reconnect_count(0) {}
+};
+
+// Configures frame buffers of a connection.
+struct MemoryOptions {
+  // Limit on frame buffer memory, in bytes, including cached buffers.
+  // Zero means no limit. Devices that would exceed it fail to connect
+  // with kErrorOutOfMemory. Without a limit, only cached buffers of the
+  // latest requested sizes are kept, so changes of geometry do not
+  // accumulate them.
+  uint64_t budget_bytes;
+  // Whether buffers of 2 MB and more are backed by huge pages. Without
+  // reserved huge pages, transparent huge pages are requested instead.
+  bool huge_pages;
+
+  MemoryOptions() : budget_bytes(0), huge_pages(false) {}
+};
+
+// Describes frame buffer memory of a connection.
+struct MemoryStats {
+  uint64_t budget_bytes;
+  // Buffers held by open devices.
+  uint64_t used_bytes;
+  // Buffers kept for reuse by reconnecting devices and by devices
+  // of the same geometry.
+  uint64_t cached_bytes;
+  // Largest sum of used and cached bytes so far.
+  uint64_t peak_bytes;
+  // Part of used and cached bytes backed by reserved huge pages.
+  uint64_t huge_page_bytes;
+  // Allocations served from the cache.
+  uint64_t reused_count;
+  // Allocations refused because of the budget or a lack of memory.
+  uint64_t failed_count;
+
+  MemoryStats()
+      : budget_bytes(0), used_bytes(0), cached_bytes(0), peak_bytes(0),
+        huge_page_bytes(0), reused_count(0), failed_count(0) {}
+};
+
+// Maximum number of device events queued on a connection. When more
+// events arrive before they are read, the oldest ones are dropped.
+const int kMaxDeviceEvents = 256;
+
+enum DeviceEventType {
+  // The device finished connecting and streams frames.
+  kDeviceEventConnected = 0,
+  // The device stopped delivering frames and is about to be reconnected.
+  kDeviceEventStalled = 1,
+  // The device is connecting again after it was connected or failed.
+  kDeviceEventReconnecting = 2,
+  // The device entered an error state, see DeviceEvent::status.
+  kDeviceEventFailed = 3,
+};
+
+// Reports a status change of an open device, see
+// Connection::WaitForDeviceEvent().
+struct DeviceEvent {
+  Device* device;
+  int device_index;
+  DeviceEventType type;
+  // Device::GetStatus() after the change.
+  ErrorCode status;
+  // Monotonic host time of the change, in microseconds.
+  uint64_t host_time_us;
+  // Number of events dropped before this one because the queue was full.
+  uint32_t dropped_events;
+
+  DeviceEvent()
+      : device(NULL), device_index(-1), type(kDeviceEventConnected),
+        status(kErrorInProgress), host_time_us(0), dropped_events(0) {}
+};
+
+// Receives the outcome of Connection::OpenDeviceAsync().
+class DeviceOpenCallback {
+ public:
+  virtual ~DeviceOpenCallback() {}
+
+  // Called once |device| has connected, with kErrorSuccess, or failed to
+  // connect, with the error. Runs on a thread owned by the connection.
+  virtual void OnDeviceOpened(Device* device, ErrorCode status) = 0;
+};
+
+class BufferAllocator;
+class DeviceEventQueue;
+class FrameDispatcher;
+
 // Provides access to all devices addressed by this connection.
 class Connection {
  public:
   // Opens connection to all locally-attached devices.
   static Connection* OpenLocal();
 
+  // Same as above. The local connection is shared, and |options| only
+  // take effect when it is first opened. Returns NULL if |options| are
+  // invalid.
+  static Connection* OpenLocal(const LocalOptions& options);
+
+  // Opens connection to devices served by a kkonnect-host running on
+  // |host|. Returns NULL if the host cannot be reached.
+  static Connection* OpenRemote(const char* host, int port);
+
+  // Opens a recording written by Recorder, which is served as a single
+  // device. Frames are leased straight from a memory mapping of the file.
+  // Returns NULL if the file cannot be read or is not a valid recording.
+  static Connection* OpenReplay(const char* path,
+                                const ReplayOptions& options);
+
+  // Opens connection to fake devices, which connect and deliver frames
+  // through the same code paths as local devices. Returns NULL if the
+  // options are invalid.
+  static Connection* OpenSynthetic(const SyntheticOptions& options);
+
   // Closes this connection. All opened Device objects become invalid.
   // This method will invoke Connection's destructor.
   void Close();
@@ -55,6 +240,65 @@ class Connection {
   ErrorCode OpenDevice(const DeviceOpenRequest& request, Device** device);
   void CloseDevice(Device* device);
 
+  // Same as OpenDevice(), and also calls |callback| once the device
+  // leaves kErrorInProgress. The callback is not called if the device
+  // is closed first. Closing the device waits for a running callback,
+  // unless called from it. The caller keeps ownership of |callback|,
+  // which must remain valid until it is called or the device is closed.
+  ErrorCode OpenDeviceAsync(const DeviceOpenRequest& request,
+                            DeviceOpenCallback* callback, Device** device);
+
+  // Waits for the next status change of any open device for up to
+  // |timeout_ms|. Negative |timeout_ms| waits forever, and zero does not
+  // wait. Returns false on timeout. Events of a device are dropped when
+  // it is closed. Events are consumed by the first reader, so there
+  // should be a single reader per connection.
+  bool WaitForDeviceEvent(DeviceEvent* event, int timeout_ms);
+
+  // Returns an eventfd that is readable while device events are queued,
+  // which allows multiplexing connections and devices with poll() or
+  // epoll. The descriptor is reset by WaitForDeviceEvent() once the queue
+  // is empty. It is owned by the connection and closed with it. Returns -1
+  // on failure.
+  int GetDeviceEventFd();
+
+  // Returns the sum of Device::GetStats() over all open devices.
+  ConnectionStats GetStats() const;
+
+  // Configures frame buffers of devices. A lower budget frees cached
+  // buffers, but does not affect buffers of open devices.
+  void SetMemoryOptions(const MemoryOptions& options);
+  MemoryStats GetMemoryStats() const;
+
+  // Creates a capture of synchronized frames from open devices, see
+  // kk_frame_set.h. Returns kErrorUnknownDevice if a device is not open.
+  // The capture must be deleted before its devices are closed.
+  ErrorCode OpenFrameSetCapture(const FrameSetOptions& options,
+                                FrameSetCapture** capture);
+
+  // Pushes frames of |options.stream| of an open device to |listener|,
+  // see kk_frame_listener.h. Delivery runs on dispatch threads that are
+  // started with the first listener. Returns kErrorUnknownDevice if
+  // |device| is not open, and kErrorInvalidArgument if |options| are
+  // invalid or |listener| is already added.
+  //
+  // Listeners take over the frames of their stream: other reads of that
+  // stream would take frames away from them. They also consume the event
+  // descriptor of the device. Closing the device removes its listeners.
+  // The caller keeps ownership of |listener|, which must remain valid
+  // until it is removed.
+  ErrorCode AddFrameListener(Device* device,
+                             const FrameListenerOptions& options,
+                             FrameListener* listener);
+
+  // Stops delivery to |listener|. Waits for its running callback to
+  // return, unless called from that callback. Returns kErrorInvalidArgument
+  // if |listener| is not added.
+  ErrorCode RemoveFrameListener(FrameListener* listener);
+
+  ErrorCode GetFrameListenerStats(FrameListener* listener,
+                                  FrameListenerStats* stats) const;
+
  protected:
   Connection();
   virtual ~Connection();
@@ -67,6 +311,12 @@ class Connection {
       const DeviceOpenRequest& request, Device** device) = 0;
   virtual void CloseDeviceInternalLocked(Device* device) = 0;
 
+  // Provides frame buffers to the devices of this connection.
+  BufferAllocator* buffer_allocator() const { return buffer_allocator_; }
+
+  // Receives status changes of the devices of this connection.
+  DeviceEventQueue* device_event_queue() const { return device_events_; }
+
   // Iterates over the list of all open devices.
   Device* GetFirstDeviceLocked() const { return devices_; }
   Device* GetNextDeviceLocked(Device* device) const { return device->next_; }
@@ -74,9 +324,17 @@ class Connection {
   mutable pthread_mutex_t mutex_;
 
  private:
+  // Removes the frame listeners and events of |device|, waiting for their
+  // running callbacks. Must be called without |mutex_|, so that callbacks
+  // can still call into the connection.
+  void StopDeviceCallbacks(Device* device);
   void CloseDeviceLocked(Device* device);
 
   Device* devices_;
+  BufferAllocator* buffer_allocator_;
+  DeviceEventQueue* device_events_;
+  // Created by the first AddFrameListener() call.
+  FrameDispatcher* frame_dispatcher_;
 
   Connection(const Connection& src);
   Connection& operator=(const Connection& src);
@@ -0,0 +1,94 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_DEPTH_CODEC_H_
+#define KKONNECT_KK_DEPTH_CODEC_H_
+
+#include <stdint.h>
+
+#include "kk_errors.h"
+
+namespace kkonnect {
+
+// Losslessly compresses 16-bit depth frames, such as kImageFormatDepthMm.
+//
+// Each pixel is predicted from its left, upper and upper-left neighbours
+// (left + up - upleft), which is exact on planar surfaces. Residuals are
+// coded with adaptive Golomb-Rice codes, and runs of zero residuals, which
+// cover the invalid (zero) regions of Kinect depth maps, are coded as
+// single run-length tokens. Frames that do not compress are stored as is.
+//
+// A codec object keeps scratch buffers between calls, and must not be
+// used by several threads at the same time.
+class DepthCodec {
+ public:
+  DepthCodec();
+  ~DepthCodec();
+
+  // Returns the largest possible size of an encoded frame.
+  static int GetMaxEncodedSize(int width, int height);
+
+  // Reads dimensions of the frame encoded in |src|.
+  static ErrorCode GetEncodedFrameSize(const uint8_t* src, int src_size,
+                                       int* width, int* height);
+
+  // Encodes the frame in |src| into |dst| and stores the number of bytes
+  // written in |encoded_size|. |dst_capacity| must be at least
+  // GetMaxEncodedSize(). When non-zero, |src_row_size| defines the
+  // distance between rows in bytes.
+  ErrorCode Encode(const uint16_t* src, int width, int height,
+                   int src_row_size, uint8_t* dst, int dst_capacity,
+                   int* encoded_size);
+
+  // Decodes a frame of the given dimensions from |src| into |dst|.
+  // Returns kErrorInvalidArgument if the data is malformed or has other
+  // dimensions. When non-zero, |dst_row_size| defines the distance
+  // between rows in bytes.
+  ErrorCode Decode(const uint8_t* src, int src_size, uint16_t* dst,
+                   int width, int height, int dst_row_size);
+
+  // Returns the name of the SIMD code path selected for this CPU.
+  const char* GetKernelName() const;
+
+ private:
+  struct Kernels;
+
+  static const Kernels* SelectKernels();
+
+  void AllocateRows(int width);
+
+  const Kernels* kernels_;
+  int row_width_;
+  uint16_t* zero_row_;
+  uint16_t* residual_row_;
+
+  DepthCodec(const DepthCodec& src);
+  DepthCodec& operator=(const DepthCodec& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_DEPTH_CODEC_H_
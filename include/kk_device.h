@@ -36,6 +36,7 @@
 namespace kkonnect {
 
 class Connection;
+class FrameFilter;
 
 // Contains information about a given device.
 enum DeviceVersion {
@@ -54,8 +55,15 @@ enum ImageFormat {
   kImageFormatNone = 0,
   // 24-bit RGB values.
   kImageFormatVideoRgb = 100,
+  // 16-bit YUV 4:2:2 values, as U0 Y0 V0 Y1 for every pair of pixels.
+  // This is the native format of Kinect1 and avoids conversion on the
+  // driver thread. See kk_color_convert.h for conversion to RGB.
+  kImageFormatVideoYuv422 = 101,
   // 16-bit depth values, in mm.
   kImageFormatDepthMm = 200,
+  // 16-bit depth values, in mm, mapped onto the pixel grid of the video
+  // stream. Pixels without depth are 0. Only supported on Kinect1.
+  kImageFormatDepthRegistered = 201,
 };
 
 struct ImageInfo {
@@ -76,14 +84,249 @@ struct ImageInfo {
 	refresh_fps(refresh_fps) {}
 };
 
+// Describes the depth camera, in pixels of the depth stream.
+struct DepthIntrinsics {
+  int width;
+  int height;
+  // Focal lengths.
+  float fx;
+  float fy;
+  // Principal point.
+  float cx;
+  float cy;
+  // Brown-Conrady distortion coefficients. Zero for undistorted streams.
+  float k1;
+  float k2;
+  float k3;
+  float p1;
+  float p2;
+
+  DepthIntrinsics()
+      : width(0), height(0), fx(0), fy(0), cx(0), cy(0),
+	k1(0), k2(0), k3(0), p1(0), p2(0) {}
+};
+
+// Describes how the device got connected.
+struct ConnectStats {
+  // Number of times the device has connected successfully.
+  int connect_count;
+  // Number of open attempts made by the most recent connect.
+  int last_attempt_count;
+  // Duration of the most recent completed connect, in milliseconds.
+  int last_connect_millis;
+
+  ConnectStats()
+      : connect_count(0), last_attempt_count(0), last_connect_millis(0) {}
+};
+
+// Number of buckets in StreamStats::latency_histogram.
+const int kLatencyHistogramBuckets = 20;
+
+// Maximum number of filters per stream. See kk_frame_filter.h.
+const int kMaxFrameFilters = 8;
+
+// Describes the time spent in a single frame filter.
+struct FilterStats {
+  // Value of FrameFilter::GetName().
+  const char* name;
+  // Number of frames the filter processed.
+  uint64_t frame_count;
+  // Total and longest time spent in the filter, in microseconds.
+  uint64_t total_us;
+  uint64_t max_us;
+
+  FilterStats() : name(NULL), frame_count(0), total_us(0), max_us(0) {}
+};
+
+// Describes frames of a single stream since the device was opened.
+struct StreamStats {
+  // Frames received from the device.
+  uint64_t received_frames;
+  // Frames handed to consumers by GetAndClear*Data() or Acquire*Frame().
+  uint64_t delivered_frames;
+  // Frames that were overwritten without being read.
+  uint64_t dropped_frames;
+  // Frame data received from a kkonnect-host, as sent over the network.
+  // Compressed depth takes fewer bytes than the frames. Zero for local
+  // devices.
+  uint64_t network_bytes;
+  // Rate of received frames, measured over about a second. Zero when the
+  // stream has not received frames for that long.
+  float fps;
+  // Time from receiving a frame to handing it to a consumer. Bucket i
+  // counts latencies in [2^i, 2^(i+1)) microseconds. The first bucket
+  // also counts shorter latencies, and the last one all longer latencies.
+  uint64_t latency_histogram[kLatencyHistogramBuckets];
+  // Filters attached to the stream, in the order they run.
+  int filter_count;
+  FilterStats filters[kMaxFrameFilters];
+
+  StreamStats()
+      : received_frames(0), delivered_frames(0), dropped_frames(0),
+        network_bytes(0), fps(0), filter_count(0) {
+    for (int i = 0; i < kLatencyHistogramBuckets; ++i) {
+      latency_histogram[i] = 0;
+    }
+  }
+};
+
+// Describes the runtime health of a device. The counters are cheap to
+// maintain, and are always collected.
+struct DeviceStats {
+  StreamStats video;
+  StreamStats depth;
+  // Time that threads spent waiting for the device lock, in microseconds.
+  uint64_t lock_wait_us;
+  // Number of times the device was found unhealthy and reconnected.
+  int reconnect_count;
+  // The most recent error status of the device, or kErrorSuccess.
+  ErrorCode last_error;
+
+  DeviceStats()
+      : lock_wait_us(0), reconnect_count(0), last_error(kErrorSuccess) {}
+};
+
+// Identifies streams in the masks used by Device::WaitForFrame().
+enum StreamMask {
+  kStreamMaskVideo = 1,
+  kStreamMaskDepth = 2,
+};
+
+// Maximum number of frames per stream that can be leased at the same time
+// with Device::AcquireVideoFrame() or Device::AcquireDepthFrame().
+const int kMaxFrameLeases = 4;
+
+// Largest number of change detection tiles per row and per column of
+// a frame, see ChangeDetectionOptions.
+const int kMaxChangeTiles = 64;
+
+// Describes a single received frame.
+struct FrameMetadata {
+  // Timestamp reported by the device, in device clock units.
+  uint32_t device_timestamp;
+  // Monotonic host time at which the frame arrived, in microseconds.
+  uint64_t host_time_us;
+  // Increases by one for every frame received on the stream.
+  uint64_t sequence;
+  // Number of frames that were overwritten without being read since
+  // the previous read on the same stream.
+  uint32_t dropped_frames;
+
+  // Results of change detection, when it is enabled for the stream.
+  // The frame is split into tiles of |change_tile_size| pixels, with
+  // partial tiles at the right and bottom edges. Zero |change_tile_size|
+  // means that detection is off and the other fields are unset.
+  int change_tile_size;
+  int change_tile_columns;
+  int change_tile_rows;
+  // Bit x of |dirty_tiles[y]| is set if tile (x, y) changed significantly
+  // since the last frame in which it was marked dirty. All tiles are dirty
+  // in the first frame after connecting.
+  uint64_t dirty_tiles[kMaxChangeTiles];
+  // Set if no tile is dirty.
+  bool is_unchanged;
+
+  FrameMetadata()
+      : device_timestamp(0), host_time_us(0), sequence(0),
+	dropped_frames(0), change_tile_size(0), change_tile_columns(0),
+	change_tile_rows(0), is_unchanged(false) {
+    for (int i = 0; i < kMaxChangeTiles; ++i) dirty_tiles[i] = 0;
+  }
+
+  bool IsTileDirty(int x, int y) const {
+    return (dirty_tiles[y] >> x) & 1;
+  }
+};
+
+// Describes a frame leased with Device::AcquireVideoFrame() or
+// Device::AcquireDepthFrame(). The memory referenced by |data| remains
+// valid and is not modified by the driver until the lease is returned
+// with Device::ReleaseFrame().
+struct FrameLease {
+  const void* data;
+  // Length of a row in |data|, in bytes.
+  int row_size;
+  int width;
+  int height;
+  ImageFormat format;
+  FrameMetadata metadata;
+
+  // Used by the Device implementation to locate the leased buffer.
+  int internal_stream;
+  int internal_slot;
+
+  FrameLease()
+      : data(NULL), row_size(0), width(0), height(0),
+	format(kImageFormatNone), internal_stream(-1), internal_slot(-1) {}
+};
+
+// Largest StreamRegion::decimation.
+const int kMaxStreamDecimation = 8;
+
+// Selects the part of a stream that the device publishes. Frames are
+// cropped and decimated as they arrive, so frame buffers, copies and
+// network transfers shrink accordingly. ImageInfo, DepthIntrinsics and
+// frames describe the published part only.
+struct StreamRegion {
+  // Crop rectangle, in pixels of the full stream. Zero |width| or |height|
+  // extends the rectangle to the right or bottom edge of the stream.
+  int x;
+  int y;
+  int width;
+  int height;
+  // Publishes one pixel for every |decimation| x |decimation| block of
+  // the rectangle, between 1 and kMaxStreamDecimation. Depth streams keep
+  // the nearest valid depth of every block. Video streams keep the top-left
+  // pixel of every block, and share chroma between pixel pairs in YUV 4:2:2.
+  int decimation;
+
+  StreamRegion() : x(0), y(0), width(0), height(0), decimation(1) {}
+};
+
+// Configures detection of changed parts of a stream. Every published
+// frame is compared tile by tile with a reference that holds the last
+// dirty version of each tile, so that slow drifts are detected as well.
+// Results are reported in FrameMetadata.
+struct ChangeDetectionOptions {
+  // Side of the square tiles, in pixels, between 8 and 256. Tiles grow
+  // as needed to fit kMaxChangeTiles per row and column. Zero disables
+  // detection.
+  int tile_size;
+  // Video tiles are dirty when the mean absolute difference of their
+  // bytes from the reference exceeds this value.
+  int video_threshold;
+  // Depth pixels change when their depth moves by more than this many mm,
+  // or when they gain or lose a valid measurement. Depth tiles are dirty
+  // when more than |depth_min_pixels| of their pixels change.
+  int depth_threshold_mm;
+  int depth_min_pixels;
+
+  ChangeDetectionOptions()
+      : tile_size(0), video_threshold(4), depth_threshold_mm(30),
+        depth_min_pixels(8) {}
+};
+
 struct DeviceOpenRequest {
   int device_index;
   ImageFormat depth_format;
   ImageFormat video_format;
+  // The rectangle is clipped to the stream, and its size is rounded down
+  // to whole blocks, but covers at least one block. Video rectangles in
+  // kImageFormatVideoYuv422 start at an even column and cover an even
+  // number of blocks.
+  StreamRegion video_region;
+  StreamRegion depth_region;
+  // Detection runs on the published part of the streams, after filters.
+  ChangeDetectionOptions video_changes;
+  ChangeDetectionOptions depth_changes;
+  // Number of extra threads that split copies of multi-megapixel frames
+  // in GetAndClearVideoData() and GetAndClearDepthData(). Zero copies on
+  // the calling thread only.
+  int copy_thread_count;
 
   DeviceOpenRequest(int device_index)
       : device_index(device_index), depth_format(kImageFormatNone),
-	video_format(kImageFormatNone) {}
+	video_format(kImageFormatNone), copy_thread_count(0) {}
 };
 
 // Provides access to a given device's data.
@@ -99,12 +342,67 @@ class Device {
   // Returns another error code if the device is in an error state.
   virtual ErrorCode GetStatus() const = 0;
 
+  // Blocks until the device leaves kErrorInProgress, or until
+  // |timeout_ms| elapses. Negative |timeout_ms| waits forever. Returns
+  // the status, which is kErrorInProgress on timeout.
+  virtual ErrorCode WaitForConnect(int timeout_ms) = 0;
+
+  // Returns timing of the connection attempts made so far.
+  virtual ConnectStats GetConnectStats() const = 0;
+
+  // Returns frame counters and health of the device since it was opened.
+  virtual DeviceStats GetStats() const = 0;
+
+  // Returns intrinsics of the depth camera. Returns false if the depth
+  // stream is not enabled yet. See kk_point_cloud.h for unprojection.
+  virtual bool GetDepthIntrinsics(DepthIntrinsics* intrinsics) const = 0;
+
   // Copies video data into |dst|. When non-zero, |row_size| defines
   // the length of row in the target array, in bytes. Returns true
   // if there was new data to copy. If there is no new data, returns false
   // and does not modify any memory referenced by |dst|.
-  virtual bool GetAndClearVideoData(uint8_t* dst, int row_size) = 0;
-  virtual bool GetAndClearDepthData(uint16_t* dst, int row_size) = 0;
+  // When |metadata| is not NULL, it receives the metadata of the copied
+  // frame.
+  virtual bool GetAndClearVideoData(
+      uint8_t* dst, int row_size, FrameMetadata* metadata) = 0;
+  virtual bool GetAndClearDepthData(
+      uint16_t* dst, int row_size, FrameMetadata* metadata) = 0;
+
+  bool GetAndClearVideoData(uint8_t* dst, int row_size) {
+    return GetAndClearVideoData(dst, row_size, NULL);
+  }
+  bool GetAndClearDepthData(uint16_t* dst, int row_size) {
+    return GetAndClearDepthData(dst, row_size, NULL);
+  }
+
+  // Leases the latest frame without copying it. Returns true if there was
+  // new data since the last GetAndClear*Data() or Acquire*Frame() call
+  // on the same stream. Returns false if there is no new data, or if
+  // too many frames are already leased on this stream.
+  // Every acquired lease must be returned with ReleaseFrame() before
+  // the device is closed.
+  virtual bool AcquireVideoFrame(FrameLease* lease) = 0;
+  virtual bool AcquireDepthFrame(FrameLease* lease) = 0;
+  virtual void ReleaseFrame(FrameLease* lease) = 0;
+
+  // Attaches a filter that runs on every frame of the stream before it
+  // is published, after the filters attached before it. The device takes
+  // ownership of the filter and deletes it when closed. Filters cannot
+  // be detached. Returns kErrorInvalidArgument if the stream already has
+  // kMaxFrameFilters filters, in which case the caller keeps ownership.
+  virtual ErrorCode AddVideoFilter(FrameFilter* filter) = 0;
+  virtual ErrorCode AddDepthFilter(FrameFilter* filter) = 0;
+
+  // Blocks until one of the streams in |streams_mask| has new data,
+  // or until |timeout_ms| elapses. Negative |timeout_ms| waits forever.
+  // Returns the mask of streams with new data, or 0 on timeout.
+  virtual int WaitForFrame(int streams_mask, int timeout_ms) = 0;
+
+  // Returns an eventfd that becomes readable whenever a new frame arrives
+  // on any stream, which allows multiplexing devices with poll() or epoll.
+  // Reading 8 bytes from the descriptor resets it. The descriptor is owned
+  // by the device and is closed with it. Returns -1 on failure.
+  virtual int GetEventFd() = 0;
 
  protected:
   Device() : next_(NULL), index_(-1) {}
@@ -37,6 +37,7 @@ enum ErrorCode {
   kErrorAlreadyOpened = 3,
   kErrorInProgress = 4,
   kErrorUnableToConnect = 5,
+  kErrorOutOfMemory = 6,
 };
 
 }  // namespace kkonnect
@@ -0,0 +1,109 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FRAME_FILTER_H_
+#define KKONNECT_KK_FRAME_FILTER_H_
+
+#include <stdint.h>
+
+#include "kk_device.h"
+
+namespace kkonnect {
+
+// Processes frames of one stream in place before they are published.
+// Filters are attached with Device::AddVideoFilter() or
+// Device::AddDepthFilter() and run on the driver thread, in the order
+// they were added. The driver cannot receive the next frame until all
+// filters return, so they should take well under a frame interval.
+//
+// Filters only see frames that the device fills into its own buffers.
+// Frames of replayed recordings are read-only and bypass filters, unless
+// they are cropped or decimated with a StreamRegion.
+class FrameFilter {
+ public:
+  virtual ~FrameFilter() {}
+
+  // Returns a short name used in FilterStats. The string must remain
+  // valid while the filter exists.
+  virtual const char* GetName() const = 0;
+
+  // Filters the frame in |data|. The geometry only changes when
+  // the device reconnects with different parameters.
+  virtual void Apply(void* data, int row_size, int width, int height,
+                     ImageFormat format) = 0;
+};
+
+// Identifies the built-in filters. All of them operate on 16-bit depth
+// in mm, and leave frames in other formats unchanged. Zero depth marks
+// pixels without a measurement.
+enum FrameFilterType {
+  // Sets depth outside [min_depth, max_depth] to zero.
+  kFrameFilterRange = 0,
+  // Fills horizontal runs of up to |max_gap| zero pixels that have valid
+  // depth on both sides, using the farther of the two neighbors so that
+  // foreground edges do not grow.
+  kFrameFilterHoleFill = 1,
+  // Zeroes pixels that have fewer than |min_neighbors| of their 8
+  // neighbors within |max_difference| mm of their own depth.
+  kFrameFilterSpeckle = 2,
+  // Smooths every pixel over time with an exponential moving average
+  // of weight |alpha|. Changes larger than |max_difference| mm restart
+  // the average, so that moving edges do not smear.
+  kFrameFilterTemporalEma = 3,
+  // Replaces every pixel by the median of its last 3 values. Holes in
+  // the current frame are kept.
+  kFrameFilterTemporalMedian = 4,
+};
+
+// Describes a built-in filter. Being plain data, it can also be used
+// to request filters from a remote host.
+struct FrameFilterParams {
+  FrameFilterType type;
+  // For kFrameFilterRange, in mm.
+  int min_depth;
+  int max_depth;
+  // For kFrameFilterHoleFill, in pixels.
+  int max_gap;
+  // For kFrameFilterSpeckle and kFrameFilterTemporalEma, in mm.
+  int max_difference;
+  // For kFrameFilterSpeckle, between 1 and 8.
+  int min_neighbors;
+  // For kFrameFilterTemporalEma, in (0, 1].
+  float alpha;
+
+  explicit FrameFilterParams(FrameFilterType type)
+      : type(type), min_depth(0), max_depth(65535), max_gap(4),
+	max_difference(50), min_neighbors(3), alpha(0.4f) {}
+};
+
+// Creates a built-in filter, which uses SIMD when the CPU supports it.
+// Returns NULL if the parameters are invalid. The caller owns the filter
+// until it is attached to a device.
+FrameFilter* CreateFrameFilter(const FrameFilterParams& params);
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FRAME_FILTER_H_
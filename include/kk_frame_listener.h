@@ -0,0 +1,92 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FRAME_LISTENER_H_
+#define KKONNECT_KK_FRAME_LISTENER_H_
+
+#include <stdint.h>
+
+#include "kk_device.h"
+
+namespace kkonnect {
+
+// Receives frames pushed by Connection::AddFrameListener(). Callbacks run
+// on dispatch threads owned by the connection, never on the driver
+// thread, so a slow listener only delays itself. Callbacks of one
+// listener never overlap and arrive in frame order. Callbacks of
+// different listeners may run at the same time.
+class FrameListener {
+ public:
+  virtual ~FrameListener() {}
+
+  // Called with a frame of the device and stream the listener was added
+  // for. The frame is shared with the other listeners of the stream: it
+  // must not be modified or released, and remains valid until this call
+  // returns. The device must not be closed from this call.
+  virtual void OnFrame(Device* device, const FrameLease& lease) = 0;
+};
+
+// Decides which frames a listener receives when it falls behind.
+enum FrameListenerPolicy {
+  // Keeps only the newest pending frame, replacing older ones.
+  kListenerLatestOnly = 0,
+  // Keeps up to |queue_depth| pending frames in order. Frames that
+  // arrive while the queue is full are not delivered.
+  kListenerQueue = 1,
+};
+
+struct FrameListenerOptions {
+  // The stream to listen to, kStreamMaskVideo or kStreamMaskDepth.
+  StreamMask stream;
+  FrameListenerPolicy policy;
+  // Size of the queue of kListenerQueue, from 1 to kMaxFrameLeases - 1.
+  // Pending frames are leased, so deep queues on one stream leave fewer
+  // leases for other listeners and readers.
+  int queue_depth;
+
+  FrameListenerOptions()
+      : stream(kStreamMaskDepth), policy(kListenerLatestOnly),
+        queue_depth(kMaxFrameLeases - 1) {}
+};
+
+struct FrameListenerStats {
+  // Number of OnFrame() calls that returned.
+  uint64_t delivered_frames;
+  // Frames that were replaced or not queued because the listener was
+  // busy with earlier frames.
+  uint64_t overrun_frames;
+  // Frames waiting for delivery, now and at most so far.
+  int queue_length;
+  int max_queue_length;
+
+  FrameListenerStats()
+      : delivered_frames(0), overrun_frames(0), queue_length(0),
+        max_queue_length(0) {}
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FRAME_LISTENER_H_
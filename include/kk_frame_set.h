@@ -0,0 +1,149 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FRAME_SET_H_
+#define KKONNECT_KK_FRAME_SET_H_
+
+#include <stdint.h>
+
+#include "kk_device.h"
+
+namespace kkonnect {
+
+// Maximum number of devices in a frame set.
+const int kMaxFrameSetDevices = 16;
+
+// Configures FrameSetCapture, see Connection::OpenFrameSetCapture().
+struct FrameSetOptions {
+  // Indexes of the open devices to synchronize.
+  int device_indexes[kMaxFrameSetDevices];
+  int device_count;
+  // The stream to capture, kStreamMaskVideo or kStreamMaskDepth.
+  StreamMask stream;
+  // Largest allowed difference between host arrival times of the frames
+  // in a set, in microseconds.
+  int tolerance_us;
+  // Number of frames queued per device while waiting for a match,
+  // from 1 to kMaxFrameLeases - 1. One more lease per device remains for
+  // the set held by the caller.
+  int queue_depth;
+
+  FrameSetOptions()
+      : device_count(0), stream(kStreamMaskDepth), tolerance_us(10000),
+        queue_depth(kMaxFrameLeases - 1) {
+    for (int i = 0; i < kMaxFrameSetDevices; ++i) device_indexes[i] = -1;
+  }
+};
+
+// Holds one frame per device, matched by host arrival time.
+struct FrameSet {
+  int device_count;
+  // Leased frames, in the order of FrameSetOptions::device_indexes.
+  FrameLease leases[kMaxFrameSetDevices];
+  // Difference between the earliest and the latest arrival in the set,
+  // in microseconds.
+  uint32_t skew_us;
+
+  FrameSet() : device_count(0), skew_us(0) {}
+};
+
+struct FrameSetStats {
+  // Number of sets returned.
+  uint64_t set_count;
+  // Frames that were leased but could not be matched into a set.
+  uint64_t discarded_frames;
+  // Skew of the returned sets, in microseconds.
+  uint32_t max_skew_us;
+  double mean_skew_us;
+
+  FrameSetStats()
+      : set_count(0), discarded_frames(0), max_skew_us(0), mean_skew_us(0) {}
+};
+
+// Captures sets of frames that arrived at about the same time on several
+// devices, so that they can be processed together. Frames are leased as
+// they arrive and kept in a bounded queue per device until a match is
+// found. Sets are returned in arrival order, and frames older than the
+// returned set are discarded.
+//
+// The capture takes over the frames of the selected stream: other reads
+// of that stream on the same devices would take frames away from it.
+// It also consumes the event descriptors of the devices.
+// A FrameSetCapture must be used by one thread at a time, and must be
+// deleted before any of its devices is closed.
+class FrameSetCapture {
+ public:
+  // Releases all queued frames. Sets returned to the caller must be
+  // released before.
+  ~FrameSetCapture();
+
+  // Waits for the next frame set for up to |timeout_ms|. Negative
+  // |timeout_ms| waits forever. Returns false on timeout. A returned set
+  // must be released with ReleaseFrameSet().
+  bool WaitForFrameSet(FrameSet* set, int timeout_ms);
+  void ReleaseFrameSet(FrameSet* set);
+
+  FrameSetStats GetStats() const;
+
+ private:
+  struct Queue {
+    Device* device;
+    int event_fd;
+    FrameLease leases[kMaxFrameLeases];
+    int head;
+    int count;
+  };
+
+  FrameSetCapture(Device** devices, const FrameSetOptions& options);
+
+  // Leases new frames of every device, discarding the oldest frames of
+  // full queues.
+  void DrainDevices();
+  // Discards queued frames that are too old to match the frames queued
+  // on other devices.
+  void DiscardStaleFrames();
+  bool FindFrameSet(FrameSet* set);
+
+  bool AcquireFrame(Queue* queue, FrameLease* lease);
+  FrameLease& GetQueuedFrame(Queue* queue, int index) {
+    return queue->leases[(queue->head + index) % kMaxFrameLeases];
+  }
+  void DiscardOldestFrame(Queue* queue);
+
+  FrameSetOptions options_;
+  Queue queues_[kMaxFrameSetDevices];
+  FrameSetStats stats_;
+  uint64_t total_skew_us_;
+
+  friend class Connection;
+
+  FrameSetCapture(const FrameSetCapture& src);
+  FrameSetCapture& operator=(const FrameSetCapture& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FRAME_SET_H_
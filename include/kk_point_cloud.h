@@ -0,0 +1,105 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_POINT_CLOUD_H_
+#define KKONNECT_KK_POINT_CLOUD_H_
+
+#include <stdint.h>
+
+#include "kk_device.h"
+
+namespace kkonnect {
+
+enum PointFormat {
+  // Three floats per point: X, Y, Z in meters.
+  kPointFormatFloatXyz = 0,
+  // Three int16_t per point: X, Y, Z in mm, saturated to the int16_t range.
+  kPointFormatInt16Xyz = 1,
+};
+
+struct PointCloudOptions {
+  PointFormat format;
+  // Only every |decimation|-th pixel of every |decimation|-th row is
+  // converted.
+  int decimation;
+  // Whether invalid (zero) depth pixels are left out of the output.
+  // Otherwise they produce points at the origin, and the output keeps
+  // the image layout.
+  bool skip_invalid;
+
+  PointCloudOptions()
+      : format(kPointFormatFloatXyz), decimation(1), skip_invalid(false) {}
+};
+
+// Unprojects kImageFormatDepthMm or kImageFormatDepthRegistered frames
+// into points in the camera coordinate system of the frame: X to the
+// right, Y down and Z forward.
+//
+// The ray of every pixel, including lens undistortion, is computed once
+// when the converter is created, so that a conversion takes a multiply
+// per coordinate. A converter object must not be used by several threads
+// at the same time.
+class PointCloudConverter {
+ public:
+  // |intrinsics| is usually obtained with Device::GetDepthIntrinsics().
+  explicit PointCloudConverter(const DepthIntrinsics& intrinsics);
+  ~PointCloudConverter();
+
+  // Returns the largest number of points produced with |decimation|.
+  int GetMaxPointCount(int decimation) const;
+
+  // Returns the size of a point in the given format, in bytes.
+  static int GetPointSize(PointFormat format);
+
+  // Converts |depth| of the intrinsics' dimensions into |points|, which
+  // must hold GetMaxPointCount() points. When non-zero, |row_size|
+  // defines the distance between depth rows in bytes. If |pixel_indexes|
+  // is not NULL, it receives the index (y * width + x) of the depth
+  // pixel of every point. Returns the number of points written, or -1 if
+  // the options are invalid.
+  int Convert(const uint16_t* depth, int row_size,
+              const PointCloudOptions& options, void* points,
+              int32_t* pixel_indexes);
+
+ private:
+  void BuildRays(int decimation);
+
+  DepthIntrinsics intrinsics_;
+  // Rays of the decimated pixel grid, as X/Z and Y/Z per pixel.
+  int ray_decimation_;
+  int ray_width_;
+  int ray_height_;
+  float* ray_x_;
+  float* ray_y_;
+  uint16_t* depth_row_;
+
+  PointCloudConverter(const PointCloudConverter& src);
+  PointCloudConverter& operator=(const PointCloudConverter& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_POINT_CLOUD_H_
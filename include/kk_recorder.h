@@ -0,0 +1,102 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_RECORDER_H_
+#define KKONNECT_KK_RECORDER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "kk_device.h"
+
+namespace kkonnect {
+
+// Writes frames into a recording file, which Connection::OpenReplay()
+// plays back without a physical device. Frames are stored uncompressed,
+// so that playback can serve them from a memory mapping without copies.
+// A Recorder object must not be used by several threads at the same time.
+class Recorder {
+ public:
+  // Creates a recording of the streams enabled on |device|, which must
+  // have finished connecting. Returns NULL on failure.
+  static Recorder* Create(const char* path, const Device* device);
+
+  // Creates a recording of streams with the given parameters. Disabled
+  // streams are not recorded. Returns NULL on failure.
+  static Recorder* Create(const char* path, DeviceVersion version,
+                          const ImageInfo& video_info,
+                          const ImageInfo& depth_info,
+                          const DepthIntrinsics& depth_intrinsics);
+
+  // Calls Finish() if it was not called yet.
+  ~Recorder();
+
+  // Appends a frame of the stream. |row_size| is the distance between
+  // rows of |data| in bytes, or zero for packed rows. The metadata is
+  // usually the one of the frame lease or read. Returns false if the
+  // stream is not recorded, or if writing failed.
+  bool AddVideoFrame(const void* data, int row_size,
+                     const FrameMetadata& metadata);
+  bool AddDepthFrame(const void* data, int row_size,
+                     const FrameMetadata& metadata);
+
+  // Writes the frame indexes and headers, and closes the file. No frames
+  // can be added afterwards. Returns false if writing failed, in which
+  // case the recording is unusable.
+  bool Finish();
+
+ private:
+  struct Stream {
+    ImageInfo info;
+    int row_size;
+    // Index entries, serialized.
+    uint8_t* index;
+    int frame_count;
+    int index_capacity;
+  };
+
+  Recorder(FILE* file, DeviceVersion version,
+           const ImageInfo& video_info, const ImageInfo& depth_info,
+           const DepthIntrinsics& depth_intrinsics);
+
+  bool AddFrame(Stream* stream, const void* data, int row_size,
+                const FrameMetadata& metadata);
+  bool WritePadding(uint64_t size);
+
+  FILE* file_;
+  bool failed_;
+  uint64_t file_size_;
+  DeviceVersion device_version_;
+  DepthIntrinsics depth_intrinsics_;
+  Stream streams_[2];
+
+  Recorder(const Recorder& src);
+  Recorder& operator=(const Recorder& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_RECORDER_H_
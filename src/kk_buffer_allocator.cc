@@ -0,0 +1,188 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_buffer_allocator.h"
+
+#include <sys/mman.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Alignment of all buffers, which matches cache lines and the widest
+// SIMD loads.
+#define BUFFER_ALIGNMENT    64
+// Size of huge pages on x86-64.
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+BufferAllocator::BufferAllocator() : used_(NULL), cached_(NULL) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+BufferAllocator::~BufferAllocator() {
+  // Devices return their buffers when they are deleted.
+  CHECK(!used_);
+  while (cached_) {
+    FreeBlockLocked(RemoveBlock(&cached_, cached_));
+  }
+  pthread_mutex_destroy(&mutex_);
+}
+
+void BufferAllocator::SetOptions(const MemoryOptions& options) {
+  Autolock l(mutex_);
+  options_ = options;
+  stats_.budget_bytes = options.budget_bytes;
+  MakeRoomLocked(0);
+}
+
+// static
+BufferAllocator::Block* BufferAllocator::RemoveBlock(Block** list,
+                                                     Block* block) {
+  while (*list != block) list = &(*list)->next;
+  *list = block->next;
+  block->next = NULL;
+  return block;
+}
+
+size_t BufferAllocator::GetBlockSize(size_t size) const {
+  size_t page = (options_.huge_pages && size >= HUGE_PAGE_SIZE) ?
+      HUGE_PAGE_SIZE : BUFFER_ALIGNMENT;
+  return (size + page - 1) / page * page;
+}
+
+bool BufferAllocator::MakeRoomLocked(size_t size) {
+  if (!options_.budget_bytes) return true;
+  while (stats_.used_bytes + stats_.cached_bytes + size >
+         options_.budget_bytes) {
+    if (!cached_) return false;
+    FreeBlockLocked(RemoveBlock(&cached_, cached_));
+  }
+  return true;
+}
+
+void BufferAllocator::FreeCachedLocked(size_t kept_size) {
+  Block** link = &cached_;
+  while (*link) {
+    Block* block = *link;
+    if (block->size == kept_size) {
+      link = &block->next;
+    } else {
+      *link = block->next;
+      FreeBlockLocked(block);
+    }
+  }
+}
+
+BufferAllocator::Block* BufferAllocator::AllocateBlockLocked(size_t size) {
+  void* data = NULL;
+  bool huge = false;
+  if (size % HUGE_PAGE_SIZE == 0 && options_.huge_pages) {
+    // Explicit huge pages need to be reserved by the administrator.
+    // Without them, aligned memory lets transparent huge pages back it.
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data == MAP_FAILED) {
+      data = NULL;
+      if (posix_memalign(&data, HUGE_PAGE_SIZE, size)) return NULL;
+#ifdef MADV_HUGEPAGE
+      madvise(data, size, MADV_HUGEPAGE);
+#endif
+    } else {
+      huge = true;
+    }
+  } else if (posix_memalign(&data, BUFFER_ALIGNMENT, size)) {
+    return NULL;
+  }
+
+  Block* block = new Block();
+  block->next = NULL;
+  block->data = data;
+  block->size = size;
+  block->huge = huge;
+  if (huge) stats_.huge_page_bytes += size;
+  return block;
+}
+
+void BufferAllocator::FreeBlockLocked(Block* block) {
+  stats_.cached_bytes -= block->size;
+  if (block->huge) {
+    stats_.huge_page_bytes -= block->size;
+    munmap(block->data, block->size);
+  } else {
+    free(block->data);
+  }
+  delete block;
+}
+
+void* BufferAllocator::Allocate(size_t size) {
+  Autolock l(mutex_);
+  size_t block_size = GetBlockSize(size);
+  Block* block = cached_;
+  while (block && block->size != block_size) block = block->next;
+  if (block) {
+    RemoveBlock(&cached_, block);
+    stats_.cached_bytes -= block_size;
+    ++stats_.reused_count;
+  } else {
+    // Without a budget, a miss suggests that the geometry changed, and
+    // buffers of other sizes are not needed anymore.
+    if (!options_.budget_bytes) FreeCachedLocked(block_size);
+    if (MakeRoomLocked(block_size)) block = AllocateBlockLocked(block_size);
+    if (!block) {
+      ++stats_.failed_count;
+      fprintf(stderr, "Unable to allocate a frame buffer of %d bytes, "
+              "%d bytes in use\n", (int) block_size, (int) stats_.used_bytes);
+      return NULL;
+    }
+  }
+
+  block->next = used_;
+  used_ = block;
+  stats_.used_bytes += block_size;
+  uint64_t total_bytes = stats_.used_bytes + stats_.cached_bytes;
+  if (total_bytes > stats_.peak_bytes) stats_.peak_bytes = total_bytes;
+  return block->data;
+}
+
+void BufferAllocator::Release(void* data) {
+  if (!data) return;
+  Autolock l(mutex_);
+  Block* block = used_;
+  while (block && block->data != data) block = block->next;
+  CHECK(block);
+  RemoveBlock(&used_, block);
+  stats_.used_bytes -= block->size;
+  block->next = cached_;
+  cached_ = block;
+  stats_.cached_bytes += block->size;
+}
+
+MemoryStats BufferAllocator::GetStats() const {
+  Autolock l(mutex_);
+  return stats_;
+}
+
+}  // namespace kkonnect
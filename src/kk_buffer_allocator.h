@@ -0,0 +1,93 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_BUFFER_ALLOCATOR_H_
+#define KKONNECT_KK_BUFFER_ALLOCATOR_H_
+
+#include <kk_connection.h>
+#include <pthread.h>
+#include <stddef.h>
+
+namespace kkonnect {
+
+// Allocates frame buffers for the devices of one connection. Buffers are
+// 64-byte aligned, and large buffers can be backed by huge pages.
+// Released buffers are cached and handed out again for the same size,
+// so reconnects and devices of the same geometry do not return memory
+// to the system and fragment the heap. Without a budget, buffers of other
+// sizes are freed when a size is not found in the cache.
+//
+// Allocation takes a lock and is meant for stream setup, not per frame.
+class BufferAllocator {
+ public:
+  BufferAllocator();
+  ~BufferAllocator();
+
+  // Applies new options, and frees cached buffers that exceed
+  // the new budget.
+  void SetOptions(const MemoryOptions& options);
+
+  // Returns a buffer of at least |size| bytes, or NULL if the budget
+  // does not allow it even after freeing cached buffers.
+  void* Allocate(size_t size);
+
+  // Returns a buffer obtained from Allocate() to the cache. Accepts NULL.
+  void Release(void* data);
+
+  MemoryStats GetStats() const;
+
+ private:
+  struct Block {
+    Block* next;
+    void* data;
+    size_t size;
+    bool huge;
+  };
+
+  size_t GetBlockSize(size_t size) const;
+  Block* AllocateBlockLocked(size_t size);
+  void FreeBlockLocked(Block* block);
+  // Frees cached buffers until |size| more bytes fit into the budget.
+  // Returns false if they do not fit with an empty cache.
+  bool MakeRoomLocked(size_t size);
+  // Frees cached buffers of all sizes except |kept_size|.
+  void FreeCachedLocked(size_t kept_size);
+  static Block* RemoveBlock(Block** list, Block* block);
+
+  mutable pthread_mutex_t mutex_;
+  MemoryOptions options_;
+  // Buffers handed out, and buffers kept for reuse.
+  Block* used_;
+  Block* cached_;
+  MemoryStats stats_;
+
+  BufferAllocator(const BufferAllocator& src);
+  BufferAllocator& operator=(const BufferAllocator& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_BUFFER_ALLOCATOR_H_
@@ -0,0 +1,300 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_change_detector.h"
+
+#include "src/kk_buffer_allocator.h"
+#include "src/utils.h"
+
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace kkonnect {
+
+// Limits of ChangeDetectionOptions::tile_size.
+#define MIN_TILE_SIZE   8
+#define MAX_TILE_SIZE   256
+
+// Compares a row of |width| pixels with the reference, and adds
+// the measure of every span of |tile_size| pixels to |sums|. Video rows
+// add sums of absolute differences of their bytes, and depth rows add
+// the number of changed pixels, see ChangeDetectionOptions.
+typedef void (*CompareRowFunction)(const uint8_t* row,
+                                   const uint8_t* reference, int width,
+                                   int tile_size, int bytes_per_pixel,
+                                   uint16_t threshold, uint64_t* sums);
+
+static uint64_t SumAbsDiffFrom(const uint8_t* a, const uint8_t* b, int start,
+                               int size) {
+  uint64_t sum = 0;
+  for (int i = start; i < size; ++i) {
+    sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+  }
+  return sum;
+}
+
+
+static uint64_t CountChangedFrom(const uint16_t* a, const uint16_t* b,
+                                 int start, int count, uint16_t threshold) {
+  uint64_t changed = 0;
+  for (int i = start; i < count; ++i) {
+    int diff = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    if (diff > threshold || (!a[i]) != (!b[i])) ++changed;
+  }
+  return changed;
+}
+
+static void CompareVideoRowScalar(const uint8_t* row,
+                                  const uint8_t* reference, int width,
+                                  int tile_size, int bytes_per_pixel,
+                                  uint16_t, uint64_t* sums) {
+  int tile_bytes = tile_size * bytes_per_pixel;
+  int row_bytes = width * bytes_per_pixel;
+  for (int x = 0, tx = 0; x < row_bytes; x += tile_bytes, ++tx) {
+    int end = x + tile_bytes < row_bytes ? x + tile_bytes : row_bytes;
+    sums[tx] += SumAbsDiffFrom(row + x, reference + x, 0, end - x);
+  }
+}
+
+static void CompareDepthRowScalar(const uint8_t* row,
+                                  const uint8_t* reference, int width,
+                                  int tile_size, int,
+                                  uint16_t threshold, uint64_t* sums) {
+  const uint16_t* a = reinterpret_cast<const uint16_t*>(row);
+  const uint16_t* b = reinterpret_cast<const uint16_t*>(reference);
+  for (int x = 0, tx = 0; x < width; x += tile_size, ++tx) {
+    int end = x + tile_size < width ? x + tile_size : width;
+    sums[tx] += CountChangedFrom(a + x, b + x, 0, end - x, threshold);
+  }
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+__attribute__((target("sse2")))
+static inline uint64_t SumAbsDiffSse2(const uint8_t* a, const uint8_t* b,
+                               int size) {
+  __m128i sum = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+  return lanes[0] + lanes[1] + SumAbsDiffFrom(a, b, i, size);
+}
+
+__attribute__((target("sse2")))
+static inline uint64_t CountChangedSse2(const uint16_t* a, const uint16_t* b,
+                                 int count, uint16_t threshold) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i limit = _mm_set1_epi16((short) threshold);
+  const __m128i ones = _mm_cmpeq_epi16(zero, zero);
+  uint64_t changed = 0;
+  int i = 0;
+  while (i + 8 <= count) {
+    // Lanes count changed pixels in their low bytes, which are summed
+    // before they can overflow.
+    __m128i counts = zero;
+    for (int n = 0; n < 255 && i + 8 <= count; ++n, i += 8) {
+      __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+      __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+      __m128i diff = _mm_or_si128(_mm_subs_epu16(va, vb),
+                                  _mm_subs_epu16(vb, va));
+      // Lanes within the threshold saturate to zero.
+      __m128i is_still = _mm_cmpeq_epi16(_mm_subs_epu16(diff, limit), zero);
+      __m128i is_flipped = _mm_xor_si128(_mm_cmpeq_epi16(va, zero),
+                                         _mm_cmpeq_epi16(vb, zero));
+      __m128i is_changed = _mm_or_si128(_mm_andnot_si128(is_still, ones),
+                                        is_flipped);
+      counts = _mm_sub_epi16(counts, is_changed);
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes),
+                     _mm_sad_epu8(counts, zero));
+    changed += lanes[0] + lanes[1];
+  }
+  return changed + CountChangedFrom(a, b, i, count, threshold);
+}
+
+__attribute__((target("sse2")))
+static void CompareVideoRowSse2(const uint8_t* row, const uint8_t* reference,
+                                int width, int tile_size, int bytes_per_pixel,
+                                uint16_t, uint64_t* sums) {
+  int tile_bytes = tile_size * bytes_per_pixel;
+  int row_bytes = width * bytes_per_pixel;
+  for (int x = 0, tx = 0; x < row_bytes; x += tile_bytes, ++tx) {
+    int end = x + tile_bytes < row_bytes ? x + tile_bytes : row_bytes;
+    sums[tx] += SumAbsDiffSse2(row + x, reference + x, end - x);
+  }
+}
+
+__attribute__((target("sse2")))
+static void CompareDepthRowSse2(const uint8_t* row, const uint8_t* reference,
+                                int width, int tile_size, int,
+                                uint16_t threshold, uint64_t* sums) {
+  const uint16_t* a = reinterpret_cast<const uint16_t*>(row);
+  const uint16_t* b = reinterpret_cast<const uint16_t*>(reference);
+  for (int x = 0, tx = 0; x < width; x += tile_size, ++tx) {
+    int end = x + tile_size < width ? x + tile_size : width;
+    sums[tx] += CountChangedSse2(a + x, b + x, end - x, threshold);
+  }
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+ChangeDetector::ChangeDetector()
+    : allocator_(NULL), format_(kImageFormatNone), width_(0), height_(0),
+      bytes_per_pixel_(0), tile_size_(0), columns_(0), rows_(0),
+      reference_(NULL), reference_size_(0), has_reference_(false) {}
+
+ChangeDetector::~ChangeDetector() {
+  if (reference_) allocator_->Release(reference_);
+}
+
+// static
+bool ChangeDetector::IsValidOptions(const ChangeDetectionOptions& options) {
+  if (!options.tile_size) return true;
+  return options.tile_size >= MIN_TILE_SIZE &&
+      options.tile_size <= MAX_TILE_SIZE && options.video_threshold >= 0 &&
+      options.depth_threshold_mm >= 0 &&
+      options.depth_threshold_mm <= 0xFFFF && options.depth_min_pixels >= 0;
+}
+
+bool ChangeDetector::Init(int width, int height, ImageFormat format) {
+  format_ = format;
+  width_ = width;
+  height_ = height;
+  bytes_per_pixel_ = GetBytesPerPixel(format);
+  has_reference_ = false;
+
+  int tile_size = options_.tile_size;
+  if (tile_size) {
+    int min_size = (width + kMaxChangeTiles - 1) / kMaxChangeTiles;
+    if (tile_size < min_size) tile_size = min_size;
+    min_size = (height + kMaxChangeTiles - 1) / kMaxChangeTiles;
+    if (tile_size < min_size) tile_size = min_size;
+  }
+  tile_size_ = tile_size;
+  columns_ = tile_size ? (width + tile_size - 1) / tile_size : 0;
+  rows_ = tile_size ? (height + tile_size - 1) / tile_size : 0;
+
+  int reference_size = tile_size ? width * height * bytes_per_pixel_ : 0;
+  if (reference_size != reference_size_) {
+    if (reference_) allocator_->Release(reference_);
+    reference_ = NULL;
+    reference_size_ = 0;
+    if (reference_size) {
+      reference_ =
+          reinterpret_cast<uint8_t*>(allocator_->Allocate(reference_size));
+      if (!reference_) return false;
+      reference_size_ = reference_size;
+    }
+  }
+  return true;
+}
+
+void ChangeDetector::CopyToReference(const uint8_t* data, int row_size,
+                                     int y0, int y1, uint64_t dirty) {
+  int reference_row_size = width_ * bytes_per_pixel_;
+  int tile_bytes = tile_size_ * bytes_per_pixel_;
+  for (int tx = 0; tx < columns_; ++tx) {
+    if (!((dirty >> tx) & 1)) continue;
+    // Runs of dirty tiles are copied together.
+    int end = tx + 1;
+    while (end < columns_ && ((dirty >> end) & 1)) ++end;
+    int offset = tx * tile_bytes;
+    int size = (end == columns_ ? reference_row_size : end * tile_bytes) -
+        offset;
+    for (int y = y0; y < y1; ++y) {
+      memcpy(reference_ + y * reference_row_size + offset,
+             data + y * row_size + offset, size);
+    }
+    tx = end;
+  }
+}
+
+void ChangeDetector::Detect(const void* data, int row_size,
+                            FrameMetadata* metadata) {
+  if (!tile_size_) return;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  metadata->change_tile_size = tile_size_;
+  metadata->change_tile_columns = columns_;
+  metadata->change_tile_rows = rows_;
+  for (int i = rows_; i < kMaxChangeTiles; ++i) metadata->dirty_tiles[i] = 0;
+
+  uint64_t all_columns = columns_ == 64 ? ~0ULL : (1ULL << columns_) - 1;
+  if (!has_reference_) {
+    for (int ty = 0; ty < rows_; ++ty) metadata->dirty_tiles[ty] = all_columns;
+    CopyToReference(bytes, row_size, 0, height_, all_columns);
+    has_reference_ = true;
+    metadata->is_unchanged = false;
+    return;
+  }
+
+  bool is_depth = (format_ == kImageFormatDepthMm ||
+                   format_ == kImageFormatDepthRegistered);
+  CompareRowFunction compare_row =
+      is_depth ? CompareDepthRowScalar : CompareVideoRowScalar;
+#ifdef KKONNECT_X86_SIMD
+  if (HasCpuFeature(kCpuFeatureSse2)) {
+    compare_row = is_depth ? CompareDepthRowSse2 : CompareVideoRowSse2;
+  }
+#endif
+
+  int reference_row_size = width_ * bytes_per_pixel_;
+  uint16_t threshold = (uint16_t) options_.depth_threshold_mm;
+  bool is_unchanged = true;
+  for (int ty = 0; ty < rows_; ++ty) {
+    int y0 = ty * tile_size_;
+    int y1 = y0 + tile_size_ < height_ ? y0 + tile_size_ : height_;
+    for (int tx = 0; tx < columns_; ++tx) sums_[tx] = 0;
+    for (int y = y0; y < y1; ++y) {
+      compare_row(bytes + y * row_size, reference_ + y * reference_row_size,
+                  width_, tile_size_, bytes_per_pixel_, threshold, sums_);
+    }
+
+    uint64_t dirty = 0;
+    for (int tx = 0; tx < columns_; ++tx) {
+      int x0 = tx * tile_size_;
+      int x1 = x0 + tile_size_ < width_ ? x0 + tile_size_ : width_;
+      uint64_t limit = is_depth ? (uint64_t) options_.depth_min_pixels :
+          (uint64_t) options_.video_threshold * (x1 - x0) * (y1 - y0) *
+          bytes_per_pixel_;
+      if (sums_[tx] > limit) dirty |= 1ULL << tx;
+    }
+    if (dirty) {
+      CopyToReference(bytes, row_size, y0, y1, dirty);
+      is_unchanged = false;
+    }
+    metadata->dirty_tiles[ty] = dirty;
+  }
+  metadata->is_unchanged = is_unchanged;
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,92 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_CHANGE_DETECTOR_H_
+#define KKONNECT_KK_CHANGE_DETECTOR_H_
+
+#include <kk_device.h>
+
+namespace kkonnect {
+
+class BufferAllocator;
+
+// Marks the tiles of published frames that changed significantly since
+// the reference, see ChangeDetectionOptions. Video tiles are compared by
+// their sums of absolute differences, and depth tiles by the number of
+// pixels that moved by more than the threshold.
+class ChangeDetector {
+ public:
+  ChangeDetector();
+  ~ChangeDetector();
+
+  // Returns true if |options| have valid values.
+  static bool IsValidOptions(const ChangeDetectionOptions& options);
+
+  void SetOptions(const ChangeDetectionOptions& options) {
+    options_ = options;
+  }
+  // Sets the allocator of the reference. Must be called before Init().
+  void SetAllocator(BufferAllocator* allocator) { allocator_ = allocator; }
+
+  // Prepares for frames of the given geometry and drops the reference,
+  // so that the next frame is all dirty. Returns false if the reference
+  // cannot be allocated.
+  bool Init(int width, int height, ImageFormat format);
+
+  bool IsEnabled() const { return tile_size_ != 0; }
+
+  // Compares |data| with the reference and fills the change fields
+  // of |metadata|. Dirty tiles are copied into the reference.
+  void Detect(const void* data, int row_size, FrameMetadata* metadata);
+
+ private:
+  void CopyToReference(const uint8_t* data, int row_size, int y0, int y1,
+                       uint64_t dirty);
+
+  ChangeDetectionOptions options_;
+  BufferAllocator* allocator_;
+  ImageFormat format_;
+  int width_;
+  int height_;
+  int bytes_per_pixel_;
+  // The fitted tile size, or zero if detection is off.
+  int tile_size_;
+  int columns_;
+  int rows_;
+  // Holds the last dirty version of every tile, in packed rows.
+  uint8_t* reference_;
+  int reference_size_;
+  bool has_reference_;
+  // Sums of one row of tiles.
+  uint64_t sums_[kMaxChangeTiles];
+
+  ChangeDetector(const ChangeDetector& src);
+  ChangeDetector& operator=(const ChangeDetector& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_CHANGE_DETECTOR_H_
@@ -0,0 +1,311 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <kk_color_convert.h>
+
+#include "src/utils.h"
+
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace kkonnect {
+
+// BT.601 studio-swing YUV to RGB coefficients, the ones libfreenect uses
+// for its RGB modes, in 1/1024 units. They are applied to luma and chroma
+// offsets scaled by 64. Every term is computed as the high half of
+// a 16-bit product, so that SIMD and scalar paths produce identical
+// output. Results may differ from libfreenect's by rounding.
+#define LUMA_OFFSET     16
+#define COEF_Y          1192   // 1.164
+#define COEF_V_TO_R     1634   // 1.596
+#define COEF_U_TO_G     (-400)  // -0.391
+#define COEF_V_TO_G     (-833)  // -0.813
+#define COEF_U_TO_B     2066   // 2.018
+
+static inline int MulCoef(int value, int coef) {
+  return (value * 64 * coef) >> 16;
+}
+
+static inline uint8_t Clamp(int value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// Converts pixel pairs starting from |start|. Writes |pixel_size| bytes
+// per pixel, in R, G, B order or, if |bgra|, in B, G, R, A order.
+static void ConvertRowFrom(const uint8_t* src, uint8_t* dst, int start,
+                           int width, int pixel_size, bool bgra) {
+  for (int x = start; x < width; x += 2) {
+    const uint8_t* uyvy = src + x * 2;
+    int u = uyvy[0] - 128;
+    int v = uyvy[2] - 128;
+    int r_offset = MulCoef(v, COEF_V_TO_R);
+    int g_offset = MulCoef(u, COEF_U_TO_G) + MulCoef(v, COEF_V_TO_G);
+    int b_offset = MulCoef(u, COEF_U_TO_B);
+    for (int i = 0; i < 2; ++i) {
+      int y = MulCoef(uyvy[1 + i * 2] - LUMA_OFFSET, COEF_Y);
+      uint8_t* pixel = dst + (x + i) * pixel_size;
+      pixel[bgra ? 2 : 0] = Clamp(y + r_offset);
+      pixel[1] = Clamp(y + g_offset);
+      pixel[bgra ? 0 : 2] = Clamp(y + b_offset);
+      if (bgra) pixel[3] = 0xFF;
+    }
+  }
+}
+
+static void ConvertRowToRgbScalar(const uint8_t* src, uint8_t* dst,
+                                  int width) {
+  ConvertRowFrom(src, dst, 0, width, 3, false);
+}
+
+static void ConvertRowToBgraScalar(const uint8_t* src, uint8_t* dst,
+                                   int width) {
+  ConvertRowFrom(src, dst, 0, width, 4, true);
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// Converts 8 UYVY pixels into 16-bit R, G and B lanes.
+__attribute__((target("sse2")))
+static inline void ComputeRgbSse2(__m128i uyvy, __m128i* r, __m128i* g,
+                                  __m128i* b) {
+  const __m128i chroma_mask = _mm_set1_epi16(0xFF);
+  const __m128i chroma_bias = _mm_set1_epi16(128);
+  __m128i y = _mm_sub_epi16(_mm_srli_epi16(uyvy, 8),
+                            _mm_set1_epi16(LUMA_OFFSET));
+  y = _mm_mulhi_epi16(_mm_slli_epi16(y, 6), _mm_set1_epi16(COEF_Y));
+  __m128i uv = _mm_sub_epi16(_mm_and_si128(uyvy, chroma_mask), chroma_bias);
+  uv = _mm_slli_epi16(uv, 6);
+  __m128i u = _mm_shufflehi_epi16(
+      _mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)),
+      _MM_SHUFFLE(2, 2, 0, 0));
+  __m128i v = _mm_shufflehi_epi16(
+      _mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)),
+      _MM_SHUFFLE(3, 3, 1, 1));
+  *r = _mm_add_epi16(y, _mm_mulhi_epi16(v, _mm_set1_epi16(COEF_V_TO_R)));
+  *g = _mm_add_epi16(
+      y, _mm_add_epi16(_mm_mulhi_epi16(u, _mm_set1_epi16(COEF_U_TO_G)),
+                       _mm_mulhi_epi16(v, _mm_set1_epi16(COEF_V_TO_G))));
+  *b = _mm_add_epi16(y, _mm_mulhi_epi16(u, _mm_set1_epi16(COEF_U_TO_B)));
+}
+
+// Interleaves 8 pixels of 16-bit channel lanes into 4-byte pixels.
+__attribute__((target("sse2")))
+static inline void InterleaveSse2(__m128i c0, __m128i c1, __m128i c2,
+                                  __m128i* low, __m128i* high) {
+  __m128i c01 = _mm_unpacklo_epi8(_mm_packus_epi16(c0, c0),
+                                  _mm_packus_epi16(c1, c1));
+  __m128i c23 = _mm_unpacklo_epi8(_mm_packus_epi16(c2, c2),
+                                  _mm_set1_epi8((char) 0xFF));
+  *low = _mm_unpacklo_epi16(c01, c23);
+  *high = _mm_unpackhi_epi16(c01, c23);
+}
+
+__attribute__((target("sse2")))
+static void ConvertRowToRgbSse2(const uint8_t* src, uint8_t* dst,
+                                int width) {
+  // Every pixel is stored as 4 bytes, and the extra byte is overwritten
+  // by the next pixel. This requires at least one more pixel after the
+  // last one converted here.
+  uint8_t pixels[32];
+  int x = 0;
+  for (; x + 8 < width; x += 8) {
+    __m128i r, g, b, low, high;
+    ComputeRgbSse2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2)),
+        &r, &g, &b);
+    InterleaveSse2(r, g, b, &low, &high);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + 16), high);
+    for (int i = 0; i < 8; ++i) {
+      memcpy(dst + (x + i) * 3, pixels + i * 4, 4);
+    }
+  }
+  ConvertRowFrom(src, dst, x, width, 3, false);
+}
+
+__attribute__((target("sse2")))
+static void ConvertRowToBgraSse2(const uint8_t* src, uint8_t* dst,
+                                 int width) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i r, g, b, low, high;
+    ComputeRgbSse2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2)),
+        &r, &g, &b);
+    InterleaveSse2(b, g, r, &low, &high);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4 + 16), high);
+  }
+  ConvertRowFrom(src, dst, x, width, 4, true);
+}
+
+// Converts 16 UYVY pixels into 16-bit R, G and B lanes. Pixels 0-7 are
+// in the low 128-bit lane, and pixels 8-15 in the high one.
+__attribute__((target("avx2")))
+static inline void ComputeRgbAvx2(__m256i uyvy, __m256i* r, __m256i* g,
+                                  __m256i* b) {
+  const __m256i chroma_mask = _mm256_set1_epi16(0xFF);
+  const __m256i chroma_bias = _mm256_set1_epi16(128);
+  __m256i y = _mm256_sub_epi16(_mm256_srli_epi16(uyvy, 8),
+                               _mm256_set1_epi16(LUMA_OFFSET));
+  y = _mm256_mulhi_epi16(_mm256_slli_epi16(y, 6),
+                         _mm256_set1_epi16(COEF_Y));
+  __m256i uv = _mm256_sub_epi16(_mm256_and_si256(uyvy, chroma_mask),
+                                chroma_bias);
+  uv = _mm256_slli_epi16(uv, 6);
+  __m256i u = _mm256_shufflehi_epi16(
+      _mm256_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)),
+      _MM_SHUFFLE(2, 2, 0, 0));
+  __m256i v = _mm256_shufflehi_epi16(
+      _mm256_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)),
+      _MM_SHUFFLE(3, 3, 1, 1));
+  *r = _mm256_add_epi16(
+      y, _mm256_mulhi_epi16(v, _mm256_set1_epi16(COEF_V_TO_R)));
+  *g = _mm256_add_epi16(
+      y, _mm256_add_epi16(
+          _mm256_mulhi_epi16(u, _mm256_set1_epi16(COEF_U_TO_G)),
+          _mm256_mulhi_epi16(v, _mm256_set1_epi16(COEF_V_TO_G))));
+  *b = _mm256_add_epi16(
+      y, _mm256_mulhi_epi16(u, _mm256_set1_epi16(COEF_U_TO_B)));
+}
+
+// Interleaves 16 pixels into 4-byte pixels. |low| receives pixels 0-3
+// and 8-11, |high| receives pixels 4-7 and 12-15.
+__attribute__((target("avx2")))
+static inline void InterleaveAvx2(__m256i c0, __m256i c1, __m256i c2,
+                                  __m256i* low, __m256i* high) {
+  __m256i c01 = _mm256_unpacklo_epi8(_mm256_packus_epi16(c0, c0),
+                                     _mm256_packus_epi16(c1, c1));
+  __m256i c23 = _mm256_unpacklo_epi8(_mm256_packus_epi16(c2, c2),
+                                     _mm256_set1_epi8((char) 0xFF));
+  *low = _mm256_unpacklo_epi16(c01, c23);
+  *high = _mm256_unpackhi_epi16(c01, c23);
+}
+
+__attribute__((target("avx2")))
+static void ConvertRowToRgbAvx2(const uint8_t* src, uint8_t* dst,
+                                int width) {
+  const __m256i compact = _mm256_setr_epi8(
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  // Each 16-byte store carries 4 extra bytes, which are overwritten by
+  // the next store. This requires one more pixel after the last one
+  // converted here.
+  int x = 0;
+  for (; x + 16 < width; x += 16) {
+    __m256i r, g, b, low, high;
+    ComputeRgbAvx2(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 2)),
+        &r, &g, &b);
+    InterleaveAvx2(r, g, b, &low, &high);
+    low = _mm256_shuffle_epi8(low, compact);
+    high = _mm256_shuffle_epi8(high, compact);
+    uint8_t* pixel = dst + x * 3;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixel),
+                     _mm256_castsi256_si128(low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixel + 12),
+                     _mm256_castsi256_si128(high));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixel + 24),
+                     _mm256_extracti128_si256(low, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixel + 36),
+                     _mm256_extracti128_si256(high, 1));
+  }
+  ConvertRowFrom(src, dst, x, width, 3, false);
+}
+
+__attribute__((target("avx2")))
+static void ConvertRowToBgraAvx2(const uint8_t* src, uint8_t* dst,
+                                 int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m256i r, g, b, low, high;
+    ComputeRgbAvx2(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 2)),
+        &r, &g, &b);
+    InterleaveAvx2(b, g, r, &low, &high);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4),
+                        _mm256_permute2x128_si256(low, high, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4 + 32),
+                        _mm256_permute2x128_si256(low, high, 0x31));
+  }
+  ConvertRowFrom(src, dst, x, width, 4, true);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+typedef void (*ConvertRowFunction)(const uint8_t* src, uint8_t* dst,
+                                   int width);
+
+static ErrorCode ConvertRows(ConvertRowFunction convert_row,
+                             const uint8_t* src, int src_row_size, int width,
+                             int height, uint8_t* dst, int dst_row_size,
+                             int pixel_size) {
+  if (!src_row_size) src_row_size = width * 2;
+  if (!dst_row_size) dst_row_size = width * pixel_size;
+  if (width <= 0 || (width & 1) || height < 0 ||
+      src_row_size < width * 2 || dst_row_size < width * pixel_size) {
+    return kErrorInvalidArgument;
+  }
+  for (int y = 0; y < height; ++y) {
+    convert_row(src, dst, width);
+    src += src_row_size;
+    dst += dst_row_size;
+  }
+  return kErrorSuccess;
+}
+
+ErrorCode ConvertYuv422ToRgb(const uint8_t* src, int src_row_size,
+                             int width, int height, uint8_t* dst,
+                             int dst_row_size) {
+  ConvertRowFunction convert_row = ConvertRowToRgbScalar;
+#ifdef KKONNECT_X86_SIMD
+  if (HasCpuFeature(kCpuFeatureAvx2)) {
+    convert_row = ConvertRowToRgbAvx2;
+  } else if (HasCpuFeature(kCpuFeatureSse2)) {
+    convert_row = ConvertRowToRgbSse2;
+  }
+#endif
+  return ConvertRows(convert_row, src, src_row_size, width, height,
+                     dst, dst_row_size, 3);
+}
+
+ErrorCode ConvertYuv422ToBgra(const uint8_t* src, int src_row_size,
+                              int width, int height, uint8_t* dst,
+                              int dst_row_size) {
+  ConvertRowFunction convert_row = ConvertRowToBgraScalar;
+#ifdef KKONNECT_X86_SIMD
+  if (HasCpuFeature(kCpuFeatureAvx2)) {
+    convert_row = ConvertRowToBgraAvx2;
+  } else if (HasCpuFeature(kCpuFeatureSse2)) {
+    convert_row = ConvertRowToBgraSse2;
+  }
+#endif
+  return ConvertRows(convert_row, src, src_row_size, width, height,
+                     dst, dst_row_size, 4);
+}
+
+}  // namespace kkonnect
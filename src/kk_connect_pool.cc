@@ -0,0 +1,123 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_connect_pool.h"
+
+#include "src/kk_freenect_base.h"
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Idle workers wake up this often to run device health checks.
+#define HEALTH_CHECK_INTERVAL_MS   1000
+
+ConnectPool::ConnectPool(Delegate* delegate, pthread_mutex_t* mutex)
+    : delegate_(delegate), mutex_(mutex), should_exit_(false),
+      threads_(NULL), connecting_(NULL), thread_count_(0) {
+  InitMonotonicCond(&cond_);
+}
+
+ConnectPool::~ConnectPool() {
+  CHECK(!thread_count_);  // Workers were joined.
+  pthread_cond_destroy(&cond_);
+  delete[] threads_;
+  delete[] connecting_;
+}
+
+void ConnectPool::Start(int thread_count) {
+  CHECK(!threads_);
+  CHECK(thread_count > 0);
+  thread_count_ = thread_count;
+  threads_ = new pthread_t[thread_count];
+  connecting_ = new BaseFreenectDevice*[thread_count];
+  for (int i = 0; i < thread_count; ++i) {
+    connecting_[i] = NULL;
+  }
+  for (int i = 0; i < thread_count; ++i) {
+    CHECK(!pthread_create(&threads_[i], NULL, RunWorker, this));
+  }
+}
+
+void ConnectPool::WakeUpLocked() {
+  pthread_cond_broadcast(&cond_);
+}
+
+void ConnectPool::WaitForConnectLocked(BaseFreenectDevice* device) {
+  for (int i = 0; i < thread_count_; ++i) {
+    while (connecting_[i] == device) {
+      pthread_cond_wait(&cond_, mutex_);
+    }
+  }
+}
+
+void ConnectPool::ShutdownLocked() {
+  should_exit_ = true;
+  pthread_cond_broadcast(&cond_);
+}
+
+void ConnectPool::Join() {
+  for (int i = 0; i < thread_count_; ++i) {
+    pthread_join(threads_[i], NULL);
+  }
+  thread_count_ = 0;
+}
+
+// static
+void* ConnectPool::RunWorker(void* arg) {
+  reinterpret_cast<ConnectPool*>(arg)->RunWorker();
+  return NULL;
+}
+
+void ConnectPool::RunWorker() {
+  while (!should_exit_) {
+    BaseFreenectDevice* device;
+    int slot = 0;
+    {
+      Autolock l(*mutex_);
+      device = delegate_->StartConnectingNextDeviceLocked();
+      if (!device) {
+        WaitCondUntil(&cond_, mutex_,
+                      GetCurrentMillis() + HEALTH_CHECK_INTERVAL_MS);
+        continue;
+      }
+      while (connecting_[slot]) ++slot;
+      connecting_[slot] = device;
+    }
+
+    if (device->NeedsClose()) {
+      // A health check stopped the device for reconnecting.
+      delegate_->WaitForStoppedCallbacks(device);
+      device->Close();
+    }
+    device->Connect();
+
+    Autolock l(*mutex_);
+    connecting_[slot] = NULL;
+    pthread_cond_broadcast(&cond_);
+  }
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_CONNECT_POOL_H_
+#define KKONNECT_KK_CONNECT_POOL_H_
+
+#include <pthread.h>
+
+namespace kkonnect {
+
+class BaseFreenectDevice;
+
+// Runs a small set of threads that connect devices concurrently, so that
+// a device that is slow to open does not delay the others.
+class ConnectPool {
+ public:
+  class Delegate {
+   public:
+    // Returns the next device that should be connected, after marking it
+    // with MarkConnectStarted(). Returns NULL if there is none.
+    // Called with the pool mutex held.
+    virtual BaseFreenectDevice* StartConnectingNextDeviceLocked() = 0;
+
+    // Waits until driver callbacks of a stopped device have returned,
+    // so that it can be closed. Called without the pool mutex.
+    virtual void WaitForStoppedCallbacks(BaseFreenectDevice*) {}
+
+   protected:
+    virtual ~Delegate() {}
+  };
+
+  // Calls to |delegate| are made while holding |mutex|, except for
+  // WaitForStoppedCallbacks().
+  ConnectPool(Delegate* delegate, pthread_mutex_t* mutex);
+  ~ConnectPool();
+
+  void Start(int thread_count);
+
+  // Wakes up idle workers to look for devices to connect.
+  // Must be called with the mutex held.
+  void WakeUpLocked();
+
+  // Waits until no worker is running Connect() on |device|. Must be
+  // called with the mutex held, which is released while waiting.
+  void WaitForConnectLocked(BaseFreenectDevice* device);
+
+  // Asks the workers to exit. Must be called with the mutex held.
+  void ShutdownLocked();
+
+  // Waits for the workers to exit after ShutdownLocked(). Must be called
+  // without the mutex, and before the destructor if Start() was called.
+  void Join();
+
+ private:
+  static void* RunWorker(void* arg);
+  void RunWorker();
+
+  Delegate* delegate_;
+  pthread_mutex_t* mutex_;
+  pthread_cond_t cond_;
+  volatile bool should_exit_;
+  pthread_t* threads_;
+  // Devices that are being connected, one entry per worker.
+  BaseFreenectDevice** connecting_;
+  int thread_count_;
+
+  ConnectPool(const ConnectPool& src);
+  ConnectPool& operator=(const ConnectPool& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_CONNECT_POOL_H_
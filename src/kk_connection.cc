@@ -26,25 +26,82 @@
 
 #include <kk_connection.h>
 
+#include "src/kk_buffer_allocator.h"
+#include "src/kk_change_detector.h"
+#include "src/kk_device_event_queue.h"
+#include "src/kk_frame_dispatcher.h"
+#include "src/kk_frame_resampler.h"
 #include "src/kk_freenect_connection.h"
+#include "src/kk_remote_connection.h"
+#include "src/kk_replay_connection.h"
+#include "src/kk_synthetic_connection.h"
 #include "src/utils.h"
 
 namespace kkonnect {
 
+// Threads that run FrameListener callbacks of a connection.
+#define DISPATCH_THREAD_COUNT   2
+
 // static
 Connection* Connection::OpenLocal() {
-  return FreenectConnection::GetInstanceImpl();
+  return FreenectConnection::GetInstanceImpl(LocalOptions());
+}
+
+// static
+Connection* Connection::OpenLocal(const LocalOptions& options) {
+  return FreenectConnection::GetInstanceImpl(options);
+}
+
+// static
+Connection* Connection::OpenRemote(const char* host, int port) {
+  return RemoteConnection::Create(host, port);
+}
+
+// static
+Connection* Connection::OpenReplay(const char* path,
+                                   const ReplayOptions& options) {
+  return ReplayConnection::Create(path, options);
 }
 
-Connection::Connection() : devices_(NULL) {
+// static
+Connection* Connection::OpenSynthetic(const SyntheticOptions& options) {
+  return SyntheticConnection::Create(options);
+}
+
+Connection::Connection()
+    : devices_(NULL), buffer_allocator_(new BufferAllocator()),
+      device_events_(new DeviceEventQueue()), frame_dispatcher_(NULL) {
   pthread_mutex_init(&mutex_, NULL);
 }
 
 Connection::~Connection() {
   CHECK(!devices_);
+  delete frame_dispatcher_;
+  delete device_events_;
+  delete buffer_allocator_;
 }
 
 void Connection::Close() {
+  // StopDeviceCallbacks() only compares devices by address, so it can
+  // work on a copy of the list without the lock.
+  Device** devices;
+  int device_count = 0;
+  {
+    Autolock l(mutex_);
+    for (Device* device = devices_; device; device = device->next_) {
+      ++device_count;
+    }
+    devices = new Device*[device_count];
+    device_count = 0;
+    for (Device* device = devices_; device; device = device->next_) {
+      devices[device_count++] = device;
+    }
+  }
+  for (int i = 0; i < device_count; ++i) {
+    StopDeviceCallbacks(devices[i]);
+  }
+  delete[] devices;
+
   Autolock l(mutex_);
   while (devices_) {
     CloseDeviceLocked(devices_);
@@ -63,6 +120,13 @@ ErrorCode Connection::OpenDevice(const DeviceOpenRequest& request,
     found_device = found_device->next_;
   }
 
+  if (!FrameResampler::IsValidRegion(request.video_region) ||
+      !FrameResampler::IsValidRegion(request.depth_region) ||
+      !ChangeDetector::IsValidOptions(request.video_changes) ||
+      !ChangeDetector::IsValidOptions(request.depth_changes)) {
+    return kErrorInvalidArgument;
+  }
+
   ErrorCode result = OpenDeviceInternalLocked(request, device);
   if (result != kErrorSuccess) return result;
   (*device)->next_ = devices_;
@@ -71,11 +135,160 @@ ErrorCode Connection::OpenDevice(const DeviceOpenRequest& request,
   return kErrorSuccess;
 }
 
+ErrorCode Connection::OpenDeviceAsync(const DeviceOpenRequest& request,
+                                      DeviceOpenCallback* callback,
+                                      Device** device) {
+  if (!callback) return kErrorInvalidArgument;
+  ErrorCode result = OpenDevice(request, device);
+  if (result != kErrorSuccess) return result;
+  device_events_->AddOpenCallback(*device, callback);
+  // The device may have finished connecting before the callback
+  // was added.
+  ErrorCode status = (*device)->GetStatus();
+  if (status != kErrorInProgress) {
+    device_events_->CompleteOpen(*device, status);
+  }
+  return kErrorSuccess;
+}
+
+bool Connection::WaitForDeviceEvent(DeviceEvent* event, int timeout_ms) {
+  return device_events_->Pop(event, timeout_ms);
+}
+
+int Connection::GetDeviceEventFd() {
+  return device_events_->GetEventFd();
+}
+
+static void AddStreamStats(const StreamStats& stats, StreamStats* total) {
+  total->received_frames += stats.received_frames;
+  total->delivered_frames += stats.delivered_frames;
+  total->dropped_frames += stats.dropped_frames;
+  total->network_bytes += stats.network_bytes;
+  total->fps += stats.fps;
+  for (int i = 0; i < kLatencyHistogramBuckets; ++i) {
+    total->latency_histogram[i] += stats.latency_histogram[i];
+  }
+}
+
+ConnectionStats Connection::GetStats() const {
+  Autolock l(mutex_);
+  ConnectionStats total;
+  for (Device* device = devices_; device; device = device->next_) {
+    DeviceStats stats = device->GetStats();
+    ErrorCode status = device->GetStatus();
+    ++total.open_device_count;
+    if (status == kErrorSuccess) {
+      ++total.connected_device_count;
+    } else if (status != kErrorInProgress) {
+      ++total.failed_device_count;
+    }
+    AddStreamStats(stats.video, &total.video);
+    AddStreamStats(stats.depth, &total.depth);
+    total.lock_wait_us += stats.lock_wait_us;
+    total.reconnect_count += stats.reconnect_count;
+  }
+  return total;
+}
+
+void Connection::SetMemoryOptions(const MemoryOptions& options) {
+  buffer_allocator_->SetOptions(options);
+}
+
+MemoryStats Connection::GetMemoryStats() const {
+  return buffer_allocator_->GetStats();
+}
+
+ErrorCode Connection::OpenFrameSetCapture(const FrameSetOptions& options,
+                                          FrameSetCapture** capture) {
+  if (options.device_count < 1 ||
+      options.device_count > kMaxFrameSetDevices ||
+      (options.stream != kStreamMaskVideo &&
+       options.stream != kStreamMaskDepth) ||
+      options.tolerance_us < 0 || options.queue_depth < 1 ||
+      options.queue_depth >= kMaxFrameLeases) {
+    return kErrorInvalidArgument;
+  }
+
+  Autolock l(mutex_);
+  Device* devices[kMaxFrameSetDevices];
+  for (int i = 0; i < options.device_count; ++i) {
+    for (int j = 0; j < i; ++j) {
+      if (options.device_indexes[j] == options.device_indexes[i]) {
+        return kErrorInvalidArgument;
+      }
+    }
+    devices[i] = devices_;
+    while (devices[i] && devices[i]->index_ != options.device_indexes[i]) {
+      devices[i] = devices[i]->next_;
+    }
+    if (!devices[i]) return kErrorUnknownDevice;
+  }
+  *capture = new FrameSetCapture(devices, options);
+  return kErrorSuccess;
+}
+
+ErrorCode Connection::AddFrameListener(Device* device,
+                                       const FrameListenerOptions& options,
+                                       FrameListener* listener) {
+  if (!listener ||
+      (options.stream != kStreamMaskVideo &&
+       options.stream != kStreamMaskDepth) ||
+      (options.policy != kListenerLatestOnly &&
+       options.policy != kListenerQueue) ||
+      options.queue_depth < 1 || options.queue_depth >= kMaxFrameLeases) {
+    return kErrorInvalidArgument;
+  }
+
+  Autolock l(mutex_);
+  Device* found_device = devices_;
+  while (found_device && found_device != device) {
+    found_device = found_device->next_;
+  }
+  if (!found_device) return kErrorUnknownDevice;
+  if (!frame_dispatcher_) {
+    // Listener methods read the dispatcher without the connection lock.
+    __atomic_store_n(&frame_dispatcher_,
+                     new FrameDispatcher(DISPATCH_THREAD_COUNT),
+                     __ATOMIC_RELEASE);
+  }
+  if (!frame_dispatcher_->AddListener(device, options, listener)) {
+    return kErrorInvalidArgument;
+  }
+  return kErrorSuccess;
+}
+
+ErrorCode Connection::RemoveFrameListener(FrameListener* listener) {
+  FrameDispatcher* dispatcher =
+      __atomic_load_n(&frame_dispatcher_, __ATOMIC_ACQUIRE);
+  if (!dispatcher || !dispatcher->RemoveListener(listener)) {
+    return kErrorInvalidArgument;
+  }
+  return kErrorSuccess;
+}
+
+ErrorCode Connection::GetFrameListenerStats(FrameListener* listener,
+                                            FrameListenerStats* stats) const {
+  FrameDispatcher* dispatcher =
+      __atomic_load_n(&frame_dispatcher_, __ATOMIC_ACQUIRE);
+  if (!dispatcher || !dispatcher->GetListenerStats(listener, stats)) {
+    return kErrorInvalidArgument;
+  }
+  return kErrorSuccess;
+}
+
 void Connection::CloseDevice(Device* device) {
+  StopDeviceCallbacks(device);
   Autolock l(mutex_);
   CloseDeviceLocked(device);
 }
 
+void Connection::StopDeviceCallbacks(Device* device) {
+  FrameDispatcher* dispatcher =
+      __atomic_load_n(&frame_dispatcher_, __ATOMIC_ACQUIRE);
+  if (dispatcher) dispatcher->RemoveDevice(device);
+  device_events_->RemoveDevice(device);
+}
+
 void Connection::CloseDeviceLocked(Device* device) {
   Device* prev_device = NULL;
   Device* found_device = devices_;
@@ -95,7 +308,11 @@ void Connection::CloseDeviceLocked(Device* device) {
     CHECK(found_device == devices_);
     devices_ = devices_->next_;
   }
+  if (frame_dispatcher_) frame_dispatcher_->RemoveDevice(found_device);
+  device_events_->RemoveDevice(found_device);
   CloseDeviceInternalLocked(found_device);
+  // Drop the events that the device reported while closing.
+  device_events_->RemoveDevice(found_device);
 }
 
 }  // namespace kkonnect
@@ -0,0 +1,596 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <kk_depth_codec.h>
+
+#include "src/utils.h"
+
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace kkonnect {
+
+// Encoded frame header: magic (2 bytes), version, mode, width (u16),
+// height (u16). All integers are little-endian.
+#define DEPTH_CODEC_HEADER_SIZE   8
+#define DEPTH_CODEC_MAGIC_0       'K'
+#define DEPTH_CODEC_MAGIC_1       'D'
+#define DEPTH_CODEC_VERSION       1
+
+// Modes of the encoded frame data.
+#define DEPTH_CODEC_MODE_RICE     0
+#define DEPTH_CODEC_MODE_STORED   1
+
+// Rice quotients of this size are escaped and followed by a raw 16-bit
+// value. This bounds the size of a code to 41 bits.
+#define RICE_ESCAPE_QUOTIENT      24
+
+// Rice statistics are halved after this many values, so that the
+// parameter follows the local noise level.
+#define RICE_RESET_COUNT          64
+
+// Runs are coded with Exp-Golomb codes of at most this many value bits.
+// Longer runs are split into several tokens.
+#define RUN_MAX_BITS              24
+
+static inline uint64_t LoadLittleEndian64(const uint8_t* src) {
+  uint64_t value;
+  memcpy(&value, src, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+static inline void StoreLittleEndian32(uint8_t* dst, uint32_t value) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap32(value);
+#endif
+  memcpy(dst, &value, sizeof(value));
+}
+
+// Writes bits starting from the least significant bit of each byte.
+class BitWriter {
+ public:
+  BitWriter(uint8_t* data, int capacity)
+      : data_(data), capacity_(capacity), pos_(0), bits_(0), count_(0) {}
+
+  // Appends the lowest |count| bits of |value|. |count| is at most 32.
+  inline void Put(uint32_t value, int count) {
+    bits_ |= ((uint64_t) value) << count_;
+    count_ += count;
+    if (count_ >= 32) {
+      if (pos_ + 4 <= capacity_) {
+        StoreLittleEndian32(data_ + pos_, (uint32_t) bits_);
+      }
+      pos_ += 4;
+      bits_ >>= 32;
+      count_ -= 32;
+    }
+  }
+
+  void Flush() {
+    while (count_ > 0) {
+      if (pos_ < capacity_) data_[pos_] = (uint8_t) bits_;
+      ++pos_;
+      bits_ >>= 8;
+      count_ -= 8;
+    }
+    count_ = 0;
+  }
+
+  // Returns true if the data did not fit into the capacity.
+  bool IsOverflow() const { return pos_ > capacity_; }
+
+  int GetSize() const { return pos_; }
+
+ private:
+  uint8_t* data_;
+  int capacity_;
+  int pos_;
+  uint64_t bits_;
+  int count_;
+};
+
+// Reads bits written by BitWriter. Reading past the end yields zero
+// bits, which is detected with IsOverrun().
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, int size)
+      : data_(data), size_(size), pos_(0), bits_(0), count_(0) {}
+
+  // Ensures that at least 56 bits are buffered.
+  inline void Refill() {
+    if (size_ - pos_ >= 8) {
+      bits_ |= LoadLittleEndian64(data_ + pos_) << count_;
+      pos_ += (63 - count_) >> 3;
+      count_ |= 56;
+      return;
+    }
+    while (count_ <= 56) {
+      uint64_t byte = pos_ < size_ ? data_[pos_] : 0;
+      bits_ |= byte << count_;
+      ++pos_;
+      count_ += 8;
+    }
+  }
+
+  // Returns the number of zero bits before the next one bit, without
+  // consuming them. Returns 64 if all buffered bits are zero.
+  inline int PeekUnary() const {
+    return bits_ ? __builtin_ctzll(bits_) : 64;
+  }
+
+  inline uint32_t Read(int count) {
+    uint32_t value = (uint32_t) (bits_ & ((((uint64_t) 1) << count) - 1));
+    bits_ >>= count;
+    count_ -= count;
+    return value;
+  }
+
+  bool IsOverrun() const { return pos_ - (count_ >> 3) > size_; }
+
+ private:
+  const uint8_t* data_;
+  int size_;
+  int pos_;
+  uint64_t bits_;
+  int count_;
+};
+
+// Tracks the mean magnitude of coded values to select the Rice parameter,
+// as in LOCO-I.
+class RiceContext {
+ public:
+  RiceContext() : sum_(16), count_(1) {}
+
+  inline int GetParameter() const {
+    int k = 0;
+    while ((count_ << k) < sum_) ++k;
+    return k;
+  }
+
+  inline void Update(uint32_t value) {
+    sum_ += value;
+    if (++count_ == RICE_RESET_COUNT) {
+      sum_ >>= 1;
+      count_ >>= 1;
+    }
+  }
+
+ private:
+  uint32_t sum_;
+  uint32_t count_;
+};
+
+static inline void PutRice(BitWriter* writer, uint32_t value, int k) {
+  uint32_t quotient = value >> k;
+  if (quotient < RICE_ESCAPE_QUOTIENT) {
+    writer->Put(1 << quotient, quotient + 1);
+    writer->Put(value & ((1 << k) - 1), k);
+  } else {
+    writer->Put(1 << RICE_ESCAPE_QUOTIENT, RICE_ESCAPE_QUOTIENT + 1);
+    writer->Put(value, 16);
+  }
+}
+
+// Requires a refilled reader. Returns false on malformed data.
+static inline bool GetRice(BitReader* reader, int k, uint32_t* value) {
+  int quotient = reader->PeekUnary();
+  if (quotient > RICE_ESCAPE_QUOTIENT) return false;
+  reader->Read(quotient + 1);
+  if (quotient == RICE_ESCAPE_QUOTIENT) {
+    *value = reader->Read(16);
+  } else {
+    *value = (quotient << k) | reader->Read(k);
+  }
+  return *value <= 0xFFFF;
+}
+
+// Emits runs of zero residuals as Rice-coded zero markers, followed by
+// the Exp-Golomb coded run length.
+static void PutRun(BitWriter* writer, uint32_t run, int k) {
+  const uint32_t max_run = (1 << (RUN_MAX_BITS + 1)) - 1;
+  while (run) {
+    uint32_t length = run < max_run ? run : max_run;
+    int bits = 31 - __builtin_clz(length);
+    PutRice(writer, 0, k);
+    writer->Put(1 << bits, bits + 1);
+    writer->Put(length & ((1 << bits) - 1), bits);
+    run -= length;
+  }
+}
+
+// Requires a refilled reader. Returns false on malformed data.
+static inline bool GetRunLength(BitReader* reader, uint32_t* run) {
+  int bits = reader->PeekUnary();
+  if (bits > RUN_MAX_BITS) return false;
+  reader->Read(bits + 1);
+  *run = (1 << bits) | reader->Read(bits);
+  return true;
+}
+
+// Residuals use modular 16-bit arithmetic, so they are exactly reversible
+// and fit into 16-bit SIMD lanes. The prediction error is mapped to
+// an unsigned value with zigzag coding.
+static inline uint16_t ZigZag(uint16_t value) {
+  return (uint16_t) ((value << 1) ^ (uint16_t) (((int16_t) value) >> 15));
+}
+
+static inline uint16_t UnZigZag(uint16_t value) {
+  return (uint16_t) ((value >> 1) ^ -(value & 1));
+}
+
+// Computes residuals of row[x] against up[x] + row[x - 1] - up[x - 1],
+// starting at |start|.
+static void ComputeResidualsFrom(const uint16_t* row, const uint16_t* up,
+                                 uint16_t* residuals, int start, int width) {
+  uint16_t prev = start ? (uint16_t) (row[start - 1] - up[start - 1]) : 0;
+  for (int x = start; x < width; ++x) {
+    uint16_t delta = row[x] - up[x];
+    residuals[x] = ZigZag(delta - prev);
+    prev = delta;
+  }
+}
+
+// Inverts ComputeResidualsFrom(), starting at |start|.
+static void ReconstructFrom(const uint16_t* residuals, const uint16_t* up,
+                            uint16_t* row, int start, int width) {
+  uint16_t prev = start ? (uint16_t) (row[start - 1] - up[start - 1]) : 0;
+  for (int x = start; x < width; ++x) {
+    prev += UnZigZag(residuals[x]);
+    row[x] = prev + up[x];
+  }
+}
+
+static void ComputeResidualsScalar(const uint16_t* row, const uint16_t* up,
+                                   uint16_t* residuals, int width) {
+  ComputeResidualsFrom(row, up, residuals, 0, width);
+}
+
+static void ReconstructScalar(const uint16_t* residuals, const uint16_t* up,
+                              uint16_t* row, int width) {
+  ReconstructFrom(residuals, up, row, 0, width);
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+__attribute__((target("sse2")))
+static void ComputeResidualsSse2(const uint16_t* row, const uint16_t* up,
+                                 uint16_t* residuals, int width) {
+  int x = 1;
+  for (; x + 8 <= width; x += 8) {
+    __m128i delta = _mm_sub_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x)));
+    __m128i prev = _mm_sub_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x - 1)));
+    __m128i value = _mm_sub_epi16(delta, prev);
+    value = _mm_xor_si128(_mm_slli_epi16(value, 1), _mm_srai_epi16(value, 15));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(residuals + x), value);
+  }
+  ComputeResidualsFrom(row, up, residuals, 0, 1);
+  ComputeResidualsFrom(row, up, residuals, x, width);
+}
+
+__attribute__((target("sse2")))
+static void ReconstructSse2(const uint16_t* residuals, const uint16_t* up,
+                            uint16_t* row, int width) {
+  const __m128i one = _mm_set1_epi16(1);
+  __m128i carry = _mm_setzero_si128();
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(residuals + x));
+    value = _mm_xor_si128(
+        _mm_srli_epi16(value, 1),
+        _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(value, one)));
+    // Prefix sum of the row deltas.
+    value = _mm_add_epi16(value, _mm_slli_si128(value, 2));
+    value = _mm_add_epi16(value, _mm_slli_si128(value, 4));
+    value = _mm_add_epi16(value, _mm_slli_si128(value, 8));
+    __m128i delta = _mm_add_epi16(value, carry);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(row + x),
+        _mm_add_epi16(delta, _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(up + x))));
+    carry = _mm_shufflehi_epi16(delta, 0xFF);
+    carry = _mm_unpackhi_epi64(carry, carry);
+  }
+  ReconstructFrom(residuals, up, row, x, width);
+}
+
+__attribute__((target("avx2")))
+static void ComputeResidualsAvx2(const uint16_t* row, const uint16_t* up,
+                                 uint16_t* residuals, int width) {
+  int x = 1;
+  for (; x + 16 <= width; x += 16) {
+    __m256i delta = _mm256_sub_epi16(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + x)));
+    __m256i prev = _mm256_sub_epi16(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x - 1)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + x - 1)));
+    __m256i value = _mm256_sub_epi16(delta, prev);
+    value = _mm256_xor_si256(_mm256_slli_epi16(value, 1),
+                             _mm256_srai_epi16(value, 15));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(residuals + x), value);
+  }
+  ComputeResidualsFrom(row, up, residuals, 0, 1);
+  ComputeResidualsFrom(row, up, residuals, x, width);
+}
+
+__attribute__((target("avx2")))
+static void ReconstructAvx2(const uint16_t* residuals, const uint16_t* up,
+                            uint16_t* row, int width) {
+  const __m256i one = _mm256_set1_epi16(1);
+  __m256i carry = _mm256_setzero_si256();
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(residuals + x));
+    value = _mm256_xor_si256(
+        _mm256_srli_epi16(value, 1),
+        _mm256_sub_epi16(_mm256_setzero_si256(),
+                         _mm256_and_si256(value, one)));
+    // Prefix sums within each 128-bit lane, then the sum of the low lane
+    // is added to the high lane.
+    value = _mm256_add_epi16(value, _mm256_slli_si256(value, 2));
+    value = _mm256_add_epi16(value, _mm256_slli_si256(value, 4));
+    value = _mm256_add_epi16(value, _mm256_slli_si256(value, 8));
+    __m256i low_sum = _mm256_shufflehi_epi16(value, 0xFF);
+    low_sum = _mm256_unpackhi_epi64(low_sum, low_sum);
+    value = _mm256_add_epi16(
+        value, _mm256_permute2x128_si256(low_sum, low_sum, 0x08));
+    __m256i delta = _mm256_add_epi16(value, carry);
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(row + x),
+        _mm256_add_epi16(delta, _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(up + x))));
+    carry = _mm256_shufflehi_epi16(delta, 0xFF);
+    carry = _mm256_unpackhi_epi64(carry, carry);
+    carry = _mm256_permute2x128_si256(carry, carry, 0x11);
+  }
+  ReconstructFrom(residuals, up, row, x, width);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+struct DepthCodec::Kernels {
+  const char* name;
+  void (*compute_residuals)(const uint16_t* row, const uint16_t* up,
+                            uint16_t* residuals, int width);
+  void (*reconstruct)(const uint16_t* residuals, const uint16_t* up,
+                      uint16_t* row, int width);
+};
+
+// static
+const DepthCodec::Kernels* DepthCodec::SelectKernels() {
+  static const Kernels kScalarKernels = {
+      "scalar", ComputeResidualsScalar, ReconstructScalar};
+#ifdef KKONNECT_X86_SIMD
+  static const Kernels kSse2Kernels = {
+      "sse2", ComputeResidualsSse2, ReconstructSse2};
+  static const Kernels kAvx2Kernels = {
+      "avx2", ComputeResidualsAvx2, ReconstructAvx2};
+  if (HasCpuFeature(kCpuFeatureAvx2)) return &kAvx2Kernels;
+  if (HasCpuFeature(kCpuFeatureSse2)) return &kSse2Kernels;
+#endif
+  return &kScalarKernels;
+}
+
+DepthCodec::DepthCodec()
+    : kernels_(SelectKernels()), row_width_(0),
+      zero_row_(NULL), residual_row_(NULL) {}
+
+DepthCodec::~DepthCodec() {
+  delete[] zero_row_;
+  delete[] residual_row_;
+}
+
+const char* DepthCodec::GetKernelName() const {
+  return kernels_->name;
+}
+
+void DepthCodec::AllocateRows(int width) {
+  if (width <= row_width_) return;
+  delete[] zero_row_;
+  delete[] residual_row_;
+  zero_row_ = new uint16_t[width];
+  residual_row_ = new uint16_t[width];
+  memset(zero_row_, 0, width * sizeof(uint16_t));
+  row_width_ = width;
+}
+
+// static
+int DepthCodec::GetMaxEncodedSize(int width, int height) {
+  return DEPTH_CODEC_HEADER_SIZE + width * height * 2;
+}
+
+// static
+ErrorCode DepthCodec::GetEncodedFrameSize(
+    const uint8_t* src, int src_size, int* width, int* height) {
+  if (src_size < DEPTH_CODEC_HEADER_SIZE ||
+      src[0] != DEPTH_CODEC_MAGIC_0 || src[1] != DEPTH_CODEC_MAGIC_1 ||
+      src[2] != DEPTH_CODEC_VERSION) {
+    return kErrorInvalidArgument;
+  }
+  *width = src[4] | (src[5] << 8);
+  *height = src[6] | (src[7] << 8);
+  return kErrorSuccess;
+}
+
+// Copies rows in little-endian byte order.
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static void CopyRowsStored(uint8_t* dst, const uint8_t* src, int width,
+                           int height, int dst_row_size, int src_row_size) {
+  for (int y = 0; y < height; ++y) {
+    const uint16_t* src_row = reinterpret_cast<const uint16_t*>(src);
+    uint16_t* dst_row = reinterpret_cast<uint16_t*>(dst);
+    for (int x = 0; x < width; ++x) {
+      dst_row[x] = __builtin_bswap16(src_row[x]);
+    }
+    dst += dst_row_size;
+    src += src_row_size;
+  }
+}
+#else
+// Row sizes are always at least |width| pixels, so rows are copied
+// as they are.
+static void CopyRowsStored(uint8_t* dst, const uint8_t* src, int,
+                           int height, int dst_row_size, int src_row_size) {
+  CopyImageData(dst, src, dst_row_size, src_row_size, height);
+}
+#endif
+
+ErrorCode DepthCodec::Encode(const uint16_t* src, int width, int height,
+                             int src_row_size, uint8_t* dst,
+                             int dst_capacity, int* encoded_size) {
+  if (!src_row_size) src_row_size = width * 2;
+  if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF ||
+      src_row_size < width * 2 || (src_row_size & 1) ||
+      dst_capacity < GetMaxEncodedSize(width, height)) {
+    return kErrorInvalidArgument;
+  }
+  AllocateRows(width);
+
+  dst[0] = DEPTH_CODEC_MAGIC_0;
+  dst[1] = DEPTH_CODEC_MAGIC_1;
+  dst[2] = DEPTH_CODEC_VERSION;
+  dst[3] = DEPTH_CODEC_MODE_RICE;
+  dst[4] = width & 0xFF;
+  dst[5] = width >> 8;
+  dst[6] = height & 0xFF;
+  dst[7] = height >> 8;
+
+  // The coded data may not exceed the size of the stored frame.
+  int raw_size = width * height * 2;
+  BitWriter writer(dst + DEPTH_CODEC_HEADER_SIZE, raw_size);
+  RiceContext context;
+  uint32_t run = 0;
+  const uint16_t* up = zero_row_;
+  const uint8_t* row_data = reinterpret_cast<const uint8_t*>(src);
+  for (int y = 0; y < height && !writer.IsOverflow(); ++y) {
+    const uint16_t* row = reinterpret_cast<const uint16_t*>(row_data);
+    kernels_->compute_residuals(row, up, residual_row_, width);
+    for (int x = 0; x < width; ++x) {
+      uint32_t value = residual_row_[x];
+      if (!value) {
+        ++run;
+        continue;
+      }
+      int k = context.GetParameter();
+      if (run) {
+        PutRun(&writer, run, k);
+        run = 0;
+      }
+      PutRice(&writer, value, k);
+      context.Update(value);
+    }
+    up = row;
+    row_data += src_row_size;
+  }
+  if (run) PutRun(&writer, run, context.GetParameter());
+  writer.Flush();
+
+  if (writer.IsOverflow()) {
+    dst[3] = DEPTH_CODEC_MODE_STORED;
+    CopyRowsStored(dst + DEPTH_CODEC_HEADER_SIZE,
+                   reinterpret_cast<const uint8_t*>(src), width, height,
+                   width * 2, src_row_size);
+    *encoded_size = DEPTH_CODEC_HEADER_SIZE + raw_size;
+  } else {
+    *encoded_size = DEPTH_CODEC_HEADER_SIZE + writer.GetSize();
+  }
+  return kErrorSuccess;
+}
+
+ErrorCode DepthCodec::Decode(const uint8_t* src, int src_size, uint16_t* dst,
+                             int width, int height, int dst_row_size) {
+  if (!dst_row_size) dst_row_size = width * 2;
+  int encoded_width, encoded_height;
+  if (GetEncodedFrameSize(src, src_size, &encoded_width, &encoded_height) ||
+      encoded_width != width || encoded_height != height || width <= 0 ||
+      height <= 0 || dst_row_size < width * 2 || (dst_row_size & 1)) {
+    return kErrorInvalidArgument;
+  }
+  int raw_size = width * height * 2;
+  const uint8_t* data = src + DEPTH_CODEC_HEADER_SIZE;
+  int data_size = src_size - DEPTH_CODEC_HEADER_SIZE;
+
+  if (src[3] == DEPTH_CODEC_MODE_STORED) {
+    if (data_size != raw_size) return kErrorInvalidArgument;
+    CopyRowsStored(reinterpret_cast<uint8_t*>(dst), data, width, height,
+                   dst_row_size, width * 2);
+    return kErrorSuccess;
+  }
+  if (src[3] != DEPTH_CODEC_MODE_RICE) return kErrorInvalidArgument;
+
+  AllocateRows(width);
+  BitReader reader(data, data_size);
+  RiceContext context;
+  uint32_t run = 0;
+  uint32_t pixels_left = width * height;
+  const uint16_t* up = zero_row_;
+  uint8_t* row_data = reinterpret_cast<uint8_t*>(dst);
+  for (int y = 0; y < height; ++y) {
+    uint16_t* row = reinterpret_cast<uint16_t*>(row_data);
+    int x = 0;
+    while (x < width) {
+      if (run) {
+        uint32_t length = (uint32_t) (width - x);
+        if (run < length) length = run;
+        memset(residual_row_ + x, 0, length * sizeof(uint16_t));
+        x += length;
+        run -= length;
+        pixels_left -= length;
+        continue;
+      }
+      reader.Refill();
+      uint32_t value;
+      int k = context.GetParameter();
+      if (!GetRice(&reader, k, &value)) return kErrorInvalidArgument;
+      if (!value) {
+        reader.Refill();
+        if (!GetRunLength(&reader, &run) || run > pixels_left) {
+          return kErrorInvalidArgument;
+        }
+        continue;
+      }
+      residual_row_[x++] = value;
+      --pixels_left;
+      context.Update(value);
+    }
+    kernels_->reconstruct(residual_row_, up, row, width);
+    up = row;
+    row_data += dst_row_size;
+  }
+  return reader.IsOverrun() ? kErrorInvalidArgument : kErrorSuccess;
+}
+
+}  // namespace kkonnect
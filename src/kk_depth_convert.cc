@@ -0,0 +1,123 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_depth_convert.h"
+
+#include <float.h>
+
+#include "src/utils.h"
+
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace kkonnect {
+
+#define MAX_DEPTH_MM   65535.0f
+
+static inline uint16_t ConvertDepthValue(float value) {
+  // Catches NaN and positive infinity.
+  if (!(value <= FLT_MAX)) return 0;
+  if (value <= 0) return 0;
+  if (value > MAX_DEPTH_MM) value = MAX_DEPTH_MM;
+  return (uint16_t) (value + 0.5f);
+}
+
+void ConvertDepthFloatToMmScalar(const float* src, uint16_t* dst,
+                                 int count) {
+  for (int i = 0; i < count; ++i) {
+    dst[i] = ConvertDepthValue(src[i]);
+  }
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// The SIMD paths follow the scalar one step by step: invalid values are
+// masked to zero, the rest is clamped, offset by 0.5 and truncated.
+__attribute__((target("sse4.1")))
+static inline __m128i ConvertDepthSse41(__m128 value) {
+  __m128 valid = _mm_cmple_ps(value, _mm_set1_ps(FLT_MAX));
+  value = _mm_max_ps(value, _mm_setzero_ps());
+  value = _mm_min_ps(value, _mm_set1_ps(MAX_DEPTH_MM));
+  value = _mm_and_ps(value, valid);
+  return _mm_cvttps_epi32(_mm_add_ps(value, _mm_set1_ps(0.5f)));
+}
+
+__attribute__((target("sse4.1")))
+static void ConvertDepthFloatToMmSse41(const float* src, uint16_t* dst,
+                                       int count) {
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i low = ConvertDepthSse41(_mm_loadu_ps(src + i));
+    __m128i high = ConvertDepthSse41(_mm_loadu_ps(src + i + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi32(low, high));
+  }
+  ConvertDepthFloatToMmScalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ConvertDepthAvx2(__m256 value) {
+  __m256 valid = _mm256_cmp_ps(value, _mm256_set1_ps(FLT_MAX), _CMP_LE_OQ);
+  value = _mm256_max_ps(value, _mm256_setzero_ps());
+  value = _mm256_min_ps(value, _mm256_set1_ps(MAX_DEPTH_MM));
+  value = _mm256_and_ps(value, valid);
+  return _mm256_cvttps_epi32(_mm256_add_ps(value, _mm256_set1_ps(0.5f)));
+}
+
+__attribute__((target("avx2")))
+static void ConvertDepthFloatToMmAvx2(const float* src, uint16_t* dst,
+                                      int count) {
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i low = ConvertDepthAvx2(_mm256_loadu_ps(src + i));
+    __m256i high = ConvertDepthAvx2(_mm256_loadu_ps(src + i + 8));
+    // Packing works within 128-bit lanes, which leaves the quarters in
+    // 0, 2, 1, 3 order.
+    __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+  }
+  ConvertDepthFloatToMmScalar(src + i, dst + i, count - i);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+void ConvertDepthFloatToMm(const float* src, uint16_t* dst, int count) {
+#ifdef KKONNECT_X86_SIMD
+  if (HasCpuFeature(kCpuFeatureAvx2)) {
+    ConvertDepthFloatToMmAvx2(src, dst, count);
+    return;
+  }
+  if (HasCpuFeature(kCpuFeatureSse41)) {
+    ConvertDepthFloatToMmSse41(src, dst, count);
+    return;
+  }
+#endif
+  ConvertDepthFloatToMmScalar(src, dst, count);
+}
+
+}  // namespace kkonnect
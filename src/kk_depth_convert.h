@@ -0,0 +1,45 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_DEPTH_CONVERT_H_
+#define KKONNECT_KK_DEPTH_CONVERT_H_
+
+#include <stdint.h>
+
+namespace kkonnect {
+
+// Converts |count| float depth values in mm, as produced by libfreenect2,
+// into 16-bit mm values. Values are rounded to the nearest integer and
+// clamped to 65535. NaN, infinite and non-positive values become 0, which
+// marks invalid depth.
+void ConvertDepthFloatToMm(const float* src, uint16_t* dst, int count);
+
+// Same as above, but always uses the scalar reference implementation.
+void ConvertDepthFloatToMmScalar(const float* src, uint16_t* dst, int count);
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_DEPTH_CONVERT_H_
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_depth_registration.h"
+
+#include <string.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Fixed-point scale of the X coordinates in the libfreenect tables.
+#define REG_X_VAL_SCALE   256
+
+// Written to compile without branches: an empty target wraps around to
+// the largest value and always takes the new depth.
+static inline void StoreClosest(uint16_t* dst, int target, uint16_t depth) {
+  uint16_t current = dst[target];
+  dst[target] = (uint16_t) (current - 1) < (uint16_t) (depth - 1) ?
+      current : depth;
+}
+
+DepthRegistration::DepthRegistration()
+    : width_(0), height_(0), max_depth_(0), x_base_(NULL),
+      target_row_(NULL), x_shift_(NULL) {}
+
+DepthRegistration::~DepthRegistration() {
+  delete[] x_base_;
+  delete[] target_row_;
+  delete[] x_shift_;
+}
+
+void DepthRegistration::Init(
+    int width, int height, const int32_t (*registration_table)[2],
+    const int32_t* depth_to_rgb_shift, int max_depth, int target_offset) {
+  CHECK(!x_base_);
+  CHECK(width > 0 && height > 0 && max_depth > 0);
+  width_ = width;
+  height_ = height;
+  max_depth_ = max_depth;
+  int pixel_count = width * height;
+  x_base_ = new int32_t[pixel_count];
+  target_row_ = new int32_t[pixel_count];
+  for (int i = 0; i < pixel_count; ++i) {
+    x_base_[i] = registration_table[i][0];
+    target_row_[i] = registration_table[i][1] * width - target_offset;
+  }
+  x_shift_ = new int32_t[max_depth];
+  memcpy(x_shift_, depth_to_rgb_shift, max_depth * sizeof(int32_t));
+}
+
+// Unsigned comparisons reject negative coordinates, as libfreenect does.
+void DepthRegistration::Apply(const uint16_t* src, uint16_t* dst) const {
+  CHECK(x_base_);
+  // Locals let the compiler keep the tables in registers.
+  const int32_t* x_base = x_base_;
+  const int32_t* target_row = target_row_;
+  const int32_t* x_shift = x_shift_;
+  uint32_t width = width_;
+  int max_depth = max_depth_;
+  int pixel_count = width_ * height_;
+  memset(dst, 0, pixel_count * sizeof(uint16_t));
+  for (int i = 0; i < pixel_count; ++i) {
+    uint16_t depth = src[i];
+    if (!depth || depth >= max_depth) continue;
+    // Truncates toward zero, so that small negative values land on the
+    // first column like in libfreenect.
+    int32_t x = (x_base[i] + x_shift[depth]) / REG_X_VAL_SCALE;
+    if ((uint32_t) x >= width) continue;
+    uint32_t target = (uint32_t) (target_row[i] + x);
+    if (target >= (uint32_t) pixel_count) continue;
+    StoreClosest(dst, target, depth);
+  }
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,81 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_DEPTH_REGISTRATION_H_
+#define KKONNECT_KK_DEPTH_REGISTRATION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace kkonnect {
+
+// Maps Kinect1 depth frames in mm onto the pixel grid of the video
+// camera, producing kImageFormatDepthRegistered frames. This follows
+// freenect_apply_registration(), but works on frames already converted
+// to mm, precomputes everything that does not depend on depth, and
+// resolves overlapping pixels without branches.
+//
+// When several depth pixels land on the same video pixel, the closest
+// one wins. Video pixels that no depth pixel maps to are set to 0.
+class DepthRegistration {
+ public:
+  DepthRegistration();
+  ~DepthRegistration();
+
+  // Builds the lookup tables from the device calibration, as found in
+  // freenect_registration. |registration_table| holds width * height
+  // pairs of fixed-point X and integer Y target coordinates,
+  // |depth_to_rgb_shift| holds the fixed-point X shift for every depth
+  // value below |max_depth|. Target indexes are offset by
+  // -|target_offset|. The tables are copied.
+  void Init(int width, int height, const int32_t (*registration_table)[2],
+            const int32_t* depth_to_rgb_shift, int max_depth,
+            int target_offset);
+
+  bool IsInitialized() const { return x_base_ != NULL; }
+
+  // Maps the |src| frame into |dst|. Both frames are packed, of the
+  // dimensions given to Init(), and must not overlap.
+  void Apply(const uint16_t* src, uint16_t* dst) const;
+
+ private:
+  int width_;
+  int height_;
+  int max_depth_;
+  // Per depth pixel: the fixed-point X coordinate before the depth
+  // dependent shift, and the index of the first pixel of the target row.
+  int32_t* x_base_;
+  int32_t* target_row_;
+  // Per depth value below |max_depth_|.
+  int32_t* x_shift_;
+
+  DepthRegistration(const DepthRegistration& src);
+  DepthRegistration& operator=(const DepthRegistration& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_DEPTH_REGISTRATION_H_
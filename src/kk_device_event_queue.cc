@@ -0,0 +1,236 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_device_event_queue.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+DeviceEventQueue::DeviceEventQueue()
+    : head_(0), count_(0), dropped_count_(0), event_fd_(-1),
+      pending_opens_(NULL), has_callback_thread_(false),
+      should_exit_(false), running_device_(NULL) {
+  pthread_mutex_init(&mutex_, NULL);
+  InitMonotonicCond(&event_cond_);
+  pthread_cond_init(&callback_cond_, NULL);
+}
+
+DeviceEventQueue::~DeviceEventQueue() {
+  bool has_callback_thread;
+  {
+    Autolock l(mutex_);
+    should_exit_ = true;
+    has_callback_thread = has_callback_thread_;
+    pthread_cond_broadcast(&callback_cond_);
+  }
+  if (has_callback_thread) pthread_join(callback_thread_, NULL);
+  while (pending_opens_) {
+    PendingOpen* open = pending_opens_;
+    pending_opens_ = open->next;
+    delete open;
+  }
+  if (event_fd_ != -1) close(event_fd_);
+  pthread_cond_destroy(&callback_cond_);
+  pthread_cond_destroy(&event_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void DeviceEventQueue::Push(Device* device, int device_index,
+                            DeviceEventType type, ErrorCode status) {
+  Autolock l(mutex_);
+  if (count_ == kMaxDeviceEvents) {
+    head_ = (head_ + 1) % kMaxDeviceEvents;
+    --count_;
+    ++dropped_count_;
+  }
+  DeviceEvent& event = events_[(head_ + count_) % kMaxDeviceEvents];
+  event.device = device;
+  event.device_index = device_index;
+  event.type = type;
+  event.status = status;
+  event.host_time_us = GetCurrentMicros();
+  event.dropped_events = dropped_count_;
+  dropped_count_ = 0;
+  ++count_;
+  pthread_cond_broadcast(&event_cond_);
+
+  if (event_fd_ != -1) {
+    uint64_t value = 1;
+    if (write(event_fd_, &value, sizeof(value)) != sizeof(value) &&
+        errno != EAGAIN) {
+      REPORT_ERRNO("write(eventfd)");
+    }
+  }
+
+  if (type == kDeviceEventConnected || type == kDeviceEventFailed) {
+    CompleteOpenLocked(device, status);
+  }
+}
+
+bool DeviceEventQueue::Pop(DeviceEvent* event, int timeout_ms) {
+  uint64_t deadline = GetCurrentMillis() + (timeout_ms > 0 ? timeout_ms : 0);
+  Autolock l(mutex_);
+  while (!count_) {
+    if (!timeout_ms) return false;
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&event_cond_, &mutex_);
+    } else if (!WaitCondUntil(&event_cond_, &mutex_, deadline)) {
+      if (!count_) return false;
+    }
+  }
+  *event = events_[head_];
+  head_ = (head_ + 1) % kMaxDeviceEvents;
+  --count_;
+  if (!count_) ResetEventFdLocked();
+  return true;
+}
+
+int DeviceEventQueue::GetEventFd() {
+  Autolock l(mutex_);
+  if (event_fd_ == -1) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+      REPORT_ERRNO("eventfd");
+      return -1;
+    }
+    // Events that are already queued should wake up the new listener.
+    if (count_) {
+      uint64_t value = 1;
+      if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+        REPORT_ERRNO("write(eventfd)");
+      }
+    }
+    event_fd_ = fd;
+  }
+  return event_fd_;
+}
+
+void DeviceEventQueue::ResetEventFdLocked() {
+  if (event_fd_ == -1) return;
+  uint64_t value;
+  if (read(event_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    REPORT_ERRNO("read(eventfd)");
+  }
+}
+
+void DeviceEventQueue::AddOpenCallback(Device* device,
+                                       DeviceOpenCallback* callback) {
+  Autolock l(mutex_);
+  PendingOpen* open = new PendingOpen();
+  open->device = device;
+  open->callback = callback;
+  open->is_complete = false;
+  open->status = kErrorInProgress;
+  open->next = pending_opens_;
+  pending_opens_ = open;
+  if (!has_callback_thread_) {
+    CHECK(!pthread_create(&callback_thread_, NULL, RunCallbackThread, this));
+    has_callback_thread_ = true;
+  }
+}
+
+void DeviceEventQueue::CompleteOpen(Device* device, ErrorCode status) {
+  Autolock l(mutex_);
+  CompleteOpenLocked(device, status);
+}
+
+void DeviceEventQueue::CompleteOpenLocked(Device* device, ErrorCode status) {
+  for (PendingOpen* open = pending_opens_; open; open = open->next) {
+    if (open->device != device || open->is_complete) continue;
+    open->is_complete = true;
+    open->status = status;
+    pthread_cond_broadcast(&callback_cond_);
+  }
+}
+
+void DeviceEventQueue::RemoveDevice(Device* device) {
+  Autolock l(mutex_);
+  int kept_count = 0;
+  for (int i = 0; i < count_; ++i) {
+    const DeviceEvent& event = events_[(head_ + i) % kMaxDeviceEvents];
+    if (event.device == device) continue;
+    events_[(head_ + kept_count++) % kMaxDeviceEvents] = event;
+  }
+  count_ = kept_count;
+  if (!count_) ResetEventFdLocked();
+
+  PendingOpen** link = &pending_opens_;
+  while (*link) {
+    PendingOpen* open = *link;
+    if (open->device == device) {
+      *link = open->next;
+      delete open;
+    } else {
+      link = &open->next;
+    }
+  }
+
+  if (has_callback_thread_ &&
+      pthread_equal(callback_thread_, pthread_self())) {
+    return;
+  }
+  while (running_device_ == device) {
+    pthread_cond_wait(&callback_cond_, &mutex_);
+  }
+}
+
+// static
+void* DeviceEventQueue::RunCallbackThread(void* arg) {
+  reinterpret_cast<DeviceEventQueue*>(arg)->RunCallbackThread();
+  return NULL;
+}
+
+void DeviceEventQueue::RunCallbackThread() {
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    PendingOpen* open = NULL;
+    PendingOpen** link = NULL;
+    while (!should_exit_) {
+      link = &pending_opens_;
+      while (*link && !(*link)->is_complete) link = &(*link)->next;
+      open = *link;
+      if (open) break;
+      pthread_cond_wait(&callback_cond_, &mutex_);
+    }
+    if (should_exit_) break;
+
+    *link = open->next;
+    running_device_ = open->device;
+    pthread_mutex_unlock(&mutex_);
+    open->callback->OnDeviceOpened(open->device, open->status);
+    pthread_mutex_lock(&mutex_);
+    running_device_ = NULL;
+    delete open;
+    pthread_cond_broadcast(&callback_cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_DEVICE_EVENT_QUEUE_H_
+#define KKONNECT_KK_DEVICE_EVENT_QUEUE_H_
+
+#include <kk_connection.h>
+#include <pthread.h>
+
+namespace kkonnect {
+
+// Collects status changes of the devices of a connection, and completes
+// Connection::OpenDeviceAsync() calls on a thread of its own, which is
+// started with the first async open.
+class DeviceEventQueue {
+ public:
+  DeviceEventQueue();
+  ~DeviceEventQueue();
+
+  // Called by devices with their own lock held. Never waits for readers
+  // or callbacks.
+  void Push(Device* device, int device_index, DeviceEventType type,
+            ErrorCode status);
+
+  bool Pop(DeviceEvent* event, int timeout_ms);
+  int GetEventFd();
+
+  // Registers |callback| to run when |device| next reports kErrorSuccess
+  // or an error, or when CompleteOpen() is called first.
+  void AddOpenCallback(Device* device, DeviceOpenCallback* callback);
+  // Completes the pending open of |device|, if any. Covers devices that
+  // finished connecting before AddOpenCallback().
+  void CompleteOpen(Device* device, ErrorCode status);
+
+  // Drops the events and the pending open of |device|, and waits for its
+  // running callback, unless called from that callback.
+  void RemoveDevice(Device* device);
+
+ private:
+  struct PendingOpen {
+    Device* device;
+    DeviceOpenCallback* callback;
+    bool is_complete;
+    ErrorCode status;
+    PendingOpen* next;
+  };
+
+  void CompleteOpenLocked(Device* device, ErrorCode status);
+  void ResetEventFdLocked();
+
+  static void* RunCallbackThread(void* arg);
+  void RunCallbackThread();
+
+  mutable pthread_mutex_t mutex_;
+  pthread_cond_t event_cond_;
+  pthread_cond_t callback_cond_;
+  DeviceEvent events_[kMaxDeviceEvents];
+  int head_;
+  int count_;
+  uint32_t dropped_count_;
+  int event_fd_;
+
+  PendingOpen* pending_opens_;
+  bool has_callback_thread_;
+  bool should_exit_;
+  pthread_t callback_thread_;
+  // Device whose callback is running, or NULL.
+  Device* running_device_;
+
+  DeviceEventQueue(const DeviceEventQueue& src);
+  DeviceEventQueue& operator=(const DeviceEventQueue& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_DEVICE_EVENT_QUEUE_H_
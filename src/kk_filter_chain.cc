@@ -0,0 +1,93 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_filter_chain.h"
+
+#include <kk_frame_filter.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+FilterChain::FilterChain() : count_(0) {
+  for (int i = 0; i < kMaxFrameFilters; ++i) {
+    entries_[i].filter = NULL;
+    entries_[i].frame_count = 0;
+    entries_[i].total_us = 0;
+    entries_[i].max_us = 0;
+  }
+}
+
+FilterChain::~FilterChain() {
+  for (int i = 0; i < count_; ++i) {
+    delete entries_[i].filter;
+  }
+}
+
+bool FilterChain::Add(FrameFilter* filter) {
+  int count = __atomic_load_n(&count_, __ATOMIC_RELAXED);
+  if (count >= kMaxFrameFilters) return false;
+  entries_[count].filter = filter;
+  __atomic_store_n(&count_, count + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void FilterChain::Apply(void* data, int row_size, int width, int height,
+                        ImageFormat format) {
+  int count = __atomic_load_n(&count_, __ATOMIC_ACQUIRE);
+  if (!count) return;
+  uint64_t start = GetCurrentMicros();
+  for (int i = 0; i < count; ++i) {
+    Entry& entry = entries_[i];
+    entry.filter->Apply(data, row_size, width, height, format);
+    uint64_t end = GetCurrentMicros();
+    uint64_t elapsed = end - start;
+    start = end;
+    __atomic_store_n(&entry.frame_count, entry.frame_count + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&entry.total_us, entry.total_us + elapsed,
+                     __ATOMIC_RELAXED);
+    if (elapsed > entry.max_us) {
+      __atomic_store_n(&entry.max_us, elapsed, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void FilterChain::GetStats(StreamStats* stats) const {
+  int count = __atomic_load_n(&count_, __ATOMIC_ACQUIRE);
+  stats->filter_count = count;
+  for (int i = 0; i < count; ++i) {
+    const Entry& entry = entries_[i];
+    FilterStats& filter_stats = stats->filters[i];
+    filter_stats.name = entry.filter->GetName();
+    filter_stats.frame_count =
+        __atomic_load_n(&entry.frame_count, __ATOMIC_RELAXED);
+    filter_stats.total_us = __atomic_load_n(&entry.total_us, __ATOMIC_RELAXED);
+    filter_stats.max_us = __atomic_load_n(&entry.max_us, __ATOMIC_RELAXED);
+  }
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FILTER_CHAIN_H_
+#define KKONNECT_KK_FILTER_CHAIN_H_
+
+#include <kk_device.h>
+
+namespace kkonnect {
+
+// Runs the filters attached to a single stream and times every one
+// of them. Filters can be added while the producer runs, since the chain
+// only grows and a filter is fully stored before it becomes visible.
+class FilterChain {
+ public:
+  FilterChain();
+  // Deletes the filters.
+  ~FilterChain();
+
+  // Appends |filter| and takes ownership of it. Returns false if the chain
+  // is full. Calls must be serialized by the caller.
+  bool Add(FrameFilter* filter);
+
+  // Runs all filters on the frame. Must only be called by the producer.
+  void Apply(void* data, int row_size, int width, int height,
+             ImageFormat format);
+
+  // Fills the filter fields of |stats|.
+  void GetStats(StreamStats* stats) const;
+
+ private:
+  struct Entry {
+    FrameFilter* filter;
+    // Written by the producer, read with relaxed atomics.
+    uint64_t frame_count;
+    uint64_t total_us;
+    uint64_t max_us;
+  };
+
+  Entry entries_[kMaxFrameFilters];
+  int count_;  // Atomic.
+
+  FilterChain(const FilterChain& src);
+  FilterChain& operator=(const FilterChain& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FILTER_CHAIN_H_
@@ -0,0 +1,379 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_frame_dispatcher.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Waits are capped to this when a device has no event descriptor.
+#define POLL_FALLBACK_MS   1
+
+FrameDispatcher::FrameDispatcher(int thread_count)
+    : should_exit_(false), entries_(NULL), wake_fd_(-1),
+      poll_devices_(NULL), poll_fds_(NULL), poll_device_count_(0),
+      poll_capacity_(0), has_all_fds_(true), needs_rebuild_(true),
+      poll_epoch_(0), threads_(NULL), thread_count_(thread_count) {
+  CHECK(thread_count > 0);
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&work_cond_, NULL);
+  pthread_cond_init(&idle_cond_, NULL);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  CHECK(wake_fd_ != -1);
+  CHECK(!pthread_create(&poll_thread_, NULL, RunPollThread, this));
+  threads_ = new pthread_t[thread_count];
+  for (int i = 0; i < thread_count; ++i) {
+    CHECK(!pthread_create(&threads_[i], NULL, RunDispatchThread, this));
+  }
+}
+
+FrameDispatcher::~FrameDispatcher() {
+  {
+    Autolock l(mutex_);
+    should_exit_ = true;
+    pthread_cond_broadcast(&work_cond_);
+  }
+  WakePollThread();
+  pthread_join(poll_thread_, NULL);
+  for (int i = 0; i < thread_count_; ++i) {
+    pthread_join(threads_[i], NULL);
+  }
+  delete[] threads_;
+
+  while (entries_) {
+    Entry* entry = entries_;
+    entries_ = entry->next;
+    ClearQueueLocked(entry);
+    delete entry;
+  }
+  delete[] poll_devices_;
+  delete[] poll_fds_;
+  close(wake_fd_);
+  pthread_cond_destroy(&idle_cond_);
+  pthread_cond_destroy(&work_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool FrameDispatcher::AddListener(Device* device,
+                                  const FrameListenerOptions& options,
+                                  FrameListener* listener) {
+  Autolock l(mutex_);
+  if (FindEntryLocked(listener)) return false;
+  Entry* entry = new Entry();
+  entry->listener = listener;
+  entry->device = device;
+  entry->options = options;
+  if (options.policy == kListenerLatestOnly) entry->options.queue_depth = 1;
+  entry->head = 0;
+  entry->count = 0;
+  entry->is_running = false;
+  entry->is_removed = false;
+  entry->next = entries_;
+  entries_ = entry;
+  needs_rebuild_ = true;
+  WakePollThread();
+  return true;
+}
+
+bool FrameDispatcher::RemoveListener(FrameListener* listener) {
+  Autolock l(mutex_);
+  Entry* entry = FindEntryLocked(listener);
+  if (!entry) return false;
+  RemoveEntryLocked(entry);
+  return true;
+}
+
+void FrameDispatcher::RemoveDevice(Device* device) {
+  Autolock l(mutex_);
+  while (true) {
+    // Removal may wait for a callback and let the list change meanwhile,
+    // so the search restarts every time.
+    Entry* entry = entries_;
+    while (entry && entry->device != device) entry = entry->next;
+    if (!entry) break;
+    RemoveEntryLocked(entry);
+  }
+
+  bool is_polled = false;
+  for (int i = 0; i < poll_device_count_; ++i) {
+    if (poll_devices_[i] == device) is_polled = true;
+  }
+  if (!is_polled) return;
+  uint64_t epoch = poll_epoch_;
+  needs_rebuild_ = true;
+  WakePollThread();
+  while (poll_epoch_ == epoch) {
+    pthread_cond_wait(&idle_cond_, &mutex_);
+  }
+}
+
+bool FrameDispatcher::GetListenerStats(FrameListener* listener,
+                                       FrameListenerStats* stats) const {
+  Autolock l(mutex_);
+  Entry* entry = FindEntryLocked(listener);
+  if (!entry) return false;
+  *stats = entry->stats;
+  stats->queue_length = entry->count;
+  return true;
+}
+
+FrameDispatcher::Entry* FrameDispatcher::FindEntryLocked(
+    FrameListener* listener) const {
+  Entry* entry = entries_;
+  while (entry && entry->listener != listener) entry = entry->next;
+  return entry;
+}
+
+void FrameDispatcher::UnlinkEntryLocked(Entry* entry) {
+  Entry** link = &entries_;
+  while (*link != entry) {
+    CHECK(*link);
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  entry->next = NULL;
+}
+
+void FrameDispatcher::RemoveEntryLocked(Entry* entry) {
+  UnlinkEntryLocked(entry);
+  ClearQueueLocked(entry);
+  needs_rebuild_ = true;
+  WakePollThread();
+  if (entry->is_running) {
+    if (pthread_equal(entry->running_thread, pthread_self())) {
+      entry->is_removed = true;
+      return;
+    }
+    while (entry->is_running) {
+      pthread_cond_wait(&idle_cond_, &mutex_);
+    }
+  }
+  delete entry;
+}
+
+void FrameDispatcher::ClearQueueLocked(Entry* entry) {
+  while (entry->count) {
+    ReleaseFrameLocked(entry->queue[entry->head]);
+    entry->head = (entry->head + 1) % kMaxFrameLeases;
+    --entry->count;
+  }
+}
+
+void FrameDispatcher::ReleaseFrameLocked(SharedFrame* frame) {
+  CHECK(frame->ref_count > 0);
+  if (--frame->ref_count) return;
+  frame->device->ReleaseFrame(&frame->lease);
+  delete frame;
+}
+
+void FrameDispatcher::DrainDevicesLocked() {
+  for (int i = 0; i < poll_device_count_; ++i) {
+    Device* device = poll_devices_[i];
+    int streams = 0;
+    for (Entry* entry = entries_; entry; entry = entry->next) {
+      if (entry->device == device) streams |= entry->options.stream;
+    }
+    if (streams & kStreamMaskVideo) {
+      DispatchFrameLocked(device, kStreamMaskVideo);
+    }
+    if (streams & kStreamMaskDepth) {
+      DispatchFrameLocked(device, kStreamMaskDepth);
+    }
+  }
+}
+
+void FrameDispatcher::DispatchFrameLocked(Device* device, StreamMask stream) {
+  SharedFrame* frame = new SharedFrame();
+  frame->device = device;
+  frame->ref_count = 0;
+  bool is_acquired = (stream == kStreamMaskVideo ?
+      device->AcquireVideoFrame(&frame->lease) :
+      device->AcquireDepthFrame(&frame->lease));
+  if (!is_acquired) {
+    delete frame;
+    return;
+  }
+
+  for (Entry* entry = entries_; entry; entry = entry->next) {
+    if (entry->device != device || entry->options.stream != stream) continue;
+    if (entry->count == entry->options.queue_depth) {
+      ++entry->stats.overrun_frames;
+      if (entry->options.policy != kListenerLatestOnly) continue;
+      ReleaseFrameLocked(entry->queue[entry->head]);
+      entry->head = (entry->head + 1) % kMaxFrameLeases;
+      --entry->count;
+    }
+    entry->queue[(entry->head + entry->count) % kMaxFrameLeases] = frame;
+    ++entry->count;
+    ++frame->ref_count;
+    if (entry->count > entry->stats.max_queue_length) {
+      entry->stats.max_queue_length = entry->count;
+    }
+  }
+
+  if (!frame->ref_count) {
+    device->ReleaseFrame(&frame->lease);
+    delete frame;
+    return;
+  }
+  pthread_cond_broadcast(&work_cond_);
+}
+
+FrameDispatcher::Entry* FrameDispatcher::FindReadyEntryLocked() const {
+  Entry* entry = entries_;
+  while (entry && (entry->is_running || !entry->count)) entry = entry->next;
+  return entry;
+}
+
+void FrameDispatcher::RebuildPollSetLocked() {
+  int device_count = 0;
+  for (Entry* entry = entries_; entry; entry = entry->next) ++device_count;
+  if (device_count + 1 > poll_capacity_) {
+    delete[] poll_devices_;
+    delete[] poll_fds_;
+    poll_capacity_ = device_count + 1;
+    poll_devices_ = new Device*[poll_capacity_];
+    poll_fds_ = new struct pollfd[poll_capacity_];
+  }
+
+  poll_device_count_ = 0;
+  has_all_fds_ = true;
+  for (Entry* entry = entries_; entry; entry = entry->next) {
+    bool is_known = false;
+    for (int i = 0; i < poll_device_count_; ++i) {
+      if (poll_devices_[i] == entry->device) is_known = true;
+    }
+    if (is_known) continue;
+    struct pollfd& fd = poll_fds_[poll_device_count_];
+    fd.fd = entry->device->GetEventFd();
+    fd.events = POLLIN;
+    if (fd.fd == -1) has_all_fds_ = false;
+    poll_devices_[poll_device_count_++] = entry->device;
+  }
+  poll_fds_[poll_device_count_].fd = wake_fd_;
+  poll_fds_[poll_device_count_].events = POLLIN;
+  needs_rebuild_ = false;
+  ++poll_epoch_;
+  pthread_cond_broadcast(&idle_cond_);
+}
+
+void FrameDispatcher::WakePollThread() {
+  uint64_t value = 1;
+  if (write(wake_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    REPORT_ERRNO("write(eventfd)");
+  }
+}
+
+// static
+void* FrameDispatcher::RunPollThread(void* arg) {
+  reinterpret_cast<FrameDispatcher*>(arg)->RunPollThread();
+  return NULL;
+}
+
+void FrameDispatcher::RunPollThread() {
+  while (true) {
+    int fd_count;
+    int wait_ms;
+    {
+      Autolock l(mutex_);
+      if (should_exit_) return;
+      // The poll set is only replaced here, so that it can be used
+      // without the lock below.
+      if (needs_rebuild_) RebuildPollSetLocked();
+      fd_count = poll_device_count_ + 1;
+      wait_ms = has_all_fds_ ? -1 : POLL_FALLBACK_MS;
+    }
+
+    // Reset the descriptors before draining, so that frames that arrive
+    // afterwards wake up the poll below.
+    for (int i = 0; i < fd_count; ++i) {
+      uint64_t value;
+      if (poll_fds_[i].fd != -1 &&
+          read(poll_fds_[i].fd, &value, sizeof(value)) < 0 &&
+          errno != EAGAIN) {
+        REPORT_ERRNO("read(eventfd)");
+      }
+    }
+    {
+      Autolock l(mutex_);
+      DrainDevicesLocked();
+    }
+
+    if (poll(poll_fds_, fd_count, wait_ms) < 0 && errno != EINTR) {
+      REPORT_ERRNO("poll");
+      Sleep(POLL_FALLBACK_MS / 1000.0);
+    }
+  }
+}
+
+// static
+void* FrameDispatcher::RunDispatchThread(void* arg) {
+  reinterpret_cast<FrameDispatcher*>(arg)->RunDispatchThread();
+  return NULL;
+}
+
+void FrameDispatcher::RunDispatchThread() {
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    Entry* entry = NULL;
+    while (!should_exit_ && !(entry = FindReadyEntryLocked())) {
+      pthread_cond_wait(&work_cond_, &mutex_);
+    }
+    if (should_exit_) break;
+
+    SharedFrame* frame = entry->queue[entry->head];
+    entry->head = (entry->head + 1) % kMaxFrameLeases;
+    --entry->count;
+    entry->is_running = true;
+    entry->running_thread = pthread_self();
+    // Move the listener to the end of the list, so that a busy listener
+    // does not starve the ones after it.
+    UnlinkEntryLocked(entry);
+    Entry** link = &entries_;
+    while (*link) link = &(*link)->next;
+    *link = entry;
+
+    pthread_mutex_unlock(&mutex_);
+    entry->listener->OnFrame(frame->device, frame->lease);
+    pthread_mutex_lock(&mutex_);
+
+    entry->is_running = false;
+    ReleaseFrameLocked(frame);
+    if (entry->is_removed) {
+      delete entry;
+    } else {
+      ++entry->stats.delivered_frames;
+    }
+    pthread_cond_broadcast(&idle_cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+}  // namespace kkonnect
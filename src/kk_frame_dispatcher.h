@@ -0,0 +1,138 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FRAME_DISPATCHER_H_
+#define KKONNECT_KK_FRAME_DISPATCHER_H_
+
+#include <kk_frame_listener.h>
+#include <poll.h>
+#include <pthread.h>
+
+namespace kkonnect {
+
+// Pushes frames of open devices to FrameListeners. A poll thread waits
+// on the event descriptors of devices that have listeners, leases every
+// new frame once and queues it for all listeners of its stream.
+// A few dispatch threads then run the listener callbacks.
+class FrameDispatcher {
+ public:
+  explicit FrameDispatcher(int thread_count);
+  ~FrameDispatcher();
+
+  // Returns false if |listener| is already registered.
+  bool AddListener(Device* device, const FrameListenerOptions& options,
+                   FrameListener* listener);
+
+  // Drops pending frames of |listener| and waits for its running callback,
+  // unless called from that callback. Returns false if |listener| is not
+  // registered.
+  bool RemoveListener(FrameListener* listener);
+
+  // Removes all listeners of |device|, and returns once the dispatcher
+  // no longer uses the device.
+  void RemoveDevice(Device* device);
+
+  bool GetListenerStats(FrameListener* listener,
+                        FrameListenerStats* stats) const;
+
+ private:
+  // A leased frame, released once all listeners it was queued for
+  // are done with it.
+  struct SharedFrame {
+    Device* device;
+    FrameLease lease;
+    int ref_count;
+  };
+
+  struct Entry {
+    FrameListener* listener;
+    Device* device;
+    FrameListenerOptions options;
+    SharedFrame* queue[kMaxFrameLeases];
+    int head;
+    int count;
+    // Set while a dispatch thread runs a callback of this listener.
+    bool is_running;
+    pthread_t running_thread;
+    // Set when the listener is removed from its own callback. The
+    // dispatch thread deletes the entry once the callback returns.
+    bool is_removed;
+    FrameListenerStats stats;
+    Entry* next;
+  };
+
+  Entry* FindEntryLocked(FrameListener* listener) const;
+  void UnlinkEntryLocked(Entry* entry);
+  // Unlinks |entry|, drops its frames, and deletes it once its callback
+  // is done.
+  void RemoveEntryLocked(Entry* entry);
+  void ClearQueueLocked(Entry* entry);
+  void ReleaseFrameLocked(SharedFrame* frame);
+
+  // Leases new frames of all listened streams and queues them.
+  void DrainDevicesLocked();
+  void DispatchFrameLocked(Device* device, StreamMask stream);
+  // Returns the first listener with pending frames that is not running.
+  Entry* FindReadyEntryLocked() const;
+
+  // Updates the descriptors polled by the poll thread.
+  void RebuildPollSetLocked();
+  void WakePollThread();
+
+  static void* RunPollThread(void* arg);
+  void RunPollThread();
+  static void* RunDispatchThread(void* arg);
+  void RunDispatchThread();
+
+  mutable pthread_mutex_t mutex_;
+  pthread_cond_t work_cond_;
+  // Signalled when a callback returns and when the poll set is rebuilt.
+  pthread_cond_t idle_cond_;
+  bool should_exit_;
+  Entry* entries_;
+
+  int wake_fd_;
+  // Devices with listeners and their descriptors, followed by |wake_fd_|.
+  Device** poll_devices_;
+  struct pollfd* poll_fds_;
+  int poll_device_count_;
+  int poll_capacity_;
+  bool has_all_fds_;
+  bool needs_rebuild_;
+  // Increments every time the poll thread picks up a new poll set.
+  uint64_t poll_epoch_;
+
+  pthread_t poll_thread_;
+  pthread_t* threads_;
+  int thread_count_;
+
+  FrameDispatcher(const FrameDispatcher& src);
+  FrameDispatcher& operator=(const FrameDispatcher& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FRAME_DISPATCHER_H_
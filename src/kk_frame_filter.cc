@@ -0,0 +1,634 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <kk_frame_filter.h>
+
+#include "src/kk_builtin_filters.h"
+#include "src/utils.h"
+
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace kkonnect {
+
+// Largest |max_difference| of the temporal EMA filter. Keeping depth
+// differences within the int16_t range lets the SIMD path use 16-bit
+// multiplies.
+#define EMA_MAX_DIFFERENCE   32767
+
+static bool IsDepthFormat(ImageFormat format) {
+  return format == kImageFormatDepthMm ||
+      format == kImageFormatDepthRegistered;
+}
+
+static inline uint16_t* GetRow(void* data, int row_size, int y) {
+  return reinterpret_cast<uint16_t*>(
+      reinterpret_cast<uint8_t*>(data) + y * row_size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// RANGE
+////////////////////////////////////////////////////////////////////////////////
+
+typedef void (*RangeRowFunction)(uint16_t* row, int width, uint16_t min,
+                                 uint16_t max);
+
+static void ClipRangeFrom(uint16_t* row, int start, int width, uint16_t min,
+                          uint16_t max) {
+  for (int x = start; x < width; ++x) {
+    if (row[x] < min || row[x] > max) row[x] = 0;
+  }
+}
+
+static void ClipRangeScalar(uint16_t* row, int width, uint16_t min,
+                            uint16_t max) {
+  ClipRangeFrom(row, 0, width, min, max);
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// SSE2 has no unsigned 16-bit compares. A value is within the range
+// exactly when both saturating differences to the bounds are zero.
+__attribute__((target("sse2")))
+static void ClipRangeSse2(uint16_t* row, int width, uint16_t min,
+                          uint16_t max) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i min_value = _mm_set1_epi16((short) min);
+  const __m128i max_value = _mm_set1_epi16((short) max);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i* ptr = reinterpret_cast<__m128i*>(row + x);
+    __m128i value = _mm_loadu_si128(ptr);
+    __m128i outside = _mm_or_si128(_mm_subs_epu16(value, max_value),
+                                   _mm_subs_epu16(min_value, value));
+    _mm_storeu_si128(ptr, _mm_and_si128(value, _mm_cmpeq_epi16(outside, zero)));
+  }
+  ClipRangeFrom(row, x, width, min, max);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+class RangeFilter : public FrameFilter {
+ public:
+  RangeFilter(int min_depth, int max_depth, bool use_simd)
+      : min_depth_(min_depth), max_depth_(max_depth),
+	clip_row_(ClipRangeScalar) {
+#ifdef KKONNECT_X86_SIMD
+    if (use_simd && HasCpuFeature(kCpuFeatureSse2)) clip_row_ = ClipRangeSse2;
+#endif
+  }
+
+  virtual const char* GetName() const { return "range"; }
+
+  virtual void Apply(void* data, int row_size, int width, int height,
+                     ImageFormat format) {
+    if (!IsDepthFormat(format)) return;
+    for (int y = 0; y < height; ++y) {
+      clip_row_(GetRow(data, row_size, y), width, min_depth_, max_depth_);
+    }
+  }
+
+ private:
+  uint16_t min_depth_;
+  uint16_t max_depth_;
+  RangeRowFunction clip_row_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// HOLE FILL
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the index of the first zero pixel at or after |start|,
+// or |width| if there is none.
+typedef int (*FindZeroFunction)(const uint16_t* row, int start, int width);
+
+static int FindZeroScalar(const uint16_t* row, int start, int width) {
+  int x = start;
+  while (x < width && row[x]) ++x;
+  return x;
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// Skips 8 valid pixels at a time, which is the common case.
+__attribute__((target("sse2")))
+static int FindZeroSse2(const uint16_t* row, int start, int width) {
+  const __m128i zero = _mm_setzero_si128();
+  int x = start;
+  for (; x + 8 <= width; x += 8) {
+    __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(value, zero));
+    if (mask) return x + __builtin_ctz(mask) / 2;
+  }
+  return FindZeroScalar(row, x, width);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+class HoleFillFilter : public FrameFilter {
+ public:
+  HoleFillFilter(int max_gap, bool use_simd)
+      : max_gap_(max_gap), find_zero_(FindZeroScalar) {
+#ifdef KKONNECT_X86_SIMD
+    if (use_simd && HasCpuFeature(kCpuFeatureSse2)) find_zero_ = FindZeroSse2;
+#endif
+  }
+
+  virtual const char* GetName() const { return "hole_fill"; }
+
+  virtual void Apply(void* data, int row_size, int width, int height,
+                     ImageFormat format) {
+    if (!IsDepthFormat(format)) return;
+    for (int y = 0; y < height; ++y) {
+      FillRow(GetRow(data, row_size, y), width);
+    }
+  }
+
+ private:
+  void FillRow(uint16_t* row, int width) {
+    // Holes at the start of the row have no left neighbor.
+    int x = 0;
+    while (x < width && !row[x]) ++x;
+    while (true) {
+      int start = find_zero_(row, x, width);
+      x = start;
+      while (x < width && !row[x]) ++x;
+      // Holes at the end of the row have no right neighbor.
+      if (x >= width) return;
+      if (x - start <= max_gap_) {
+        uint16_t fill = row[start - 1] > row[x] ? row[start - 1] : row[x];
+        for (int i = start; i < x; ++i) row[i] = fill;
+      }
+    }
+  }
+
+  int max_gap_;
+  FindZeroFunction find_zero_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// SPECKLE
+////////////////////////////////////////////////////////////////////////////////
+
+// Filters one row. The neighbor rows are padded with a zero pixel on
+// each side, and |cur| points to the first real pixel of its row.
+typedef void (*SpeckleRowFunction)(
+    const uint16_t* prev, const uint16_t* cur, const uint16_t* next,
+    uint16_t* dst, int width, uint16_t max_difference, int min_neighbors);
+
+static void RemoveSpecklesFrom(
+    const uint16_t* prev, const uint16_t* cur, const uint16_t* next,
+    uint16_t* dst, int start, int width, uint16_t max_difference,
+    int min_neighbors) {
+  for (int x = start; x < width; ++x) {
+    int center = cur[x];
+    if (!center) continue;
+    const uint16_t neighbors[8] = {
+      prev[x - 1], prev[x], prev[x + 1], cur[x - 1],
+      cur[x + 1], next[x - 1], next[x], next[x + 1],
+    };
+    int count = 0;
+    for (int i = 0; i < 8; ++i) {
+      int difference = neighbors[i] - center;
+      if (neighbors[i] && difference <= max_difference &&
+          -difference <= max_difference) {
+        ++count;
+      }
+    }
+    if (count < min_neighbors) dst[x] = 0;
+  }
+}
+
+static void RemoveSpecklesScalar(
+    const uint16_t* prev, const uint16_t* cur, const uint16_t* next,
+    uint16_t* dst, int width, uint16_t max_difference, int min_neighbors) {
+  RemoveSpecklesFrom(prev, cur, next, dst, 0, width, max_difference,
+                     min_neighbors);
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// Adds one to |count| for every lane where |neighbor| is valid and close
+// enough to |center|.
+__attribute__((target("sse2")))
+static inline __m128i CountNeighborSse2(
+    const uint16_t* ptr, __m128i center, __m128i max_difference,
+    __m128i count) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i neighbor = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+  __m128i difference = _mm_or_si128(_mm_subs_epu16(neighbor, center),
+                                    _mm_subs_epu16(center, neighbor));
+  __m128i close = _mm_cmpeq_epi16(
+      _mm_subs_epu16(difference, max_difference), zero);
+  __m128i valid = _mm_andnot_si128(_mm_cmpeq_epi16(neighbor, zero), close);
+  return _mm_sub_epi16(count, valid);
+}
+
+__attribute__((target("sse2")))
+static void RemoveSpecklesSse2(
+    const uint16_t* prev, const uint16_t* cur, const uint16_t* next,
+    uint16_t* dst, int width, uint16_t max_difference, int min_neighbors) {
+  const __m128i max_difference_value = _mm_set1_epi16((short) max_difference);
+  const __m128i min_count = _mm_set1_epi16((short) (min_neighbors - 1));
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i center =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x));
+    __m128i count = _mm_setzero_si128();
+    const uint16_t* rows[3] = { prev + x, cur + x, next + x };
+    for (int i = 0; i < 3; ++i) {
+      count = CountNeighborSse2(rows[i] - 1, center, max_difference_value,
+                                count);
+      if (i != 1) {
+        count = CountNeighborSse2(rows[i], center, max_difference_value,
+                                  count);
+      }
+      count = CountNeighborSse2(rows[i] + 1, center, max_difference_value,
+                                count);
+    }
+    __m128i keep = _mm_cmpgt_epi16(count, min_count);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                     _mm_and_si128(center, keep));
+  }
+  RemoveSpecklesFrom(prev, cur, next, dst, x, width, max_difference,
+                     min_neighbors);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+class SpeckleFilter : public FrameFilter {
+ public:
+  SpeckleFilter(int max_difference, int min_neighbors, bool use_simd)
+      : max_difference_(max_difference), min_neighbors_(min_neighbors),
+	filter_row_(RemoveSpecklesScalar), rows_(NULL), width_(0) {
+#ifdef KKONNECT_X86_SIMD
+    if (use_simd && HasCpuFeature(kCpuFeatureSse2)) {
+      filter_row_ = RemoveSpecklesSse2;
+    }
+#endif
+  }
+
+  virtual ~SpeckleFilter() {
+    delete[] rows_;
+  }
+
+  virtual const char* GetName() const { return "speckle"; }
+
+  virtual void Apply(void* data, int row_size, int width, int height,
+                     ImageFormat format) {
+    if (!IsDepthFormat(format)) return;
+    if (width != width_) {
+      delete[] rows_;
+      width_ = width;
+      // Three rows of original pixels and a row of zeros, each padded
+      // with a zero pixel on both sides.
+      rows_ = new uint16_t[(width + 2) * 4];
+      memset(rows_, 0, (width + 2) * 4 * sizeof(uint16_t));
+    }
+
+    // The frame is filtered in place, so neighbors are read from copies
+    // of the original rows.
+    uint16_t* zero_row = GetPaddedRow(3);
+    uint16_t* prev = zero_row;
+    uint16_t* cur = GetPaddedRow(0);
+    uint16_t* next = GetPaddedRow(1);
+    uint16_t* spare = GetPaddedRow(2);
+    if (height > 0) LoadRow(cur, data, row_size, 0);
+    if (height > 1) LoadRow(next, data, row_size, 1);
+    for (int y = 0; y < height; ++y) {
+      filter_row_(prev, cur, y + 1 < height ? next : zero_row,
+                  GetRow(data, row_size, y), width, max_difference_,
+                  min_neighbors_);
+      uint16_t* old_prev = prev == zero_row ? spare : prev;
+      prev = cur;
+      cur = next;
+      next = old_prev;
+      if (y + 2 < height) LoadRow(next, data, row_size, y + 2);
+    }
+  }
+
+ private:
+  // Returns the first real pixel of the padded row.
+  uint16_t* GetPaddedRow(int index) {
+    return rows_ + (width_ + 2) * index + 1;
+  }
+
+  void LoadRow(uint16_t* dst, void* data, int row_size, int y) {
+    memcpy(dst, GetRow(data, row_size, y), width_ * sizeof(uint16_t));
+  }
+
+  uint16_t max_difference_;
+  int min_neighbors_;
+  SpeckleRowFunction filter_row_;
+  uint16_t* rows_;
+  int width_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// TEMPORAL
+////////////////////////////////////////////////////////////////////////////////
+
+// Keeps per-pixel history for temporal filters, and resets it whenever
+// the geometry changes.
+class TemporalFilter : public FrameFilter {
+ public:
+  explicit TemporalFilter(int history_count)
+      : history_count_(history_count), history_(NULL), width_(0),
+	height_(0) {}
+
+  virtual ~TemporalFilter() {
+    delete[] history_;
+  }
+
+  virtual void Apply(void* data, int row_size, int width, int height,
+                     ImageFormat format) {
+    if (!IsDepthFormat(format)) return;
+    if (width != width_ || height != height_) {
+      delete[] history_;
+      width_ = width;
+      height_ = height;
+      int pixel_count = width * height * history_count_;
+      history_ = new uint16_t[pixel_count];
+      memset(history_, 0, pixel_count * sizeof(uint16_t));
+    }
+    for (int y = 0; y < height; ++y) {
+      ApplyRow(GetRow(data, row_size, y), y);
+    }
+    FinishFrame();
+  }
+
+ protected:
+  virtual void ApplyRow(uint16_t* row, int y) = 0;
+  virtual void FinishFrame() {}
+
+  // Returns row |y| of history frame |index|.
+  uint16_t* GetHistoryRow(int index, int y) {
+    return history_ + (index * height_ + y) * width_;
+  }
+  int width() const { return width_; }
+
+ private:
+  int history_count_;
+  uint16_t* history_;
+  int width_;
+  int height_;
+};
+
+typedef void (*EmaRowFunction)(uint16_t* row, uint16_t* average, int width,
+                               int alpha, uint16_t max_difference);
+
+// |alpha| is in 1/256 units. The average is computed as the high bits of
+// a 32-bit product, so that SIMD and scalar paths produce identical output.
+static void UpdateEmaFrom(uint16_t* row, uint16_t* average, int start,
+                          int width, int alpha, uint16_t max_difference) {
+  for (int x = start; x < width; ++x) {
+    int value = row[x];
+    int previous = average[x];
+    int difference = value - previous;
+    if (value && previous && difference <= max_difference &&
+        -difference <= max_difference) {
+      value = previous + ((difference * alpha) >> 8);
+    }
+    row[x] = average[x] = value;
+  }
+}
+
+static void UpdateEmaScalar(uint16_t* row, uint16_t* average, int width,
+                            int alpha, uint16_t max_difference) {
+  UpdateEmaFrom(row, average, 0, width, alpha, max_difference);
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+__attribute__((target("sse2")))
+static void UpdateEmaSse2(uint16_t* row, uint16_t* average, int width,
+                          int alpha, uint16_t max_difference) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_value = _mm_set1_epi16((short) alpha);
+  const __m128i max_difference_value = _mm_set1_epi16((short) max_difference);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i* row_ptr = reinterpret_cast<__m128i*>(row + x);
+    __m128i* average_ptr = reinterpret_cast<__m128i*>(average + x);
+    __m128i value = _mm_loadu_si128(row_ptr);
+    __m128i previous = _mm_loadu_si128(average_ptr);
+    __m128i distance = _mm_or_si128(_mm_subs_epu16(value, previous),
+                                    _mm_subs_epu16(previous, value));
+    __m128i restart = _mm_or_si128(
+        _mm_cmpeq_epi16(previous, zero),
+        _mm_xor_si128(_mm_cmpeq_epi16(
+            _mm_subs_epu16(distance, max_difference_value), zero),
+                      _mm_cmpeq_epi16(zero, zero)));
+    // Differences that fit in int16_t are exact. Larger ones restart.
+    __m128i difference = _mm_sub_epi16(value, previous);
+    __m128i low = _mm_mullo_epi16(difference, alpha_value);
+    __m128i high = _mm_mulhi_epi16(difference, alpha_value);
+    __m128i step = _mm_or_si128(_mm_slli_epi16(high, 8),
+                                _mm_srli_epi16(low, 8));
+    __m128i result = _mm_or_si128(
+        _mm_and_si128(restart, value),
+        _mm_andnot_si128(restart, _mm_add_epi16(previous, step)));
+    result = _mm_andnot_si128(_mm_cmpeq_epi16(value, zero), result);
+    _mm_storeu_si128(row_ptr, result);
+    _mm_storeu_si128(average_ptr, result);
+  }
+  UpdateEmaFrom(row, average, x, width, alpha, max_difference);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+class TemporalEmaFilter : public TemporalFilter {
+ public:
+  TemporalEmaFilter(float alpha, int max_difference, bool use_simd)
+      : TemporalFilter(1), alpha_((int) (alpha * 256 + 0.5f)),
+	max_difference_(max_difference), update_row_(UpdateEmaScalar) {
+    if (alpha_ < 1) alpha_ = 1;
+#ifdef KKONNECT_X86_SIMD
+    if (use_simd && HasCpuFeature(kCpuFeatureSse2)) update_row_ = UpdateEmaSse2;
+#endif
+  }
+
+  virtual const char* GetName() const { return "temporal_ema"; }
+
+ protected:
+  virtual void ApplyRow(uint16_t* row, int y) {
+    update_row_(row, GetHistoryRow(0, y), width(), alpha_, max_difference_);
+  }
+
+ private:
+  int alpha_;
+  uint16_t max_difference_;
+  EmaRowFunction update_row_;
+};
+
+typedef void (*MedianRowFunction)(uint16_t* row, uint16_t* newer,
+                                  uint16_t* older, int width);
+
+static inline int Median3(int a, int b, int c) {
+  int low = a < b ? a : b;
+  int high = a < b ? b : a;
+  int mid = high < c ? high : c;
+  return low > mid ? low : mid;
+}
+
+// Holes in the history are replaced by the current value. |older| then
+// receives the current value, and becomes the newer frame.
+static void UpdateMedianFrom(uint16_t* row, uint16_t* newer, uint16_t* older,
+                             int start, int width) {
+  for (int x = start; x < width; ++x) {
+    int value = row[x];
+    int a = newer[x] ? newer[x] : value;
+    int b = older[x] ? older[x] : value;
+    older[x] = value;
+    if (value) row[x] = Median3(value, a, b);
+  }
+}
+
+static void UpdateMedianScalar(uint16_t* row, uint16_t* newer,
+                               uint16_t* older, int width) {
+  UpdateMedianFrom(row, newer, older, 0, width);
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// Unsigned 16-bit minimum and maximum with SSE2 only.
+__attribute__((target("sse2")))
+static inline __m128i MinU16Sse2(__m128i a, __m128i b) {
+  return _mm_sub_epi16(a, _mm_subs_epu16(a, b));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i MaxU16Sse2(__m128i a, __m128i b) {
+  return _mm_add_epi16(b, _mm_subs_epu16(a, b));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i ReplaceHolesSse2(__m128i history, __m128i value) {
+  __m128i hole = _mm_cmpeq_epi16(history, _mm_setzero_si128());
+  return _mm_or_si128(_mm_and_si128(hole, value),
+                      _mm_andnot_si128(hole, history));
+}
+
+__attribute__((target("sse2")))
+static void UpdateMedianSse2(uint16_t* row, uint16_t* newer, uint16_t* older,
+                             int width) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i* row_ptr = reinterpret_cast<__m128i*>(row + x);
+    __m128i* older_ptr = reinterpret_cast<__m128i*>(older + x);
+    __m128i value = _mm_loadu_si128(row_ptr);
+    __m128i a = ReplaceHolesSse2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(newer + x)), value);
+    __m128i b = ReplaceHolesSse2(_mm_loadu_si128(older_ptr), value);
+    _mm_storeu_si128(older_ptr, value);
+    __m128i median = MaxU16Sse2(MinU16Sse2(value, a),
+                                MinU16Sse2(MaxU16Sse2(value, a), b));
+    median = _mm_andnot_si128(
+        _mm_cmpeq_epi16(value, _mm_setzero_si128()), median);
+    _mm_storeu_si128(row_ptr, median);
+  }
+  UpdateMedianFrom(row, newer, older, x, width);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+class TemporalMedianFilter : public TemporalFilter {
+ public:
+  explicit TemporalMedianFilter(bool use_simd)
+      : TemporalFilter(2), newer_index_(0),
+	update_row_(UpdateMedianScalar) {
+#ifdef KKONNECT_X86_SIMD
+    if (use_simd && HasCpuFeature(kCpuFeatureSse2)) {
+      update_row_ = UpdateMedianSse2;
+    }
+#endif
+  }
+
+  virtual const char* GetName() const { return "temporal_median"; }
+
+ protected:
+  virtual void ApplyRow(uint16_t* row, int y) {
+    update_row_(row, GetHistoryRow(newer_index_, y),
+                GetHistoryRow(1 - newer_index_, y), width());
+  }
+
+  virtual void FinishFrame() {
+    newer_index_ = 1 - newer_index_;
+  }
+
+ private:
+  int newer_index_;
+  MedianRowFunction update_row_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// FACTORY
+////////////////////////////////////////////////////////////////////////////////
+
+static FrameFilter* CreateFilter(const FrameFilterParams& params,
+                                 bool use_simd) {
+  switch (params.type) {
+    case kFrameFilterRange:
+      if (params.min_depth < 0 || params.max_depth > 65535 ||
+          params.min_depth > params.max_depth) {
+        return NULL;
+      }
+      return new RangeFilter(params.min_depth, params.max_depth, use_simd);
+    case kFrameFilterHoleFill:
+      if (params.max_gap < 1) return NULL;
+      return new HoleFillFilter(params.max_gap, use_simd);
+    case kFrameFilterSpeckle:
+      if (params.max_difference < 0 || params.max_difference > 65535 ||
+          params.min_neighbors < 1 || params.min_neighbors > 8) {
+        return NULL;
+      }
+      return new SpeckleFilter(params.max_difference, params.min_neighbors,
+                               use_simd);
+    case kFrameFilterTemporalEma:
+      if (!(params.alpha > 0 && params.alpha <= 1) ||
+          params.max_difference < 0 ||
+          params.max_difference > EMA_MAX_DIFFERENCE) {
+        return NULL;
+      }
+      return new TemporalEmaFilter(params.alpha, params.max_difference,
+                                   use_simd);
+    case kFrameFilterTemporalMedian:
+      return new TemporalMedianFilter(use_simd);
+  }
+  return NULL;
+}
+
+FrameFilter* CreateFrameFilter(const FrameFilterParams& params) {
+  return CreateFilter(params, true);
+}
+
+FrameFilter* CreateScalarFrameFilter(const FrameFilterParams& params) {
+  return CreateFilter(params, false);
+}
+
+}  // namespace kkonnect
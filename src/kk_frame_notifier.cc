@@ -0,0 +1,104 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_frame_notifier.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+FrameNotifier::FrameNotifier(const PendingSource* source)
+    : source_(source), waiter_count_(0), event_fd_(-1) {
+  pthread_mutex_init(&mutex_, NULL);
+  InitMonotonicCond(&cond_);
+}
+
+FrameNotifier::~FrameNotifier() {
+  if (event_fd_ != -1) close(event_fd_);
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void FrameNotifier::Notify() {
+  int fd = __atomic_load_n(&event_fd_, __ATOMIC_ACQUIRE);
+  if (fd != -1) {
+    uint64_t value = 1;
+    if (write(fd, &value, sizeof(value)) != sizeof(value) &&
+        errno != EAGAIN) {
+      REPORT_ERRNO("write(eventfd)");
+    }
+  }
+
+  // Pairs with the increment in Wait(): either the waiter sees the new
+  // frame before sleeping, or this load sees the waiter.
+  if (!__atomic_load_n(&waiter_count_, __ATOMIC_SEQ_CST)) return;
+  Autolock l(mutex_);
+  pthread_cond_broadcast(&cond_);
+}
+
+int FrameNotifier::Wait(int streams_mask, int timeout_ms) {
+  uint64_t deadline = GetCurrentMillis() + (timeout_ms > 0 ? timeout_ms : 0);
+  Autolock l(mutex_);
+  __atomic_add_fetch(&waiter_count_, 1, __ATOMIC_SEQ_CST);
+  int pending;
+  while (true) {
+    pending = source_->GetPendingStreams() & streams_mask;
+    if (pending || !timeout_ms) break;
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&cond_, &mutex_);
+    } else if (!WaitCondUntil(&cond_, &mutex_, deadline)) {
+      pending = source_->GetPendingStreams() & streams_mask;
+      break;
+    }
+  }
+  __atomic_sub_fetch(&waiter_count_, 1, __ATOMIC_SEQ_CST);
+  return pending;
+}
+
+int FrameNotifier::GetEventFd() {
+  Autolock l(mutex_);
+  if (event_fd_ == -1) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+      REPORT_ERRNO("eventfd");
+      return -1;
+    }
+    // Frames that are already pending should wake up the new listener.
+    if (source_->GetPendingStreams()) {
+      uint64_t value = 1;
+      if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+        REPORT_ERRNO("write(eventfd)");
+      }
+    }
+    __atomic_store_n(&event_fd_, fd, __ATOMIC_RELEASE);
+  }
+  return event_fd_;
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,78 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FRAME_NOTIFIER_H_
+#define KKONNECT_KK_FRAME_NOTIFIER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace kkonnect {
+
+// Wakes up consumers that wait for new frames of a device, either
+// in WaitForFrame() or through an eventfd.
+class FrameNotifier {
+ public:
+  // Returns a mask of streams that have unread frames.
+  class PendingSource {
+   public:
+    virtual int GetPendingStreams() const = 0;
+
+   protected:
+    virtual ~PendingSource() {}
+  };
+
+  explicit FrameNotifier(const PendingSource* source);
+  ~FrameNotifier();
+
+  // Called by the producer after publishing a frame. Takes the wait lock
+  // only when a consumer is blocked in Wait(), and only long enough
+  // to signal it.
+  void Notify();
+
+  // Blocks until one of |streams_mask| has unread frames, or until
+  // |timeout_ms| elapses. Negative |timeout_ms| waits forever.
+  // Returns the pending streams from |streams_mask|, or 0 on timeout.
+  int Wait(int streams_mask, int timeout_ms);
+
+  // Returns an eventfd that becomes readable on every Notify().
+  // The descriptor is created on the first call.
+  int GetEventFd();
+
+ private:
+  const PendingSource* source_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  int waiter_count_;  // Atomic.
+  int event_fd_;  // Atomic.
+
+  FrameNotifier(const FrameNotifier& src);
+  FrameNotifier& operator=(const FrameNotifier& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FRAME_NOTIFIER_H_
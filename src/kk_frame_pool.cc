@@ -0,0 +1,284 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_frame_pool.h"
+
+#include "src/kk_buffer_allocator.h"
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Frame rates are measured over windows of this length.
+#define FPS_WINDOW_US   1000000
+
+FramePool::FramePool()
+    : allocator_(NULL), width_(0), height_(0), row_size_(0), buffer_size_(0),
+      format_(kImageFormatNone), external_(false), fill_slot_(0),
+      next_sequence_(1),
+      latest_(0), last_read_sequence_(0), lease_count_(0),
+      internal_lease_count_(0),
+      received_frames_(0), delivered_frames_(0), dropped_frames_(0),
+      fps_milli_(0), last_publish_time_(0), fps_window_start_(0),
+      fps_window_frames_(0) {
+  for (int i = 0; i < kLatencyHistogramBuckets; ++i) {
+    latency_histogram_[i] = 0;
+  }
+  for (int i = 0; i < kSlotCount; ++i) {
+    slots_[i].data = NULL;
+    slots_[i].lease_count = 0;
+  }
+}
+
+FramePool::~FramePool() {
+  CHECK(!HasLeases());
+  Free();
+}
+
+void FramePool::Free() {
+  __atomic_store_n(&latest_, 0, __ATOMIC_SEQ_CST);
+  for (int i = 0; i < kSlotCount; ++i) {
+    if (!external_) allocator_->Release(slots_[i].data);
+    slots_[i].data = NULL;
+  }
+  buffer_size_ = 0;
+  external_ = false;
+}
+
+bool FramePool::Init(
+    int width, int height, int bytes_per_pixel, ImageFormat format) {
+  int row_size = width * bytes_per_pixel;
+  if (buffer_size_ && !external_ && width == width_ && height == height_ &&
+      row_size == row_size_) {
+    format_ = format;
+    return true;
+  }
+
+  // Buffers of another geometry cannot be released while still leased.
+  CHECK(!HasLeases());
+  Free();
+  width_ = width;
+  height_ = height;
+  row_size_ = row_size;
+  format_ = format;
+  buffer_size_ = row_size * height;
+  for (int i = 0; i < kSlotCount; ++i) {
+    slots_[i].data =
+        reinterpret_cast<uint8_t*>(allocator_->Allocate(buffer_size_));
+    slots_[i].lease_count = 0;
+    if (!slots_[i].data) {
+      Free();
+      return false;
+    }
+  }
+  fill_slot_ = 0;
+  return true;
+}
+
+void FramePool::InitExternal(
+    int width, int height, int row_size, ImageFormat format) {
+  CHECK(!HasLeases());
+  Free();
+  width_ = width;
+  height_ = height;
+  row_size_ = row_size;
+  format_ = format;
+  buffer_size_ = row_size * height;
+  external_ = true;
+  for (int i = 0; i < kSlotCount; ++i) {
+    slots_[i].lease_count = 0;
+  }
+  fill_slot_ = 0;
+}
+
+bool FramePool::HasLeases() const {
+  return __atomic_load_n(&lease_count_, __ATOMIC_SEQ_CST) ||
+      __atomic_load_n(&internal_lease_count_, __ATOMIC_SEQ_CST);
+}
+
+int FramePool::FindFreeSlot(int latest_slot) const {
+  for (int i = 0; i < kSlotCount; ++i) {
+    if (i == latest_slot) continue;
+    if (!__atomic_load_n(&slots_[i].lease_count, __ATOMIC_SEQ_CST)) return i;
+  }
+  return -1;
+}
+
+void* FramePool::Publish(uint32_t device_timestamp) {
+  CHECK(buffer_size_);
+  int latest_slot = fill_slot_;
+  FrameMetadata& metadata = slots_[latest_slot].metadata;
+  uint64_t now = GetCurrentMicros();
+  metadata.device_timestamp = device_timestamp;
+  metadata.host_time_us = now;
+  metadata.sequence = next_sequence_++;
+  __atomic_store_n(&latest_, PackLatest(metadata.sequence, latest_slot),
+                   __ATOMIC_SEQ_CST);
+  UpdateProducerStats(now);
+
+  // A consumer that increments a lease count after this scan will observe
+  // the new |latest_| on its re-check and back off, so the chosen slot
+  // cannot be read while it is being filled. Acquire() reserves slots
+  // before touching them, which guarantees that a free slot exists.
+  fill_slot_ = FindFreeSlot(latest_slot);
+  CHECK(fill_slot_ >= 0);
+  return slots_[fill_slot_].data;
+}
+
+void FramePool::UpdateProducerStats(uint64_t now) {
+  // Single writer, so plain increments with relaxed stores suffice.
+  __atomic_store_n(&received_frames_, received_frames_ + 1,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&last_publish_time_, now, __ATOMIC_RELAXED);
+  ++fps_window_frames_;
+  uint64_t elapsed = now - fps_window_start_;
+  if (elapsed >= FPS_WINDOW_US) {
+    // A window that started long ago only marks the start of a stream.
+    uint32_t fps_milli = elapsed < 2 * FPS_WINDOW_US ?
+        (uint32_t) (fps_window_frames_ * 1000000000 / elapsed) : 0;
+    __atomic_store_n(&fps_milli_, fps_milli, __ATOMIC_RELAXED);
+    fps_window_start_ = now;
+    fps_window_frames_ = 0;
+  }
+}
+
+void FramePool::PublishExternal(const void* data, uint32_t device_timestamp) {
+  CHECK(external_);
+  // The fill slot is not leased, so its pointer can be swapped. Publish()
+  // makes the new pointer visible together with the frame.
+  slots_[fill_slot_].data =
+      const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(data));
+  Publish(device_timestamp);
+}
+
+bool FramePool::HasNewFrame() const {
+  uint64_t latest = __atomic_load_n(&latest_, __ATOMIC_SEQ_CST);
+  return (latest >> kSlotBits) >
+      __atomic_load_n(&last_read_sequence_, __ATOMIC_SEQ_CST);
+}
+
+bool FramePool::Acquire(int stream, bool internal, FrameLease* lease) {
+  uint64_t latest = __atomic_load_n(&latest_, __ATOMIC_SEQ_CST);
+  if (!latest) return false;
+
+  int* lease_count = internal ? &internal_lease_count_ : &lease_count_;
+  int max_leases = internal ? kInternalLeases : kMaxFrameLeases;
+  if (__atomic_add_fetch(lease_count, 1, __ATOMIC_SEQ_CST) > max_leases) {
+    __atomic_sub_fetch(lease_count, 1, __ATOMIC_SEQ_CST);
+    return false;
+  }
+
+  int slot;
+  uint64_t sequence;
+  while (true) {
+    sequence = latest >> kSlotBits;
+    slot = static_cast<int>(latest & ((1 << kSlotBits) - 1)) - 1;
+    if (sequence <= __atomic_load_n(&last_read_sequence_, __ATOMIC_SEQ_CST)) {
+      __atomic_sub_fetch(lease_count, 1, __ATOMIC_SEQ_CST);
+      return false;
+    }
+
+    __atomic_add_fetch(&slots_[slot].lease_count, 1, __ATOMIC_SEQ_CST);
+    uint64_t latest2 = __atomic_load_n(&latest_, __ATOMIC_SEQ_CST);
+    if (latest2 == latest) break;
+    // A newer frame was published, and the producer may already be
+    // refilling this slot. Retry with the newer frame.
+    __atomic_sub_fetch(&slots_[slot].lease_count, 1, __ATOMIC_SEQ_CST);
+    latest = latest2;
+  }
+
+  // Mark the frame as read, unless another consumer got a newer one.
+  uint64_t last_read = __atomic_load_n(&last_read_sequence_, __ATOMIC_SEQ_CST);
+  while (true) {
+    if (last_read >= sequence) {
+      __atomic_sub_fetch(&slots_[slot].lease_count, 1, __ATOMIC_SEQ_CST);
+      __atomic_sub_fetch(lease_count, 1, __ATOMIC_SEQ_CST);
+      return false;
+    }
+    if (__atomic_compare_exchange_n(
+            &last_read_sequence_, &last_read, sequence, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      break;
+    }
+  }
+
+  lease->data = slots_[slot].data;
+  lease->row_size = row_size_;
+  lease->width = width_;
+  lease->height = height_;
+  lease->format = format_;
+  lease->metadata = slots_[slot].metadata;
+  lease->metadata.dropped_frames = static_cast<uint32_t>(
+      sequence - last_read - 1);
+  UpdateConsumerStats(lease->metadata);
+  lease->internal_stream = stream;
+  lease->internal_slot = slot;
+  return true;
+}
+
+void FramePool::UpdateConsumerStats(const FrameMetadata& metadata) {
+  __atomic_add_fetch(&delivered_frames_, 1, __ATOMIC_RELAXED);
+  if (metadata.dropped_frames) {
+    __atomic_add_fetch(&dropped_frames_, metadata.dropped_frames,
+                       __ATOMIC_RELAXED);
+  }
+  uint64_t latency = GetCurrentMicros() - metadata.host_time_us;
+  int bucket = latency ? 63 - __builtin_clzll(latency) : 0;
+  if (bucket >= kLatencyHistogramBuckets) {
+    bucket = kLatencyHistogramBuckets - 1;
+  }
+  __atomic_add_fetch(&latency_histogram_[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void FramePool::GetStats(StreamStats* stats) const {
+  stats->received_frames =
+      __atomic_load_n(&received_frames_, __ATOMIC_RELAXED);
+  stats->delivered_frames =
+      __atomic_load_n(&delivered_frames_, __ATOMIC_RELAXED);
+  stats->dropped_frames = __atomic_load_n(&dropped_frames_, __ATOMIC_RELAXED);
+  for (int i = 0; i < kLatencyHistogramBuckets; ++i) {
+    stats->latency_histogram[i] =
+        __atomic_load_n(&latency_histogram_[i], __ATOMIC_RELAXED);
+  }
+  // The producer only updates the rate when frames arrive.
+  uint64_t idle_time = GetCurrentMicros() -
+      __atomic_load_n(&last_publish_time_, __ATOMIC_RELAXED);
+  stats->fps = idle_time < FPS_WINDOW_US ?
+      __atomic_load_n(&fps_milli_, __ATOMIC_RELAXED) / 1000.0f : 0;
+}
+
+void FramePool::Release(FrameLease* lease, bool internal) {
+  int slot = lease->internal_slot;
+  CHECK(slot >= 0 && slot < kSlotCount);
+  CHECK(__atomic_sub_fetch(&slots_[slot].lease_count, 1, __ATOMIC_SEQ_CST)
+        >= 0);
+  CHECK(__atomic_sub_fetch(
+            internal ? &internal_lease_count_ : &lease_count_, 1,
+            __ATOMIC_SEQ_CST) >= 0);
+  lease->data = NULL;
+  lease->internal_slot = -1;
+}
+
+}  // namespace kkonnect
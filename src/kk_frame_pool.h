@@ -0,0 +1,163 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FRAME_POOL_H_
+#define KKONNECT_KK_FRAME_POOL_H_
+
+#include <kk_device.h>
+
+namespace kkonnect {
+
+class BufferAllocator;
+
+// Holds frame buffers of a single stream. The producer fills buffers
+// in place and publishes them, while consumers lease the latest buffer
+// for reading. A buffer is never handed to the producer while it is leased.
+//
+// Publish() and Acquire() are lock-free, so a slow consumer can never
+// stall the producer. There must be only one producer thread at a time,
+// while any number of consumer threads can acquire and release leases.
+class FramePool {
+ public:
+  FramePool();
+  ~FramePool();
+
+  // Sets the allocator of frame buffers. Must be called before Init().
+  void SetAllocator(BufferAllocator* allocator) { allocator_ = allocator; }
+
+  // Allocates buffers for frames of the given geometry. Existing buffers
+  // are kept if the geometry did not change, so that outstanding leases
+  // remain valid across reconnects. Must not be called concurrently with
+  // the producer. Returns false if the buffers cannot be allocated.
+  bool Init(int width, int height, int bytes_per_pixel, ImageFormat format);
+  bool IsInitialized() const { return buffer_size_ != 0; }
+
+  // Sets up the pool for frames that live in memory owned by the producer,
+  // such as a memory-mapped recording. Such frames are published with
+  // PublishExternal() instead of being filled in place, and must remain
+  // valid and unmodified while the pool exists.
+  void InitExternal(int width, int height, int row_size, ImageFormat format);
+  int buffer_size() const { return buffer_size_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int row_size() const { return row_size_; }
+  ImageFormat format() const { return format_; }
+
+  // Returns the buffer that should receive the next frame.
+  void* GetFillBuffer() const { return slots_[fill_slot_].data; }
+  // Returns the metadata of the next frame, for fields that the producer
+  // sets before publishing. Publish() only stamps the timing fields.
+  FrameMetadata* GetFillMetadata() { return &slots_[fill_slot_].metadata; }
+
+  // Makes the fill buffer the latest frame, stamping it with the host
+  // arrival time and the next sequence number. Returns the buffer that
+  // should receive the next frame.
+  void* Publish(uint32_t device_timestamp);
+
+  // Makes |data| the latest frame, with the same stamping as Publish().
+  // Leases of the frame point straight into |data|.
+  void PublishExternal(const void* data, uint32_t device_timestamp);
+
+  // Returns true if the latest frame was not read yet.
+  bool HasNewFrame() const;
+
+  // Leases the latest frame if it was not read yet. When several consumers
+  // race for the same frame, only one of them gets it. Consumers can hold
+  // up to kMaxFrameLeases leases, while |internal| leases are taken from
+  // a separate reserve, so that GetAndClear*Data() can copy a frame even
+  // when consumers hold the maximum. Release() must be given the same
+  // |internal| value.
+  bool Acquire(int stream, bool internal, FrameLease* lease);
+  void Release(FrameLease* lease, bool internal);
+
+  // Reads the frame counters. Counting uses relaxed atomics, so the
+  // counters are not updated together.
+  void GetStats(StreamStats* stats) const;
+
+ private:
+  // Leases reserved for GetAndClear*Data(), in addition to kMaxFrameLeases.
+  static const int kInternalLeases = 2;
+  // One slot is always being filled, and one holds the latest frame.
+  static const int kSlotCount = kMaxFrameLeases + kInternalLeases + 2;
+
+  // |latest_| packs the sequence number of the latest frame with its slot.
+  // Sequence numbers never repeat, which rules out ABA on the exchange.
+  static const int kSlotBits = 8;
+  static uint64_t PackLatest(uint64_t sequence, int slot) {
+    return (sequence << kSlotBits) | (slot + 1);
+  }
+
+  struct Slot {
+    uint8_t* data;
+    int lease_count;  // Atomic.
+    FrameMetadata metadata;
+  };
+
+  void Free();
+  bool HasLeases() const;
+  int FindFreeSlot(int latest_slot) const;
+  void UpdateProducerStats(uint64_t now);
+  void UpdateConsumerStats(const FrameMetadata& metadata);
+
+  BufferAllocator* allocator_;
+  Slot slots_[kSlotCount];
+  int width_;
+  int height_;
+  int row_size_;
+  int buffer_size_;
+  ImageFormat format_;
+  // Whether slot buffers point to frames owned by the producer.
+  bool external_;
+
+  // Owned by the producer.
+  int fill_slot_;
+  uint64_t next_sequence_;
+
+  // Shared with consumers, accessed atomically.
+  uint64_t latest_;
+  uint64_t last_read_sequence_;
+  int lease_count_;
+  int internal_lease_count_;
+
+  // Statistics, accessed with relaxed atomics. Only the producer writes
+  // |received_frames_|, |fps_milli_| and |last_publish_time_|.
+  uint64_t received_frames_;
+  uint64_t delivered_frames_;
+  uint64_t dropped_frames_;
+  uint64_t latency_histogram_[kLatencyHistogramBuckets];
+  uint32_t fps_milli_;
+  uint64_t last_publish_time_;
+  // Owned by the producer, for measuring |fps_milli_|.
+  uint64_t fps_window_start_;
+  uint64_t fps_window_frames_;
+
+  FramePool(const FramePool& src);
+  FramePool& operator=(const FramePool& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FRAME_POOL_H_
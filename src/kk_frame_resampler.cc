@@ -0,0 +1,303 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_frame_resampler.h"
+
+#include "src/kk_buffer_allocator.h"
+#include "src/utils.h"
+
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace kkonnect {
+
+// Depth blocks are reduced with unsigned minimums of (depth - 1), which
+// turns invalid zero depth into 0xFFFF. Adding one to the result restores
+// zero for blocks without any valid depth.
+
+static inline uint16_t MinU16(uint16_t a, uint16_t b) {
+  return a < b ? a : b;
+}
+
+// Folds |rows| rows of |width| depth values into |dst|.
+typedef void (*FoldRowsFunction)(const uint8_t* src, int src_row_size,
+                                 int rows, uint16_t* dst, int width);
+// Reduces pairs of |2 * width| values in |src| into |width| values in |dst|.
+typedef void (*FoldPairsFunction)(const uint16_t* src, uint16_t* dst,
+                                  int width);
+
+static void FoldRowsFrom(const uint8_t* src, int src_row_size, int rows,
+                         uint16_t* dst, int start, int width) {
+  for (int x = start; x < width; ++x) {
+    uint16_t value = 0xFFFF;
+    for (int y = 0; y < rows; ++y) {
+      const uint16_t* row =
+          reinterpret_cast<const uint16_t*>(src + y * src_row_size);
+      value = MinU16(value, (uint16_t) (row[x] - 1));
+    }
+    dst[x] = value;
+  }
+}
+
+static void FoldRowsScalar(const uint8_t* src, int src_row_size, int rows,
+                           uint16_t* dst, int width) {
+  FoldRowsFrom(src, src_row_size, rows, dst, 0, width);
+}
+
+static void FoldPairsFrom(const uint16_t* src, uint16_t* dst, int start,
+                          int width) {
+  for (int x = start; x < width; ++x) {
+    dst[x] = MinU16(src[x * 2], src[x * 2 + 1]);
+  }
+}
+
+static void FoldPairsScalar(const uint16_t* src, uint16_t* dst, int width) {
+  FoldPairsFrom(src, dst, 0, width);
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// Unsigned 16-bit minimum with SSE2 only.
+__attribute__((target("sse2")))
+static inline __m128i MinU16Sse2(__m128i a, __m128i b) {
+  return _mm_sub_epi16(a, _mm_subs_epu16(a, b));
+}
+
+__attribute__((target("sse2")))
+static void FoldRowsSse2(const uint8_t* src, int src_row_size, int rows,
+                         uint16_t* dst, int width) {
+  const __m128i one = _mm_set1_epi16(1);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i value = _mm_set1_epi16((short) 0xFFFF);
+    for (int y = 0; y < rows; ++y) {
+      const uint16_t* row =
+          reinterpret_cast<const uint16_t*>(src + y * src_row_size);
+      value = MinU16Sse2(value, _mm_sub_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), one));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), value);
+  }
+  FoldRowsFrom(src, src_row_size, rows, dst, x, width);
+}
+
+// Returns minimums of the even and odd values of |pairs| in the low
+// halves of 32-bit lanes, biased into the signed range for packing.
+__attribute__((target("sse2")))
+static inline __m128i MinPairsSse2(__m128i pairs) {
+  __m128i even = _mm_and_si128(pairs, _mm_set1_epi32(0xFFFF));
+  __m128i odd = _mm_srli_epi32(pairs, 16);
+  return _mm_sub_epi32(MinU16Sse2(even, odd), _mm_set1_epi32(0x8000));
+}
+
+// |dst| may be the same as |src|, since every store lands below
+// the values that later iterations load.
+__attribute__((target("sse2")))
+static void FoldPairsSse2(const uint16_t* src, uint16_t* dst, int width) {
+  const __m128i bias = _mm_set1_epi16((short) 0x8000);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i low = MinPairsSse2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2)));
+    __m128i high = MinPairsSse2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2 + 8)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                     _mm_xor_si128(_mm_packs_epi32(low, high), bias));
+  }
+  FoldPairsFrom(src, dst, x, width);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+FrameResampler::FrameResampler()
+    : allocator_(NULL), format_(kImageFormatNone), full_width_(0),
+      full_height_(0), bytes_per_pixel_(0), identity_(true), x_(0), y_(0),
+      decimation_(1), width_(0), height_(0), input_(NULL), input_size_(0),
+      scratch_(NULL), scratch_size_(0) {}
+
+FrameResampler::~FrameResampler() {
+  if (input_) allocator_->Release(input_);
+  delete[] scratch_;
+}
+
+// static
+bool FrameResampler::IsValidRegion(const StreamRegion& region) {
+  return region.x >= 0 && region.y >= 0 && region.width >= 0 &&
+      region.height >= 0 && region.decimation >= 1 &&
+      region.decimation <= kMaxStreamDecimation;
+}
+
+// Fits a rectangle of [start, start + size) to [0, full), with
+// a size that is a multiple of |unit| and a start that is a multiple
+// of |alignment|. Zero |size| extends to the end.
+static void FitRange(int full, int unit, int alignment, int* start,
+                     int* size) {
+  if (*start > full - unit) *start = full - unit;
+  *start -= *start % alignment;
+  if (!*size || *size > full - *start) *size = full - *start;
+  *size -= *size % unit;
+  if (!*size) *size = unit;
+}
+
+bool FrameResampler::Init(int full_width, int full_height,
+                          ImageFormat format) {
+  format_ = format;
+  full_width_ = full_width;
+  full_height_ = full_height;
+  bytes_per_pixel_ = GetBytesPerPixel(format);
+
+  // YUV 4:2:2 frames are built from whole pixel pairs.
+  bool is_yuv = (format == kImageFormatVideoYuv422);
+  int decimation = region_.decimation;
+  int max_decimation = is_yuv ? full_width / 2 : full_width;
+  if (decimation > max_decimation) decimation = max_decimation;
+  if (decimation > full_height) decimation = full_height;
+  int x = region_.x;
+  int y = region_.y;
+  int width = region_.width;
+  int height = region_.height;
+  FitRange(full_width, is_yuv ? decimation * 2 : decimation, is_yuv ? 2 : 1,
+           &x, &width);
+  FitRange(full_height, decimation, 1, &y, &height);
+  x_ = x;
+  y_ = y;
+  decimation_ = decimation;
+  width_ = width / decimation;
+  height_ = height / decimation;
+  identity_ = (width_ == full_width && height_ == full_height);
+
+  int input_size = identity_ ? 0 : full_width * full_height * bytes_per_pixel_;
+  if (input_size != input_size_) {
+    if (input_) allocator_->Release(input_);
+    input_ = NULL;
+    input_size_ = 0;
+    if (input_size) {
+      input_ = reinterpret_cast<uint8_t*>(allocator_->Allocate(input_size));
+      if (!input_) return false;
+      input_size_ = input_size;
+    }
+  }
+  int scratch_size = identity_ ? 0 : width;
+  if (scratch_size > scratch_size_) {
+    delete[] scratch_;
+    scratch_ = new uint16_t[scratch_size];
+    scratch_size_ = scratch_size;
+  }
+  return true;
+}
+
+DepthIntrinsics FrameResampler::AdjustIntrinsics(
+    const DepthIntrinsics& intrinsics) const {
+  if (identity_) return intrinsics;
+  // Depth pixels stand for the centers of their blocks.
+  float offset = (decimation_ - 1) / 2.0f;
+  DepthIntrinsics result = intrinsics;
+  result.width = width_;
+  result.height = height_;
+  result.fx = intrinsics.fx / decimation_;
+  result.fy = intrinsics.fy / decimation_;
+  result.cx = (intrinsics.cx - x_ - offset) / decimation_;
+  result.cy = (intrinsics.cy - y_ - offset) / decimation_;
+  return result;
+}
+
+void FrameResampler::Resample(const void* src, int src_row_size, void* dst) {
+  const uint8_t* src_bytes = reinterpret_cast<const uint8_t*>(src) +
+      y_ * src_row_size + x_ * bytes_per_pixel_;
+  if (decimation_ == 1) {
+    CopyImageData(dst, src_bytes, width_ * bytes_per_pixel_, src_row_size,
+                  height_, NULL);
+  } else if (format_ == kImageFormatDepthMm ||
+             format_ == kImageFormatDepthRegistered) {
+    ResampleDepth(src_bytes, src_row_size, reinterpret_cast<uint16_t*>(dst));
+  } else {
+    ResampleVideo(src_bytes, src_row_size, reinterpret_cast<uint8_t*>(dst));
+  }
+}
+
+void FrameResampler::ResampleDepth(const uint8_t* src, int src_row_size,
+                                   uint16_t* dst) {
+  FoldRowsFunction fold_rows = FoldRowsScalar;
+  FoldPairsFunction fold_pairs = FoldPairsScalar;
+#ifdef KKONNECT_X86_SIMD
+  if (HasCpuFeature(kCpuFeatureSse2)) {
+    fold_rows = FoldRowsSse2;
+    fold_pairs = FoldPairsSse2;
+  }
+#endif
+
+  int block_width = decimation_;
+  for (int y = 0; y < height_; ++y) {
+    fold_rows(src + y * decimation_ * src_row_size, src_row_size,
+              decimation_, scratch_, width_ * decimation_);
+    // Halve blocks in place while they have an even width, then reduce
+    // what remains of them one by one.
+    int block = block_width;
+    while (!(block & 1)) {
+      block /= 2;
+      fold_pairs(scratch_, scratch_, width_ * block);
+    }
+    uint16_t* dst_row = dst + y * width_;
+    for (int x = 0; x < width_; ++x) {
+      uint16_t value = scratch_[x * block];
+      for (int i = 1; i < block; ++i) {
+        value = MinU16(value, scratch_[x * block + i]);
+      }
+      dst_row[x] = value + 1;
+    }
+  }
+}
+
+void FrameResampler::ResampleVideo(const uint8_t* src, int src_row_size,
+                                   uint8_t* dst) {
+  // Decimated video keeps single pixels, so there is little to vectorize.
+  int step = decimation_ * bytes_per_pixel_;
+  for (int y = 0; y < height_; ++y) {
+    const uint8_t* src_row = src + y * decimation_ * src_row_size;
+    uint8_t* dst_row = dst + y * width_ * bytes_per_pixel_;
+    if (format_ == kImageFormatVideoYuv422) {
+      // The luma of pixel n is at byte 2n + 1. Every output pair takes
+      // chroma from the pair of its first pixel.
+      for (int x = 0; x < width_; x += 2) {
+        int first = x * decimation_;
+        int second = first + decimation_;
+        const uint8_t* pair = src_row + (first & ~1) * 2;
+        dst_row[x * 2] = pair[0];
+        dst_row[x * 2 + 1] = src_row[first * 2 + 1];
+        dst_row[x * 2 + 2] = pair[2];
+        dst_row[x * 2 + 3] = src_row[second * 2 + 1];
+      }
+    } else {
+      for (int x = 0; x < width_; ++x) {
+        memcpy(dst_row + x * bytes_per_pixel_, src_row + x * step,
+               bytes_per_pixel_);
+      }
+    }
+  }
+}
+
+}  // namespace kkonnect
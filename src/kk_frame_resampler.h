@@ -0,0 +1,105 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_FRAME_RESAMPLER_H_
+#define KKONNECT_KK_FRAME_RESAMPLER_H_
+
+#include <kk_device.h>
+
+namespace kkonnect {
+
+class BufferAllocator;
+
+// Crops and decimates full frames of a stream into the frames described
+// by a StreamRegion. See StreamRegion for how pixels are selected.
+class FrameResampler {
+ public:
+  FrameResampler();
+  ~FrameResampler();
+
+  // Returns true if |region| has valid values. The rectangle is not
+  // checked against the stream, since it is clipped to it.
+  static bool IsValidRegion(const StreamRegion& region);
+
+  void SetRegion(const StreamRegion& region) { region_ = region; }
+  // Sets the allocator of the input buffer. Must be called before Init().
+  void SetAllocator(BufferAllocator* allocator) { allocator_ = allocator; }
+
+  // Fits the region to full frames of the given geometry. Existing
+  // buffers are kept if the geometry did not change. Returns false if
+  // the input buffer cannot be allocated.
+  bool Init(int full_width, int full_height, ImageFormat format);
+
+  // Returns true if frames pass through unchanged.
+  bool IsIdentity() const { return identity_; }
+
+  // Returns the size of resampled frames.
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Adjusts intrinsics of full frames to resampled frames.
+  DepthIntrinsics AdjustIntrinsics(const DepthIntrinsics& intrinsics) const;
+
+  // Returns the buffer that receives full frames, and its row size.
+  // Only valid if the resampler is not the identity.
+  void* GetInputBuffer() const { return input_; }
+  int input_row_size() const { return full_width_ * bytes_per_pixel_; }
+
+  // Resamples a full frame with |src_row_size| bytes per row into |dst|,
+  // which receives packed rows.
+  void Resample(const void* src, int src_row_size, void* dst);
+
+ private:
+  void ResampleDepth(const uint8_t* src, int src_row_size, uint16_t* dst);
+  void ResampleVideo(const uint8_t* src, int src_row_size, uint8_t* dst);
+
+  StreamRegion region_;
+  BufferAllocator* allocator_;
+  ImageFormat format_;
+  int full_width_;
+  int full_height_;
+  int bytes_per_pixel_;
+  bool identity_;
+  // The fitted rectangle and decimation.
+  int x_;
+  int y_;
+  int decimation_;
+  int width_;
+  int height_;
+  // Holds full frames, with |input_size_| bytes.
+  uint8_t* input_;
+  int input_size_;
+  // Holds minimums of one row of depth blocks.
+  uint16_t* scratch_;
+  int scratch_size_;
+
+  FrameResampler(const FrameResampler& src);
+  FrameResampler& operator=(const FrameResampler& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_FRAME_RESAMPLER_H_
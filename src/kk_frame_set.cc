@@ -0,0 +1,242 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <kk_frame_set.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Waits are capped to this when a device has no event descriptor.
+#define POLL_FALLBACK_MS   1
+
+FrameSetCapture::FrameSetCapture(Device** devices,
+                                 const FrameSetOptions& options)
+    : options_(options), total_skew_us_(0) {
+  for (int i = 0; i < options_.device_count; ++i) {
+    Queue& queue = queues_[i];
+    queue.device = devices[i];
+    queue.event_fd = devices[i]->GetEventFd();
+    queue.head = 0;
+    queue.count = 0;
+  }
+}
+
+FrameSetCapture::~FrameSetCapture() {
+  for (int i = 0; i < options_.device_count; ++i) {
+    Queue& queue = queues_[i];
+    while (queue.count) {
+      queue.device->ReleaseFrame(&GetQueuedFrame(&queue, 0));
+      queue.head = (queue.head + 1) % kMaxFrameLeases;
+      --queue.count;
+    }
+  }
+}
+
+bool FrameSetCapture::AcquireFrame(Queue* queue, FrameLease* lease) {
+  if (options_.stream == kStreamMaskVideo) {
+    return queue->device->AcquireVideoFrame(lease);
+  }
+  return queue->device->AcquireDepthFrame(lease);
+}
+
+void FrameSetCapture::DiscardOldestFrame(Queue* queue) {
+  CHECK(queue->count);
+  queue->device->ReleaseFrame(&GetQueuedFrame(queue, 0));
+  queue->head = (queue->head + 1) % kMaxFrameLeases;
+  --queue->count;
+  ++stats_.discarded_frames;
+}
+
+void FrameSetCapture::DrainDevices() {
+  for (int i = 0; i < options_.device_count; ++i) {
+    Queue* queue = &queues_[i];
+    while (true) {
+      if (queue->count == options_.queue_depth) {
+        // Only give up a queued frame for a newer one.
+        if (!queue->device->WaitForFrame(options_.stream, 0)) break;
+        DiscardOldestFrame(queue);
+      }
+      FrameLease lease;
+      if (!AcquireFrame(queue, &lease)) break;
+      GetQueuedFrame(queue, queue->count) = lease;
+      ++queue->count;
+    }
+  }
+}
+
+// Frames of a device only get newer. A frame that arrived more than the
+// tolerance before the oldest queued frame of another device can never
+// be matched with that device.
+void FrameSetCapture::DiscardStaleFrames() {
+  bool discarded = true;
+  while (discarded) {
+    discarded = false;
+    uint64_t latest_oldest = 0;
+    for (int i = 0; i < options_.device_count; ++i) {
+      Queue* queue = &queues_[i];
+      if (!queue->count) continue;
+      uint64_t oldest = GetQueuedFrame(queue, 0).metadata.host_time_us;
+      if (oldest > latest_oldest) latest_oldest = oldest;
+    }
+    for (int i = 0; i < options_.device_count; ++i) {
+      Queue* queue = &queues_[i];
+      while (queue->count &&
+             GetQueuedFrame(queue, 0).metadata.host_time_us +
+             options_.tolerance_us < latest_oldest) {
+        DiscardOldestFrame(queue);
+        discarded = true;
+      }
+    }
+  }
+}
+
+// Tries every queued frame as the reference of a set, taking the closest
+// frame of each device. Picks the set with the lowest skew, and the
+// earliest one among equals.
+bool FrameSetCapture::FindFrameSet(FrameSet* set) {
+  int device_count = options_.device_count;
+  for (int i = 0; i < device_count; ++i) {
+    if (!queues_[i].count) return false;
+  }
+
+  int best_picks[kMaxFrameSetDevices];
+  uint64_t best_skew = 0;
+  uint64_t best_end = 0;
+  bool found = false;
+  for (int r = 0; r < device_count; ++r) {
+    for (int k = 0; k < queues_[r].count; ++k) {
+      uint64_t reference =
+          GetQueuedFrame(&queues_[r], k).metadata.host_time_us;
+      int picks[kMaxFrameSetDevices];
+      uint64_t start = reference;
+      uint64_t end = reference;
+      for (int i = 0; i < device_count; ++i) {
+        Queue* queue = &queues_[i];
+        uint64_t best_distance = 0;
+        for (int j = 0; j < queue->count; ++j) {
+          uint64_t time = GetQueuedFrame(queue, j).metadata.host_time_us;
+          uint64_t distance =
+              time > reference ? time - reference : reference - time;
+          if (!j || distance < best_distance) {
+            best_distance = distance;
+            picks[i] = j;
+          }
+        }
+        uint64_t time =
+            GetQueuedFrame(queue, picks[i]).metadata.host_time_us;
+        if (time < start) start = time;
+        if (time > end) end = time;
+      }
+      uint64_t skew = end - start;
+      if (skew > (uint64_t) options_.tolerance_us) continue;
+      if (!found || skew < best_skew ||
+          (skew == best_skew && end < best_end)) {
+        found = true;
+        best_skew = skew;
+        best_end = end;
+        for (int i = 0; i < device_count; ++i) best_picks[i] = picks[i];
+      }
+    }
+  }
+  if (!found) return false;
+
+  // Frames before the picked ones are older than any future set.
+  for (int i = 0; i < device_count; ++i) {
+    Queue* queue = &queues_[i];
+    for (int j = 0; j < best_picks[i]; ++j) DiscardOldestFrame(queue);
+    set->leases[i] = GetQueuedFrame(queue, 0);
+    queue->head = (queue->head + 1) % kMaxFrameLeases;
+    --queue->count;
+  }
+  set->device_count = device_count;
+  set->skew_us = (uint32_t) best_skew;
+
+  ++stats_.set_count;
+  total_skew_us_ += best_skew;
+  if (set->skew_us > stats_.max_skew_us) stats_.max_skew_us = set->skew_us;
+  return true;
+}
+
+bool FrameSetCapture::WaitForFrameSet(FrameSet* set, int timeout_ms) {
+  uint64_t deadline = GetCurrentMillis() + (timeout_ms > 0 ? timeout_ms : 0);
+  struct pollfd fds[kMaxFrameSetDevices];
+  bool has_all_fds = true;
+  for (int i = 0; i < options_.device_count; ++i) {
+    fds[i].fd = queues_[i].event_fd;
+    fds[i].events = POLLIN;
+    if (fds[i].fd == -1) has_all_fds = false;
+  }
+
+  while (true) {
+    // Reset the descriptors before draining, so that frames that arrive
+    // afterwards wake up the poll below.
+    for (int i = 0; i < options_.device_count; ++i) {
+      uint64_t value;
+      if (fds[i].fd != -1 &&
+          read(fds[i].fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        REPORT_ERRNO("read(eventfd)");
+      }
+    }
+    DrainDevices();
+    DiscardStaleFrames();
+    if (FindFrameSet(set)) return true;
+
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      uint64_t now = GetCurrentMillis();
+      if (now >= deadline) return false;
+      wait_ms = (int) (deadline - now);
+    }
+    if (!has_all_fds && (wait_ms < 0 || wait_ms > POLL_FALLBACK_MS)) {
+      wait_ms = POLL_FALLBACK_MS;
+    }
+    if (poll(fds, options_.device_count, wait_ms) < 0 && errno != EINTR) {
+      REPORT_ERRNO("poll");
+      return false;
+    }
+  }
+}
+
+void FrameSetCapture::ReleaseFrameSet(FrameSet* set) {
+  for (int i = 0; i < set->device_count; ++i) {
+    queues_[i].device->ReleaseFrame(&set->leases[i]);
+  }
+  set->device_count = 0;
+}
+
+FrameSetStats FrameSetCapture::GetStats() const {
+  FrameSetStats stats = stats_;
+  if (stats.set_count) {
+    stats.mean_skew_us = (double) total_skew_us_ / stats.set_count;
+  }
+  return stats;
+}
+
+}  // namespace kkonnect
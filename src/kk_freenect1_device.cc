@@ -25,35 +25,43 @@
  */
 
 #include "src/kk_freenect1_device.h"
+
+#include "external/libfreenect/include/libfreenect_registration.h"
+#include "src/kk_buffer_allocator.h"
 #include "src/utils.h"
 
 namespace kkonnect {
 
 #define MAX_DEVICE_OPEN_ATTEMPTS   10
+#define OPEN_RETRY_BASE_SECONDS    0.05
+#define OPEN_RETRY_MAX_SECONDS     1.0
 
 #define DEVICE_WIDTH     640
 #define DEVICE_HEIGHT    480
 #define DEVICE_FPS       15
 
+// Nominal Kinect1 video camera parameters, used for registered depth.
+#define VIDEO_FOCAL_LENGTH   525.0f
+#define VIDEO_CENTER_X       319.5f
+#define VIDEO_CENTER_Y       239.5f
+
 Freenect1Device::Freenect1Device(
-    freenect_context* context, freenect_video_cb video_cb,
-    freenect_depth_cb depth_cb, const DeviceOpenRequest& request)
+    freenect_context* context, pthread_mutex_t* context_mutex,
+    const DeviceOpenRequest& request)
     : BaseFreenectDevice(kDeviceVersion1), context_(context),
-      video_cb_(video_cb), depth_cb_(depth_cb), open_request_(request),
-      device_(NULL), video_data1_(NULL), video_data2_(NULL),
-      depth_data1_(NULL), depth_data2_(NULL) {}
+      context_mutex_(context_mutex), open_request_(request), device_(NULL),
+      registration_input_(NULL) {}
 
 Freenect1Device::~Freenect1Device() {
   CloseLocked();
-
-  delete[] video_data1_;
-  delete[] video_data2_;
-  delete[] depth_data1_;
-  delete[] depth_data2_;
+  buffer_allocator()->Release(registration_input_);
 }
 
 void Freenect1Device::CloseLocked() {
   if (device_) {
+    // StopLocked() detached the callbacks, and the connection waited
+    // for the running ones, so none can use |device_| anymore.
+    Autolock l(*context_mutex_);
     freenect_close_device(device_);
     device_ = NULL;
   }
@@ -64,14 +72,26 @@ void Freenect1Device::Connect() {
   int device_index = open_request_.device_index;
   fprintf(stderr, "Connecting to Kinect1 #%d\n", device_index);
 
-  int openAttempt = 1;
+  unsigned int seed = (unsigned int) (GetCurrentMillis() ^ device_index);
   freenect_device* device_raw = NULL;
   while (true) {
-    int res = freenect_open_device(context_, &device_raw, device_index);
+    int openAttempt;
+    {
+      Autolock l(mutex_, &lock_wait_us_);
+      openAttempt = RecordConnectAttemptLocked();
+    }
+
+    int res;
+    {
+      // libfreenect does not protect its device list, so opens are
+      // serialized per context. Retry delays run concurrently.
+      Autolock l(*context_mutex_);
+      res = freenect_open_device(context_, &device_raw, device_index);
+    }
     if (!res) break;
 
     {
-      Autolock l(mutex_);
+      Autolock l(mutex_, &lock_wait_us_);
       UpdateHealthTimerLocked();
       fprintf(
           stderr, "Failed freenect_open_device on #%d, error=%d, attempt=%d\n",
@@ -82,39 +102,71 @@ void Freenect1Device::Connect() {
       }
     }
 
-    Sleep(0.5);
-    ++openAttempt;
+    Sleep(GetBackoffDelay(openAttempt, OPEN_RETRY_BASE_SECONDS,
+                          OPEN_RETRY_MAX_SECONDS, &seed));
   }
 
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
   device_ = device_raw;
+  freenect_set_user(device_, this);
   UpdateHealthTimerLocked();
   CHECK_FREENECT(freenect_set_led(device_, LED_RED));
   freenect_update_tilt_state(device_);
   freenect_get_tilt_state(device_);
 
-  if (open_request_.video_format == kImageFormatVideoRgb) {
-    // TODO(igorc): Try switching to compressed UYVY and depth streams.
-    // Use YUV_RGB as it forces 15Hz refresh rate and takes 2 bytes per pixel.
+  if (open_request_.video_format == kImageFormatVideoRgb ||
+      open_request_.video_format == kImageFormatVideoYuv422) {
+    // TODO(igorc): Try switching to compressed depth streams.
+    // YUV modes run at 15Hz and take 2 bytes per pixel over USB. With
+    // YUV_RAW, frames are passed through without conversion on the
+    // event thread.
+    bool is_yuv = open_request_.video_format == kImageFormatVideoYuv422;
     CHECK_FREENECT(freenect_set_video_mode(
 	device_, freenect_find_video_mode(
-	FREENECT_RESOLUTION_MEDIUM, FREENECT_VIDEO_YUV_RGB)));
-    CHECK_FREENECT(freenect_set_video_buffer(device_, video_data1_));
-    SetVideoParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS);
-    video_data1_ = new uint8_t[GetVideoBufferSizeLocked()];
-    video_data2_ = new uint8_t[GetVideoBufferSizeLocked()];
-    freenect_set_video_callback(device_, video_cb_);
+	FREENECT_RESOLUTION_MEDIUM,
+        is_yuv ? FREENECT_VIDEO_YUV_RAW : FREENECT_VIDEO_YUV_RGB)));
+    if (!SetVideoParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS,
+                              open_request_.video_format)) {
+      SetStatusLocked(kErrorOutOfMemory);
+      return;
+    }
+    CHECK_FREENECT(freenect_set_video_buffer(
+        device_, GetVideoFillBuffer()));
+    freenect_set_video_callback(device_, OnVideoCallback);
   }
 
-  if (open_request_.depth_format == kImageFormatDepthMm) {
+  if (open_request_.depth_format == kImageFormatDepthMm ||
+      open_request_.depth_format == kImageFormatDepthRegistered) {
+    // Registered depth is remapped from FREENECT_DEPTH_MM frames rather
+    // than produced by FREENECT_DEPTH_REGISTERED, whose remapping runs
+    // on the event thread with per-pixel table lookups.
     CHECK_FREENECT(freenect_set_depth_mode(
 	device_, freenect_find_depth_mode(
 	FREENECT_RESOLUTION_MEDIUM, FREENECT_DEPTH_MM)));
-    CHECK_FREENECT(freenect_set_depth_buffer(device_, depth_data1_));
-    SetDepthParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS);
-    depth_data1_ = new uint16_t[GetDepthBufferSizeLocked()];
-    depth_data2_ = new uint16_t[GetDepthBufferSizeLocked()];
-    freenect_set_depth_callback(device_, depth_cb_);
+    if (!SetDepthParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS,
+                              open_request_.depth_format)) {
+      SetStatusLocked(kErrorOutOfMemory);
+      return;
+    }
+    if (!ApplyCalibrationLocked()) {
+      SetStatusLocked(kErrorUnableToConnect);
+      return;
+    }
+    void* depth_buffer = GetDepthFillBuffer();
+    if (registration_.IsInitialized()) {
+      if (!registration_input_) {
+        registration_input_ = reinterpret_cast<uint16_t*>(
+            buffer_allocator()->Allocate(
+                DEVICE_WIDTH * DEVICE_HEIGHT * sizeof(uint16_t)));
+        if (!registration_input_) {
+          SetStatusLocked(kErrorOutOfMemory);
+          return;
+        }
+      }
+      depth_buffer = registration_input_;
+    }
+    CHECK_FREENECT(freenect_set_depth_buffer(device_, depth_buffer));
+    freenect_set_depth_callback(device_, OnDepthCallback);
   }
 
   if (IsVideoEnabledLocked()) {
@@ -133,24 +185,97 @@ void Freenect1Device::Connect() {
 }
 
 void Freenect1Device::StopLocked() {
+  if (!device_ || !freenect_get_user(device_)) return;  // Stopped.
   if (IsVideoEnabledLocked()) freenect_stop_video(device_);
   if (IsDepthEnabledLocked()) freenect_stop_depth(device_);
+  // Callbacks that are already running hold on to this object until
+  // the connection observes a quiescent state of the event loop.
+  freenect_set_user(device_, NULL);
+}
+
+// static
+void Freenect1Device::OnDepthCallback(
+    freenect_device* dev, void* depth_data, uint32_t timestamp) {
+  Freenect1Device* device =
+      reinterpret_cast<Freenect1Device*>(freenect_get_user(dev));
+  if (!device) return;  // Closed.
+  device->HandleDepthData(dev, depth_data, timestamp);
+}
+
+// static
+void Freenect1Device::OnVideoCallback(
+    freenect_device* dev, void* video_data, uint32_t timestamp) {
+  Freenect1Device* device =
+      reinterpret_cast<Freenect1Device*>(freenect_get_user(dev));
+  if (!device) return;  // Closed.
+  device->HandleVideoData(dev, video_data, timestamp);
 }
 
-void Freenect1Device::HandleVideoData(void* video_data) {
-  Autolock l(mutex_);
+// Depth intrinsics are derived from the device's zero plane calibration,
+// in the same way as freenect_camera_to_world(). Registered depth takes
+// the intrinsics of the video camera.
+bool Freenect1Device::ApplyCalibrationLocked() {
+  freenect_registration registration = freenect_copy_registration(device_);
+  const freenect_zero_plane_info& zero_plane = registration.zero_plane_info;
+  bool success = true;
+  DepthIntrinsics intrinsics;
+  intrinsics.width = DEVICE_WIDTH;
+  intrinsics.height = DEVICE_HEIGHT;
+  if (open_request_.depth_format == kImageFormatDepthRegistered) {
+    if (!registration.registration_table ||
+        !registration.depth_to_rgb_shift) {
+      fprintf(stderr, "No registration data for Kinect1 #%d\n",
+              open_request_.device_index);
+      success = false;
+    } else if (!registration_.IsInitialized()) {
+      // Calibration does not change across reconnects of the device.
+      registration_.Init(
+          DEVICE_WIDTH, DEVICE_HEIGHT, registration.registration_table,
+          registration.depth_to_rgb_shift, FREENECT_DEPTH_MM_MAX_VALUE,
+          DEVICE_HEIGHT * registration.reg_pad_info.start_lines);
+    }
+    intrinsics.fx = VIDEO_FOCAL_LENGTH;
+    intrinsics.fy = VIDEO_FOCAL_LENGTH;
+    intrinsics.cx = VIDEO_CENTER_X;
+    intrinsics.cy = VIDEO_CENTER_Y;
+    SetDepthIntrinsicsLocked(intrinsics);
+  } else if (zero_plane.reference_distance > 0 &&
+             zero_plane.reference_pixel_size > 0) {
+    intrinsics.fx = zero_plane.reference_distance /
+        (2 * zero_plane.reference_pixel_size);
+    intrinsics.fy = intrinsics.fx;
+    intrinsics.cx = DEVICE_WIDTH / 2.0f;
+    intrinsics.cy = DEVICE_HEIGHT / 2.0f;
+    SetDepthIntrinsicsLocked(intrinsics);
+  }
+  freenect_destroy_registration(&registration);
+  return success;
+}
+
+// Frame handlers run on the freenect event thread and do not take |mutex_|.
+// Stream parameters do not change while streams are running.
+void Freenect1Device::HandleVideoData(
+    freenect_device* dev, void* video_data, uint32_t timestamp) {
+  // libfreenect wrote the frame straight into the pooled fill buffer.
+  CHECK(video_data == GetVideoFillBuffer());
   CHECK_FREENECT(freenect_set_video_buffer(
-      device_,
-      video_data == video_data1_ ? video_data2_ : video_data2_));
-  SetVideoDataLocked(video_data);
+      dev, PublishVideoFrame(timestamp)));
 }
 
-void Freenect1Device::HandleDepthData(void* depth_data) {
-  Autolock l(mutex_);
+void Freenect1Device::HandleDepthData(
+    freenect_device* dev, void* depth_data, uint32_t timestamp) {
+  if (registration_input_) {
+    // The input buffer stays with libfreenect, and the remapped frame
+    // goes straight into the pooled fill buffer.
+    CHECK(depth_data == registration_input_);
+    registration_.Apply(registration_input_,
+                        reinterpret_cast<uint16_t*>(GetDepthFillBuffer()));
+    PublishDepthFrame(timestamp);
+    return;
+  }
+  CHECK(depth_data == GetDepthFillBuffer());
   CHECK_FREENECT(freenect_set_depth_buffer(
-      device_,
-      depth_data == depth_data1_ ? depth_data2_ : depth_data2_));
-  SetDepthDataLocked(depth_data);
+      dev, PublishDepthFrame(timestamp)));
 }
 
 }  // namespace kkonnect
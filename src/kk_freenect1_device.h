@@ -30,6 +30,7 @@
 #include <pthread.h>
 
 #include "external/libfreenect/include/libfreenect.h"
+#include "src/kk_depth_registration.h"
 #include "src/kk_freenect_base.h"
 
 namespace kkonnect {
@@ -37,32 +38,47 @@ namespace kkonnect {
 // Implements Device for a libfreenect device.
 class Freenect1Device : public BaseFreenectDevice {
  public:
+  // |context_mutex| serializes calls that modify |context|.
   Freenect1Device(
-      freenect_context* context, freenect_video_cb video_cb,
-      freenect_depth_cb depth_cb, const DeviceOpenRequest& request);
+      freenect_context* context, pthread_mutex_t* context_mutex,
+      const DeviceOpenRequest& request);
   virtual ~Freenect1Device();
 
   virtual void Connect();
 
-  void HandleDepthData(void* depth_data);
-  void HandleVideoData(void* video_data);
-
   freenect_device* device() { return device_; }
+  freenect_context* context() const { return context_; }
 
  protected:
   virtual void CloseLocked();
   virtual void StopLocked();
+  virtual const char* GetBackendName() const { return "Kinect1"; }
 
  private:
+  // libfreenect callbacks. The owning Freenect1Device is stored as
+  // the freenect user pointer, so dispatch does not take any locks.
+  static void OnDepthCallback(
+      freenect_device* dev, void* depth_data, uint32_t timestamp);
+  static void OnVideoCallback(
+      freenect_device* dev, void* video_data, uint32_t timestamp);
+
+  void HandleDepthData(
+      freenect_device* dev, void* depth_data, uint32_t timestamp);
+  void HandleVideoData(
+      freenect_device* dev, void* video_data, uint32_t timestamp);
+
+  // Reads the device calibration to set depth intrinsics and, for
+  // registered depth, to build the registration tables.
+  bool ApplyCalibrationLocked();
+
   freenect_context* context_;
-  freenect_video_cb video_cb_;
-  freenect_depth_cb depth_cb_;
+  pthread_mutex_t* context_mutex_;
   DeviceOpenRequest open_request_;
   freenect_device* device_;
-  uint8_t* video_data1_;
-  uint8_t* video_data2_;
-  uint16_t* depth_data1_;
-  uint16_t* depth_data2_;
+  // For registered depth, libfreenect writes frames in mm into
+  // |registration_input_|, and they are remapped into the pool.
+  DepthRegistration registration_;
+  uint16_t* registration_input_;
 };
 
 }  // namespace kkonnect
@@ -28,12 +28,15 @@
 
 #include <string.h>
 
+#include "src/kk_depth_convert.h"
 #include "src/kk_freenect2_device.h"
 #include "src/utils.h"
 
 namespace kkonnect {
 
 #define MAX_DEVICE_OPEN_ATTEMPTS   10
+#define OPEN_RETRY_BASE_SECONDS    0.05
+#define OPEN_RETRY_MAX_SECONDS     1.0
 
 #define DEVICE_WIDTH     512
 #define DEVICE_HEIGHT    424
@@ -54,8 +57,7 @@ class FrameListenerImpl : public libfreenect2::FrameListener {
 Freenect2Device::Freenect2Device(
     libfreenect2::Freenect2* context, const DeviceOpenRequest& request)
     : BaseFreenectDevice(kDeviceVersion2), context_(context),
-      open_request_(request), device_(NULL), video_data_(NULL),
-      depth_data_(NULL) {
+      open_request_(request), device_(NULL) {
   callback_ = new FrameListenerImpl(this);
 }
 
@@ -65,8 +67,6 @@ Freenect2Device::~Freenect2Device() {
     delete device_;
   }
 
-  delete[] video_data_;
-  delete[] depth_data_;
   delete callback_;
 }
 
@@ -75,24 +75,29 @@ void Freenect2Device::Connect() {
   int device_index = open_request_.device_index;
   fprintf(stderr, "Connecting to Kinect1 #%d\n", device_index);
 
-  int openAttempt = 1;
+  unsigned int seed = (unsigned int) (GetCurrentMillis() ^ device_index);
   libfreenect2::Freenect2Device* device_raw = NULL;
   while (true) {
+    int openAttempt;
+    {
+      Autolock l(mutex_, &lock_wait_us_);
+      openAttempt = RecordConnectAttemptLocked();
+    }
     device_raw = context_->openDevice(device_index);
     if (device_raw) break;
     fprintf(
         stderr, "Failed freenect2_open_device on #%d, attempt=%d\n",
         device_index, openAttempt);
     if (openAttempt >= MAX_DEVICE_OPEN_ATTEMPTS) {
-      Autolock l(mutex_);
+      Autolock l(mutex_, &lock_wait_us_);
       SetStatusLocked(kErrorUnableToConnect);
       return;
     }
-    Sleep(0.5);
-    ++openAttempt;
+    Sleep(GetBackoffDelay(openAttempt, OPEN_RETRY_BASE_SECONDS,
+                          OPEN_RETRY_MAX_SECONDS, &seed));
   }
 
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
   device_ = device_raw;
 
   if (open_request_.video_format == kImageFormatVideoRgb) {
@@ -100,8 +105,11 @@ void Freenect2Device::Connect() {
     // CHECK_FREENECT(freenect2_set_video_mode(
     //    device_, freenect2_find_video_mode(
     //    FREENECT2_RESOLUTION_512x424, FREENECT2_VIDEO_RGB)));
-    SetVideoParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS);
-    video_data_ = new uint8_t[GetVideoBufferSizeLocked()];
+    if (!SetVideoParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS,
+                              kImageFormatVideoRgb)) {
+      SetStatusLocked(kErrorOutOfMemory);
+      return;
+    }
     device_->setColorFrameListener(callback_);
   }
 
@@ -109,8 +117,11 @@ void Freenect2Device::Connect() {
     // CHECK_FREENECT(freenect2_set_depth_mode(
     //    device_, freenect2_find_depth_mode(
     //    FREENECT2_RESOLUTION_512x424, FREENECT2_DEPTH_MM)));
-    SetDepthParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS);
-    depth_data_ = new uint16_t[GetDepthBufferSizeLocked()];
+    if (!SetDepthParamsLocked(DEVICE_WIDTH, DEVICE_HEIGHT, DEVICE_FPS,
+                              kImageFormatDepthMm)) {
+      SetStatusLocked(kErrorOutOfMemory);
+      return;
+    }
     device_->setIrAndDepthFrameListener(callback_);
   }
 
@@ -121,23 +132,23 @@ void Freenect2Device::Connect() {
 }
 
 void Freenect2Device::Stop() {
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
   if (device_) device_->stop();
 }
 
-void Freenect2Device::HandleVideoData(void* video_data) {
-  Autolock l(mutex_);
-  memcpy(video_data_, video_data, GetVideoBufferSizeLocked());
-  SetVideoDataLocked(depth_data_);
+void Freenect2Device::HandleVideoData(void* video_data, uint32_t timestamp) {
+  // The fill buffer takes full frames, even when the published stream
+  // region is smaller.
+  memcpy(GetVideoFillBuffer(), video_data, DEVICE_WIDTH * DEVICE_HEIGHT * 3);
+  PublishVideoFrame(timestamp);
 }
 
-void Freenect2Device::HandleDepthData(void* depth_data) {
-  Autolock l(mutex_);
-  uint32_t* depth_data2 = reinterpret_cast<uint32_t*>(depth_data);
-  for (int i = 0; i < DEVICE_WIDTH * DEVICE_HEIGHT; ++i) {
-    depth_data_[i] = depth_data2[i];
-  }
-  SetDepthDataLocked(depth_data_);
+void Freenect2Device::HandleDepthData(void* depth_data, uint32_t timestamp) {
+  // libfreenect2 reports depth as float mm.
+  ConvertDepthFloatToMm(reinterpret_cast<const float*>(depth_data),
+                        reinterpret_cast<uint16_t*>(GetDepthFillBuffer()),
+                        DEVICE_WIDTH * DEVICE_HEIGHT);
+  PublishDepthFrame(timestamp);
 }
 
 bool FrameListenerImpl::onNewFrame(
@@ -146,7 +157,8 @@ bool FrameListenerImpl::onNewFrame(
     CHECK(frame->width == DEVICE_WIDTH);
     CHECK(frame->height == DEVICE_HEIGHT);
     CHECK(frame->bytes_per_pixel == 3);
-    device_->HandleVideoData(frame->data);
+    // libfreenect2 does not report device timestamps yet.
+    device_->HandleVideoData(frame->data, 0);
     return true;
   }
 
@@ -157,7 +169,7 @@ bool FrameListenerImpl::onNewFrame(
     CHECK(frame->width == DEVICE_WIDTH);
     CHECK(frame->height == DEVICE_HEIGHT);
     CHECK(frame->bytes_per_pixel == 4);
-    device_->HandleDepthData(frame->data);
+    device_->HandleDepthData(frame->data, 0);
     return true;
   }
 
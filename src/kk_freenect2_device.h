@@ -46,18 +46,19 @@ class Freenect2Device : public BaseFreenectDevice {
   virtual void Connect();
   virtual void Stop();
 
-  void HandleDepthData(void* depth_data);
-  void HandleVideoData(void* video_data);
+  void HandleDepthData(void* depth_data, uint32_t timestamp);
+  void HandleVideoData(void* video_data, uint32_t timestamp);
 
   const libfreenect2::Freenect2Device* device() { return device_; }
 
+ protected:
+  virtual const char* GetBackendName() const { return "Kinect2"; }
+
  private:
   libfreenect2::Freenect2* context_;
   libfreenect2::FrameListener* callback_;
   DeviceOpenRequest open_request_;
   libfreenect2::Freenect2Device* device_;
-  uint8_t* video_data_;
-  uint16_t* depth_data_;
 };
 
 }  // namespace kkonnect
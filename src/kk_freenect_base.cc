@@ -26,126 +26,433 @@
 
 #include "src/kk_freenect_base.h"
 
+#include "src/kk_device_event_queue.h"
+
 namespace kkonnect {
 
+// Nominal Kinect1 zero plane parameters, in mm, from libfreenect.
+#define KINECT1_REFERENCE_DISTANCE     120.0f
+#define KINECT1_REFERENCE_PIXEL_SIZE   0.1042f
+
+// Typical Kinect2 IR camera parameters for the 512x424 depth stream,
+// as reported by libfreenect2.
+#define KINECT2_FOCAL_LENGTH           365.456f
+#define KINECT2_CENTER_X               254.878f
+#define KINECT2_CENTER_Y               205.395f
+#define KINECT2_K1                     0.0905474f
+#define KINECT2_K2                     -0.26819f
+#define KINECT2_K3                     0.0950862f
+
+static DepthIntrinsics GetNominalDepthIntrinsics(
+    DeviceVersion version, int width, int height) {
+  DepthIntrinsics intrinsics;
+  intrinsics.width = width;
+  intrinsics.height = height;
+  if (version == kDeviceVersion1) {
+    float scale = width / 640.0f;
+    intrinsics.fx = KINECT1_REFERENCE_DISTANCE /
+        (2 * KINECT1_REFERENCE_PIXEL_SIZE) * scale;
+    intrinsics.fy = intrinsics.fx;
+    intrinsics.cx = width / 2.0f;
+    intrinsics.cy = height / 2.0f;
+  } else {
+    float scale = width / 512.0f;
+    intrinsics.fx = KINECT2_FOCAL_LENGTH * scale;
+    intrinsics.fy = intrinsics.fx;
+    intrinsics.cx = KINECT2_CENTER_X * scale;
+    intrinsics.cy = KINECT2_CENTER_Y * scale;
+    intrinsics.k1 = KINECT2_K1;
+    intrinsics.k2 = KINECT2_K2;
+    intrinsics.k3 = KINECT2_K3;
+  }
+  return intrinsics;
+}
+
 BaseFreenectDevice::BaseFreenectDevice(DeviceVersion version)
-  : version_(version), status_(kErrorInProgress), connect_started_(false),
-    last_video_data_(NULL), last_depth_data_(NULL),
-    has_video_update_(false), has_depth_update_(false),
+  : lock_wait_us_(0), version_(version), status_(kErrorInProgress),
+    event_queue_(NULL), device_index_(-1),
+    connect_started_(false), needs_close_(false), connect_start_time_(0),
+    reconnect_count_(0),
+    last_error_(kErrorSuccess), copy_pool_(NULL), buffer_allocator_(NULL),
+    external_frames_(false),
     video_width_(0), video_height_(0), video_fps_(0),
-    depth_width_(0), depth_height_(0), depth_fps_(0) {
+    video_format_(kImageFormatNone),
+    depth_width_(0), depth_height_(0), depth_fps_(0),
+    depth_format_(kImageFormatNone), notifier_(this) {
   pthread_mutex_init(&mutex_, NULL);
+  InitMonotonicCond(&status_cond_);
   UpdateHealthTimerLocked();
 }
 
-BaseFreenectDevice::~BaseFreenectDevice() {}
+BaseFreenectDevice::~BaseFreenectDevice() {
+  delete copy_pool_;
+  pthread_cond_destroy(&status_cond_);
+}
 
 DeviceInfo BaseFreenectDevice::GetDeviceInfo() const {
   return DeviceInfo(version_);
 }
 
 ImageInfo BaseFreenectDevice::GetVideoImageInfo() const {
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
   if (!IsVideoEnabledLocked()) return ImageInfo();
-  return ImageInfo(video_width_, video_height_, kImageFormatVideoRgb,
-		   video_fps_);
+  return ImageInfo(video_width_, video_height_, video_format_, video_fps_);
 }
 
 ImageInfo BaseFreenectDevice::GetDepthImageInfo() const {
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
   if (!IsDepthEnabledLocked()) return ImageInfo();
-  return ImageInfo(depth_width_, depth_height_, kImageFormatDepthMm,
-		   depth_fps_);
+  return ImageInfo(depth_width_, depth_height_, depth_format_, depth_fps_);
+}
+
+bool BaseFreenectDevice::GetDepthIntrinsics(
+    DepthIntrinsics* intrinsics) const {
+  Autolock l(mutex_, &lock_wait_us_);
+  if (!IsDepthEnabledLocked()) return false;
+  *intrinsics = depth_intrinsics_;
+  return true;
 }
 
 void BaseFreenectDevice::UpdateHealthTimerLocked() {
-  last_health_time_ = GetCurrentMillis();
+  __atomic_store_n(&last_health_time_, GetCurrentMillis(), __ATOMIC_RELAXED);
 }
 
 void BaseFreenectDevice::Stop() {
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
   StopLocked();
 }
 
+void BaseFreenectDevice::Close() {
+  Autolock l(mutex_, &lock_wait_us_);
+  CloseLocked();
+  needs_close_ = false;
+}
+
+bool BaseFreenectDevice::NeedsClose() const {
+  Autolock l(mutex_, &lock_wait_us_);
+  return needs_close_;
+}
+
 bool BaseFreenectDevice::MarkConnectStarted() {
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
 
-  uint64_t timeout = GetCurrentMillis() - last_health_time_;
+  uint64_t timeout = GetCurrentMillis() -
+      __atomic_load_n(&last_health_time_, __ATOMIC_RELAXED);
   if (status_ == kErrorSuccess && timeout > 20 * 1000) {
-    fprintf(stderr,
-	    "Detected unhealthy freenect1 device, closing and reconnecting\n");
+    fprintf(stderr, "Detected unhealthy %s, closing and reconnecting\n",
+            GetBackendName());
+    if (event_queue_) {
+      event_queue_->Push(this, device_index_, kDeviceEventStalled, status_);
+    }
+    // Driver callbacks may still be running, so closing is left to
+    // the connect worker.
     StopLocked();
-    CloseLocked();
+    needs_close_ = true;
     connect_started_ = false;
+    ++reconnect_count_;
     SetStatusLocked(kErrorInProgress);
   }
 
   if (connect_started_) return false;
   connect_started_ = true;
+  connect_start_time_ = GetCurrentMillis();
+  connect_stats_.last_attempt_count = 0;
   UpdateHealthTimerLocked();
   return true;
 }
 
+void BaseFreenectDevice::SetCopyThreadCount(int thread_count) {
+  CHECK(!copy_pool_);
+  if (thread_count > 0) copy_pool_ = new ThreadPool(thread_count);
+}
+
+void BaseFreenectDevice::SetBufferAllocator(BufferAllocator* allocator) {
+  Autolock l(mutex_, &lock_wait_us_);
+  buffer_allocator_ = allocator;
+  video_pool_.SetAllocator(allocator);
+  depth_pool_.SetAllocator(allocator);
+  video_resampler_.SetAllocator(allocator);
+  depth_resampler_.SetAllocator(allocator);
+  video_changes_.SetAllocator(allocator);
+  depth_changes_.SetAllocator(allocator);
+}
+
+void BaseFreenectDevice::SetEventQueue(DeviceEventQueue* queue,
+                                       int device_index) {
+  Autolock l(mutex_, &lock_wait_us_);
+  event_queue_ = queue;
+  device_index_ = device_index;
+}
+
+void BaseFreenectDevice::SetStreamRegions(const StreamRegion& video_region,
+                                          const StreamRegion& depth_region) {
+  Autolock l(mutex_, &lock_wait_us_);
+  video_resampler_.SetRegion(video_region);
+  depth_resampler_.SetRegion(depth_region);
+}
+
+void BaseFreenectDevice::SetChangeDetection(
+    const ChangeDetectionOptions& video_options,
+    const ChangeDetectionOptions& depth_options) {
+  Autolock l(mutex_, &lock_wait_us_);
+  video_changes_.SetOptions(video_options);
+  depth_changes_.SetOptions(depth_options);
+}
+
+int BaseFreenectDevice::RecordConnectAttemptLocked() {
+  return ++connect_stats_.last_attempt_count;
+}
+
+ConnectStats BaseFreenectDevice::GetConnectStats() const {
+  Autolock l(mutex_, &lock_wait_us_);
+  return connect_stats_;
+}
+
+DeviceStats BaseFreenectDevice::GetStats() const {
+  DeviceStats stats;
+  // Frame counters do not need the lock.
+  video_pool_.GetStats(&stats.video);
+  depth_pool_.GetStats(&stats.depth);
+  video_filters_.GetStats(&stats.video);
+  depth_filters_.GetStats(&stats.depth);
+  Autolock l(mutex_, &lock_wait_us_);
+  stats.lock_wait_us = __atomic_load_n(&lock_wait_us_, __ATOMIC_RELAXED);
+  stats.reconnect_count = reconnect_count_;
+  stats.last_error = last_error_;
+  return stats;
+}
+
 ErrorCode BaseFreenectDevice::GetStatus() const {
-  Autolock l(mutex_);
+  Autolock l(mutex_, &lock_wait_us_);
+  return status_;
+}
+
+ErrorCode BaseFreenectDevice::WaitForConnect(int timeout_ms) {
+  uint64_t deadline = GetCurrentMillis() + (timeout_ms > 0 ? timeout_ms : 0);
+  Autolock l(mutex_, &lock_wait_us_);
+  while (status_ == kErrorInProgress && timeout_ms) {
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&status_cond_, &mutex_);
+    } else if (!WaitCondUntil(&status_cond_, &mutex_, deadline)) {
+      break;
+    }
+  }
   return status_;
 }
 
 void BaseFreenectDevice::SetStatusLocked(ErrorCode status) {
+  ErrorCode old_status = status_;
   status_ = status;
+  if (status != kErrorInProgress) pthread_cond_broadcast(&status_cond_);
+  if (event_queue_ && status != old_status) {
+    DeviceEventType type = kDeviceEventFailed;
+    if (status == kErrorSuccess) {
+      type = kDeviceEventConnected;
+    } else if (status == kErrorInProgress) {
+      type = kDeviceEventReconnecting;
+    }
+    event_queue_->Push(this, device_index_, type, status);
+  }
+  if (status != kErrorSuccess && status != kErrorInProgress) {
+    last_error_ = status;
+  }
   UpdateHealthTimerLocked();
+
+  if (connect_start_time_ && status != kErrorInProgress) {
+    connect_stats_.last_connect_millis =
+        (int) (GetCurrentMillis() - connect_start_time_);
+    connect_start_time_ = 0;
+    if (status == kErrorSuccess) ++connect_stats_.connect_count;
+    fprintf(stderr, "%s connect %s in %d ms after %d attempt(s)\n",
+            GetBackendName(),
+            status == kErrorSuccess ? "succeeded" : "failed",
+            connect_stats_.last_connect_millis,
+            connect_stats_.last_attempt_count);
+  }
+}
+
+bool BaseFreenectDevice::InitPoolLocked(
+    FramePool* pool, FrameResampler* resampler, ChangeDetector* changes,
+    int width, int height, ImageFormat format) {
+  if (!resampler->Init(width, height, format)) return false;
+  // Resampled frames are always copied into the pool.
+  if (external_frames_ && resampler->IsIdentity()) {
+    pool->InitExternal(width, height, width * GetBytesPerPixel(format),
+                       format);
+  } else if (!pool->Init(resampler->width(), resampler->height(),
+                         GetBytesPerPixel(format), format)) {
+    return false;
+  }
+  return changes->Init(resampler->width(), resampler->height(), format);
 }
 
-void BaseFreenectDevice::SetVideoParamsLocked(int width, int height, int fps) {
-  video_width_ = width;
-  video_height_ = height;
+bool BaseFreenectDevice::SetVideoParamsLocked(int width, int height, int fps,
+                                              ImageFormat format) {
+  if (!InitPoolLocked(&video_pool_, &video_resampler_, &video_changes_,
+                      width, height, format)) {
+    video_width_ = 0;
+    return false;
+  }
+  video_width_ = video_resampler_.width();
+  video_height_ = video_resampler_.height();
   video_fps_ = fps;
+  video_format_ = format;
+  return true;
 }
 
-void BaseFreenectDevice::SetDepthParamsLocked(int width, int height, int fps) {
-  depth_width_ = width;
-  depth_height_ = height;
+bool BaseFreenectDevice::SetDepthParamsLocked(int width, int height, int fps,
+                                              ImageFormat format) {
+  if (!InitPoolLocked(&depth_pool_, &depth_resampler_, &depth_changes_,
+                      width, height, format)) {
+    depth_width_ = 0;
+    return false;
+  }
+  depth_width_ = depth_resampler_.width();
+  depth_height_ = depth_resampler_.height();
   depth_fps_ = fps;
+  depth_format_ = format;
+  depth_intrinsics_ = depth_resampler_.AdjustIntrinsics(
+      GetNominalDepthIntrinsics(version_, width, height));
+  return true;
+}
+
+void BaseFreenectDevice::SetDepthIntrinsicsLocked(
+    const DepthIntrinsics& intrinsics) {
+  depth_intrinsics_ = depth_resampler_.AdjustIntrinsics(intrinsics);
 }
 
 int BaseFreenectDevice::GetVideoBufferSizeLocked() const {
-  return video_width_ * video_height_ * 3;
+  return video_width_ * video_height_ * GetBytesPerPixel(video_format_);
 }
 
 int BaseFreenectDevice::GetDepthBufferSizeLocked() const {
-  return depth_width_ * depth_height_ * 2;
+  return depth_width_ * depth_height_ * GetBytesPerPixel(depth_format_);
 }
 
-void BaseFreenectDevice::SetVideoDataLocked(void* video_data) {
-  if (!IsVideoEnabledLocked()) return;
-  last_video_data_ = reinterpret_cast<uint8_t*>(video_data);
-  has_video_update_ = true;
-  UpdateHealthTimerLocked();
+void* BaseFreenectDevice::PublishFrame(
+    FramePool* pool, FrameResampler* resampler, FilterChain* filters,
+    ChangeDetector* changes, uint32_t device_timestamp) {
+  UpdateHealthTimerLocked();  // Atomic, does not need the lock.
+  if (!resampler->IsIdentity()) {
+    resampler->Resample(resampler->GetInputBuffer(),
+                        resampler->input_row_size(), pool->GetFillBuffer());
+  }
+  filters->Apply(pool->GetFillBuffer(), pool->row_size(), pool->width(),
+                 pool->height(), pool->format());
+  changes->Detect(pool->GetFillBuffer(), pool->row_size(),
+                  pool->GetFillMetadata());
+  void* next_buffer = pool->Publish(device_timestamp);
+  notifier_.Notify();
+  return resampler->IsIdentity() ? next_buffer : resampler->GetInputBuffer();
 }
 
-void BaseFreenectDevice::SetDepthDataLocked(void* depth_data) {
-  if (!IsDepthEnabledLocked()) return;
-  last_depth_data_ = reinterpret_cast<uint16_t*>(depth_data);
-  has_depth_update_ = true;
+void BaseFreenectDevice::PublishExternalFrame(
+    FramePool* pool, FrameResampler* resampler, FilterChain* filters,
+    ChangeDetector* changes, const void* data, uint32_t device_timestamp) {
   UpdateHealthTimerLocked();
+  if (resampler->IsIdentity()) {
+    changes->Detect(data, pool->row_size(), pool->GetFillMetadata());
+    pool->PublishExternal(data, device_timestamp);
+  } else {
+    // External frames are read-only, so only resampled ones are filtered.
+    resampler->Resample(data, resampler->input_row_size(),
+                        pool->GetFillBuffer());
+    filters->Apply(pool->GetFillBuffer(), pool->row_size(), pool->width(),
+                   pool->height(), pool->format());
+    changes->Detect(pool->GetFillBuffer(), pool->row_size(),
+                    pool->GetFillMetadata());
+    pool->Publish(device_timestamp);
+  }
+  notifier_.Notify();
 }
 
-bool BaseFreenectDevice::GetAndClearVideoData(uint8_t* dst, int row_size) {
-  Autolock l(mutex_);
-  if (!has_video_update_) return false;
-  CopyImageData(dst, last_video_data_, row_size, video_width_ * 3,
-                video_height_);
-  has_video_update_ = false;
-  return true;
+void* BaseFreenectDevice::PublishVideoFrame(uint32_t device_timestamp) {
+  return PublishFrame(&video_pool_, &video_resampler_, &video_filters_,
+                      &video_changes_, device_timestamp);
+}
+
+void* BaseFreenectDevice::PublishDepthFrame(uint32_t device_timestamp) {
+  return PublishFrame(&depth_pool_, &depth_resampler_, &depth_filters_,
+                      &depth_changes_, device_timestamp);
+}
+
+void BaseFreenectDevice::PublishExternalVideoFrame(
+    const void* data, uint32_t device_timestamp) {
+  PublishExternalFrame(&video_pool_, &video_resampler_, &video_filters_,
+                       &video_changes_, data, device_timestamp);
+}
+
+void BaseFreenectDevice::PublishExternalDepthFrame(
+    const void* data, uint32_t device_timestamp) {
+  PublishExternalFrame(&depth_pool_, &depth_resampler_, &depth_filters_,
+                       &depth_changes_, data, device_timestamp);
+}
+
+ErrorCode BaseFreenectDevice::AddVideoFilter(FrameFilter* filter) {
+  if (!filter) return kErrorInvalidArgument;
+  Autolock l(mutex_, &lock_wait_us_);
+  return video_filters_.Add(filter) ? kErrorSuccess : kErrorInvalidArgument;
 }
 
-bool BaseFreenectDevice::GetAndClearDepthData(uint16_t* dst, int row_size) {
-  Autolock l(mutex_);
-  if (!has_depth_update_) return false;
-  CopyImageData(dst, last_depth_data_, row_size, depth_width_ * 2,
-                depth_height_);
-  has_depth_update_ = false;
+ErrorCode BaseFreenectDevice::AddDepthFilter(FrameFilter* filter) {
+  if (!filter) return kErrorInvalidArgument;
+  Autolock l(mutex_, &lock_wait_us_);
+  return depth_filters_.Add(filter) ? kErrorSuccess : kErrorInvalidArgument;
+}
+
+int BaseFreenectDevice::GetPendingStreams() const {
+  int streams = 0;
+  if (video_pool_.HasNewFrame()) streams |= kStreamMaskVideo;
+  if (depth_pool_.HasNewFrame()) streams |= kStreamMaskDepth;
+  return streams;
+}
+
+int BaseFreenectDevice::WaitForFrame(int streams_mask, int timeout_ms) {
+  return notifier_.Wait(streams_mask, timeout_ms);
+}
+
+int BaseFreenectDevice::GetEventFd() {
+  return notifier_.GetEventFd();
+}
+
+bool BaseFreenectDevice::GetAndClearData(
+    FramePool* pool, Stream stream, void* dst, int row_size,
+    FrameMetadata* metadata) {
+  // The lease keeps the buffer intact, so the copy needs no device lock.
+  FrameLease lease;
+  if (!pool->Acquire(stream, true, &lease)) return false;
+  CopyImageData(dst, lease.data, row_size, lease.row_size, lease.height,
+                copy_pool_);
+  if (metadata) *metadata = lease.metadata;
+  pool->Release(&lease, true);
   return true;
 }
 
+bool BaseFreenectDevice::GetAndClearVideoData(
+    uint8_t* dst, int row_size, FrameMetadata* metadata) {
+  return GetAndClearData(&video_pool_, kStreamVideo, dst, row_size, metadata);
+}
+
+bool BaseFreenectDevice::GetAndClearDepthData(
+    uint16_t* dst, int row_size, FrameMetadata* metadata) {
+  return GetAndClearData(&depth_pool_, kStreamDepth, dst, row_size, metadata);
+}
+
+bool BaseFreenectDevice::AcquireVideoFrame(FrameLease* lease) {
+  return video_pool_.Acquire(kStreamVideo, false, lease);
+}
+
+bool BaseFreenectDevice::AcquireDepthFrame(FrameLease* lease) {
+  return depth_pool_.Acquire(kStreamDepth, false, lease);
+}
+
+void BaseFreenectDevice::ReleaseFrame(FrameLease* lease) {
+  if (lease->internal_stream == kStreamVideo) {
+    video_pool_.Release(lease, false);
+  } else {
+    CHECK(lease->internal_stream == kStreamDepth);
+    depth_pool_.Release(lease, false);
+  }
+}
+
 }  // namespace kkonnect
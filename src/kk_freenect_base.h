@@ -30,10 +30,18 @@
 #include <kk_device.h>
 #include <pthread.h>
 
+#include "src/kk_change_detector.h"
+#include "src/kk_filter_chain.h"
+#include "src/kk_frame_notifier.h"
+#include "src/kk_frame_pool.h"
+#include "src/kk_frame_resampler.h"
+#include "src/kk_thread_pool.h"
 #include "src/utils.h"
 
 namespace kkonnect {
 
+class DeviceEventQueue;
+
 #define CHECK_FREENECT(call)                                            \
     { int res__ = (call);                                               \
       if (res__) {                                                      \
@@ -44,7 +52,8 @@ namespace kkonnect {
       } }
 
 // Implements Device for a libfreenect device.
-class BaseFreenectDevice : public Device {
+class BaseFreenectDevice
+    : public Device, private FrameNotifier::PendingSource {
  public:
   BaseFreenectDevice(DeviceVersion version);
   virtual ~BaseFreenectDevice();
@@ -54,53 +63,196 @@ class BaseFreenectDevice : public Device {
   virtual ImageInfo GetDepthImageInfo() const;
 
   virtual ErrorCode GetStatus() const;
+  virtual ErrorCode WaitForConnect(int timeout_ms);
+  virtual ConnectStats GetConnectStats() const;
+  virtual DeviceStats GetStats() const;
+  virtual bool GetDepthIntrinsics(DepthIntrinsics* intrinsics) const;
+
+  using Device::GetAndClearVideoData;
+  using Device::GetAndClearDepthData;
+  virtual bool GetAndClearVideoData(
+      uint8_t* dst, int row_size, FrameMetadata* metadata);
+  virtual bool GetAndClearDepthData(
+      uint16_t* dst, int row_size, FrameMetadata* metadata);
+
+  virtual bool AcquireVideoFrame(FrameLease* lease);
+  virtual bool AcquireDepthFrame(FrameLease* lease);
+  virtual void ReleaseFrame(FrameLease* lease);
 
-  virtual bool GetAndClearVideoData(uint8_t* dst, int row_size);
-  virtual bool GetAndClearDepthData(uint16_t* dst, int row_size);
+  virtual ErrorCode AddVideoFilter(FrameFilter* filter);
+  virtual ErrorCode AddDepthFilter(FrameFilter* filter);
+
+  virtual int WaitForFrame(int streams_mask, int timeout_ms);
+  virtual int GetEventFd();
 
   // Connects and starts the device stream.
   virtual void Connect() = 0;
 
-  // Stops the device before calling the destructor.
+  // Stops the device before calling the destructor. Driver callbacks
+  // that are already running may still reference the object until they
+  // return, and no new ones start.
   void Stop();
 
-  // Returns true if it was not marked before.
+  // Disconnects from the device after Stop(), once running driver
+  // callbacks have returned.
+  void Close();
+
+  // Returns true if it was not marked before. Stops a device that stopped
+  // delivering frames, so that it can be reconnected.
   bool MarkConnectStarted();
 
+  // Returns true if the device was stopped for reconnecting and was not
+  // closed yet. It must then be closed like in CloseDevice(), before
+  // it is connected again or deleted.
+  bool NeedsClose() const;
+
+  // Starts threads for copying large frames. Must be called before the
+  // device is returned to the caller.
+  void SetCopyThreadCount(int thread_count);
+
+  // Sets the allocator of frame buffers, which must outlive the device.
+  // Must be called before the device is returned to the caller.
+  void SetBufferAllocator(BufferAllocator* allocator);
+
+  // Sets the queue that receives status changes, which must outlive
+  // the device. Must be called before the device is returned to
+  // the caller.
+  void SetEventQueue(DeviceEventQueue* queue, int device_index);
+
+  // Selects the published parts of the streams. Must be called before
+  // the device is returned to the caller.
+  void SetStreamRegions(const StreamRegion& video_region,
+                        const StreamRegion& depth_region);
+
+  // Configures change detection of the streams. Must be called before
+  // the device is returned to the caller.
+  void SetChangeDetection(const ChangeDetectionOptions& video_options,
+                          const ChangeDetectionOptions& depth_options);
+
  protected:
   virtual void CloseLocked() = 0;
   virtual void StopLocked() = 0;
 
+  // Names the kind of device in log messages.
+  virtual const char* GetBackendName() const = 0;
+
   void UpdateHealthTimerLocked();
   void SetStatusLocked(ErrorCode status);
 
-  void SetVideoParamsLocked(int width, int height, int fps);
-  void SetDepthParamsLocked(int width, int height, int fps);
+  // Counts an attempt to open the device. Returns the attempt number.
+  int RecordConnectAttemptLocked();
+
+  // Makes the stream parameter setters below prepare the frame pools
+  // for PublishExternal*Frame() instead of allocating buffers.
+  void SetExternalFramesLocked() { external_frames_ = true; }
+
+  // Take the geometry of full frames, which are cropped and decimated
+  // to the stream regions on publishing. Return false, and leave
+  // the stream disabled, if frame buffers cannot be allocated.
+  bool SetVideoParamsLocked(int width, int height, int fps,
+                            ImageFormat format);
+  // Also resets depth intrinsics to nominal values for the device version.
+  bool SetDepthParamsLocked(int width, int height, int fps,
+                            ImageFormat format);
+  // Takes intrinsics of full frames.
+  void SetDepthIntrinsicsLocked(const DepthIntrinsics& intrinsics);
   int IsVideoEnabledLocked() const { return video_width_ != 0; }
   int IsDepthEnabledLocked() const { return depth_width_ != 0; }
   int GetVideoBufferSizeLocked() const;
   int GetDepthBufferSizeLocked() const;
 
-  void SetDepthDataLocked(void* depth_data);
-  void SetVideoDataLocked(void* video_data);
+  // Return buffers that should receive the next full frame. Only valid
+  // after the stream parameters have been set.
+  void* GetVideoFillBuffer() const {
+    return GetFillBuffer(video_pool_, video_resampler_);
+  }
+  void* GetDepthFillBuffer() const {
+    return GetFillBuffer(depth_pool_, depth_resampler_);
+  }
+
+  // Resample the filled buffer to the stream region, run the stream
+  // filters and change detection on it and publish it as the latest
+  // frame. Return the buffer
+  // that should receive the next frame. These methods do not require
+  // |mutex_|, so that the driver thread never waits for consumers.
+  // They must only be called from one thread at a time per stream.
+  void* PublishVideoFrame(uint32_t device_timestamp);
+  void* PublishDepthFrame(uint32_t device_timestamp);
+
+  // Publish frames that stay owned by the caller, without copying them.
+  // |data| holds packed rows and must remain valid while the device exists.
+  void PublishExternalVideoFrame(const void* data, uint32_t device_timestamp);
+  void PublishExternalDepthFrame(const void* data, uint32_t device_timestamp);
+
+  BufferAllocator* buffer_allocator() const { return buffer_allocator_; }
 
   mutable pthread_mutex_t mutex_;
+  // Time spent waiting for |mutex_|. Pass to Autolock when locking it.
+  mutable uint64_t lock_wait_us_;  // Atomic.
 
  private:
+  enum Stream {
+    kStreamVideo = 0,
+    kStreamDepth = 1,
+  };
+
+  virtual int GetPendingStreams() const;
+
+  // Returns the pooled buffer if frames are published as they are,
+  // or the input buffer of the resampler otherwise.
+  static void* GetFillBuffer(const FramePool& pool,
+                             const FrameResampler& resampler) {
+    return resampler.IsIdentity() ?
+        pool.GetFillBuffer() : resampler.GetInputBuffer();
+  }
+
+  bool InitPoolLocked(FramePool* pool, FrameResampler* resampler,
+                      ChangeDetector* changes, int width, int height,
+                      ImageFormat format);
+  void* PublishFrame(FramePool* pool, FrameResampler* resampler,
+                     FilterChain* filters, ChangeDetector* changes,
+                     uint32_t device_timestamp);
+  void PublishExternalFrame(FramePool* pool, FrameResampler* resampler,
+                            FilterChain* filters, ChangeDetector* changes,
+                            const void* data, uint32_t device_timestamp);
+
+  bool GetAndClearData(FramePool* pool, Stream stream, void* dst,
+                       int row_size, FrameMetadata* metadata);
+
   DeviceVersion version_;
   ErrorCode status_;
+  // Signalled when |status_| leaves kErrorInProgress.
+  pthread_cond_t status_cond_;
+  DeviceEventQueue* event_queue_;
+  int device_index_;
   bool connect_started_;
-  uint64_t last_health_time_;
-  uint8_t* last_video_data_;
-  uint16_t* last_depth_data_;
-  bool has_video_update_;
-  bool has_depth_update_;
+  bool needs_close_;
+  uint64_t last_health_time_;  // Atomic.
+  uint64_t connect_start_time_;
+  ConnectStats connect_stats_;
+  int reconnect_count_;
+  ErrorCode last_error_;
+  FramePool video_pool_;
+  FramePool depth_pool_;
+  FilterChain video_filters_;
+  FilterChain depth_filters_;
+  FrameResampler video_resampler_;
+  FrameResampler depth_resampler_;
+  ChangeDetector video_changes_;
+  ChangeDetector depth_changes_;
+  ThreadPool* copy_pool_;
+  BufferAllocator* buffer_allocator_;
+  bool external_frames_;
   int video_width_;
   int video_height_;
   int video_fps_;
+  ImageFormat video_format_;
   int depth_width_;
   int depth_height_;
   int depth_fps_;
+  ImageFormat depth_format_;
+  DepthIntrinsics depth_intrinsics_;
+  FrameNotifier notifier_;
 };
 
 }  // namespace kkonnect
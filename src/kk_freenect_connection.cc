@@ -37,28 +37,63 @@ namespace kkonnect {
 
 #define LIBUSB_ERROR_INTERRUPTED  -10
 
+// Number of devices that can be connecting at the same time.
+#define CONNECT_THREAD_COUNT      4
+
 pthread_mutex_t FreenectConnection::global_mutex_ = PTHREAD_MUTEX_INITIALIZER;
 FreenectConnection* FreenectConnection::instance_ = NULL;
 
 // static
-FreenectConnection* FreenectConnection::GetInstanceImpl() {
+FreenectConnection* FreenectConnection::GetInstanceImpl(
+    const LocalOptions& options) {
+  if (options.event_thread_count < 1 ||
+      options.event_thread_count > kMaxLocalEventThreads) {
+    fprintf(stderr, "Invalid number of freenect event threads: %d\n",
+            options.event_thread_count);
+    return NULL;
+  }
+  for (int i = 0; i < kMaxLocalDevices; ++i) {
+    if (options.device_threads[i] >= options.event_thread_count) {
+      fprintf(stderr, "Invalid event thread for Kinect1 #%d\n", i);
+      return NULL;
+    }
+  }
+
   Autolock l(global_mutex_);
   if (!instance_) {
-    instance_ = new FreenectConnection();
+    instance_ = new FreenectConnection(options);
     instance_->Refresh();
   }
   return instance_;
 }
 
-FreenectConnection::FreenectConnection()
-    : ref_count_(1), should_exit_(false),
-      freenect1_context_(NULL), freenect1_device_count_(0),
+FreenectConnection::FreenectConnection(const LocalOptions& options)
+    : ref_count_(1), should_exit_(false), connect_pool_(this, &mutex_),
+      options_(options), freenect1_shards_(NULL), freenect1_started_(false),
+      freenect1_device_count_(0),
       /*freenect2_context_(NULL),*/ freenect2_device_count_(0) {
-  pthread_cond_init(&connection_cond_, NULL);
+  freenect1_shards_ = new Freenect1Shard[options_.event_thread_count];
+  for (int i = 0; i < options_.event_thread_count; ++i) {
+    Freenect1Shard& shard = freenect1_shards_[i];
+    shard.connection = this;
+    shard.index = i;
+    shard.context = NULL;
+    pthread_mutex_init(&shard.context_mutex, NULL);
+    shard.epoch = 0;
+    pthread_mutex_init(&shard.epoch_mutex, NULL);
+    pthread_cond_init(&shard.epoch_cond, NULL);
+    shard.waiter_count = 0;
+    shard.has_exited = false;
+  }
 }
 
 FreenectConnection::~FreenectConnection() {
-  pthread_cond_destroy(&connection_cond_);
+  for (int i = 0; i < options_.event_thread_count; ++i) {
+    pthread_cond_destroy(&freenect1_shards_[i].epoch_cond);
+    pthread_mutex_destroy(&freenect1_shards_[i].epoch_mutex);
+    pthread_mutex_destroy(&freenect1_shards_[i].context_mutex);
+  }
+  delete[] freenect1_shards_;
 
   {
     Autolock l(global_mutex_);
@@ -74,9 +109,18 @@ void FreenectConnection::DecRefLocked() {
 void FreenectConnection::CloseInternalLocked() {
   should_exit_ = true;
   fprintf(stderr, "FreenectConnection::CloseInternalLocked()\n");
+  // Connect workers use the contexts, so they exit first. They need
+  // the mutex to exit.
+  connect_pool_.ShutdownLocked();
+  pthread_mutex_unlock(&mutex_);
+  connect_pool_.Join();
+  pthread_mutex_lock(&mutex_);
   // delete freenect2_context_;
-  if (freenect1_context_) freenect_shutdown(freenect1_context_);
-  pthread_cond_broadcast(&connection_cond_);
+  for (int i = 0; i < options_.event_thread_count; ++i) {
+    if (freenect1_shards_[i].context) {
+      freenect_shutdown(freenect1_shards_[i].context);
+    }
+  }
   // TODO(igorc): De-init, but do not destroy. Also wait for threads to exit.
   DecRefLocked();
 }
@@ -115,14 +159,21 @@ ErrorCode FreenectConnection::GetDeviceInfo(
 ErrorCode FreenectConnection::Refresh() {
   Autolock l(mutex_);
 
-  if (!freenect1_context_) {
-    CHECK_FREENECT(freenect_init(&freenect1_context_, NULL));
-    freenect_set_log_level(freenect1_context_, FREENECT_LOG_DEBUG);
-    freenect_select_subdevices(
-	freenect1_context_, (freenect_device_flags) FREENECT_DEVICE_CAMERA);
-    CHECK(!pthread_create(&freenect1_thread_, NULL, RunFreenect1Loop, this));
-    CHECK(!pthread_create(&connection_thread_, NULL, RunConnectLoop, this));
-    ref_count_ += 2;
+  if (!freenect1_started_) {
+    // Every context enumerates the same devices, and each device is
+    // opened on the context of its shard.
+    for (int i = 0; i < options_.event_thread_count; ++i) {
+      Freenect1Shard* shard = &freenect1_shards_[i];
+      CHECK_FREENECT(freenect_init(&shard->context, NULL));
+      freenect_set_log_level(shard->context, FREENECT_LOG_DEBUG);
+      freenect_select_subdevices(
+          shard->context, (freenect_device_flags) FREENECT_DEVICE_CAMERA);
+      CHECK(!pthread_create(&shard->thread, NULL, RunFreenect1Loop, shard));
+      ++ref_count_;
+    }
+    connect_pool_.Start(CONNECT_THREAD_COUNT);
+    ++ref_count_;
+    freenect1_started_ = true;
   }
 
   /*if (!freenect2_context_) {
@@ -130,7 +181,7 @@ ErrorCode FreenectConnection::Refresh() {
     // freenect2_set_log_level(freenect2_context_, FREENECT2_LOG_DEBUG);
   }*/
 
-  freenect1_device_count_ = freenect_num_devices(freenect1_context_);
+  freenect1_device_count_ = freenect_num_devices(freenect1_shards_[0].context);
   freenect2_device_count_ = 0;  // freenect2_context_->enumerateDevices();
 
   fprintf(stderr, "Found %d Kinect1 and %d Kinect2 devices\n",
@@ -148,17 +199,22 @@ ErrorCode FreenectConnection::OpenDeviceInternalLocked(
 
   BaseFreenectDevice* base_device;
   if (version == kDeviceVersion1) {
+    Freenect1Shard* shard = GetShardForDevice(request.device_index);
     base_device = new Freenect1Device(
-        freenect1_context_, OnFreenect1VideoCallback, OnFreenect1DepthCallback,
-	request);
+        shard->context, &shard->context_mutex, request);
   } else {
     return kErrorUnknownDevice;
     // DeviceOpenRequest request2 = request;
     // request2.device_index -= freenect1_device_count_;
     // base_device = new Freenect2Device(freenect2_context_, request2);
   }
+  base_device->SetCopyThreadCount(request.copy_thread_count);
+  base_device->SetBufferAllocator(buffer_allocator());
+  base_device->SetEventQueue(device_event_queue(), request.device_index);
+  base_device->SetChangeDetection(request.video_changes, request.depth_changes);
+  base_device->SetStreamRegions(request.video_region, request.depth_region);
 
-  pthread_cond_broadcast(&connection_cond_);
+  connect_pool_.WakeUpLocked();
 
   *device = base_device;
   return kErrorSuccess;
@@ -168,41 +224,34 @@ void FreenectConnection::CloseDeviceInternalLocked(Device* device) {
   BaseFreenectDevice* base_device =
       reinterpret_cast<BaseFreenectDevice*>(device);
   if (base_device->MarkConnectStarted()) {
-    // The device did not start connecting yet.
-    delete base_device;
-    return;
+    if (!base_device->NeedsClose()) {
+      // The device did not start connecting yet.
+      delete base_device;
+      return;
+    }
+  } else {
+    // The device is no longer listed, so workers cannot pick it up again.
+    connect_pool_.WaitForConnectLocked(base_device);
   }
-  // TODO(igorc): Stop and destroy after aborting Connect().
   base_device->Stop();
+  // Event threads do not need |mutex_|, but other calls should not wait
+  // for them.
+  pthread_mutex_unlock(&mutex_);
+  WaitForStoppedCallbacks(base_device);
+  pthread_mutex_lock(&mutex_);
+  base_device->Close();
   delete base_device;
 }
 
-// static
-void* FreenectConnection::RunConnectLoop(void* arg) {
-  reinterpret_cast<FreenectConnection*>(arg)->RunConnectLoop();
-  return NULL;
-}
-
-void FreenectConnection::RunConnectLoop() {
-  while (!should_exit_) {
-    BaseFreenectDevice* device;
-    {
-      Autolock l(mutex_);
-      device = StartConnectingNextDeviceLocked();
-      if (!device) {
-        // Wake up every second for health check.
-        const int kTimeoutMs = 1000;
-        struct timespec abstime;
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        abstime.tv_sec = now.tv_sec + 5;
-        abstime.tv_nsec = (now.tv_usec + 1000UL * kTimeoutMs) * 1000UL;
-        pthread_cond_timedwait(&connection_cond_, &mutex_, &abstime);
-        continue;
-      }
+void FreenectConnection::WaitForStoppedCallbacks(
+    BaseFreenectDevice* device) {
+  if (device->GetDeviceInfo().version != kDeviceVersion1) return;
+  freenect_context* context =
+      static_cast<Freenect1Device*>(device)->context();
+  for (int i = 0; i < options_.event_thread_count; ++i) {
+    if (freenect1_shards_[i].context == context) {
+      WaitForFreenect1Quiescence(&freenect1_shards_[i]);
     }
-
-    device->Connect();
   }
 }
 
@@ -221,63 +270,76 @@ BaseFreenectDevice* FreenectConnection::StartConnectingNextDeviceLocked() {
 // FREENECT1 METHODS
 ////////////////////////////////////////////////////////////////////////////////
 
+FreenectConnection::Freenect1Shard* FreenectConnection::GetShardForDevice(
+    int device_index) const {
+  int shard_index = -1;
+  if (device_index < kMaxLocalDevices) {
+    shard_index = options_.device_threads[device_index];
+  }
+  if (shard_index < 0) {
+    shard_index = device_index % options_.event_thread_count;
+  }
+  return &freenect1_shards_[shard_index];
+}
+
 // static
 void* FreenectConnection::RunFreenect1Loop(void* arg) {
-  reinterpret_cast<FreenectConnection*>(arg)->RunFreenect1Loop();
+  Freenect1Shard* shard = reinterpret_cast<Freenect1Shard*>(arg);
+  shard->connection->RunFreenect1Loop(shard);
   return NULL;
 }
 
-void FreenectConnection::RunFreenect1Loop() {
+void FreenectConnection::RunFreenect1Loop(Freenect1Shard* shard) {
+  int cpu = shard->index < kMaxLocalEventThreads ?
+      options_.thread_cpus[shard->index] : -1;
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (res) {
+      fprintf(stderr, "Unable to pin freenect1 event thread %d to CPU %d: "
+              "%d\n", shard->index, cpu, res);
+    }
+  }
+
+  // Use a timeout, so that the epoch advances even without USB traffic.
+  struct timeval timeout;
   while (!should_exit_) {
-    int res = freenect_process_events(freenect1_context_);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100 * 1000;
+    int res = freenect_process_events_timeout(shard->context, &timeout);
+    __atomic_add_fetch(&shard->epoch, 1, __ATOMIC_SEQ_CST);
+    // Pairs with the increment in WaitForFreenect1Quiescence():
+    // either the waiter sees the new epoch, or this load sees the waiter.
+    if (__atomic_load_n(&shard->waiter_count, __ATOMIC_SEQ_CST)) {
+      Autolock l(shard->epoch_mutex);
+      pthread_cond_broadcast(&shard->epoch_cond);
+    }
     if (res == LIBUSB_ERROR_INTERRUPTED) {
       fprintf(stderr, "freenect1: LIBUSB_ERROR_INTERRUPTED\n");
     } if (res) {
       fprintf(stderr, "freenect1: freenect_process_events returned %d\n", res);
     }
   }
-}
 
-// static
-void FreenectConnection::OnFreenect1DepthCallback(
-    freenect_device* dev, void* depth_data, uint32_t timestamp) {
-  (void) timestamp;
-  GetInstanceImpl()->HandleFreenect1DepthData(dev, depth_data);
-}
-
-// static
-void FreenectConnection::OnFreenect1VideoCallback(
-    freenect_device* dev, void* video_data, uint32_t timestamp) {
-  (void) timestamp;
-  GetInstanceImpl()->HandleFreenect1VideoData(dev, video_data);
+  // No more callbacks can run on this shard.
+  Autolock l(shard->epoch_mutex);
+  shard->has_exited = true;
+  pthread_cond_broadcast(&shard->epoch_cond);
 }
 
-Freenect1Device* FreenectConnection::FindFreenect1Locked(
-    freenect_device* dev) const {
-  Device* device = GetFirstDeviceLocked();
-  while (device) {
-    if (device->GetDeviceInfo().version != kDeviceVersion1) continue;
-    Freenect1Device* device2 = reinterpret_cast<Freenect1Device*>(device);
-    if (device2->device() == dev) return device2;
-    device = GetNextDeviceLocked(device);
+void FreenectConnection::WaitForFreenect1Quiescence(Freenect1Shard* shard) {
+  // An iteration that was in progress at the time of the call ends with
+  // the first increment, and a fresh one ends with the second.
+  uint64_t target = __atomic_load_n(&shard->epoch, __ATOMIC_SEQ_CST) + 2;
+  Autolock l(shard->epoch_mutex);
+  __atomic_add_fetch(&shard->waiter_count, 1, __ATOMIC_SEQ_CST);
+  while (!shard->has_exited &&
+         __atomic_load_n(&shard->epoch, __ATOMIC_SEQ_CST) < target) {
+    pthread_cond_wait(&shard->epoch_cond, &shard->epoch_mutex);
   }
-  return NULL;
-}
-
-void FreenectConnection::HandleFreenect1DepthData(
-    freenect_device* dev, void* depth_data) {
-  Autolock l(mutex_);
-  Freenect1Device* device = FindFreenect1Locked(dev);
-  if (!device) return;  // Closed.
-  device->HandleDepthData(depth_data);
-}
-
-void FreenectConnection::HandleFreenect1VideoData(
-    freenect_device* dev, void* video_data) {
-  Autolock l(mutex_);
-  Freenect1Device* device = FindFreenect1Locked(dev);
-  if (!device) return;  // Closed.
-  device->HandleVideoData(video_data);
+  __atomic_sub_fetch(&shard->waiter_count, 1, __ATOMIC_SEQ_CST);
 }
 
 }  // namespace kkonnect
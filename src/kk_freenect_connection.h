@@ -30,6 +30,7 @@
 #include <kk_device.h>
 #include <pthread.h>
 
+#include "src/kk_connect_pool.h"
 #include "src/kk_freenect_base.h"
 #include "src/kk_freenect1_device.h"
 // #include "src/kk_freenect2_device.h"
@@ -38,16 +39,18 @@
 namespace kkonnect {
 
 // Implements connection using local libfreenect and libfreenect2.
-class FreenectConnection : public Connection {
+class FreenectConnection
+    : public Connection, private ConnectPool::Delegate {
  public:
-  static FreenectConnection* GetInstanceImpl();
+  // Returns NULL if |options| are invalid.
+  static FreenectConnection* GetInstanceImpl(const LocalOptions& options);
 
   virtual ErrorCode Refresh();
   virtual int GetDeviceCount();
   virtual ErrorCode GetDeviceInfo(int device_index, DeviceInfo* info);
 
  protected:
-  FreenectConnection();
+  explicit FreenectConnection(const LocalOptions& options);
   virtual ~FreenectConnection();
 
   virtual void CloseInternalLocked();
@@ -57,33 +60,50 @@ class FreenectConnection : public Connection {
   virtual void CloseDeviceInternalLocked(Device* device);
 
  private:
+  // A libfreenect context with its own event thread.
+  struct Freenect1Shard {
+    FreenectConnection* connection;
+    int index;
+    freenect_context* context;
+    // Serializes calls that modify |context|.
+    pthread_mutex_t context_mutex;
+    pthread_t thread;
+    uint64_t epoch;  // Atomic.
+    // Guards |has_exited| and signals |epoch_cond| for threads waiting
+    // on the epoch, counted in |waiter_count|.
+    pthread_mutex_t epoch_mutex;
+    pthread_cond_t epoch_cond;
+    int waiter_count;  // Atomic.
+    bool has_exited;
+  };
+
   void DecRefLocked();
 
   bool GetVersionLocked(int device_index, DeviceVersion* version) const;
 
-  static void* RunConnectLoop(void* arg);
-  void RunConnectLoop();
-  BaseFreenectDevice* StartConnectingNextDeviceLocked();
+  virtual BaseFreenectDevice* StartConnectingNextDeviceLocked();
+  virtual void WaitForStoppedCallbacks(BaseFreenectDevice* device);
+
+  Freenect1Shard* GetShardForDevice(int device_index) const;
 
   static void* RunFreenect1Loop(void* arg);
-  static void OnFreenect1DepthCallback(
-      freenect_device* dev, void* depth_data, uint32_t timestamp);
-  static void OnFreenect1VideoCallback(
-      freenect_device* dev, void* rgb_data, uint32_t timestamp);
-  void RunFreenect1Loop();
-  void HandleFreenect1DepthData(freenect_device* dev, void* depth_data);
-  void HandleFreenect1VideoData(freenect_device* dev, void* rgb_data);
-  Freenect1Device* FindFreenect1Locked(freenect_device* dev) const;
+  void RunFreenect1Loop(Freenect1Shard* shard);
+
+  // Waits until the event loop of |shard| completes an iteration that
+  // started after this call, or exits. Callbacks that could have observed
+  // a device before it was stopped are finished by then. Must be called
+  // without |mutex_|.
+  void WaitForFreenect1Quiescence(Freenect1Shard* shard);
 
   static pthread_mutex_t global_mutex_;
   static FreenectConnection* instance_;
 
   int ref_count_;
   volatile bool should_exit_;
-  pthread_t connection_thread_;
-  pthread_cond_t connection_cond_;
-  freenect_context* freenect1_context_;
-  pthread_t freenect1_thread_;
+  ConnectPool connect_pool_;
+  LocalOptions options_;
+  Freenect1Shard* freenect1_shards_;
+  bool freenect1_started_;
   int freenect1_device_count_;
   // libfreenect2::Freenect2* freenect2_context_;
   int freenect2_device_count_;
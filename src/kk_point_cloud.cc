@@ -0,0 +1,357 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <kk_point_cloud.h>
+
+#include <math.h>
+
+#include "src/utils.h"
+
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace kkonnect {
+
+// Iterations used to invert the distortion model when building rays.
+#define UNDISTORT_ITERATIONS   10
+
+#define MM_TO_METERS           0.001f
+
+// Receives converted points of a row.
+struct PointOutput {
+  uint8_t* points;
+  int32_t* pixel_indexes;
+  int count;
+  int max_count;
+};
+
+// Converts |width| depth values of a row with the matching rays. Pixel
+// |i| of the row has index |base_index| + |i| * |step| in the frame.
+typedef void (*ConvertRowFunction)(
+    const uint16_t* depth, const float* ray_x, const float* ray_y,
+    int start, int width, bool skip_invalid, int base_index, int step,
+    PointOutput* output);
+
+static inline void AddPixelIndex(PointOutput* output, int index) {
+  if (output->pixel_indexes) output->pixel_indexes[output->count] = index;
+}
+
+static inline int16_t SaturateInt16(long value) {
+  return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+}
+
+static void ConvertRowToFloatScalar(
+    const uint16_t* depth, const float* ray_x, const float* ray_y,
+    int start, int width, bool skip_invalid, int base_index, int step,
+    PointOutput* output) {
+  for (int i = start; i < width; ++i) {
+    if (skip_invalid && !depth[i]) continue;
+    float z = depth[i] * MM_TO_METERS;
+    float* point =
+        reinterpret_cast<float*>(output->points) + output->count * 3;
+    point[0] = z * ray_x[i];
+    point[1] = z * ray_y[i];
+    point[2] = z;
+    AddPixelIndex(output, base_index + i * step);
+    ++output->count;
+  }
+}
+
+static void ConvertRowToInt16Scalar(
+    const uint16_t* depth, const float* ray_x, const float* ray_y,
+    int start, int width, bool skip_invalid, int base_index, int step,
+    PointOutput* output) {
+  for (int i = start; i < width; ++i) {
+    if (skip_invalid && !depth[i]) continue;
+    float z = depth[i];
+    int16_t* point =
+        reinterpret_cast<int16_t*>(output->points) + output->count * 3;
+    point[0] = SaturateInt16(lrintf(z * ray_x[i]));
+    point[1] = SaturateInt16(lrintf(z * ray_y[i]));
+    point[2] = SaturateInt16(depth[i]);
+    AddPixelIndex(output, base_index + i * step);
+    ++output->count;
+  }
+}
+
+#ifdef KKONNECT_X86_SIMD
+
+// Points are stored with one 16-byte or 8-byte store each, which writes
+// past the point. The next point overwrites it, and the last point of
+// the output is stored exactly. Invalid points are stored too but not
+// counted, so that compacting the output takes no branches.
+__attribute__((target("sse2")))
+static inline void StoreFloatPoint(__m128 point, int index, int valid,
+                                   PointOutput* output) {
+  int count = output->count;
+  float* dst = reinterpret_cast<float*>(output->points) + count * 3;
+  if (count + 1 < output->max_count) {
+    _mm_storeu_ps(dst, point);
+  } else if (count < output->max_count) {
+    float values[4];
+    _mm_storeu_ps(values, point);
+    memcpy(dst, values, 3 * sizeof(float));
+  } else {
+    return;
+  }
+  if (output->pixel_indexes) output->pixel_indexes[count] = index;
+  output->count = count + valid;
+}
+
+__attribute__((target("sse2")))
+static inline void StoreInt16Point(__m128i point, int index, int valid,
+                                   PointOutput* output) {
+  int count = output->count;
+  int16_t* dst = reinterpret_cast<int16_t*>(output->points) + count * 3;
+  if (count + 1 < output->max_count) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), point);
+  } else if (count < output->max_count) {
+    int16_t values[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values), point);
+    memcpy(dst, values, 3 * sizeof(int16_t));
+  } else {
+    return;
+  }
+  if (output->pixel_indexes) output->pixel_indexes[count] = index;
+  output->count = count + valid;
+}
+
+// Adds the indexes of four consecutive pixels.
+__attribute__((target("sse2")))
+static inline void AddPixelIndexes(PointOutput* output, int index, int step) {
+  if (!output->pixel_indexes) return;
+  __m128i indexes = _mm_set_epi32(index + 3 * step, index + 2 * step,
+                                  index + step, index);
+  _mm_storeu_si128(
+      reinterpret_cast<__m128i*>(output->pixel_indexes + output->count),
+      indexes);
+}
+
+// Returns a bit mask of lanes to store.
+__attribute__((target("sse2")))
+static inline int GetStoreMask(__m128i depth, bool skip_invalid) {
+  if (!skip_invalid) return 0xF;
+  __m128i invalid = _mm_cmpeq_epi32(depth, _mm_setzero_si128());
+  return ~_mm_movemask_ps(_mm_castsi128_ps(invalid)) & 0xF;
+}
+
+__attribute__((target("sse2")))
+static void ConvertRowToFloatSse2(
+    const uint16_t* depth, const float* ray_x, const float* ray_y,
+    int start, int width, bool skip_invalid, int base_index, int step,
+    PointOutput* output) {
+  // A local copy lets the compiler keep the count in a register.
+  PointOutput local = *output;
+  const __m128 scale = _mm_set1_ps(MM_TO_METERS);
+  int i = start;
+  for (; i + 4 <= width; i += 4) {
+    __m128i depth_i32 = _mm_unpacklo_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth + i)),
+        _mm_setzero_si128());
+    int mask = GetStoreMask(depth_i32, skip_invalid);
+    if (!mask) continue;
+    __m128 z = _mm_mul_ps(_mm_cvtepi32_ps(depth_i32), scale);
+    __m128 x = _mm_mul_ps(z, _mm_loadu_ps(ray_x + i));
+    __m128 y = _mm_mul_ps(z, _mm_loadu_ps(ray_y + i));
+    __m128 w = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    if (mask == 0xF && local.count + 4 < local.max_count) {
+      AddPixelIndexes(&local, base_index + i * step, step);
+      float* dst =
+          reinterpret_cast<float*>(local.points) + local.count * 3;
+      _mm_storeu_ps(dst, x);
+      _mm_storeu_ps(dst + 3, y);
+      _mm_storeu_ps(dst + 6, z);
+      _mm_storeu_ps(dst + 9, w);
+      local.count += 4;
+      continue;
+    }
+    __m128 points[4] = {x, y, z, w};
+    for (int lane = 0; lane < 4; ++lane) {
+      StoreFloatPoint(points[lane], base_index + (i + lane) * step,
+                      (mask >> lane) & 1, &local);
+    }
+  }
+  *output = local;
+  ConvertRowToFloatScalar(depth, ray_x, ray_y, i, width, skip_invalid,
+                          base_index, step, output);
+}
+
+__attribute__((target("sse2")))
+static void ConvertRowToInt16Sse2(
+    const uint16_t* depth, const float* ray_x, const float* ray_y,
+    int start, int width, bool skip_invalid, int base_index, int step,
+    PointOutput* output) {
+  // A local copy lets the compiler keep the count in a register.
+  PointOutput local = *output;
+  int i = start;
+  for (; i + 4 <= width; i += 4) {
+    __m128i depth_i32 = _mm_unpacklo_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth + i)),
+        _mm_setzero_si128());
+    int mask = GetStoreMask(depth_i32, skip_invalid);
+    if (!mask) continue;
+    __m128 z = _mm_cvtepi32_ps(depth_i32);
+    __m128i x = _mm_cvtps_epi32(_mm_mul_ps(z, _mm_loadu_ps(ray_x + i)));
+    __m128i y = _mm_cvtps_epi32(_mm_mul_ps(z, _mm_loadu_ps(ray_y + i)));
+    __m128i xy = _mm_unpacklo_epi16(_mm_packs_epi32(x, x),
+                                    _mm_packs_epi32(y, y));
+    __m128i zw = _mm_unpacklo_epi16(_mm_packs_epi32(depth_i32, depth_i32),
+                                    _mm_setzero_si128());
+    __m128i low = _mm_unpacklo_epi32(xy, zw);
+    __m128i high = _mm_unpackhi_epi32(xy, zw);
+    if (mask == 0xF && local.count + 4 < local.max_count) {
+      AddPixelIndexes(&local, base_index + i * step, step);
+      int16_t* dst =
+          reinterpret_cast<int16_t*>(local.points) + local.count * 3;
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), low);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 3),
+                       _mm_srli_si128(low, 8));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 6), high);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 9),
+                       _mm_srli_si128(high, 8));
+      local.count += 4;
+      continue;
+    }
+    __m128i points[4] = {
+        low, _mm_srli_si128(low, 8), high, _mm_srli_si128(high, 8)};
+    for (int lane = 0; lane < 4; ++lane) {
+      StoreInt16Point(points[lane], base_index + (i + lane) * step,
+                      (mask >> lane) & 1, &local);
+    }
+  }
+  *output = local;
+  ConvertRowToInt16Scalar(depth, ray_x, ray_y, i, width, skip_invalid,
+                          base_index, step, output);
+}
+
+#endif  // KKONNECT_X86_SIMD
+
+PointCloudConverter::PointCloudConverter(const DepthIntrinsics& intrinsics)
+    : intrinsics_(intrinsics), ray_decimation_(0), ray_width_(0),
+      ray_height_(0), ray_x_(NULL), ray_y_(NULL), depth_row_(NULL) {
+  CHECK(intrinsics.width > 0 && intrinsics.height > 0);
+  CHECK(intrinsics.fx > 0 && intrinsics.fy > 0);
+  BuildRays(1);
+}
+
+PointCloudConverter::~PointCloudConverter() {
+  delete[] ray_x_;
+  delete[] ray_y_;
+  delete[] depth_row_;
+}
+
+// static
+int PointCloudConverter::GetPointSize(PointFormat format) {
+  return format == kPointFormatInt16Xyz ? 3 * sizeof(int16_t) :
+      3 * sizeof(float);
+}
+
+int PointCloudConverter::GetMaxPointCount(int decimation) const {
+  if (decimation < 1) return 0;
+  return ((intrinsics_.width + decimation - 1) / decimation) *
+      ((intrinsics_.height + decimation - 1) / decimation);
+}
+
+void PointCloudConverter::BuildRays(int decimation) {
+  delete[] ray_x_;
+  delete[] ray_y_;
+  delete[] depth_row_;
+  ray_decimation_ = decimation;
+  ray_width_ = (intrinsics_.width + decimation - 1) / decimation;
+  ray_height_ = (intrinsics_.height + decimation - 1) / decimation;
+  ray_x_ = new float[ray_width_ * ray_height_];
+  ray_y_ = new float[ray_width_ * ray_height_];
+  depth_row_ = new uint16_t[ray_width_];
+
+  const DepthIntrinsics& in = intrinsics_;
+  for (int row = 0; row < ray_height_; ++row) {
+    for (int column = 0; column < ray_width_; ++column) {
+      double distorted_x = (column * decimation - in.cx) / in.fx;
+      double distorted_y = (row * decimation - in.cy) / in.fy;
+      double x = distorted_x;
+      double y = distorted_y;
+      for (int i = 0; i < UNDISTORT_ITERATIONS; ++i) {
+        double r2 = x * x + y * y;
+        double radial = 1 + ((in.k3 * r2 + in.k2) * r2 + in.k1) * r2;
+        double delta_x = 2 * in.p1 * x * y + in.p2 * (r2 + 2 * x * x);
+        double delta_y = in.p1 * (r2 + 2 * y * y) + 2 * in.p2 * x * y;
+        x = (distorted_x - delta_x) / radial;
+        y = (distorted_y - delta_y) / radial;
+      }
+      ray_x_[row * ray_width_ + column] = (float) x;
+      ray_y_[row * ray_width_ + column] = (float) y;
+    }
+  }
+}
+
+int PointCloudConverter::Convert(const uint16_t* depth, int row_size,
+                                 const PointCloudOptions& options,
+                                 void* points, int32_t* pixel_indexes) {
+  int width = intrinsics_.width;
+  if (!row_size) row_size = width * 2;
+  if (!depth || !points || options.decimation < 1 ||
+      row_size < width * 2 || (row_size & 1) ||
+      (options.format != kPointFormatFloatXyz &&
+       options.format != kPointFormatInt16Xyz)) {
+    return -1;
+  }
+  int decimation = options.decimation;
+  if (decimation != ray_decimation_) BuildRays(decimation);
+
+  bool is_float = options.format == kPointFormatFloatXyz;
+  ConvertRowFunction convert_row =
+      is_float ? ConvertRowToFloatScalar : ConvertRowToInt16Scalar;
+#ifdef KKONNECT_X86_SIMD
+  if (HasCpuFeature(kCpuFeatureSse2)) {
+    convert_row = is_float ? ConvertRowToFloatSse2 : ConvertRowToInt16Sse2;
+  }
+#endif
+
+  PointOutput output;
+  output.points = reinterpret_cast<uint8_t*>(points);
+  output.pixel_indexes = pixel_indexes;
+  output.count = 0;
+  output.max_count = ray_width_ * ray_height_;
+  int row_length = row_size / 2;
+  for (int row = 0; row < ray_height_; ++row) {
+    int y = row * decimation;
+    const uint16_t* values = depth + y * row_length;
+    if (decimation > 1) {
+      for (int column = 0; column < ray_width_; ++column) {
+        depth_row_[column] = values[column * decimation];
+      }
+      values = depth_row_;
+    }
+    convert_row(values, ray_x_ + row * ray_width_,
+                ray_y_ + row * ray_width_, 0, ray_width_,
+                options.skip_invalid, y * width, decimation, &output);
+  }
+  return output.count;
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,225 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include <kk_recorder.h>
+
+#include "src/kk_recording_format.h"
+#include "src/utils.h"
+
+namespace kkonnect {
+
+#define INITIAL_INDEX_CAPACITY   1024
+
+// static
+Recorder* Recorder::Create(const char* path, const Device* device) {
+  if (device->GetStatus() != kErrorSuccess) {
+    fprintf(stderr, "Cannot record a device that is not connected\n");
+    return NULL;
+  }
+  DepthIntrinsics depth_intrinsics;
+  device->GetDepthIntrinsics(&depth_intrinsics);
+  return Create(path, device->GetDeviceInfo().version,
+                device->GetVideoImageInfo(), device->GetDepthImageInfo(),
+                depth_intrinsics);
+}
+
+// static
+Recorder* Recorder::Create(const char* path, DeviceVersion version,
+                           const ImageInfo& video_info,
+                           const ImageInfo& depth_info,
+                           const DepthIntrinsics& depth_intrinsics) {
+  const ImageInfo* infos[2] = {&video_info, &depth_info};
+  bool has_stream = false;
+  for (int i = 0; i < 2; ++i) {
+    if (!infos[i]->enabled) continue;
+    if (infos[i]->width <= 0 || infos[i]->height <= 0 ||
+        !GetBytesPerPixel(infos[i]->format)) {
+      fprintf(stderr, "Cannot record stream of format %d\n",
+              (int) infos[i]->format);
+      return NULL;
+    }
+    has_stream = true;
+  }
+  if (!has_stream) {
+    fprintf(stderr, "No streams to record\n");
+    return NULL;
+  }
+
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    REPORT_ERRNO("fopen");
+    return NULL;
+  }
+  Recorder* recorder = new Recorder(
+      file, version, video_info, depth_info, depth_intrinsics);
+  // The headers are written by Finish(). Until then, the file has no
+  // magic and cannot be mistaken for a complete recording.
+  if (!recorder->WritePadding(RECORDING_DATA_OFFSET)) {
+    delete recorder;
+    return NULL;
+  }
+  return recorder;
+}
+
+Recorder::Recorder(FILE* file, DeviceVersion version,
+                   const ImageInfo& video_info, const ImageInfo& depth_info,
+                   const DepthIntrinsics& depth_intrinsics)
+    : file_(file), failed_(false), file_size_(0), device_version_(version),
+      depth_intrinsics_(depth_intrinsics) {
+  const ImageInfo* infos[2] = {&video_info, &depth_info};
+  for (int i = 0; i < 2; ++i) {
+    Stream& stream = streams_[i];
+    stream.info = *infos[i];
+    stream.row_size = stream.info.enabled ?
+        stream.info.width * GetBytesPerPixel(stream.info.format) : 0;
+    stream.index = NULL;
+    stream.frame_count = 0;
+    stream.index_capacity = 0;
+  }
+}
+
+Recorder::~Recorder() {
+  Finish();
+  for (int i = 0; i < 2; ++i) {
+    delete[] streams_[i].index;
+  }
+}
+
+bool Recorder::WritePadding(uint64_t size) {
+  static const uint8_t kZeros[RECORDING_FRAME_ALIGNMENT * 2] = {0};
+  while (size && !failed_) {
+    size_t chunk = size < sizeof(kZeros) ? size : sizeof(kZeros);
+    if (fwrite(kZeros, 1, chunk, file_) != chunk) {
+      REPORT_ERRNO("fwrite");
+      failed_ = true;
+    }
+    file_size_ += chunk;
+    size -= chunk;
+  }
+  return !failed_;
+}
+
+bool Recorder::AddVideoFrame(const void* data, int row_size,
+                             const FrameMetadata& metadata) {
+  return AddFrame(&streams_[kRecordingStreamVideo], data, row_size,
+                  metadata);
+}
+
+bool Recorder::AddDepthFrame(const void* data, int row_size,
+                             const FrameMetadata& metadata) {
+  return AddFrame(&streams_[kRecordingStreamDepth], data, row_size,
+                  metadata);
+}
+
+bool Recorder::AddFrame(Stream* stream, const void* data, int row_size,
+                        const FrameMetadata& metadata) {
+  if (!file_ || failed_ || !stream->info.enabled) return false;
+  if (!row_size) row_size = stream->row_size;
+  if (row_size < stream->row_size) return false;
+
+  uint64_t padding = (RECORDING_FRAME_ALIGNMENT -
+      file_size_ % RECORDING_FRAME_ALIGNMENT) % RECORDING_FRAME_ALIGNMENT;
+  if (!WritePadding(padding)) return false;
+  RecordingIndexEntry entry;
+  entry.data_offset = file_size_;
+  entry.host_time_us = metadata.host_time_us;
+  entry.device_timestamp = metadata.device_timestamp;
+
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+  int height = stream->info.height;
+  if (row_size == stream->row_size) {
+    size_t size = (size_t) row_size * height;
+    failed_ = fwrite(src, 1, size, file_) != size;
+  } else {
+    for (int y = 0; y < height && !failed_; ++y) {
+      failed_ = fwrite(src + (size_t) y * row_size, 1, stream->row_size,
+                       file_) != (size_t) stream->row_size;
+    }
+  }
+  if (failed_) {
+    REPORT_ERRNO("fwrite");
+    return false;
+  }
+  file_size_ += (uint64_t) stream->row_size * height;
+
+  if (stream->frame_count == stream->index_capacity) {
+    int capacity = stream->index_capacity ?
+        stream->index_capacity * 2 : INITIAL_INDEX_CAPACITY;
+    uint8_t* index = new uint8_t[capacity * RECORDING_INDEX_ENTRY_SIZE];
+    if (stream->frame_count) {
+      memcpy(index, stream->index,
+             stream->frame_count * RECORDING_INDEX_ENTRY_SIZE);
+    }
+    delete[] stream->index;
+    stream->index = index;
+    stream->index_capacity = capacity;
+  }
+  PutRecordingIndexEntry(
+      stream->index + stream->frame_count * RECORDING_INDEX_ENTRY_SIZE,
+      entry);
+  ++stream->frame_count;
+  return true;
+}
+
+bool Recorder::Finish() {
+  if (!file_) return !failed_;
+
+  uint8_t headers[RECORDING_DATA_OFFSET];
+  memset(headers, 0, sizeof(headers));
+  RecordingHeader header;
+  header.device_version = device_version_;
+  header.depth_intrinsics = depth_intrinsics_;
+  uint8_t* pos = PutRecordingHeader(headers, header);
+  for (int i = 0; i < 2 && !failed_; ++i) {
+    Stream& stream = streams_[i];
+    RecordingStreamHeader stream_header;
+    stream_header.info = stream.info;
+    stream_header.frame_count = stream.frame_count;
+    stream_header.index_offset = file_size_;
+    pos = PutRecordingStreamHeader(pos, stream_header);
+    size_t size = (size_t) stream.frame_count * RECORDING_INDEX_ENTRY_SIZE;
+    if (size && fwrite(stream.index, 1, size, file_) != size) {
+      REPORT_ERRNO("fwrite");
+      failed_ = true;
+    }
+    file_size_ += size;
+  }
+
+  if (!failed_ && (fseek(file_, 0, SEEK_SET) ||
+                   fwrite(headers, 1, sizeof(headers), file_) !=
+                   sizeof(headers))) {
+    REPORT_ERRNO("fwrite");
+    failed_ = true;
+  }
+  if (fclose(file_)) {
+    REPORT_ERRNO("fclose");
+    failed_ = true;
+  }
+  file_ = NULL;
+  return !failed_;
+}
+
+}  // namespace kkonnect
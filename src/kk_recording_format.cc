@@ -0,0 +1,97 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_recording_format.h"
+
+#include "src/kk_remote_protocol.h"
+#include "src/utils.h"
+
+namespace kkonnect {
+
+uint8_t* PutRecordingHeader(uint8_t* dst, const RecordingHeader& header) {
+  uint8_t* start = dst;
+  dst = PutUint32(dst, RECORDING_MAGIC);
+  dst = PutUint32(dst, RECORDING_VERSION);
+  dst = PutUint32(dst, header.device_version == kDeviceVersion2 ? 2 : 1);
+  dst = PutDepthIntrinsics(dst, header.depth_intrinsics);
+  memset(dst, 0, start + RECORDING_HEADER_SIZE - dst);  // Reserved.
+  return start + RECORDING_HEADER_SIZE;
+}
+
+const uint8_t* GetRecordingHeader(const uint8_t* src,
+                                  RecordingHeader* header) {
+  const uint8_t* start = src;
+  uint32_t magic, version, device_version;
+  src = GetUint32(src, &magic);
+  src = GetUint32(src, &version);
+  if (magic != RECORDING_MAGIC || version != RECORDING_VERSION) return NULL;
+  src = GetUint32(src, &device_version);
+  header->device_version =
+      device_version == 2 ? kDeviceVersion2 : kDeviceVersion1;
+  GetDepthIntrinsics(src, &header->depth_intrinsics);
+  return start + RECORDING_HEADER_SIZE;
+}
+
+uint8_t* PutRecordingStreamHeader(
+    uint8_t* dst, const RecordingStreamHeader& header) {
+  dst = PutImageInfo(dst, header.info);
+  dst = PutUint32(dst, header.frame_count);
+  dst = PutUint32(dst, 0);  // Reserved.
+  return PutUint64(dst, header.index_offset);
+}
+
+const uint8_t* GetRecordingStreamHeader(
+    const uint8_t* src, RecordingStreamHeader* header) {
+  uint32_t reserved;
+  src = GetImageInfo(src, &header->info);
+  src = GetUint32(src, &header->frame_count);
+  src = GetUint32(src, &reserved);
+  return GetUint64(src, &header->index_offset);
+}
+
+uint8_t* PutRecordingIndexEntry(
+    uint8_t* dst, const RecordingIndexEntry& entry) {
+  dst = PutUint64(dst, entry.data_offset);
+  dst = PutUint64(dst, entry.host_time_us);
+  dst = PutUint32(dst, entry.device_timestamp);
+  return PutUint32(dst, 0);  // Reserved.
+}
+
+const uint8_t* GetRecordingIndexEntry(
+    const uint8_t* src, RecordingIndexEntry* entry) {
+  uint32_t reserved;
+  src = GetUint64(src, &entry->data_offset);
+  src = GetUint64(src, &entry->host_time_us);
+  src = GetUint32(src, &entry->device_timestamp);
+  return GetUint32(src, &reserved);
+}
+
+uint64_t GetRecordingFrameSize(const ImageInfo& info) {
+  if (!info.enabled) return 0;
+  return (uint64_t) info.width * info.height * GetBytesPerPixel(info.format);
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,111 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_RECORDING_FORMAT_H_
+#define KKONNECT_KK_RECORDING_FORMAT_H_
+
+#include <kk_device.h>
+#include <stdint.h>
+
+// Defines the recording file written by Recorder and played back by
+// ReplayConnection.
+//
+// A recording starts with a file header and two stream headers, video
+// then depth. Frames follow as packed rows, each at an offset aligned
+// to RECORDING_FRAME_ALIGNMENT, so that they can be leased straight from
+// a memory mapping. After the frames, every stream has an index of
+// fixed-size entries in arrival order, so that any frame is found
+// without a search. All integers are little-endian.
+//
+// File header: u32 magic, u32 format version, u32 device version,
+// depth intrinsics, reserved bytes.
+// Stream header: stream info, u32 frame count, u32 reserved,
+// u64 offset of the stream index.
+// Index entry: u64 offset of the frame data, u64 host arrival time in
+// microseconds, u32 device timestamp, u32 reserved.
+
+namespace kkonnect {
+
+#define RECORDING_MAGIC             0x43524b4b  // "KKRC"
+#define RECORDING_VERSION           1
+
+#define RECORDING_HEADER_SIZE       64
+#define RECORDING_STREAM_HEADER_SIZE 24
+#define RECORDING_INDEX_ENTRY_SIZE  24
+#define RECORDING_FRAME_ALIGNMENT   64
+// Offset of the first frame, after the file and stream headers.
+#define RECORDING_DATA_OFFSET       128
+
+enum RecordingStream {
+  kRecordingStreamVideo = 0,
+  kRecordingStreamDepth = 1,
+  kRecordingStreamCount = 2,
+};
+
+struct RecordingHeader {
+  DeviceVersion device_version;
+  DepthIntrinsics depth_intrinsics;
+
+  RecordingHeader() : device_version(kDeviceVersion1) {}
+};
+
+struct RecordingStreamHeader {
+  ImageInfo info;
+  uint32_t frame_count;
+  uint64_t index_offset;
+
+  RecordingStreamHeader() : frame_count(0), index_offset(0) {}
+};
+
+struct RecordingIndexEntry {
+  uint64_t data_offset;
+  uint64_t host_time_us;
+  uint32_t device_timestamp;
+
+  RecordingIndexEntry()
+      : data_offset(0), host_time_us(0), device_timestamp(0) {}
+};
+
+// Serialization of the structures above. Each function returns the
+// position after the serialized structure. GetRecordingHeader() returns
+// NULL if the magic or version do not match.
+uint8_t* PutRecordingHeader(uint8_t* dst, const RecordingHeader& header);
+const uint8_t* GetRecordingHeader(const uint8_t* src, RecordingHeader* header);
+uint8_t* PutRecordingStreamHeader(
+    uint8_t* dst, const RecordingStreamHeader& header);
+const uint8_t* GetRecordingStreamHeader(
+    const uint8_t* src, RecordingStreamHeader* header);
+uint8_t* PutRecordingIndexEntry(
+    uint8_t* dst, const RecordingIndexEntry& entry);
+const uint8_t* GetRecordingIndexEntry(
+    const uint8_t* src, RecordingIndexEntry* entry);
+
+// Returns the size of a stored frame of |info|, without alignment.
+uint64_t GetRecordingFrameSize(const ImageInfo& info);
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_RECORDING_FORMAT_H_
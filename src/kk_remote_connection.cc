@@ -0,0 +1,361 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_remote_connection.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+#define REMOTE_REPLY_TIMEOUT_MS   5000
+
+// static
+RemoteConnection* RemoteConnection::Create(const char* host, int port) {
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%d", port);
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses = NULL;
+  int err = getaddrinfo(host, port_str, &hints, &addresses);
+  if (err) {
+    fprintf(stderr, "Unable to resolve KKonnect host '%s': %s\n",
+            host, gai_strerror(err));
+    return NULL;
+  }
+
+  int fd = -1;
+  for (struct addrinfo* address = addresses; address;
+       address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC,
+                address->ai_protocol);
+    if (fd == -1) continue;
+    if (!connect(fd, address->ai_addr, address->ai_addrlen)) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd == -1) {
+    fprintf(stderr, "Unable to connect to KKonnect host '%s:%d'\n",
+            host, port);
+    return NULL;
+  }
+
+  // Requests are small and latency-sensitive.
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+  RemoteConnection* connection = new RemoteConnection(fd);
+  bool started;
+  {
+    Autolock l(connection->mutex_);
+    started = connection->StartLocked();
+  }
+  if (!started) {
+    connection->Close();
+    return NULL;
+  }
+  return connection;
+}
+
+RemoteConnection::RemoteConnection(int fd)
+    : fd_(fd), reader_started_(false), reader_done_(false),
+      has_reply_(false), reply_type_(0), reply_size_(0), device_count_(0) {
+  pthread_mutex_init(&reply_mutex_, NULL);
+  InitMonotonicCond(&reply_cond_);
+  for (int i = 0; i < REMOTE_MAX_DEVICES; ++i) {
+    device_versions_[i] = kDeviceVersion1;
+    devices_[i] = NULL;
+  }
+}
+
+RemoteConnection::~RemoteConnection() {
+  pthread_cond_destroy(&reply_cond_);
+  pthread_mutex_destroy(&reply_mutex_);
+}
+
+bool RemoteConnection::StartLocked() {
+  CHECK(!pthread_create(&reader_thread_, NULL, RunReader, this));
+  reader_started_ = true;
+
+  uint8_t payload[4];
+  PutUint32(payload, REMOTE_PROTOCOL_VERSION);
+  if (!CallLocked(kRemoteMsgHello, 0, payload, sizeof(payload))) return false;
+  uint32_t version = 0;
+  if (reply_size_ >= 4) GetUint32(reply_data_, &version);
+  if (version != REMOTE_PROTOCOL_VERSION) {
+    fprintf(stderr, "KKonnect host speaks protocol %d instead of %d\n",
+            (int) version, REMOTE_PROTOCOL_VERSION);
+    return false;
+  }
+  return RefreshLocked() == kErrorSuccess;
+}
+
+void RemoteConnection::DisconnectLocked() {
+  shutdown(fd_, SHUT_RDWR);
+  if (reader_started_) {
+    pthread_join(reader_thread_, NULL);
+    reader_started_ = false;
+  }
+}
+
+void RemoteConnection::CloseInternalLocked() {
+  DisconnectLocked();
+  close(fd_);
+  delete this;
+}
+
+bool RemoteConnection::CallLocked(uint16_t type, uint16_t device_index,
+                                  const void* payload, uint32_t size) {
+  {
+    Autolock l(reply_mutex_);
+    if (reader_done_) return false;
+    has_reply_ = false;
+  }
+
+  if (!SendRemoteMessage(fd_, type, device_index, payload, size)) {
+    return false;
+  }
+
+  bool timed_out = false;
+  {
+    Autolock l(reply_mutex_);
+    uint64_t deadline = GetCurrentMillis() + REMOTE_REPLY_TIMEOUT_MS;
+    while (!has_reply_ && !reader_done_) {
+      if (!WaitCondUntil(&reply_cond_, &reply_mutex_, deadline)) {
+        timed_out = true;
+        break;
+      }
+    }
+    if (has_reply_) {
+      if (reply_type_ == type) return true;
+      fprintf(stderr, "Unexpected reply %d from KKonnect host, expected %d\n",
+              (int) reply_type_, (int) type);
+    }
+  }
+
+  if (timed_out) {
+    fprintf(stderr, "KKonnect host did not reply, disconnecting\n");
+  }
+  // The protocol is out of sync, so the connection cannot be used anymore.
+  DisconnectLocked();
+  return false;
+}
+
+ErrorCode RemoteConnection::Refresh() {
+  Autolock l(mutex_);
+  return RefreshLocked();
+}
+
+ErrorCode RemoteConnection::RefreshLocked() {
+  if (!CallLocked(kRemoteMsgListDevices, 0, NULL, 0)) {
+    return kErrorUnableToConnect;
+  }
+  uint32_t count = 0;
+  if (reply_size_ >= 4) GetUint32(reply_data_, &count);
+  if (count > REMOTE_MAX_DEVICES || reply_size_ < 4 + count) {
+    return kErrorUnableToConnect;
+  }
+  device_count_ = count;
+  for (uint32_t i = 0; i < count; ++i) {
+    device_versions_[i] = reply_data_[4 + i] == 2 ?
+        kDeviceVersion2 : kDeviceVersion1;
+  }
+  return kErrorSuccess;
+}
+
+int RemoteConnection::GetDeviceCount() {
+  Autolock l(mutex_);
+  return device_count_;
+}
+
+ErrorCode RemoteConnection::GetDeviceInfo(
+    int device_index, DeviceInfo* info) {
+  Autolock l(mutex_);
+  if (device_index < 0 || device_index >= device_count_) {
+    return kErrorUnknownDevice;
+  }
+  *info = DeviceInfo(device_versions_[device_index]);
+  return kErrorSuccess;
+}
+
+ErrorCode RemoteConnection::OpenDeviceInternalLocked(
+    const DeviceOpenRequest& request, Device** device) {
+  int device_index = request.device_index;
+  if (device_index < 0 || device_index >= device_count_) {
+    return kErrorUnknownDevice;
+  }
+
+  // Register the device before the request, so that status messages
+  // that follow the reply can find it.
+  RemoteDevice* remote_device =
+      new RemoteDevice(device_versions_[device_index]);
+  remote_device->SetCopyThreadCount(request.copy_thread_count);
+  remote_device->SetBufferAllocator(buffer_allocator());
+  remote_device->SetEventQueue(device_event_queue(), device_index);
+  remote_device->SetChangeDetection(request.video_changes,
+                                    request.depth_changes);
+  __atomic_store_n(&devices_[device_index], remote_device, __ATOMIC_RELEASE);
+
+  // Depth compression is lossless, and the client decodes it on the
+  // reader thread, so it is always requested.
+  // The host crops and decimates, so that only published data is sent.
+  uint8_t payload[REMOTE_OPEN_DEVICE_SIZE];
+  uint8_t* pos = PutUint16(payload, (uint16_t) request.video_format);
+  pos = PutUint16(pos, (uint16_t) request.depth_format);
+  pos = PutUint16(pos, kRemoteEncodingDepthCodec);
+  pos = PutStreamRegion(pos, request.video_region);
+  PutStreamRegion(pos, request.depth_region);
+  uint32_t result = kErrorUnableToConnect;
+  if (CallLocked(kRemoteMsgOpenDevice, device_index, payload,
+                 sizeof(payload)) && reply_size_ >= 4) {
+    GetUint32(reply_data_, &result);
+  }
+
+  if (result != kErrorSuccess) {
+    {
+      Autolock l(reply_mutex_);
+      devices_[device_index] = NULL;
+    }
+    delete remote_device;
+    return (ErrorCode) result;
+  }
+
+  *device = remote_device;
+  return kErrorSuccess;
+}
+
+void RemoteConnection::CloseDeviceInternalLocked(Device* device) {
+  int device_index = -1;
+  for (int i = 0; i < REMOTE_MAX_DEVICES; ++i) {
+    if (devices_[i] == device) device_index = i;
+  }
+  CHECK(device_index != -1);
+  RemoteDevice* remote_device = devices_[device_index];
+
+  // The host sends nothing for the device after the reply. If the call
+  // fails, the reader thread has exited. Either way, the reader no longer
+  // uses the device afterwards.
+  CallLocked(kRemoteMsgCloseDevice, device_index, NULL, 0);
+  {
+    Autolock l(reply_mutex_);
+    devices_[device_index] = NULL;
+  }
+  delete remote_device;
+}
+
+RemoteDevice* RemoteConnection::GetDevice(int device_index) const {
+  if (device_index >= REMOTE_MAX_DEVICES) return NULL;
+  return __atomic_load_n(&devices_[device_index], __ATOMIC_ACQUIRE);
+}
+
+// static
+void* RemoteConnection::RunReader(void* arg) {
+  reinterpret_cast<RemoteConnection*>(arg)->RunReader();
+  return NULL;
+}
+
+void RemoteConnection::RunReader() {
+  while (true) {
+    uint8_t header_data[REMOTE_HEADER_SIZE];
+    if (!ReadFully(fd_, header_data, sizeof(header_data))) break;
+    RemoteHeader header;
+    GetRemoteHeader(header_data, &header);
+    if (header.size > REMOTE_MAX_PAYLOAD_SIZE) {
+      fprintf(stderr, "Received oversized message from KKonnect host\n");
+      break;
+    }
+    if (!HandleMessage(header)) break;
+  }
+
+  Autolock l(reply_mutex_);
+  reader_done_ = true;
+  for (int i = 0; i < REMOTE_MAX_DEVICES; ++i) {
+    if (devices_[i]) devices_[i]->HandleDisconnect();
+  }
+  pthread_cond_broadcast(&reply_cond_);
+}
+
+bool RemoteConnection::HandleMessage(const RemoteHeader& header) {
+  if (header.type == kRemoteMsgFrame) {
+    if (header.size < REMOTE_FRAME_HEADER_SIZE) return false;
+    uint8_t frame_header_data[REMOTE_FRAME_HEADER_SIZE];
+    if (!ReadFully(fd_, frame_header_data, sizeof(frame_header_data))) {
+      return false;
+    }
+    RemoteFrameHeader frame_header;
+    GetRemoteFrameHeader(frame_header_data, &frame_header);
+    if (frame_header.data_size != header.size - REMOTE_FRAME_HEADER_SIZE) {
+      return false;
+    }
+    RemoteDevice* device = GetDevice(header.device_index);
+    if (!device) return SkipFully(fd_, frame_header.data_size);
+    return device->ReceiveFrame(fd_, frame_header);
+  }
+
+  if (header.type == kRemoteMsgDeviceStatus) {
+    if (header.size != REMOTE_STATUS_SIZE) return false;
+    uint8_t data[REMOTE_STATUS_SIZE];
+    if (!ReadFully(fd_, data, sizeof(data))) return false;
+    uint32_t status;
+    ImageInfo video_info;
+    ImageInfo depth_info;
+    DepthIntrinsics intrinsics;
+    const uint8_t* pos = GetUint32(data, &status);
+    pos = GetImageInfo(pos, &video_info);
+    pos = GetImageInfo(pos, &depth_info);
+    GetDepthIntrinsics(pos, &intrinsics);
+    RemoteDevice* device = GetDevice(header.device_index);
+    if (device) {
+      device->HandleStatus((ErrorCode) status, video_info, depth_info,
+                           intrinsics);
+    }
+    return true;
+  }
+
+  // Everything else is a reply to the outstanding request.
+  if (header.size > (uint32_t) kMaxReplySize) return false;
+  uint8_t data[kMaxReplySize];
+  if (!ReadFully(fd_, data, header.size)) return false;
+  Autolock l(reply_mutex_);
+  has_reply_ = true;
+  reply_type_ = header.type;
+  reply_size_ = header.size;
+  memcpy(reply_data_, data, header.size);
+  pthread_cond_broadcast(&reply_cond_);
+  return true;
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_REMOTE_CONNECTION_H_
+#define KKONNECT_KK_REMOTE_CONNECTION_H_
+
+#include <kk_connection.h>
+#include <pthread.h>
+
+#include "src/kk_remote_device.h"
+#include "src/kk_remote_protocol.h"
+
+namespace kkonnect {
+
+// Implements connection to devices attached to a kkonnect-host.
+class RemoteConnection : public Connection {
+ public:
+  // Returns NULL if the host cannot be reached.
+  static RemoteConnection* Create(const char* host, int port);
+
+  virtual ErrorCode Refresh();
+  virtual int GetDeviceCount();
+  virtual ErrorCode GetDeviceInfo(int device_index, DeviceInfo* info);
+
+ protected:
+  explicit RemoteConnection(int fd);
+  virtual ~RemoteConnection();
+
+  virtual void CloseInternalLocked();
+
+  virtual ErrorCode OpenDeviceInternalLocked(
+      const DeviceOpenRequest& request, Device** device);
+  virtual void CloseDeviceInternalLocked(Device* device);
+
+ private:
+  // Largest reply payload, enough for the device list.
+  static const int kMaxReplySize = 4 + REMOTE_MAX_DEVICES;
+
+  bool StartLocked();
+  void DisconnectLocked();
+  ErrorCode RefreshLocked();
+
+  // Sends a request and waits for the reply of the same type. On success,
+  // the reply is stored in |reply_data_| and |reply_size_|.
+  bool CallLocked(uint16_t type, uint16_t device_index,
+                  const void* payload, uint32_t size);
+
+  static void* RunReader(void* arg);
+  void RunReader();
+  bool HandleMessage(const RemoteHeader& header);
+  RemoteDevice* GetDevice(int device_index) const;
+
+  int fd_;
+  pthread_t reader_thread_;
+  bool reader_started_;
+
+  // Guards the reply fields, |reader_done_| and clearing of |devices_|.
+  pthread_mutex_t reply_mutex_;
+  pthread_cond_t reply_cond_;
+  bool reader_done_;
+  bool has_reply_;
+  uint16_t reply_type_;
+  uint32_t reply_size_;
+  uint8_t reply_data_[kMaxReplySize];
+
+  int device_count_;
+  DeviceVersion device_versions_[REMOTE_MAX_DEVICES];
+  // Indexed by device index. Read by the reader thread without locks.
+  RemoteDevice* devices_[REMOTE_MAX_DEVICES];
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_REMOTE_CONNECTION_H_
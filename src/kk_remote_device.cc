@@ -0,0 +1,142 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_remote_device.h"
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+RemoteDevice::RemoteDevice(DeviceVersion version)
+    : BaseFreenectDevice(version), encoded_buffer_(NULL),
+      encoded_buffer_size_(0) {
+  network_bytes_[kRemoteStreamVideo] = 0;
+  network_bytes_[kRemoteStreamDepth] = 0;
+}
+
+RemoteDevice::~RemoteDevice() {
+  delete[] encoded_buffer_;
+}
+
+DeviceStats RemoteDevice::GetStats() const {
+  DeviceStats stats = BaseFreenectDevice::GetStats();
+  stats.video.network_bytes = __atomic_load_n(
+      &network_bytes_[kRemoteStreamVideo], __ATOMIC_RELAXED);
+  stats.depth.network_bytes = __atomic_load_n(
+      &network_bytes_[kRemoteStreamDepth], __ATOMIC_RELAXED);
+  return stats;
+}
+
+void RemoteDevice::HandleStatus(ErrorCode status, const ImageInfo& video_info,
+                                const ImageInfo& depth_info,
+                                const DepthIntrinsics& depth_intrinsics) {
+  Autolock l(mutex_, &lock_wait_us_);
+  if (video_info.enabled && !IsVideoEnabledLocked() &&
+      !SetVideoParamsLocked(video_info.width, video_info.height,
+                            video_info.refresh_fps, video_info.format)) {
+    status = kErrorOutOfMemory;
+  }
+  if (depth_info.enabled && !IsDepthEnabledLocked() &&
+      !SetDepthParamsLocked(depth_info.width, depth_info.height,
+                            depth_info.refresh_fps, depth_info.format)) {
+    status = kErrorOutOfMemory;
+  }
+  // The host reports zero intrinsics until its depth stream is enabled.
+  if (IsDepthEnabledLocked() && depth_intrinsics.fx > 0) {
+    SetDepthIntrinsicsLocked(depth_intrinsics);
+  }
+  SetStatusLocked(status);
+}
+
+void RemoteDevice::HandleDisconnect() {
+  Autolock l(mutex_, &lock_wait_us_);
+  SetStatusLocked(kErrorUnableToConnect);
+}
+
+bool RemoteDevice::ReceiveFrame(int fd, const RemoteFrameHeader& header) {
+  if (!ReceiveFrameData(fd, header)) return false;
+  // Counted after publishing, so that the count rarely runs ahead of
+  // received frames.
+  int stream = header.stream == kRemoteStreamVideo ?
+      kRemoteStreamVideo : kRemoteStreamDepth;
+  __atomic_add_fetch(&network_bytes_[stream], header.data_size,
+                     __ATOMIC_RELAXED);
+  return true;
+}
+
+bool RemoteDevice::ReceiveFrameData(
+    int fd, const RemoteFrameHeader& header) {
+  // Stream parameters are only changed by HandleStatus(), which runs
+  // on the same thread, so they can be read without |mutex_|.
+  bool is_video = (header.stream == kRemoteStreamVideo);
+  bool enabled = is_video ? IsVideoEnabledLocked() : IsDepthEnabledLocked();
+  int size = is_video ? GetVideoBufferSizeLocked() : GetDepthBufferSizeLocked();
+  if (enabled && !is_video &&
+      header.encoding == kRemoteEncodingDepthCodec) {
+    return ReceiveEncodedDepth(fd, header);
+  }
+  if (!enabled || header.encoding != kRemoteEncodingRaw ||
+      header.data_size != (uint32_t) size) {
+    return SkipFully(fd, header.data_size);
+  }
+
+  if (is_video) {
+    if (!ReadFully(fd, GetVideoFillBuffer(), size)) return false;
+    PublishVideoFrame(header.device_timestamp);
+  } else {
+    if (!ReadFully(fd, GetDepthFillBuffer(), size)) return false;
+    PublishDepthFrame(header.device_timestamp);
+  }
+  return true;
+}
+
+bool RemoteDevice::ReceiveEncodedDepth(
+    int fd, const RemoteFrameHeader& header) {
+  ImageInfo info = GetDepthImageInfo();
+  if (header.data_size >
+      (uint32_t) DepthCodec::GetMaxEncodedSize(info.width, info.height)) {
+    return SkipFully(fd, header.data_size);
+  }
+  if ((int) header.data_size > encoded_buffer_size_) {
+    delete[] encoded_buffer_;
+    encoded_buffer_size_ =
+        DepthCodec::GetMaxEncodedSize(info.width, info.height);
+    encoded_buffer_ = new uint8_t[encoded_buffer_size_];
+  }
+  if (!ReadFully(fd, encoded_buffer_, header.data_size)) return false;
+
+  // A frame that fails to decode is dropped, the stream stays in sync.
+  uint16_t* dst = reinterpret_cast<uint16_t*>(GetDepthFillBuffer());
+  if (depth_codec_.Decode(encoded_buffer_, header.data_size, dst,
+                          info.width, info.height, 0) != kErrorSuccess) {
+    fprintf(stderr, "Dropping malformed depth frame from KKonnect host\n");
+    return true;
+  }
+  PublishDepthFrame(header.device_timestamp);
+  return true;
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,81 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_REMOTE_DEVICE_H_
+#define KKONNECT_KK_REMOTE_DEVICE_H_
+
+#include <kk_depth_codec.h>
+#include <kk_device.h>
+
+#include "src/kk_freenect_base.h"
+#include "src/kk_remote_protocol.h"
+
+namespace kkonnect {
+
+// Implements Device for a device attached to a kkonnect-host. Frames are
+// received by RemoteConnection's reader thread straight into the pooled
+// buffers, so consumers see them exactly like frames of a local device.
+// Compressed depth frames are decoded into the pooled buffers.
+class RemoteDevice : public BaseFreenectDevice {
+ public:
+  explicit RemoteDevice(DeviceVersion version);
+  virtual ~RemoteDevice();
+
+  virtual DeviceStats GetStats() const;
+
+  // The host connects the device on open.
+  virtual void Connect() {}
+
+  // The following methods are called on the reader thread.
+  void HandleStatus(ErrorCode status, const ImageInfo& video_info,
+                    const ImageInfo& depth_info,
+                    const DepthIntrinsics& depth_intrinsics);
+  void HandleDisconnect();
+
+  // Reads frame data of |header| from |fd|. Returns false if the
+  // connection failed.
+  bool ReceiveFrame(int fd, const RemoteFrameHeader& header);
+
+ protected:
+  virtual void CloseLocked() {}
+  virtual void StopLocked() {}
+  virtual const char* GetBackendName() const { return "Remote device"; }
+
+ private:
+  bool ReceiveFrameData(int fd, const RemoteFrameHeader& header);
+  bool ReceiveEncodedDepth(int fd, const RemoteFrameHeader& header);
+
+  // Used on the reader thread only.
+  DepthCodec depth_codec_;
+  uint8_t* encoded_buffer_;
+  int encoded_buffer_size_;
+  // Frame data received per RemoteStream.
+  uint64_t network_bytes_[2];  // Atomic.
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_REMOTE_DEVICE_H_
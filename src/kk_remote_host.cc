@@ -0,0 +1,404 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_remote_host.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <kk_depth_codec.h>
+
+#include "src/kk_remote_protocol.h"
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Sessions wake up this often to report device status changes.
+#define SESSION_POLL_INTERVAL_MS   100
+
+class RemoteHost::Session {
+ public:
+  Session(Connection* connection, int fd);
+  ~Session();
+
+  static void* Run(void* arg);
+
+ private:
+  struct OpenedDevice {
+    Device* device;
+    int event_fd;
+    ErrorCode last_status;
+    bool status_sent;
+    RemoteEncoding depth_encoding;
+  };
+
+  void Run();
+  bool HandleRequest(const RemoteHeader& header, const uint8_t* payload);
+  bool SendStatusIfChanged(int device_index);
+  bool SendFrames(int device_index);
+  bool SendFrame(int device_index, RemoteStream stream,
+                 const FrameLease& lease);
+  void CloseDevice(int device_index);
+
+  Connection* connection_;
+  int fd_;
+  OpenedDevice devices_[REMOTE_MAX_DEVICES];
+  DepthCodec depth_codec_;
+  uint8_t* encode_buffer_;
+  int encode_buffer_size_;
+};
+
+RemoteHost::Session::Session(Connection* connection, int fd)
+    : connection_(connection), fd_(fd), encode_buffer_(NULL),
+      encode_buffer_size_(0) {
+  for (int i = 0; i < REMOTE_MAX_DEVICES; ++i) {
+    devices_[i].device = NULL;
+    devices_[i].event_fd = -1;
+    devices_[i].last_status = kErrorInProgress;
+    devices_[i].status_sent = false;
+    devices_[i].depth_encoding = kRemoteEncodingRaw;
+  }
+}
+
+RemoteHost::Session::~Session() {
+  for (int i = 0; i < REMOTE_MAX_DEVICES; ++i) {
+    CloseDevice(i);
+  }
+  close(fd_);
+  delete[] encode_buffer_;
+}
+
+// static
+void* RemoteHost::Session::Run(void* arg) {
+  Session* session = reinterpret_cast<Session*>(arg);
+  session->Run();
+  delete session;
+  return NULL;
+}
+
+void RemoteHost::Session::Run() {
+  struct pollfd fds[1 + REMOTE_MAX_DEVICES];
+  int fd_devices[1 + REMOTE_MAX_DEVICES];
+  uint8_t payload[64];
+  while (true) {
+    int fd_count = 0;
+    fds[fd_count].fd = fd_;
+    fds[fd_count].events = POLLIN;
+    fd_devices[fd_count++] = -1;
+    for (int i = 0; i < REMOTE_MAX_DEVICES; ++i) {
+      if (devices_[i].event_fd == -1) continue;
+      fds[fd_count].fd = devices_[i].event_fd;
+      fds[fd_count].events = POLLIN;
+      fd_devices[fd_count++] = i;
+    }
+
+    int res = poll(fds, fd_count, SESSION_POLL_INTERVAL_MS);
+    if (res < 0 && errno != EINTR) {
+      REPORT_ERRNO("poll");
+      return;
+    }
+
+    for (int i = 0; i < REMOTE_MAX_DEVICES; ++i) {
+      if (devices_[i].device && !SendStatusIfChanged(i)) return;
+    }
+    if (res <= 0) continue;
+
+    for (int i = 1; i < fd_count; ++i) {
+      if (!(fds[i].revents & POLLIN)) continue;
+      uint64_t value;
+      if (read(fds[i].fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        REPORT_ERRNO("read(eventfd)");
+      }
+      if (!SendFrames(fd_devices[i])) return;
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      uint8_t header_data[REMOTE_HEADER_SIZE];
+      if (!ReadFully(fd_, header_data, sizeof(header_data))) return;
+      RemoteHeader header;
+      GetRemoteHeader(header_data, &header);
+      if (header.size > sizeof(payload)) {
+        fprintf(stderr, "Received oversized request from KKonnect client\n");
+        return;
+      }
+      if (!ReadFully(fd_, payload, header.size)) return;
+      if (!HandleRequest(header, payload)) return;
+    }
+  }
+}
+
+bool RemoteHost::Session::HandleRequest(
+    const RemoteHeader& header, const uint8_t* payload) {
+  uint8_t reply[4 + REMOTE_MAX_DEVICES];
+  int device_index = header.device_index;
+  switch (header.type) {
+    case kRemoteMsgHello: {
+      PutUint32(reply, REMOTE_PROTOCOL_VERSION);
+      return SendRemoteMessage(fd_, header.type, 0, reply, 4);
+    }
+
+    case kRemoteMsgListDevices: {
+      connection_->Refresh();
+      int count = connection_->GetDeviceCount();
+      if (count > REMOTE_MAX_DEVICES) count = REMOTE_MAX_DEVICES;
+      for (int i = 0; i < count; ++i) {
+        DeviceInfo info(kDeviceVersion1);
+        connection_->GetDeviceInfo(i, &info);
+        reply[4 + i] = info.version == kDeviceVersion2 ? 2 : 1;
+      }
+      PutUint32(reply, count);
+      return SendRemoteMessage(fd_, header.type, 0, reply, 4 + count);
+    }
+
+    case kRemoteMsgOpenDevice: {
+      if (header.size < 4) return false;
+      ErrorCode result = kErrorSuccess;
+      if (device_index >= REMOTE_MAX_DEVICES) {
+        result = kErrorUnknownDevice;
+      } else if (devices_[device_index].device) {
+        result = kErrorAlreadyOpened;
+      } else {
+        uint16_t video_format, depth_format;
+        uint16_t depth_encoding = kRemoteEncodingRaw;
+        const uint8_t* pos = GetUint16(payload, &video_format);
+        pos = GetUint16(pos, &depth_format);
+        if (header.size >= 6) pos = GetUint16(pos, &depth_encoding);
+        DeviceOpenRequest request(device_index);
+        request.video_format = (ImageFormat) video_format;
+        request.depth_format = (ImageFormat) depth_format;
+        if (header.size >= REMOTE_OPEN_DEVICE_SIZE) {
+          pos = GetStreamRegion(pos, &request.video_region);
+          GetStreamRegion(pos, &request.depth_region);
+        }
+        Device* device = NULL;
+        result = connection_->OpenDevice(request, &device);
+        if (result == kErrorSuccess) {
+          OpenedDevice& opened = devices_[device_index];
+          opened.device = device;
+          opened.event_fd = device->GetEventFd();
+          opened.status_sent = false;
+          opened.depth_encoding =
+              depth_encoding == kRemoteEncodingDepthCodec ?
+              kRemoteEncodingDepthCodec : kRemoteEncodingRaw;
+        }
+      }
+      PutUint32(reply, result);
+      return SendRemoteMessage(fd_, header.type, device_index, reply, 4);
+    }
+
+    case kRemoteMsgCloseDevice: {
+      if (device_index < REMOTE_MAX_DEVICES) CloseDevice(device_index);
+      return SendRemoteMessage(fd_, header.type, device_index, NULL, 0);
+    }
+
+    default:
+      fprintf(stderr, "Unknown request %d from KKonnect client\n",
+              (int) header.type);
+      return false;
+  }
+}
+
+bool RemoteHost::Session::SendStatusIfChanged(int device_index) {
+  OpenedDevice& opened = devices_[device_index];
+  ErrorCode status = opened.device->GetStatus();
+  if (opened.status_sent && status == opened.last_status) return true;
+  opened.last_status = status;
+  opened.status_sent = true;
+
+  uint8_t payload[REMOTE_STATUS_SIZE];
+  uint8_t* pos = PutUint32(payload, status);
+  pos = PutImageInfo(pos, opened.device->GetVideoImageInfo());
+  pos = PutImageInfo(pos, opened.device->GetDepthImageInfo());
+  DepthIntrinsics intrinsics;
+  opened.device->GetDepthIntrinsics(&intrinsics);
+  PutDepthIntrinsics(pos, intrinsics);
+  return SendRemoteMessage(fd_, kRemoteMsgDeviceStatus, device_index,
+                           payload, sizeof(payload));
+}
+
+bool RemoteHost::Session::SendFrames(int device_index) {
+  Device* device = devices_[device_index].device;
+  // Frames may only follow the status that announces stream parameters.
+  if (!SendStatusIfChanged(device_index)) return false;
+
+  FrameLease lease;
+  if (device->AcquireVideoFrame(&lease)) {
+    bool sent = SendFrame(device_index, kRemoteStreamVideo, lease);
+    device->ReleaseFrame(&lease);
+    if (!sent) return false;
+  }
+  if (device->AcquireDepthFrame(&lease)) {
+    bool sent = SendFrame(device_index, kRemoteStreamDepth, lease);
+    device->ReleaseFrame(&lease);
+    if (!sent) return false;
+  }
+  return true;
+}
+
+bool RemoteHost::Session::SendFrame(
+    int device_index, RemoteStream stream, const FrameLease& lease) {
+  RemoteFrameHeader frame_header;
+  frame_header.stream = stream;
+  frame_header.encoding = kRemoteEncodingRaw;
+  frame_header.device_timestamp = lease.metadata.device_timestamp;
+  frame_header.sequence = lease.metadata.sequence;
+  frame_header.data_size = lease.row_size * lease.height;
+
+  // Pooled buffers have no row padding, so raw frames are sent straight
+  // from the leased buffer.
+  const void* data = lease.data;
+  if (stream == kRemoteStreamDepth &&
+      devices_[device_index].depth_encoding == kRemoteEncodingDepthCodec) {
+    int max_size = DepthCodec::GetMaxEncodedSize(lease.width, lease.height);
+    if (max_size > encode_buffer_size_) {
+      delete[] encode_buffer_;
+      encode_buffer_ = new uint8_t[max_size];
+      encode_buffer_size_ = max_size;
+    }
+    int encoded_size;
+    if (depth_codec_.Encode(
+            reinterpret_cast<const uint16_t*>(lease.data), lease.width,
+            lease.height, lease.row_size, encode_buffer_,
+            encode_buffer_size_, &encoded_size) == kErrorSuccess) {
+      frame_header.encoding = kRemoteEncodingDepthCodec;
+      frame_header.data_size = encoded_size;
+      data = encode_buffer_;
+    }
+  }
+
+  RemoteHeader header;
+  header.size = REMOTE_FRAME_HEADER_SIZE + frame_header.data_size;
+  header.type = kRemoteMsgFrame;
+  header.device_index = device_index;
+
+  uint8_t headers[REMOTE_HEADER_SIZE + REMOTE_FRAME_HEADER_SIZE];
+  PutRemoteFrameHeader(PutRemoteHeader(headers, header), frame_header);
+
+  struct iovec iov[2];
+  iov[0].iov_base = headers;
+  iov[0].iov_len = sizeof(headers);
+  iov[1].iov_base = const_cast<void*>(data);
+  iov[1].iov_len = frame_header.data_size;
+  return WritevFully(fd_, iov, 2);
+}
+
+void RemoteHost::Session::CloseDevice(int device_index) {
+  OpenedDevice& opened = devices_[device_index];
+  if (!opened.device) return;
+  connection_->CloseDevice(opened.device);
+  opened.device = NULL;
+  opened.event_fd = -1;
+}
+
+RemoteHost::RemoteHost(Connection* connection)
+    : connection_(connection), listen_fd_(-1), shutdown_(false) {}
+
+RemoteHost::~RemoteHost() {
+  if (listen_fd_ != -1) close(listen_fd_);
+}
+
+bool RemoteHost::Listen(int port) {
+  CHECK(listen_fd_ == -1);
+  int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    REPORT_ERRNO("socket");
+    return false;
+  }
+
+  int flag = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+  flag = 0;
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &flag, sizeof(flag));
+
+  struct sockaddr_in6 address;
+  memset(&address, 0, sizeof(address));
+  address.sin6_family = AF_INET6;
+  address.sin6_addr = in6addr_any;
+  address.sin6_port = htons(port);
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&address),
+           sizeof(address))) {
+    REPORT_ERRNO("bind");
+    close(fd);
+    return false;
+  }
+  if (listen(fd, 16)) {
+    REPORT_ERRNO("listen");
+    close(fd);
+    return false;
+  }
+  listen_fd_ = fd;
+  return true;
+}
+
+int RemoteHost::GetPort() const {
+  CHECK(listen_fd_ != -1);
+  struct sockaddr_in6 address;
+  socklen_t address_size = sizeof(address);
+  if (getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&address),
+                  &address_size)) {
+    REPORT_ERRNO("getsockname");
+    return -1;
+  }
+  return ntohs(address.sin6_port);
+}
+
+void RemoteHost::Run() {
+  CHECK(listen_fd_ != -1);
+  while (true) {
+    int fd = accept4(listen_fd_, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (__atomic_load_n(&shutdown_, __ATOMIC_SEQ_CST)) return;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      REPORT_ERRNO("accept");
+      return;
+    }
+
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    pthread_t thread;
+    Session* session = new Session(connection_, fd);
+    if (pthread_create(&thread, NULL, Session::Run, session)) {
+      fprintf(stderr, "Unable to start KKonnect client session\n");
+      delete session;
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
+
+void RemoteHost::Shutdown() {
+  CHECK(listen_fd_ != -1);
+  __atomic_store_n(&shutdown_, true, __ATOMIC_SEQ_CST);
+  // Wakes up accept4() in Run(). The socket is closed by the destructor.
+  if (shutdown(listen_fd_, SHUT_RDWR)) REPORT_ERRNO("shutdown");
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_REMOTE_HOST_H_
+#define KKONNECT_KK_REMOTE_HOST_H_
+
+#include <kk_connection.h>
+
+namespace kkonnect {
+
+// Serves devices of a connection to RemoteConnection clients over TCP.
+// Each client is served by its own thread, which multiplexes client
+// requests and device frame events with poll().
+class RemoteHost {
+ public:
+  // |connection| must outlive the host.
+  explicit RemoteHost(Connection* connection);
+  ~RemoteHost();
+
+  // Starts listening on |port|, or on an ephemeral port if |port| is
+  // zero. Returns false on failure.
+  bool Listen(int port);
+
+  // Returns the port that the host listens on.
+  int GetPort() const;
+
+  // Accepts clients until the listening socket fails or Shutdown()
+  // is called.
+  void Run();
+
+  // Makes Run() return. Sessions of connected clients keep running until
+  // the clients disconnect. May be called from any thread.
+  void Shutdown();
+
+ private:
+  class Session;
+
+  Connection* connection_;
+  int listen_fd_;
+  bool shutdown_;  // Atomic.
+
+  RemoteHost(const RemoteHost& src);
+  RemoteHost& operator=(const RemoteHost& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_REMOTE_HOST_H_
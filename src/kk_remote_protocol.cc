@@ -0,0 +1,285 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_remote_protocol.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+uint8_t* PutUint8(uint8_t* dst, uint8_t value) {
+  dst[0] = value;
+  return dst + 1;
+}
+
+uint8_t* PutUint16(uint8_t* dst, uint16_t value) {
+  dst[0] = (uint8_t) value;
+  dst[1] = (uint8_t) (value >> 8);
+  return dst + 2;
+}
+
+uint8_t* PutUint32(uint8_t* dst, uint32_t value) {
+  dst = PutUint16(dst, (uint16_t) value);
+  return PutUint16(dst, (uint16_t) (value >> 16));
+}
+
+uint8_t* PutUint64(uint8_t* dst, uint64_t value) {
+  dst = PutUint32(dst, (uint32_t) value);
+  return PutUint32(dst, (uint32_t) (value >> 32));
+}
+
+uint8_t* PutFloat(uint8_t* dst, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return PutUint32(dst, bits);
+}
+
+const uint8_t* GetUint8(const uint8_t* src, uint8_t* value) {
+  *value = src[0];
+  return src + 1;
+}
+
+const uint8_t* GetUint16(const uint8_t* src, uint16_t* value) {
+  *value = (uint16_t) (src[0] | (src[1] << 8));
+  return src + 2;
+}
+
+const uint8_t* GetUint32(const uint8_t* src, uint32_t* value) {
+  uint16_t low, high;
+  src = GetUint16(src, &low);
+  src = GetUint16(src, &high);
+  *value = low | ((uint32_t) high << 16);
+  return src;
+}
+
+const uint8_t* GetUint64(const uint8_t* src, uint64_t* value) {
+  uint32_t low, high;
+  src = GetUint32(src, &low);
+  src = GetUint32(src, &high);
+  *value = low | ((uint64_t) high << 32);
+  return src;
+}
+
+const uint8_t* GetFloat(const uint8_t* src, float* value) {
+  uint32_t bits;
+  src = GetUint32(src, &bits);
+  memcpy(value, &bits, sizeof(bits));
+  return src;
+}
+
+uint8_t* PutRemoteHeader(uint8_t* dst, const RemoteHeader& header) {
+  dst = PutUint32(dst, header.size);
+  dst = PutUint16(dst, header.type);
+  return PutUint16(dst, header.device_index);
+}
+
+const uint8_t* GetRemoteHeader(const uint8_t* src, RemoteHeader* header) {
+  src = GetUint32(src, &header->size);
+  src = GetUint16(src, &header->type);
+  return GetUint16(src, &header->device_index);
+}
+
+uint8_t* PutRemoteFrameHeader(uint8_t* dst, const RemoteFrameHeader& header) {
+  dst = PutUint8(dst, header.stream);
+  dst = PutUint8(dst, header.encoding);
+  dst = PutUint16(dst, 0);  // Reserved.
+  dst = PutUint32(dst, header.device_timestamp);
+  dst = PutUint64(dst, header.sequence);
+  return PutUint32(dst, header.data_size);
+}
+
+const uint8_t* GetRemoteFrameHeader(
+    const uint8_t* src, RemoteFrameHeader* header) {
+  uint16_t reserved;
+  src = GetUint8(src, &header->stream);
+  src = GetUint8(src, &header->encoding);
+  src = GetUint16(src, &reserved);
+  src = GetUint32(src, &header->device_timestamp);
+  src = GetUint64(src, &header->sequence);
+  return GetUint32(src, &header->data_size);
+}
+
+uint8_t* PutImageInfo(uint8_t* dst, const ImageInfo& info) {
+  dst = PutUint8(dst, info.enabled ? 1 : 0);
+  dst = PutUint8(dst, (uint8_t) info.refresh_fps);
+  dst = PutUint16(dst, (uint16_t) info.format);
+  dst = PutUint16(dst, (uint16_t) info.width);
+  return PutUint16(dst, (uint16_t) info.height);
+}
+
+const uint8_t* GetImageInfo(const uint8_t* src, ImageInfo* info) {
+  uint8_t enabled, fps;
+  uint16_t format, width, height;
+  src = GetUint8(src, &enabled);
+  src = GetUint8(src, &fps);
+  src = GetUint16(src, &format);
+  src = GetUint16(src, &width);
+  src = GetUint16(src, &height);
+  if (enabled) {
+    *info = ImageInfo(width, height, (ImageFormat) format, fps);
+  } else {
+    *info = ImageInfo();
+  }
+  return src;
+}
+
+uint8_t* PutStreamRegion(uint8_t* dst, const StreamRegion& region) {
+  dst = PutUint16(dst, (uint16_t) region.x);
+  dst = PutUint16(dst, (uint16_t) region.y);
+  dst = PutUint16(dst, (uint16_t) region.width);
+  dst = PutUint16(dst, (uint16_t) region.height);
+  return PutUint16(dst, (uint16_t) region.decimation);
+}
+
+const uint8_t* GetStreamRegion(const uint8_t* src, StreamRegion* region) {
+  uint16_t x, y, width, height, decimation;
+  src = GetUint16(src, &x);
+  src = GetUint16(src, &y);
+  src = GetUint16(src, &width);
+  src = GetUint16(src, &height);
+  src = GetUint16(src, &decimation);
+  region->x = x;
+  region->y = y;
+  region->width = width;
+  region->height = height;
+  region->decimation = decimation;
+  return src;
+}
+
+bool ReadFully(int fd, void* dst, size_t size) {
+  uint8_t* pos = reinterpret_cast<uint8_t*>(dst);
+  while (size) {
+    ssize_t res = read(fd, pos, size);
+    if (res == 0) return false;
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      if (errno != ECONNRESET) REPORT_ERRNO("read");
+      return false;
+    }
+    pos += res;
+    size -= res;
+  }
+  return true;
+}
+
+bool WriteFully(int fd, const void* src, size_t size) {
+  struct iovec iov;
+  iov.iov_base = const_cast<void*>(src);
+  iov.iov_len = size;
+  return WritevFully(fd, &iov, 1);
+}
+
+bool WritevFully(int fd, struct iovec* iov, int iov_count) {
+  while (iov_count) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+    ssize_t res = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EPIPE && errno != ECONNRESET) REPORT_ERRNO("sendmsg");
+      return false;
+    }
+    // Advance over the written part. |iov| is modified in place.
+    while (iov_count && (size_t) res >= iov->iov_len) {
+      res -= iov->iov_len;
+      ++iov;
+      --iov_count;
+    }
+    if (iov_count) {
+      iov->iov_base = reinterpret_cast<uint8_t*>(iov->iov_base) + res;
+      iov->iov_len -= res;
+    }
+  }
+  return true;
+}
+
+bool SkipFully(int fd, size_t size) {
+  uint8_t buffer[4096];
+  while (size) {
+    size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+    if (!ReadFully(fd, buffer, chunk)) return false;
+    size -= chunk;
+  }
+  return true;
+}
+
+bool SendRemoteMessage(int fd, uint16_t type, uint16_t device_index,
+                       const void* payload, uint32_t size) {
+  RemoteHeader header;
+  header.size = size;
+  header.type = type;
+  header.device_index = device_index;
+  uint8_t header_data[REMOTE_HEADER_SIZE];
+  PutRemoteHeader(header_data, header);
+
+  struct iovec iov[2];
+  iov[0].iov_base = header_data;
+  iov[0].iov_len = sizeof(header_data);
+  iov[1].iov_base = const_cast<void*>(payload);
+  iov[1].iov_len = size;
+  return WritevFully(fd, iov, size ? 2 : 1);
+}
+
+uint8_t* PutDepthIntrinsics(uint8_t* dst, const DepthIntrinsics& intrinsics) {
+  dst = PutUint16(dst, (uint16_t) intrinsics.width);
+  dst = PutUint16(dst, (uint16_t) intrinsics.height);
+  dst = PutFloat(dst, intrinsics.fx);
+  dst = PutFloat(dst, intrinsics.fy);
+  dst = PutFloat(dst, intrinsics.cx);
+  dst = PutFloat(dst, intrinsics.cy);
+  dst = PutFloat(dst, intrinsics.k1);
+  dst = PutFloat(dst, intrinsics.k2);
+  dst = PutFloat(dst, intrinsics.k3);
+  dst = PutFloat(dst, intrinsics.p1);
+  return PutFloat(dst, intrinsics.p2);
+}
+
+const uint8_t* GetDepthIntrinsics(
+    const uint8_t* src, DepthIntrinsics* intrinsics) {
+  uint16_t width, height;
+  src = GetUint16(src, &width);
+  src = GetUint16(src, &height);
+  intrinsics->width = width;
+  intrinsics->height = height;
+  src = GetFloat(src, &intrinsics->fx);
+  src = GetFloat(src, &intrinsics->fy);
+  src = GetFloat(src, &intrinsics->cx);
+  src = GetFloat(src, &intrinsics->cy);
+  src = GetFloat(src, &intrinsics->k1);
+  src = GetFloat(src, &intrinsics->k2);
+  src = GetFloat(src, &intrinsics->k3);
+  src = GetFloat(src, &intrinsics->p1);
+  return GetFloat(src, &intrinsics->p2);
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,150 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_REMOTE_PROTOCOL_H_
+#define KKONNECT_KK_REMOTE_PROTOCOL_H_
+
+#include <kk_device.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Defines the binary protocol between RemoteConnection and kkonnect-host.
+//
+// Every message starts with an 8-byte header: payload size (u32),
+// message type (u16) and device index (u16). All integers are
+// little-endian. Requests are sent by the client one at a time, and
+// the host answers each with a message of the same type. Status and frame
+// messages are pushed by the host at any time.
+
+namespace kkonnect {
+
+#define REMOTE_PROTOCOL_VERSION   1
+#define REMOTE_DEFAULT_PORT       7421
+
+// Highest device index that can be addressed over the protocol, plus one.
+#define REMOTE_MAX_DEVICES        64
+
+// Largest accepted payload, enough for a raw 1920x1080 RGB frame.
+#define REMOTE_MAX_PAYLOAD_SIZE   (8 * 1024 * 1024)
+
+enum RemoteMessageType {
+  // Request: u32 protocol version. Reply: u32 protocol version.
+  kRemoteMsgHello = 1,
+  // Request: empty. Reply: u32 count, followed by u8 version per device.
+  kRemoteMsgListDevices = 2,
+  // Request: u16 video format, u16 depth format, u16 preferred depth
+  // encoding, video stream region, depth stream region. Trailing fields
+  // may be omitted. Reply: u32 error code.
+  kRemoteMsgOpenDevice = 3,
+  // Request: empty. Reply: empty. The host sends no frames for the device
+  // after the reply.
+  kRemoteMsgCloseDevice = 4,
+  // Pushed: u32 error code, video stream info, depth stream info,
+  // depth intrinsics.
+  kRemoteMsgDeviceStatus = 5,
+  // Pushed: frame header, followed by frame data.
+  kRemoteMsgFrame = 6,
+};
+
+enum RemoteStream {
+  kRemoteStreamVideo = 0,
+  kRemoteStreamDepth = 1,
+};
+
+enum RemoteEncoding {
+  // Rows without padding, in the stream's ImageFormat.
+  kRemoteEncodingRaw = 0,
+  // Depth frame compressed with DepthCodec.
+  kRemoteEncodingDepthCodec = 1,
+};
+
+#define REMOTE_HEADER_SIZE        8
+#define REMOTE_STREAM_INFO_SIZE   8
+#define REMOTE_INTRINSICS_SIZE    (4 + 9 * 4)
+#define REMOTE_REGION_SIZE        10
+#define REMOTE_OPEN_DEVICE_SIZE   (6 + 2 * REMOTE_REGION_SIZE)
+#define REMOTE_STATUS_SIZE        \
+    (4 + 2 * REMOTE_STREAM_INFO_SIZE + REMOTE_INTRINSICS_SIZE)
+#define REMOTE_FRAME_HEADER_SIZE  20
+
+struct RemoteHeader {
+  uint32_t size;
+  uint16_t type;
+  uint16_t device_index;
+};
+
+struct RemoteFrameHeader {
+  uint8_t stream;
+  uint8_t encoding;
+  uint32_t device_timestamp;
+  uint64_t sequence;
+  uint32_t data_size;
+};
+
+// Little-endian serialization. Each function returns the position
+// after the serialized value.
+uint8_t* PutUint8(uint8_t* dst, uint8_t value);
+uint8_t* PutUint16(uint8_t* dst, uint16_t value);
+uint8_t* PutUint32(uint8_t* dst, uint32_t value);
+uint8_t* PutUint64(uint8_t* dst, uint64_t value);
+uint8_t* PutFloat(uint8_t* dst, float value);
+const uint8_t* GetUint8(const uint8_t* src, uint8_t* value);
+const uint8_t* GetUint16(const uint8_t* src, uint16_t* value);
+const uint8_t* GetUint32(const uint8_t* src, uint32_t* value);
+const uint8_t* GetUint64(const uint8_t* src, uint64_t* value);
+const uint8_t* GetFloat(const uint8_t* src, float* value);
+
+uint8_t* PutRemoteHeader(uint8_t* dst, const RemoteHeader& header);
+const uint8_t* GetRemoteHeader(const uint8_t* src, RemoteHeader* header);
+uint8_t* PutRemoteFrameHeader(uint8_t* dst, const RemoteFrameHeader& header);
+const uint8_t* GetRemoteFrameHeader(
+    const uint8_t* src, RemoteFrameHeader* header);
+uint8_t* PutImageInfo(uint8_t* dst, const ImageInfo& info);
+const uint8_t* GetImageInfo(const uint8_t* src, ImageInfo* info);
+uint8_t* PutStreamRegion(uint8_t* dst, const StreamRegion& region);
+const uint8_t* GetStreamRegion(const uint8_t* src, StreamRegion* region);
+uint8_t* PutDepthIntrinsics(uint8_t* dst, const DepthIntrinsics& intrinsics);
+const uint8_t* GetDepthIntrinsics(
+    const uint8_t* src, DepthIntrinsics* intrinsics);
+
+// Blocking socket I/O that retries on EINTR and partial transfers.
+// Return false if the connection was closed or failed. Writes never
+// raise SIGPIPE.
+bool ReadFully(int fd, void* dst, size_t size);
+bool WriteFully(int fd, const void* src, size_t size);
+bool WritevFully(int fd, struct iovec* iov, int iov_count);
+
+// Reads and drops |size| bytes.
+bool SkipFully(int fd, size_t size);
+
+// Sends a message consisting of a header and |payload|.
+bool SendRemoteMessage(int fd, uint16_t type, uint16_t device_index,
+                       const void* payload, uint32_t size);
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_REMOTE_PROTOCOL_H_
@@ -0,0 +1,181 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_replay_connection.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// static
+ReplayConnection* ReplayConnection::Create(const char* path,
+                                           const ReplayOptions& options) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    REPORT_ERRNO("open");
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    REPORT_ERRNO("fstat");
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size < RECORDING_DATA_OFFSET) {
+    fprintf(stderr, "Recording %s is truncated\n", path);
+    close(fd);
+    return NULL;
+  }
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    REPORT_ERRNO("mmap");
+    close(fd);
+    return NULL;
+  }
+  madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+  ReplayConnection* connection = new ReplayConnection(
+      fd, reinterpret_cast<const uint8_t*>(mapping), st.st_size, options);
+  bool valid;
+  {
+    Autolock l(connection->mutex_);
+    valid = connection->ParseLocked();
+  }
+  if (!valid) {
+    fprintf(stderr, "File %s is not a valid recording\n", path);
+    connection->Close();
+    return NULL;
+  }
+  return connection;
+}
+
+ReplayConnection::ReplayConnection(int fd, const uint8_t* mapping,
+                                   uint64_t size,
+                                   const ReplayOptions& options)
+    : fd_(fd), mapping_(mapping), size_(size), options_(options) {
+}
+
+ReplayConnection::~ReplayConnection() {
+}
+
+bool ReplayConnection::ParseLocked() {
+  const uint8_t* pos = GetRecordingHeader(mapping_, &header_);
+  if (!pos) return false;
+  for (int i = 0; i < kRecordingStreamCount; ++i) {
+    RecordingStreamHeader stream_header;
+    pos = GetRecordingStreamHeader(pos, &stream_header);
+    ImageInfo& info = stream_header.info;
+    if (!info.enabled) continue;
+    if (info.width <= 0 || info.height <= 0 ||
+        !GetBytesPerPixel(info.format)) {
+      return false;
+    }
+    uint64_t index_size =
+        (uint64_t) stream_header.frame_count * RECORDING_INDEX_ENTRY_SIZE;
+    if (stream_header.frame_count > INT_MAX ||
+        stream_header.index_offset > size_ ||
+        index_size > size_ - stream_header.index_offset) {
+      return false;
+    }
+
+    const uint8_t* index = mapping_ + stream_header.index_offset;
+    uint64_t frame_size = GetRecordingFrameSize(info);
+    for (uint32_t j = 0; j < stream_header.frame_count; ++j) {
+      RecordingIndexEntry entry;
+      GetRecordingIndexEntry(index + j * RECORDING_INDEX_ENTRY_SIZE, &entry);
+      if (entry.data_offset < RECORDING_DATA_OFFSET ||
+          entry.data_offset % RECORDING_FRAME_ALIGNMENT ||
+          entry.data_offset > size_ ||
+          frame_size > size_ - entry.data_offset) {
+        return false;
+      }
+    }
+
+    streams_[i].info = info;
+    streams_[i].index = index;
+    streams_[i].frame_count = stream_header.frame_count;
+  }
+  return true;
+}
+
+ErrorCode ReplayConnection::GetDeviceInfo(int device_index,
+                                          DeviceInfo* info) {
+  if (device_index != 0) return kErrorUnknownDevice;
+  *info = DeviceInfo(header_.device_version);
+  return kErrorSuccess;
+}
+
+void ReplayConnection::CloseInternalLocked() {
+  munmap(const_cast<uint8_t*>(mapping_), size_);
+  close(fd_);
+  delete this;
+}
+
+ErrorCode ReplayConnection::OpenDeviceInternalLocked(
+    const DeviceOpenRequest& request, Device** device) {
+  if (request.device_index != 0) return kErrorUnknownDevice;
+
+  // Streams can be dropped, but not converted.
+  ImageFormat formats[kRecordingStreamCount];
+  formats[kRecordingStreamVideo] = request.video_format;
+  formats[kRecordingStreamDepth] = request.depth_format;
+  ReplayStream streams[kRecordingStreamCount];
+  for (int i = 0; i < kRecordingStreamCount; ++i) {
+    if (formats[i] == kImageFormatNone) continue;
+    if (!streams_[i].info.enabled || streams_[i].info.format != formats[i]) {
+      return kErrorInvalidArgument;
+    }
+    streams[i] = streams_[i];
+  }
+
+  ReplayDevice* replay_device = new ReplayDevice(
+      header_.device_version, mapping_, streams,
+      header_.depth_intrinsics, options_);
+  replay_device->SetCopyThreadCount(request.copy_thread_count);
+  replay_device->SetBufferAllocator(buffer_allocator());
+  replay_device->SetEventQueue(device_event_queue(), request.device_index);
+  replay_device->SetChangeDetection(request.video_changes,
+                                    request.depth_changes);
+  replay_device->SetStreamRegions(request.video_region, request.depth_region);
+  replay_device->Connect();
+  *device = replay_device;
+  return kErrorSuccess;
+}
+
+void ReplayConnection::CloseDeviceInternalLocked(Device* device) {
+  ReplayDevice* replay_device = reinterpret_cast<ReplayDevice*>(device);
+  replay_device->Stop();
+  replay_device->Close();
+  delete replay_device;
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,74 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_REPLAY_CONNECTION_H_
+#define KKONNECT_KK_REPLAY_CONNECTION_H_
+
+#include <kk_connection.h>
+
+#include "src/kk_recording_format.h"
+#include "src/kk_replay_device.h"
+
+namespace kkonnect {
+
+// Implements connection to a recording, served as a single device.
+class ReplayConnection : public Connection {
+ public:
+  // Returns NULL if the file is not a valid recording.
+  static ReplayConnection* Create(const char* path,
+                                  const ReplayOptions& options);
+
+  virtual ErrorCode Refresh() { return kErrorSuccess; }
+  virtual int GetDeviceCount() { return 1; }
+  virtual ErrorCode GetDeviceInfo(int device_index, DeviceInfo* info);
+
+ protected:
+  ReplayConnection(int fd, const uint8_t* mapping, uint64_t size,
+                   const ReplayOptions& options);
+  virtual ~ReplayConnection();
+
+  virtual void CloseInternalLocked();
+
+  virtual ErrorCode OpenDeviceInternalLocked(
+      const DeviceOpenRequest& request, Device** device);
+  virtual void CloseDeviceInternalLocked(Device* device);
+
+ private:
+  // Reads the headers and checks that all indexed frames lie within
+  // the mapping.
+  bool ParseLocked();
+
+  int fd_;
+  const uint8_t* mapping_;
+  uint64_t size_;
+  ReplayOptions options_;
+  RecordingHeader header_;
+  ReplayStream streams_[kRecordingStreamCount];
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_REPLAY_CONNECTION_H_
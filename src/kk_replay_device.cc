@@ -0,0 +1,166 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_replay_device.h"
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+ReplayDevice::ReplayDevice(DeviceVersion version, const uint8_t* mapping,
+                           const ReplayStream* streams,
+                           const DepthIntrinsics& depth_intrinsics,
+                           const ReplayOptions& options)
+    : BaseFreenectDevice(version), mapping_(mapping),
+      depth_intrinsics_(depth_intrinsics), options_(options),
+      pacer_started_(false), stopping_(false) {
+  for (int i = 0; i < kRecordingStreamCount; ++i) {
+    streams_[i] = streams[i];
+  }
+  pthread_mutex_init(&pacer_mutex_, NULL);
+  InitMonotonicCond(&pacer_cond_);
+}
+
+ReplayDevice::~ReplayDevice() {
+  CHECK(!pacer_started_);
+  pthread_cond_destroy(&pacer_cond_);
+  pthread_mutex_destroy(&pacer_mutex_);
+}
+
+void ReplayDevice::Connect() {
+  Autolock l(mutex_, &lock_wait_us_);
+  SetExternalFramesLocked();
+  // Streams only need buffers when they are cropped or decimated.
+  const ImageInfo& video = streams_[kRecordingStreamVideo].info;
+  const ImageInfo& depth = streams_[kRecordingStreamDepth].info;
+  if ((video.enabled &&
+       !SetVideoParamsLocked(video.width, video.height, video.refresh_fps,
+                             video.format)) ||
+      (depth.enabled &&
+       !SetDepthParamsLocked(depth.width, depth.height, depth.refresh_fps,
+                             depth.format))) {
+    SetStatusLocked(kErrorOutOfMemory);
+    return;
+  }
+  if (depth.enabled) SetDepthIntrinsicsLocked(depth_intrinsics_);
+  SetStatusLocked(kErrorSuccess);
+
+  CHECK(!pthread_create(&pacer_thread_, NULL, RunPacer, this));
+  pacer_started_ = true;
+}
+
+void ReplayDevice::StopLocked() {
+  if (!pacer_started_) return;
+  {
+    Autolock l(pacer_mutex_);
+    __atomic_store_n(&stopping_, true, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pacer_cond_);
+  }
+  pthread_join(pacer_thread_, NULL);
+  pacer_started_ = false;
+}
+
+// static
+void* ReplayDevice::RunPacer(void* arg) {
+  reinterpret_cast<ReplayDevice*>(arg)->RunPacer();
+  return NULL;
+}
+
+bool ReplayDevice::WaitUntil(uint64_t deadline_us) {
+  Autolock l(pacer_mutex_);
+  uint64_t deadline_ms = (deadline_us + 999) / 1000;
+  while (!stopping_ && GetCurrentMicros() < deadline_us) {
+    WaitCondUntil(&pacer_cond_, &pacer_mutex_, deadline_ms);
+  }
+  return !stopping_;
+}
+
+void ReplayDevice::RunPacer() {
+  int total_frames = 0;
+  for (int i = 0; i < kRecordingStreamCount; ++i) {
+    total_frames += streams_[i].frame_count;
+  }
+  if (!total_frames) return;
+
+  bool paced = options_.speed > 0;
+  do {
+    // Both stream indexes are in arrival order. Merge them by host time,
+    // and measure times from the first frame of this pass.
+    int next[kRecordingStreamCount] = {0};
+    RecordingIndexEntry entries[kRecordingStreamCount];
+    for (int i = 0; i < kRecordingStreamCount; ++i) {
+      if (streams_[i].frame_count) {
+        GetRecordingIndexEntry(streams_[i].index, &entries[i]);
+      }
+    }
+    uint64_t first_time_us = ~(uint64_t) 0;
+    for (int i = 0; i < kRecordingStreamCount; ++i) {
+      if (streams_[i].frame_count &&
+          entries[i].host_time_us < first_time_us) {
+        first_time_us = entries[i].host_time_us;
+      }
+    }
+    uint64_t start_us = GetCurrentMicros();
+
+    for (int n = 0; n < total_frames; ++n) {
+      int stream = -1;
+      for (int i = 0; i < kRecordingStreamCount; ++i) {
+        if (next[i] == streams_[i].frame_count) continue;
+        if (stream < 0 ||
+            entries[i].host_time_us < entries[stream].host_time_us) {
+          stream = i;
+        }
+      }
+      const RecordingIndexEntry& entry = entries[stream];
+
+      if (paced) {
+        // Recorded times only need to be ordered within each stream.
+        uint64_t offset_us = entry.host_time_us > first_time_us ?
+            entry.host_time_us - first_time_us : 0;
+        if (!WaitUntil(start_us + (uint64_t) (offset_us / options_.speed))) {
+          return;
+        }
+      } else if (__atomic_load_n(&stopping_, __ATOMIC_RELAXED)) {
+        return;
+      }
+
+      const uint8_t* data = mapping_ + entry.data_offset;
+      if (stream == kRecordingStreamVideo) {
+        PublishExternalVideoFrame(data, entry.device_timestamp);
+      } else {
+        PublishExternalDepthFrame(data, entry.device_timestamp);
+      }
+
+      if (++next[stream] < streams_[stream].frame_count) {
+        GetRecordingIndexEntry(
+            streams_[stream].index +
+            next[stream] * RECORDING_INDEX_ENTRY_SIZE, &entries[stream]);
+      }
+    }
+  } while (options_.loop);
+}
+
+}  // namespace kkonnect
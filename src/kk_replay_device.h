@@ -0,0 +1,93 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_REPLAY_DEVICE_H_
+#define KKONNECT_KK_REPLAY_DEVICE_H_
+
+#include <kk_connection.h>
+#include <kk_device.h>
+#include <pthread.h>
+
+#include "src/kk_freenect_base.h"
+#include "src/kk_recording_format.h"
+
+namespace kkonnect {
+
+// Describes a recorded stream inside the mapping of a recording.
+struct ReplayStream {
+  ImageInfo info;
+  // Serialized index entries, validated against the mapping.
+  const uint8_t* index;
+  int frame_count;
+
+  ReplayStream() : index(NULL), frame_count(0) {}
+};
+
+// Implements Device for a recording. A pacing thread publishes frames
+// at their recorded times, pointing the frame pools into the mapping
+// instead of copying the frames.
+class ReplayDevice : public BaseFreenectDevice {
+ public:
+  // |mapping| and the stream indexes must outlive the device.
+  ReplayDevice(DeviceVersion version, const uint8_t* mapping,
+               const ReplayStream* streams,
+               const DepthIntrinsics& depth_intrinsics,
+               const ReplayOptions& options);
+  virtual ~ReplayDevice();
+
+  // Starts playback. The device is connected when this returns.
+  virtual void Connect();
+
+ protected:
+  virtual void CloseLocked() {}
+  virtual void StopLocked();
+  virtual const char* GetBackendName() const { return "Replay device"; }
+
+ private:
+  static void* RunPacer(void* arg);
+  void RunPacer();
+
+  // Waits until GetCurrentMicros() reaches |deadline_us|. Returns false
+  // if the device is stopping.
+  bool WaitUntil(uint64_t deadline_us);
+
+  const uint8_t* mapping_;
+  ReplayStream streams_[kRecordingStreamCount];
+  DepthIntrinsics depth_intrinsics_;
+  ReplayOptions options_;
+
+  pthread_t pacer_thread_;
+  bool pacer_started_;
+  // Guard waits for |stopping_|, which is also read without the lock
+  // when playback is not paced.
+  pthread_mutex_t pacer_mutex_;
+  pthread_cond_t pacer_cond_;
+  bool stopping_;
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_REPLAY_DEVICE_H_
@@ -0,0 +1,141 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_synthetic_connection.h"
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+// Number of devices that can be connecting at the same time.
+#define CONNECT_THREAD_COUNT      4
+
+#define MAX_SYNTHETIC_FPS         1000
+
+// static
+SyntheticConnection* SyntheticConnection::Create(
+    const SyntheticOptions& options) {
+  if (options.device_count < 0 || options.width <= 0 ||
+      options.height <= 0 || options.fps <= 0 ||
+      options.fps > MAX_SYNTHETIC_FPS || options.jitter_ms < 0 ||
+      options.drop_rate < 0 || options.drop_rate > 1 ||
+      options.failed_open_attempts < 0 || options.stall_after_frames < 0) {
+    fprintf(stderr, "Invalid synthetic device options\n");
+    return NULL;
+  }
+  return new SyntheticConnection(options);
+}
+
+SyntheticConnection::SyntheticConnection(const SyntheticOptions& options)
+    : options_(options), connect_pool_(this, &mutex_) {
+  connect_pool_.Start(CONNECT_THREAD_COUNT);
+}
+
+SyntheticConnection::~SyntheticConnection() {
+}
+
+void SyntheticConnection::CloseInternalLocked() {
+  connect_pool_.ShutdownLocked();
+  // Workers need the mutex to exit.
+  pthread_mutex_unlock(&mutex_);
+  connect_pool_.Join();
+  pthread_mutex_lock(&mutex_);
+  delete this;
+}
+
+int SyntheticConnection::GetDeviceCount() {
+  return options_.device_count;
+}
+
+ErrorCode SyntheticConnection::GetDeviceInfo(int device_index,
+                                             DeviceInfo* info) {
+  if (device_index < 0 || device_index >= options_.device_count) {
+    return kErrorUnknownDevice;
+  }
+  *info = DeviceInfo(options_.version);
+  return kErrorSuccess;
+}
+
+ErrorCode SyntheticConnection::OpenDeviceInternalLocked(
+    const DeviceOpenRequest& request, Device** device) {
+  if (request.device_index < 0 ||
+      request.device_index >= options_.device_count) {
+    return kErrorUnknownDevice;
+  }
+  if ((request.video_format != kImageFormatNone &&
+       request.video_format != kImageFormatVideoRgb &&
+       request.video_format != kImageFormatVideoYuv422) ||
+      (request.depth_format != kImageFormatNone &&
+       request.depth_format != kImageFormatDepthMm &&
+       request.depth_format != kImageFormatDepthRegistered)) {
+    return kErrorInvalidArgument;
+  }
+
+  SyntheticDevice* synthetic_device = new SyntheticDevice(options_, request);
+  synthetic_device->SetCopyThreadCount(request.copy_thread_count);
+  synthetic_device->SetBufferAllocator(buffer_allocator());
+  synthetic_device->SetEventQueue(device_event_queue(), request.device_index);
+  synthetic_device->SetChangeDetection(request.video_changes,
+                                       request.depth_changes);
+  synthetic_device->SetStreamRegions(request.video_region,
+                                     request.depth_region);
+
+  connect_pool_.WakeUpLocked();
+
+  *device = synthetic_device;
+  return kErrorSuccess;
+}
+
+void SyntheticConnection::CloseDeviceInternalLocked(Device* device) {
+  SyntheticDevice* synthetic_device =
+      reinterpret_cast<SyntheticDevice*>(device);
+  if (synthetic_device->MarkConnectStarted()) {
+    if (!synthetic_device->NeedsClose()) {
+      // The device did not start connecting yet.
+      delete synthetic_device;
+      return;
+    }
+  } else {
+    // The device is no longer listed, so workers cannot pick it up again.
+    connect_pool_.WaitForConnectLocked(synthetic_device);
+  }
+  synthetic_device->Stop();
+  synthetic_device->Close();
+  delete synthetic_device;
+}
+
+BaseFreenectDevice* SyntheticConnection::StartConnectingNextDeviceLocked() {
+  Device* device = GetFirstDeviceLocked();
+  while (device) {
+    BaseFreenectDevice* base_device =
+        reinterpret_cast<BaseFreenectDevice*>(device);
+    if (base_device->MarkConnectStarted()) return base_device;
+    device = GetNextDeviceLocked(device);
+  }
+  return NULL;
+}
+
+}  // namespace kkonnect
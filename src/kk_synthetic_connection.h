@@ -0,0 +1,68 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_SYNTHETIC_CONNECTION_H_
+#define KKONNECT_KK_SYNTHETIC_CONNECTION_H_
+
+#include <kk_connection.h>
+
+#include "src/kk_connect_pool.h"
+#include "src/kk_synthetic_device.h"
+
+namespace kkonnect {
+
+// Implements connection to fake devices. Devices are connected and
+// health-checked by a ConnectPool, as with FreenectConnection.
+class SyntheticConnection
+    : public Connection, private ConnectPool::Delegate {
+ public:
+  // Returns NULL if |options| are invalid.
+  static SyntheticConnection* Create(const SyntheticOptions& options);
+
+  virtual ErrorCode Refresh() { return kErrorSuccess; }
+  virtual int GetDeviceCount();
+  virtual ErrorCode GetDeviceInfo(int device_index, DeviceInfo* info);
+
+ protected:
+  explicit SyntheticConnection(const SyntheticOptions& options);
+  virtual ~SyntheticConnection();
+
+  virtual void CloseInternalLocked();
+
+  virtual ErrorCode OpenDeviceInternalLocked(
+      const DeviceOpenRequest& request, Device** device);
+  virtual void CloseDeviceInternalLocked(Device* device);
+
+ private:
+  virtual BaseFreenectDevice* StartConnectingNextDeviceLocked();
+
+  SyntheticOptions options_;
+  ConnectPool connect_pool_;
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_SYNTHETIC_CONNECTION_H_
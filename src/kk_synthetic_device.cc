@@ -0,0 +1,190 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_synthetic_device.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+#define MAX_DEVICE_OPEN_ATTEMPTS   10
+#define OPEN_RETRY_BASE_SECONDS    0.05
+#define OPEN_RETRY_MAX_SECONDS     1.0
+
+SyntheticDevice::SyntheticDevice(const SyntheticOptions& options,
+                                 const DeviceOpenRequest& request)
+    : BaseFreenectDevice(options.version), options_(options),
+      open_request_(request), generator_started_(false), stopping_(false) {
+  pthread_mutex_init(&generator_mutex_, NULL);
+  InitMonotonicCond(&generator_cond_);
+}
+
+SyntheticDevice::~SyntheticDevice() {
+  CHECK(!generator_started_);
+  pthread_cond_destroy(&generator_cond_);
+  pthread_mutex_destroy(&generator_mutex_);
+}
+
+void SyntheticDevice::Connect() {
+  int device_index = open_request_.device_index;
+  fprintf(stderr, "Connecting to synthetic device #%d\n", device_index);
+
+  unsigned int seed = (unsigned int) (GetCurrentMillis() ^ device_index);
+  while (true) {
+    int open_attempt;
+    {
+      Autolock l(mutex_, &lock_wait_us_);
+      open_attempt = RecordConnectAttemptLocked();
+    }
+    if (open_attempt > options_.failed_open_attempts) break;
+
+    {
+      Autolock l(mutex_, &lock_wait_us_);
+      UpdateHealthTimerLocked();
+      fprintf(stderr, "Failed synthetic open on #%d, attempt=%d\n",
+              device_index, open_attempt);
+      if (open_attempt >= MAX_DEVICE_OPEN_ATTEMPTS) {
+        SetStatusLocked(kErrorUnableToConnect);
+        return;
+      }
+    }
+
+    Sleep(GetBackoffDelay(open_attempt, OPEN_RETRY_BASE_SECONDS,
+                          OPEN_RETRY_MAX_SECONDS, &seed));
+  }
+
+  Autolock l(mutex_, &lock_wait_us_);
+  CHECK(!generator_started_);
+  if ((open_request_.video_format != kImageFormatNone &&
+       !SetVideoParamsLocked(options_.width, options_.height, options_.fps,
+                             open_request_.video_format)) ||
+      (open_request_.depth_format != kImageFormatNone &&
+       !SetDepthParamsLocked(options_.width, options_.height, options_.fps,
+                             open_request_.depth_format))) {
+    SetStatusLocked(kErrorOutOfMemory);
+    return;
+  }
+  stopping_ = false;
+  CHECK(!pthread_create(&generator_thread_, NULL, RunGenerator, this));
+  generator_started_ = true;
+  SetStatusLocked(kErrorSuccess);
+}
+
+void SyntheticDevice::StopLocked() {
+  if (!generator_started_) return;
+  {
+    Autolock l(generator_mutex_);
+    stopping_ = true;
+    pthread_cond_signal(&generator_cond_);
+  }
+  pthread_join(generator_thread_, NULL);
+  generator_started_ = false;
+}
+
+// static
+void* SyntheticDevice::RunGenerator(void* arg) {
+  reinterpret_cast<SyntheticDevice*>(arg)->RunGenerator();
+  return NULL;
+}
+
+bool SyntheticDevice::WaitUntil(uint64_t deadline_us) {
+  Autolock l(generator_mutex_);
+  uint64_t deadline_ms = (deadline_us + 999) / 1000;
+  while (!stopping_ && GetCurrentMicros() < deadline_us) {
+    WaitCondUntil(&generator_cond_, &generator_mutex_, deadline_ms);
+  }
+  return !stopping_;
+}
+
+// The generator plays the role of the driver thread. Stream parameters do
+// not change while it runs.
+void SyntheticDevice::RunGenerator() {
+  bool has_video = open_request_.video_format != kImageFormatNone;
+  bool has_depth = open_request_.depth_format != kImageFormatNone;
+  unsigned int seed = (unsigned int) (GetCurrentMicros() ^
+                                      open_request_.device_index);
+  int64_t interval_us = 1000000 / options_.fps;
+  int64_t jitter_us = (int64_t) (options_.jitter_ms * 1000);
+  int drop_threshold = (int) (options_.drop_rate * RAND_MAX);
+  uint64_t start_us = GetCurrentMicros();
+
+  for (int frame = 0; ; ++frame) {
+    if (options_.stall_after_frames && frame >= options_.stall_after_frames) {
+      // Stop producing frames, like a device that hung, until the health
+      // check reconnects.
+      Autolock l(generator_mutex_);
+      while (!stopping_) {
+        pthread_cond_wait(&generator_cond_, &generator_mutex_);
+      }
+      return;
+    }
+
+    int64_t offset_us = frame * interval_us;
+    if (jitter_us) {
+      offset_us += rand_r(&seed) % (2 * jitter_us + 1) - jitter_us;
+      if (offset_us < 0) offset_us = 0;
+    }
+    if (!WaitUntil(start_us + offset_us)) return;
+    if (drop_threshold && rand_r(&seed) < drop_threshold) continue;
+
+    // Device timestamps keep the nominal spacing, in microseconds.
+    uint32_t timestamp = (uint32_t) (frame * interval_us);
+    if (has_video) {
+      FillVideo(reinterpret_cast<uint8_t*>(GetVideoFillBuffer()), frame);
+      PublishVideoFrame(timestamp);
+    }
+    if (has_depth) {
+      FillDepth(reinterpret_cast<uint16_t*>(GetDepthFillBuffer()), frame);
+      PublishDepthFrame(timestamp);
+    }
+  }
+}
+
+// Horizontal bands that scroll by one row per frame.
+void SyntheticDevice::FillVideo(uint8_t* dst, int frame) const {
+  int row_size =
+      options_.width * GetBytesPerPixel(open_request_.video_format);
+  for (int y = 0; y < options_.height; ++y) {
+    memset(dst + y * row_size, (y + frame) & 0xFF, row_size);
+  }
+}
+
+// A ramp with steps, receding by 8 mm per row and frame.
+void SyntheticDevice::FillDepth(uint16_t* dst, int frame) const {
+  int width = options_.width;
+  for (int y = 0; y < options_.height; ++y) {
+    uint16_t base = 500 + ((y + frame) & 511) * 8;
+    uint16_t* row = dst + y * width;
+    for (int x = 0; x < width; ++x) {
+      row[x] = base + (x & 63);
+    }
+  }
+}
+
+}  // namespace kkonnect
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_SYNTHETIC_DEVICE_H_
+#define KKONNECT_KK_SYNTHETIC_DEVICE_H_
+
+#include <kk_connection.h>
+#include <kk_device.h>
+#include <pthread.h>
+
+#include "src/kk_freenect_base.h"
+
+namespace kkonnect {
+
+// Implements Device with generated frames. Connect() runs on the connect
+// pool and retries like a libfreenect device. A generator thread plays
+// the role of the driver thread: it fills the pooled buffers in place
+// and publishes them at the configured rate.
+class SyntheticDevice : public BaseFreenectDevice {
+ public:
+  SyntheticDevice(const SyntheticOptions& options,
+                  const DeviceOpenRequest& request);
+  virtual ~SyntheticDevice();
+
+  virtual void Connect();
+
+ protected:
+  virtual void CloseLocked() {}
+  virtual void StopLocked();
+  virtual const char* GetBackendName() const { return "Synthetic device"; }
+
+ private:
+  static void* RunGenerator(void* arg);
+  void RunGenerator();
+
+  // Waits until GetCurrentMicros() reaches |deadline_us|. Returns false
+  // if the device is stopping.
+  bool WaitUntil(uint64_t deadline_us);
+
+  // Fill buffers with patterns that move with |frame|.
+  void FillVideo(uint8_t* dst, int frame) const;
+  void FillDepth(uint16_t* dst, int frame) const;
+
+  SyntheticOptions options_;
+  DeviceOpenRequest open_request_;
+
+  pthread_t generator_thread_;
+  bool generator_started_;
+  // Guards waits for |stopping_|, which is signalled by StopLocked().
+  pthread_mutex_t generator_mutex_;
+  pthread_cond_t generator_cond_;
+  bool stopping_;
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_SYNTHETIC_DEVICE_H_
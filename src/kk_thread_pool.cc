@@ -0,0 +1,125 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#include "src/kk_thread_pool.h"
+
+#include "src/utils.h"
+
+namespace kkonnect {
+
+ThreadPool::ThreadPool(int thread_count)
+    : should_exit_(false), generation_(0), task_(NULL), task_count_(0),
+      next_index_(0), pending_count_(0), threads_(NULL),
+      thread_count_(thread_count) {
+  CHECK(thread_count >= 0);
+  pthread_mutex_init(&run_mutex_, NULL);
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&work_cond_, NULL);
+  pthread_cond_init(&done_cond_, NULL);
+  threads_ = new pthread_t[thread_count];
+  for (int i = 0; i < thread_count; ++i) {
+    CHECK(!pthread_create(&threads_[i], NULL, RunThread, this));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    Autolock l(mutex_);
+    should_exit_ = true;
+    pthread_cond_broadcast(&work_cond_);
+  }
+  for (int i = 0; i < thread_count_; ++i) {
+    pthread_join(threads_[i], NULL);
+  }
+  delete[] threads_;
+  pthread_cond_destroy(&done_cond_);
+  pthread_cond_destroy(&work_cond_);
+  pthread_mutex_destroy(&mutex_);
+  pthread_mutex_destroy(&run_mutex_);
+}
+
+void ThreadPool::RunParallel(Task* task, int count) {
+  if (count <= 0) return;
+  Autolock run_lock(run_mutex_);
+  {
+    Autolock l(mutex_);
+    task_ = task;
+    task_count_ = count;
+    next_index_ = 0;
+    pending_count_ = count;
+    ++generation_;
+    pthread_cond_broadcast(&work_cond_);
+  }
+
+  RunTasks();
+
+  Autolock l(mutex_);
+  while (pending_count_) {
+    pthread_cond_wait(&done_cond_, &mutex_);
+  }
+  task_ = NULL;
+}
+
+void ThreadPool::RunTasks() {
+  while (true) {
+    Task* task;
+    int index;
+    {
+      Autolock l(mutex_);
+      if (!task_ || next_index_ == task_count_) return;
+      task = task_;
+      index = next_index_++;
+    }
+
+    task->Run(index);
+
+    Autolock l(mutex_);
+    if (!--pending_count_) pthread_cond_broadcast(&done_cond_);
+  }
+}
+
+// static
+void* ThreadPool::RunThread(void* arg) {
+  reinterpret_cast<ThreadPool*>(arg)->RunThread();
+  return NULL;
+}
+
+void ThreadPool::RunThread() {
+  uint64_t seen_generation = 0;
+  while (true) {
+    {
+      Autolock l(mutex_);
+      while (!should_exit_ && generation_ == seen_generation) {
+        pthread_cond_wait(&work_cond_, &mutex_);
+      }
+      if (should_exit_) return;
+      seen_generation = generation_;
+    }
+    RunTasks();
+  }
+}
+
+}  // namespace kkonnect
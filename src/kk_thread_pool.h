@@ -0,0 +1,85 @@
+/*
+ * This file is part of the KKonnect Project.
+ *
+ * Copyright (c) 2015 individual KKonnect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef KKONNECT_KK_THREAD_POOL_H_
+#define KKONNECT_KK_THREAD_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace kkonnect {
+
+// Runs data-parallel work, such as copies of large frames, on a fixed set
+// of threads. The calling thread takes part in the work as well.
+class ThreadPool {
+ public:
+  class Task {
+   public:
+    // Processes part |index| of the work. Called concurrently for
+    // different indexes.
+    virtual void Run(int index) = 0;
+
+   protected:
+    virtual ~Task() {}
+  };
+
+  // Starts |thread_count| threads in addition to the calling thread.
+  explicit ThreadPool(int thread_count);
+  ~ThreadPool();
+
+  int GetThreadCount() const { return thread_count_; }
+
+  // Calls task->Run() for every index in [0, count) and returns once all
+  // calls completed. Concurrent calls are serialized.
+  void RunParallel(Task* task, int count);
+
+ private:
+  static void* RunThread(void* arg);
+  void RunThread();
+
+  // Runs parts of the current task until none are left.
+  void RunTasks();
+
+  pthread_mutex_t run_mutex_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t work_cond_;
+  pthread_cond_t done_cond_;
+  bool should_exit_;
+  uint64_t generation_;
+  Task* task_;
+  int task_count_;
+  int next_index_;
+  int pending_count_;
+  pthread_t* threads_;
+  int thread_count_;
+
+  ThreadPool(const ThreadPool& src);
+  ThreadPool& operator=(const ThreadPool& src);
+};
+
+}  // namespace kkonnect
+
+#endif  // KKONNECT_KK_THREAD_POOL_H_
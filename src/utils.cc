@@ -30,8 +30,35 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef KKONNECT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "src/kk_thread_pool.h"
+
 namespace kkonnect {
 
+// Copies of this many bytes and more use non-temporal stores. Such copies
+// would evict most of the L2 cache, and the consumer rarely reads all of
+// the destination right away.
+#define NON_TEMPORAL_COPY_THRESHOLD   (1024 * 1024)
+
+// Copies are split across a thread pool in bands of at least this size.
+#define PARALLEL_COPY_BAND_SIZE       (1024 * 1024)
+
+void Autolock::Lock(uint64_t* wait_us) {
+  uint64_t start_time = wait_us ? GetCurrentMicros() : 0;
+  int err = pthread_mutex_lock(lock_);
+  if (err != 0) {
+    fprintf(stderr, "Unable to aquire mutex: %d\n", err);
+    CHECK(false);
+  }
+  if (wait_us) {
+    __atomic_add_fetch(wait_us, GetCurrentMicros() - start_time,
+                       __ATOMIC_RELAXED);
+  }
+}
+
 uint64_t GetCurrentMillis() {
   struct timespec time;
   if (clock_gettime(CLOCK_MONOTONIC, &time) == -1) {
@@ -41,6 +68,15 @@ uint64_t GetCurrentMillis() {
   return ((uint64_t) time.tv_sec) * 1000 + time.tv_nsec / 1000000;
 }
 
+uint64_t GetCurrentMicros() {
+  struct timespec time;
+  if (clock_gettime(CLOCK_MONOTONIC, &time) == -1) {
+    REPORT_ERRNO("clock_gettime(monotonic)");
+    CHECK(false);
+  }
+  return ((uint64_t) time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
 void Sleep(double seconds) {
   struct timespec req;
   struct timespec rem;
@@ -57,22 +93,195 @@ void Sleep(double seconds) {
   }
 }
 
+double GetBackoffDelay(int attempt, double base_seconds, double max_seconds,
+                       unsigned int* seed) {
+  double delay = base_seconds;
+  for (int i = 1; i < attempt && delay < max_seconds; ++i) {
+    delay *= 2;
+  }
+  if (delay > max_seconds) delay = max_seconds;
+  double jitter = (double) rand_r(seed) / RAND_MAX;
+  return delay * (0.5 + 0.5 * jitter);
+}
+
+void InitMonotonicCond(pthread_cond_t* cond) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  CHECK(!pthread_condattr_setclock(&attr, CLOCK_MONOTONIC));
+  CHECK(!pthread_cond_init(cond, &attr));
+  pthread_condattr_destroy(&attr);
+}
+
+bool WaitCondUntil(pthread_cond_t* cond, pthread_mutex_t* mutex,
+                   uint64_t deadline_millis) {
+  struct timespec abstime;
+  abstime.tv_sec = deadline_millis / 1000;
+  abstime.tv_nsec = (deadline_millis % 1000) * 1000000;
+  int err = pthread_cond_timedwait(cond, mutex, &abstime);
+  if (err == ETIMEDOUT) return false;
+  CHECK(!err);
+  return true;
+}
+
+// Bit i is set if CpuFeature i is disabled.
+static int disabled_cpu_features = 0;  // Atomic.
+
+bool HasCpuFeature(CpuFeature feature) {
+#ifdef KKONNECT_X86_SIMD
+  int disabled = __atomic_load_n(&disabled_cpu_features, __ATOMIC_RELAXED);
+  if (disabled & (1 << feature)) return false;
+  __builtin_cpu_init();
+  switch (feature) {
+    case kCpuFeatureSse2:
+      return __builtin_cpu_supports("sse2");
+    case kCpuFeatureSse41:
+      return __builtin_cpu_supports("sse4.1");
+    case kCpuFeatureAvx2:
+      return __builtin_cpu_supports("avx2");
+  }
+#endif
+  return false;
+}
+
+void SetCpuFeatureDisabled(CpuFeature feature, bool disabled) {
+  if (disabled) {
+    __atomic_or_fetch(&disabled_cpu_features, 1 << feature,
+                      __ATOMIC_RELAXED);
+  } else {
+    __atomic_and_fetch(&disabled_cpu_features, ~(1 << feature),
+                       __ATOMIC_RELAXED);
+  }
+}
+
+int GetBytesPerPixel(ImageFormat format) {
+  switch (format) {
+    case kImageFormatVideoRgb:
+      return 3;
+    case kImageFormatVideoYuv422:
+    case kImageFormatDepthMm:
+    case kImageFormatDepthRegistered:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+#ifdef KKONNECT_X86_SIMD
+__attribute__((target("sse2")))
+static void CopyNonTemporal(uint8_t* dst, const uint8_t* src, size_t size) {
+  size_t head = (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15;
+  if (head > size) head = size;
+  memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+  for (; size >= 64; size -= 64, dst += 64, src += 64) {
+    const __m128i* src_block = reinterpret_cast<const __m128i*>(src);
+    __m128i* dst_block = reinterpret_cast<__m128i*>(dst);
+    __m128i v0 = _mm_loadu_si128(src_block);
+    __m128i v1 = _mm_loadu_si128(src_block + 1);
+    __m128i v2 = _mm_loadu_si128(src_block + 2);
+    __m128i v3 = _mm_loadu_si128(src_block + 3);
+    _mm_stream_si128(dst_block, v0);
+    _mm_stream_si128(dst_block + 1, v1);
+    _mm_stream_si128(dst_block + 2, v2);
+    _mm_stream_si128(dst_block + 3, v3);
+  }
+  memcpy(dst, src, size);
+}
+#endif  // KKONNECT_X86_SIMD
+
+struct ImageCopy {
+  uint8_t* dst;
+  const uint8_t* src;
+  int dst_row_size;
+  int src_row_size;
+  int row_bytes;
+  bool non_temporal;
+};
+
+static void CopyRows(const ImageCopy& copy, int first_row, int row_count) {
+  uint8_t* dst = copy.dst + (size_t) first_row * copy.dst_row_size;
+  const uint8_t* src = copy.src + (size_t) first_row * copy.src_row_size;
+  // Rows without padding are copied as one block.
+  int block_count = row_count;
+  size_t block_size = copy.row_bytes;
+  if (copy.dst_row_size == copy.row_bytes &&
+      copy.src_row_size == copy.row_bytes) {
+    block_count = 1;
+    block_size *= row_count;
+  }
+
+  for (int i = 0; i < block_count; ++i) {
+#ifdef KKONNECT_X86_SIMD
+    if (copy.non_temporal) {
+      CopyNonTemporal(dst, src, block_size);
+    } else {
+      memcpy(dst, src, block_size);
+    }
+#else
+    memcpy(dst, src, block_size);
+#endif
+    dst += copy.dst_row_size;
+    src += copy.src_row_size;
+  }
+
+#ifdef KKONNECT_X86_SIMD
+  // Non-temporal stores must be visible before the copy is reported done.
+  if (copy.non_temporal) _mm_sfence();
+#endif
+}
+
+class ParallelCopyTask : public ThreadPool::Task {
+ public:
+  ParallelCopyTask(const ImageCopy& copy, int height, int band_count)
+      : copy_(copy), height_(height), band_count_(band_count) {}
+
+  virtual void Run(int index) {
+    int first_row = (int) ((int64_t) height_ * index / band_count_);
+    int end_row = (int) ((int64_t) height_ * (index + 1) / band_count_);
+    CopyRows(copy_, first_row, end_row - first_row);
+  }
+
+ private:
+  const ImageCopy& copy_;
+  int height_;
+  int band_count_;
+};
+
 void CopyImageData(void* dst, const void* src, int dst_row_size,
-		   int src_row_size, int height) {
+		   int src_row_size, int height, ThreadPool* pool) {
   CHECK(dst_row_size >= 0);
   CHECK(src_row_size > 0);
   CHECK(height >= 0);
-  if (!dst_row_size || dst_row_size == src_row_size) {
-    memcpy(dst, src, src_row_size * height);
+  if (!dst_row_size) dst_row_size = src_row_size;
+
+  ImageCopy copy;
+  copy.dst = reinterpret_cast<uint8_t*>(dst);
+  copy.src = reinterpret_cast<const uint8_t*>(src);
+  copy.dst_row_size = dst_row_size;
+  copy.src_row_size = src_row_size;
+  copy.row_bytes =
+      dst_row_size < src_row_size ? dst_row_size : src_row_size;
+  int64_t total_size = (int64_t) copy.row_bytes * height;
+  copy.non_temporal = total_size >= NON_TEMPORAL_COPY_THRESHOLD &&
+      HasCpuFeature(kCpuFeatureSse2);
+
+  int band_count = 1;
+  if (pool) {
+    band_count = (int) (total_size / PARALLEL_COPY_BAND_SIZE);
+    if (band_count > pool->GetThreadCount() + 1) {
+      band_count = pool->GetThreadCount() + 1;
+    }
+    if (band_count > height) band_count = height;
+  }
+  if (band_count <= 1) {
+    CopyRows(copy, 0, height);
     return;
   }
 
-  CHECK(dst_row_size > src_row_size);
-  for (int i = 0; i < height; ++i) {
-    memcpy(dst, src, src_row_size);
-    dst = reinterpret_cast<uint8_t*>(dst) + dst_row_size;
-    src = reinterpret_cast<const uint8_t*>(src) + src_row_size;
-  }
+  ParallelCopyTask task(copy, height, band_count);
+  pool->RunParallel(&task, band_count);
 }
 
 }  // namespace kkonnect
@@ -28,6 +28,7 @@
 #define KKONNECT_UTILS_H_
 
 #include <errno.h>
+#include <kk_device.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -37,8 +38,17 @@
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 
+// Defined when x86 SIMD code paths can be compiled. Such code is built
+// with per-function target attributes and selected at runtime with
+// HasCpuFeature(), so the library does not require any -m flags.
+#if defined(__x86_64__) || defined(__i386__)
+#define KKONNECT_X86_SIMD 1
+#endif
+
 namespace kkonnect {
 
+class ThreadPool;
+
 #define CHECK(cond)                                             \
   if (!(cond)) {                                                \
     fprintf(stderr, "EXITING with check-fail at %s (%s:%d)"     \
@@ -53,12 +63,12 @@ namespace kkonnect {
 
 class Autolock {
  public:
-  Autolock(pthread_mutex_t& lock) : lock_(&lock) {
-    int err = pthread_mutex_lock(lock_);
-    if (err != 0) {
-      fprintf(stderr, "Unable to aquire mutex: %d\n", err);
-      CHECK(false);
-    }
+  // When |wait_us| is not NULL, the time spent waiting for a contended
+  // |lock| is added to it with a relaxed atomic add. Uncontended locking
+  // is not timed.
+  Autolock(pthread_mutex_t& lock, uint64_t* wait_us = NULL) : lock_(&lock) {
+    if (wait_us && !pthread_mutex_trylock(lock_)) return;
+    Lock(wait_us);
   }
 
   ~Autolock() {
@@ -70,6 +80,8 @@ class Autolock {
   }
 
  private:
+  void Lock(uint64_t* wait_us);
+
   Autolock(const Autolock& src);
   Autolock& operator=(const Autolock& rhs);
 
@@ -77,13 +89,52 @@ class Autolock {
 };
 
 uint64_t GetCurrentMillis();
+uint64_t GetCurrentMicros();
 
 void Sleep(double seconds);
 
+// Returns the delay before retry number |attempt|, counting from 1.
+// The delay doubles from |base_seconds| with every attempt, up to
+// |max_seconds|. Half of it is randomized using |seed|, so that devices
+// that failed together do not retry in lockstep.
+double GetBackoffDelay(int attempt, double base_seconds, double max_seconds,
+                       unsigned int* seed);
+
+// Initializes |cond| to measure timeouts on the monotonic clock,
+// the same clock that GetCurrentMillis() uses.
+void InitMonotonicCond(pthread_cond_t* cond);
+
+// Waits on |cond| until it is signalled or until GetCurrentMillis()
+// reaches |deadline_millis|. Returns false on timeout.
+bool WaitCondUntil(pthread_cond_t* cond, pthread_mutex_t* mutex,
+                   uint64_t deadline_millis);
+
+enum CpuFeature {
+  kCpuFeatureSse2,
+  kCpuFeatureSse41,
+  kCpuFeatureAvx2,
+};
+
+// Returns true if the CPU supports |feature|. Always false on non-x86.
+bool HasCpuFeature(CpuFeature feature);
+
+// Makes HasCpuFeature() report |feature| as unsupported while |disabled|
+// is set, so that benchmarks can force every code path. Objects that
+// select their code path on construction are only affected if created
+// after the call.
+void SetCpuFeatureDisabled(CpuFeature feature, bool disabled);
+
+// Returns the size of a pixel in |format|, or 0 for unknown formats.
+int GetBytesPerPixel(ImageFormat format);
+
 // Copies rows from src to dst, adjusting rows by provided sizes.
 // |dst_row_size| can be zero, which means it is the same as |src_row_size|.
+// Every row receives min(dst_row_size, src_row_size) bytes, and padding
+// of longer destination rows is left untouched. Large images are written
+// with non-temporal stores that bypass the cache, and are split across
+// |pool| if one is given.
 void CopyImageData(void* dst, const void* src, int dst_row_size,
-		   int src_row_size, int height);
+		   int src_row_size, int height, ThreadPool* pool = NULL);
 
 }  // namespace kkonnect
 